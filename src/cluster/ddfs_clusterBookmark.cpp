@@ -0,0 +1,207 @@
+/*
+ * @file ddfs_clusterBookmark.cpp
+ *
+ * @brief Bookmarks: snapshots of the namespace of the leader, asked for
+ *        from any node.
+ *
+ * @author Harman Patial <harman.patial@gmail.com>
+ *
+ */
+
+#include "ddfs_clusterBookmark.hpp"
+#include "ddfs_clusterWire.hpp"
+#include "ddfs_clusterMessagesPaxos.hpp"
+#include "../logger/ddfs_fileLogger.hpp"
+
+using namespace std;
+
+ddfsLogger &global_logger_cbm = ddfsLogger::getInstance();
+
+static void appendVarint(vector<uint8_t> &payload, uint64_t value) {
+    uint8_t buffer[10];
+    size_t length = ddfsClusterWire::putVarint(buffer, value);
+    payload.insert(payload.end(), buffer, buffer + length);
+}
+
+static void appendString(vector<uint8_t> &payload, const string &value) {
+    appendVarint(payload, value.size());
+    payload.insert(payload.end(), value.begin(), value.end());
+}
+
+/* Reads a varint at cursor, false if it runs past end */
+static bool takeVarint(const uint8_t *&cursor, const uint8_t *end, uint64_t *value) {
+    size_t used = ddfsClusterWire::getVarint(cursor, end, value);
+    cursor += used;
+    return (used != 0);
+}
+
+static bool takeString(const uint8_t *&cursor, const uint8_t *end, string *value) {
+    uint64_t length;
+    if(takeVarint(cursor, end, &length) == false || length > (uint64_t) (end - cursor))
+        return false;
+    value->assign((const char *) cursor, length);
+    cursor += length;
+    return true;
+}
+
+static DDFS_STATUS statusCode(ddfsStatus status) {
+    for(int code = DDFS_OK; code <= DDFS_FAILURE; code++) {
+        if(status.compareStatus(ddfsStatus((DDFS_STATUS) code)))
+            return (DDFS_STATUS) code;
+    }
+    return DDFS_FAILURE;
+}
+
+/*
+ *  ddfsBookmarkServer
+ */
+ddfsBookmarkServer::ddfsBookmarkServer(ddfsClusterPaxos *c, ddfsBookmarkCreate take) :
+                    cluster(c), create(take) {
+    for(unsigned int i = 0; i < cluster->clusterMembers.size(); i++) {
+        ddfsClusterMemberPaxos *member = cluster->clusterMembers[i];
+        if(member->isLocalNode())
+            continue;
+
+        member->setStreamService(CLUSTER_MESSAGE_CREATE_BOOKMARK_REQUEST,
+                    [this, member](uint64_t streamID, vector<uint8_t> &payload) {
+            receive(member, payload);
+        });
+    }
+}
+
+ddfsBookmarkServer::~ddfsBookmarkServer() {
+    for(unsigned int i = 0; i < cluster->clusterMembers.size(); i++) {
+        ddfsClusterMemberPaxos *member = cluster->clusterMembers[i];
+        if(member->isLocalNode())
+            continue;
+
+        member->setStreamService(CLUSTER_MESSAGE_CREATE_BOOKMARK_REQUEST, ddfsClusterStreamHandler());
+    }
+}
+
+ddfsStatus ddfsBookmarkServer::createLocal(const string &name, uint64_t *id) {
+    return create(name, id);
+}
+
+void ddfsBookmarkServer::answer(ddfsClusterMemberPaxos *from, uint64_t requestID, string name) {
+    uint64_t bookmark = 0;
+    ddfsStatus status = create(name, &bookmark);
+
+    vector<uint8_t> payload;
+    payload.push_back(CLUSTER_MESSAGE_CREATE_BOOKMARK_REPLY);
+    appendVarint(payload, requestID);
+    appendVarint(payload, statusCode(status));
+    appendVarint(payload, bookmark);
+
+    status = from->sendStream(&payload[0], payload.size(), NULL, DDFS_TRAFFIC_CLIENT);
+    if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+        global_logger_cbm << ddfsLogger::LOG_WARNING << "CBM:: Reply for bookmark " << name << " to "
+                    << from->getHostName() << " failed. " << status.statusToString() << "\n";
+    }
+}
+
+void ddfsBookmarkServer::receive(ddfsClusterMemberPaxos *from, vector<uint8_t> &payload) {
+    const uint8_t *cursor = &payload[0];
+    const uint8_t *end = cursor + payload.size();
+    uint8_t kind = *cursor++;
+    uint64_t id;
+    string name;
+
+    if(kind != CLUSTER_MESSAGE_CREATE_BOOKMARK_REQUEST || takeVarint(cursor, end, &id) == false ||
+       takeString(cursor, end, &name) == false)
+        return;
+
+    /* Not on the network thread */
+    worker.queue([this, from, id, name] { answer(from, id, name); });
+}
+
+/*
+ *  ddfsBookmarkClient
+ */
+ddfsBookmarkClient::ddfsBookmarkClient(ddfsClusterPaxos *c, ddfsBookmarkServer *server) :
+                    cluster(c), localServer(server), nextRequestID(1) {
+    for(unsigned int i = 0; i < cluster->clusterMembers.size(); i++) {
+        ddfsClusterMemberPaxos *member = cluster->clusterMembers[i];
+        if(member->isLocalNode())
+            continue;
+
+        member->setStreamService(CLUSTER_MESSAGE_CREATE_BOOKMARK_REPLY,
+                    [this](uint64_t streamID, vector<uint8_t> &payload) {
+            receive(payload);
+        });
+    }
+}
+
+ddfsBookmarkClient::~ddfsBookmarkClient() {
+    for(unsigned int i = 0; i < cluster->clusterMembers.size(); i++) {
+        ddfsClusterMemberPaxos *member = cluster->clusterMembers[i];
+        if(member->isLocalNode())
+            continue;
+
+        member->setStreamService(CLUSTER_MESSAGE_CREATE_BOOKMARK_REPLY, ddfsClusterStreamHandler());
+    }
+}
+
+void ddfsBookmarkClient::receive(vector<uint8_t> &payload) {
+    const uint8_t *cursor = &payload[0];
+    const uint8_t *end = cursor + payload.size();
+    uint8_t kind = *cursor++;
+    uint64_t id, status, bookmark;
+
+    if(kind != CLUSTER_MESSAGE_CREATE_BOOKMARK_REPLY || takeVarint(cursor, end, &id) == false ||
+       takeVarint(cursor, end, &status) == false || takeVarint(cursor, end, &bookmark) == false)
+        return;
+
+    std::lock_guard<std::mutex> guard(clientLock);
+    unordered_map<uint64_t, pendingRequest>::iterator request = pending.find(id);
+    if(request == pending.end())
+        return;
+
+    request->second.status = (status <= DDFS_FAILURE) ? (DDFS_STATUS) status : DDFS_FAILURE;
+    request->second.bookmark = bookmark;
+    request->second.done = true;
+    replyArrived.notify_all();
+}
+
+ddfsStatus ddfsBookmarkClient::createBookmark(const string &name, uint64_t *bookmark) {
+    ddfsClusterMemberPaxos *leader = cluster->getLeader();
+    if(leader == NULL)
+        return (ddfsStatus(DDFS_HOST_DOWN));
+
+    if(leader->isLocalNode()) {
+        if(localServer == NULL)
+            return (ddfsStatus(DDFS_HOST_DOWN));
+        return localServer->createLocal(name, bookmark);
+    }
+
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> guard(clientLock);
+        id = nextRequestID++;
+        pendingRequest &request = pending[id];
+        request.done = false;
+        request.status = DDFS_FAILURE;
+        request.bookmark = 0;
+    }
+
+    vector<uint8_t> payload;
+    payload.push_back(CLUSTER_MESSAGE_CREATE_BOOKMARK_REQUEST);
+    appendVarint(payload, id);
+    appendString(payload, name);
+
+    ddfsStatus status = leader->sendStream(&payload[0], payload.size(), NULL, DDFS_TRAFFIC_CLIENT);
+
+    std::unique_lock<std::mutex> guard(clientLock);
+    if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+        status = ddfsStatus(DDFS_HOST_DOWN);
+    } else if(replyArrived.wait_for(guard, chrono::milliseconds((int) s_requestTimeoutMs),
+                    [this, id] { return pending[id].done; }) == false) {
+        status = ddfsStatus(DDFS_NETWORK_RETRY);
+    } else {
+        status = ddfsStatus(pending[id].status);
+        *bookmark = pending[id].bookmark;
+    }
+
+    pending.erase(id);
+    return status;
+}
@@ -0,0 +1,118 @@
+/*
+ * @file ddfs_clusterBookmark.hpp
+ *
+ * @brief Bookmarks: snapshots of the namespace of the leader, asked for
+ *        from any node.
+ *
+ * A bookmark is a named point in time of the metadata. Any node asks
+ * the leader for one with CLUSTER_MESSAGE_CREATE_BOOKMARK_REQUEST, the
+ * leader takes a snapshot of its namespace (see ddfs_snapshot.hpp),
+ * which is O(1) and holds up no writer, and answers with
+ * CLUSTER_MESSAGE_CREATE_BOOKMARK_REPLY and the id of the snapshot. A
+ * backup then reads the bookmark at its own pace while writes go on.
+ *
+ *   client                               leader
+ *     | --- REQUEST (name) ----------------> |  snapshot taken
+ *     | <-- REPLY (status, bookmark id) ---- |
+ *
+ * Messages travel as streams (see ddfs_clusterStream.hpp) in the client
+ * traffic class, the message type is the first byte of the payload:
+ *
+ *   REQUEST        Type, request ID, name.
+ *   REPLY          Type, request ID, status, bookmark ID.
+ *
+ * @author Harman Patial <harman.patial@gmail.com>
+ *
+ */
+#ifndef DDFS_CLUSTER_BOOKMARK_H
+#define DDFS_CLUSTER_BOOKMARK_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+#include "ddfs_clusterPaxos.hpp"
+#include "ddfs_clusterMemberPaxos.hpp"
+#include "ddfs_clusterMetadataCache.hpp"
+#include "../global/ddfs_status.hpp"
+
+using namespace std;
+
+/* Takes a snapshot called name of the namespace, sets id to it */
+typedef std::function<ddfsStatus(const string &name, uint64_t *id)> ddfsBookmarkCreate;
+
+/*!
+ *  \class  ddfsBookmarkServer
+ *  \brief  Takes bookmarks on the leader for whoever asks.
+ */
+class ddfsBookmarkServer {
+public:
+    ddfsBookmarkServer(ddfsClusterPaxos *cluster, ddfsBookmarkCreate create);
+    ~ddfsBookmarkServer();
+
+    /* For a client on this node */
+    ddfsStatus createLocal(const string &name, uint64_t *id);
+
+private:
+    ddfsClusterPaxos *cluster;
+    ddfsBookmarkCreate create;
+    /* Bookmarks are taken one at a time, in the order asked */
+    ddfsMetadataWorker worker;
+
+    void receive(ddfsClusterMemberPaxos *from, vector<uint8_t> &payload);
+    void answer(ddfsClusterMemberPaxos *from, uint64_t requestID, string name);
+
+    ddfsBookmarkServer(ddfsBookmarkServer const&);     // Don't Implement
+    void operator=(ddfsBookmarkServer const&);         // Don't implement
+};
+
+/*!
+ *  \class  ddfsBookmarkClient
+ *  \brief  Asks the leader for bookmarks.
+ *
+ *   localServer answers when the local node is the leader, leave it
+ *   NULL when this node never leads.
+ */
+class ddfsBookmarkClient {
+public:
+    ddfsBookmarkClient(ddfsClusterPaxos *cluster, ddfsBookmarkServer *localServer = NULL);
+    ~ddfsBookmarkClient();
+
+    /*
+     * @brief Bookmark the namespace of the leader as it is now.
+     *
+     * @return DDFS_OK              id is the bookmark on the leader
+     * @return DDFS_HOST_DOWN       No leader, or it can not be reached
+     * @return DDFS_NETWORK_RETRY   No reply in s_requestTimeoutMs
+     * @return Anything else taking the snapshot failed with
+     */
+    ddfsStatus createBookmark(const string &name, uint64_t *id);
+
+private:
+    static const int s_requestTimeoutMs = 5000;
+
+    struct pendingRequest {
+        bool done;
+        DDFS_STATUS status;
+        uint64_t bookmark;
+    };
+
+    ddfsClusterPaxos *cluster;
+    ddfsBookmarkServer *localServer;
+
+    std::mutex clientLock;
+    std::condition_variable replyArrived;
+    unordered_map<uint64_t, pendingRequest> pending;
+    uint64_t nextRequestID;
+
+    void receive(vector<uint8_t> &payload);
+
+    ddfsBookmarkClient(ddfsBookmarkClient const&);     // Don't Implement
+    void operator=(ddfsBookmarkClient const&);         // Don't implement
+};
+
+#endif /* Ending DDFS_CLUSTER_BOOKMARK_H */
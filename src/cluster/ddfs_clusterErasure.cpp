@@ -0,0 +1,131 @@
+/*
+ * @file ddfs_clusterErasure.cpp
+ *
+ * @brief Erasure coded chunks, striped across cluster members.
+ *
+ * @author Harman Patial <harman.patial@gmail.com>
+ *
+ */
+
+#include <cstring>
+#include <thread>
+
+#include "ddfs_clusterErasure.hpp"
+#include "../logger/ddfs_fileLogger.hpp"
+
+using namespace std;
+
+ddfsLogger &global_logger_ce = ddfsLogger::getInstance();
+
+ddfsClusterErasure::ddfsClusterErasure(ddfsClusterReplication *r, int dataFragments, int parityFragments) :
+                    replication(r), codec(dataFragments, parityFragments) {
+}
+
+size_t ddfsClusterErasure::fragmentSize(size_t chunkSize) {
+    size_t k = codec.getDataFragments();
+    /* An empty chunk still has fragments, of one padding byte */
+    if(chunkSize == 0)
+        return 1;
+    return (chunkSize + k - 1) / k;
+}
+
+ddfsStatus ddfsClusterErasure::writeChunk(const vector<string> &members, uint64_t chunkID,
+                    const void *data, size_t size) {
+    int k = codec.getDataFragments();
+    int total = k + codec.getParityFragments();
+
+    if(codec.isValid() == false || (int) members.size() != total)
+        return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+    /* The last data fragment is padded with zeroes */
+    size_t fragment = fragmentSize(size);
+    vector<uint8_t> fragments(total * fragment, 0);
+    if(size > 0)
+        memcpy(&fragments[0], data, size);
+
+    vector<uint8_t *> pointers(total);
+    for(int i = 0; i < total; i++)
+        pointers[i] = &fragments[i * fragment];
+
+    ddfsStatus status = codec.encode(&pointers[0], &pointers[k], fragment);
+    if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+        return status;
+
+    /* Each fragment to its member, all of them at once */
+    vector<ddfsStatus> results(total, ddfsStatus(DDFS_FAILURE));
+    vector<std::thread> writers;
+
+    for(int i = 0; i < total; i++) {
+        writers.push_back(std::thread([this, &members, &pointers, &results, chunkID, fragment, i] {
+            vector<string> chain(1, members[i]);
+            results[i] = replication->replicate(chain, fragmentID(chunkID, i), pointers[i], fragment);
+        }));
+    }
+
+    for(int i = 0; i < total; i++)
+        writers[i].join();
+
+    for(int i = 0; i < total; i++) {
+        if(results[i].compareStatus(ddfsStatus(DDFS_OK)) == false) {
+            global_logger_ce << ddfsLogger::LOG_WARNING << "CE:: Fragment " << i << " of chunk " << chunkID
+                        << " on " << members[i] << " failed. " << results[i].statusToString() << "\n";
+            return results[i];
+        }
+    }
+
+    return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsClusterErasure::readChunk(const vector<string> &members, uint64_t chunkID,
+                    void *data, size_t size, ddfsFragmentReader reader) {
+    int k = codec.getDataFragments();
+    int total = k + codec.getParityFragments();
+
+    if(codec.isValid() == false || (int) members.size() != total)
+        return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+    size_t fragment = fragmentSize(size);
+    vector<uint8_t> fragments(total * fragment);
+    vector<uint8_t *> pointers(total);
+    bool present[DDFS_RS_MAX_FRAGMENTS];
+    int available = 0;
+
+    for(int i = 0; i < total; i++) {
+        pointers[i] = &fragments[i * fragment];
+        present[i] = false;
+    }
+
+    /* Data fragments first, parity only for the ones that are missing */
+    for(int i = 0; i < total && available < k; i++) {
+        ddfsStatus status = reader(members[i], fragmentID(chunkID, i), pointers[i], fragment);
+        if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+            global_logger_ce << ddfsLogger::LOG_INFO << "CE:: Fragment " << i << " of chunk " << chunkID
+                        << " unavailable on " << members[i] << ". " << status.statusToString() << "\n";
+            continue;
+        }
+        present[i] = true;
+        available++;
+    }
+
+    if(available < k) {
+        global_logger_ce << ddfsLogger::LOG_WARNING << "CE:: Chunk " << chunkID << " lost, only "
+                    << available << " of " << k << " fragments could be read.\n";
+        return (ddfsStatus(DDFS_FAILURE));
+    }
+
+    bool degraded = false;
+    for(int i = 0; i < k; i++)
+        degraded = degraded || (present[i] == false);
+
+    if(degraded) {
+        /* Parity fragments not read come back too, they are dropped */
+        ddfsStatus status = codec.reconstruct(&pointers[0], present, fragment);
+        if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+            return status;
+    }
+
+    if(size > 0)
+        memcpy(data, &fragments[0], size);
+
+    return (ddfsStatus(DDFS_OK));
+}
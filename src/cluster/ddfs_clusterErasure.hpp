@@ -0,0 +1,98 @@
+/*
+ * @file ddfs_clusterErasure.hpp
+ *
+ * @brief Erasure coded chunks, striped across cluster members.
+ *
+ * A chunk is cut into k data fragments, m parity fragments are computed
+ * with ddfsReedSolomon and each of the k + m fragments is stored on its
+ * own member. Cold data takes (k + m) / k times its size instead of the
+ * three times of full replicas: 1.5 times for RS(6,3), and it still
+ * survives three lost members.
+ *
+ * A read takes the data fragments when they are all there. When some
+ * are not, enough parity fragments are read to make up k and the
+ * missing data is reconstructed from them, a degraded read.
+ *
+ * Fragments are written as single replica chains through
+ * ddfsClusterReplication. Fragment i of chunk c is stored under the
+ * chunk ID ddfsClusterErasure::fragmentID(c, i).
+ *
+ * @author Harman Patial <harman.patial@gmail.com>
+ *
+ */
+#ifndef DDFS_CLUSTER_ERASURE_H
+#define DDFS_CLUSTER_ERASURE_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdint.h>
+
+#include "ddfs_clusterReplication.hpp"
+#include "../global/ddfs_reedSolomon.hpp"
+#include "../global/ddfs_status.hpp"
+
+using namespace std;
+
+/* Reads a fragment stored on member into buffer, size bytes */
+typedef std::function<ddfsStatus(const string &member, uint64_t fragmentID,
+                    uint8_t *buffer, size_t size)> ddfsFragmentReader;
+
+/*!
+ *  \class  ddfsClusterErasure
+ *  \brief  Writes and reads chunks as k + m fragments.
+ */
+class ddfsClusterErasure {
+public:
+    ddfsClusterErasure(ddfsClusterReplication *replication, int dataFragments, int parityFragments);
+
+    int getDataFragments() {
+        return codec.getDataFragments();
+    }
+
+    int getParityFragments() {
+        return codec.getParityFragments();
+    }
+
+    /* Bytes of every fragment of a chunk of chunkSize bytes */
+    size_t fragmentSize(size_t chunkSize);
+
+    /* Chunk ID a fragment is stored under */
+    static uint64_t fragmentID(uint64_t chunkID, int fragment) {
+        return (chunkID * DDFS_RS_MAX_FRAGMENTS) + fragment;
+    }
+
+    /*
+     * @brief Encode a chunk and store fragment i on members[i].
+     *
+     * members holds k + m host names, the local node may be one of
+     * them. The fragments are sent to all members at the same time.
+     *
+     * @return DDFS_OK                      Every fragment is stored
+     * @return DDFS_GENERAL_PARAM_INVALID   Invalid scheme or member count
+     * @return Anything else a fragment failed with
+     */
+    ddfsStatus writeChunk(const vector<string> &members, uint64_t chunkID,
+                    const void *data, size_t size);
+
+    /*
+     * @brief Read a chunk of size bytes back from its members.
+     *
+     * Missing data fragments are reconstructed from the parity.
+     *
+     * @return DDFS_OK                      data holds the chunk
+     * @return DDFS_GENERAL_PARAM_INVALID   Invalid scheme or member count
+     * @return DDFS_FAILURE                 Fewer than k fragments could be read
+     */
+    ddfsStatus readChunk(const vector<string> &members, uint64_t chunkID,
+                    void *data, size_t size, ddfsFragmentReader reader);
+
+private:
+    ddfsClusterReplication *replication;
+    ddfsReedSolomon codec;
+
+    ddfsClusterErasure(ddfsClusterErasure const&);     // Don't Implement
+    void operator=(ddfsClusterErasure const&);         // Don't implement
+};
+
+#endif /* Ending DDFS_CLUSTER_ERASURE_H */
@@ -57,7 +57,8 @@ private:
 	T_memberID memberID;
 	T_uniqueID uniqueIdentification;
 	T_clusterMemberState currentState;
-    T_network ddfsNetwork;
+    /* Any implementation of the Network interface */
+    T_network *ddfsNetwork;
 }; // class end
 
 #endif /* Ending DDFS_CLUSTER_MEMBER_H */
@@ -16,46 +16,65 @@
 #include "ddfs_clusterMemberPaxos.hpp"
 #include "ddfs_clusterPaxos.hpp"
 #include "ddfs_clusterPaxosInstance.hpp"
+#include "../network/ddfs_bufferPool.hpp"
 
 using namespace std;
 
 ddfsLogger &global_logger_cmp = ddfsLogger::getInstance();
 
-ddfsClusterMemberPaxos::ddfsClusterMemberPaxos() {
+ddfsClusterMemberPaxos::ddfsClusterMemberPaxos() :
+                    streams([this](void *data, int size, ddfsTrafficClass trafficClass) {
+                        return sendPacket(data, size, trafficClass);
+                    }) {
     clusterID = s_invalid_clusterID;
     memberID = s_invalid_memberID;
     uniqueIdentification = -1;
     memberState.store(s_clusterMemberUnknown);
     networkPrivatePtr = NULL;
+    peerWireVersion.store(DDFS_WIRE_VERSION_1);
     _isLocalNode = false;
+    clusterPaxos = NULL;
+    localNode = NULL;
 
-    network = new ddfsTcpConnection<ddfsClusterMemberPaxos>();
-    network->init();
+    /* Network is created in init(), once the host names are known */
+    network = NULL;
+    networkType = DDFS_NETWORK_TCP;
+}
+
+ddfsClusterMemberPaxos::ddfsClusterMemberPaxos(ddfsClusterPaxos *cp, DDFS_NETWORK_TYPE type) :
+                                ddfsClusterMemberPaxos() {
+    clusterPaxos = cp;
+    networkType = type;
 }
 
 ddfsClusterMemberPaxos::~ddfsClusterMemberPaxos() {
+    /* Its control thread sends through the network */
+    streams.stop();
     delete(network);
 }
 
 ddfsStatus ddfsClusterMemberPaxos::init(string hostn, ddfsClusterMemberPaxos *localNode) {
     ddfsStatus status(DDFS_OK);
 
+    if(network) {
+        global_logger_cmp << ddfsLogger::LOG_INFO
+                    << "clusterMemberPaxos :: Initialization already done.\n";
+        return (ddfsStatus(DDFS_OK));
+    }
+
     hostName = hostn;
 
-    if(!localNode)
+    if(!localNode) {
         _isLocalNode = true;
+        global_logger_cmp << ddfsLogger::LOG_INFO
+                    << "clusterMemberPaxos :: Localhost Initialization started.\n";
+    }
 
-    if(network) {
-        if(!localNode) {
-            global_logger_cmp << ddfsLogger::LOG_INFO
-                        << "clusterMemberPaxos :: Localhost Initialization started.\n";
-        } else {
-            global_logger_cmp << ddfsLogger::LOG_INFO
-                        << "clusterMemberPaxos :: Initialization already done.\n";
-            return (ddfsStatus(DDFS_OK));
-        }
-    } else {
-        network = new ddfsTcpConnection<ddfsClusterMemberPaxos>();
+    status = createNetwork(localNode ? localNode->getHostName() : hostn);
+    if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+        global_logger_cmp << ddfsLogger::LOG_WARNING
+                    << "clusterMemberPaxos :: Unable to create the network.\n";
+        return status;
     }
 
     network->init();
@@ -78,11 +97,8 @@ ddfsStatus ddfsClusterMemberPaxos::init(string hostn, ddfsClusterMemberPaxos *lo
         global_logger_cmp << ddfsLogger::LOG_INFO
                         << "localHost name : " << localHostName << ". remoteHostName : " << hostn << "\n";
 
-        for(unsigned int i=0; i < localHostName.size() && i < hostn.size(); i++) {
-            if(localHostName[i] > hostn[i]) {
-                doNotConnect = true;
-            }
-        }
+        if(localHostName.compare(hostn) > 0)
+            doNotConnect = true;
     }
 
     /*  Initialize the underline network class */
@@ -141,7 +157,7 @@ ddfsStatus ddfsClusterMemberPaxos::init(string hostn, ddfsClusterMemberPaxos *lo
                     std::string s("DDFS Destination Node : ");
                     s.append(getHostName());
                     s.append(" Request ");
-                    network->sendData((void *)s.c_str(), s.size(), networkPrivatePtr);
+                    network->sendData((void *)s.c_str(), s.size(), networkPrivatePtr, DDFS_TRAFFIC_CONSENSUS);
                 }
                 break;
             }
@@ -149,14 +165,68 @@ ddfsStatus ddfsClusterMemberPaxos::init(string hostn, ddfsClusterMemberPaxos *lo
     }
 #endif
 
+    uint64_t id = memberIDFor(hostn);
+
+    /* Set if this is the localNode */
+    setUniqueIdentification(id);
+    setMemberID(id);
+
+    return (ddfsStatus(DDFS_OK));
+}
+
+uint64_t ddfsClusterMemberPaxos::memberIDFor(string hostn) {
     struct in_addr addr;
+    string address;
+    uint16_t port = DDFS_SERVER_PORT;
 
-    inet_aton(hostn.c_str(), &addr) ;
-    addr.s_addr = addr.s_addr >> 16;
+    if(ddfsParseNodeAddress(hostn, &address, &port) == false ||
+       inet_aton(address.c_str(), &addr) == 0)
+        return s_invalid_memberID;
 
-    /* Set if this is the localNode */
-    setUniqueIdentification(addr.s_addr);
-    setMemberID(addr.s_addr);
+    /* Whole address and port, nodes sharing an address differ by port */
+    return ((uint64_t) ntohl(addr.s_addr) << 16) | port;
+}
+
+ddfsStatus ddfsClusterMemberPaxos::createNetwork(string localHostName) {
+    switch(networkType) {
+        case DDFS_NETWORK_TCP: {
+            ddfsTcpConnection<ddfsClusterMemberPaxos> *tcpNetwork = new ddfsTcpConnection<ddfsClusterMemberPaxos>(localHostName);
+
+            if(clusterPaxos)
+                tcpNetwork->setSocketOptions(clusterPaxos->getSocketOptions());
+
+            /* Local node listens on the port of its host name, or on the
+             * configured port when the name does not carry one */
+            if(_isLocalNode && clusterPaxos) {
+                ddfsTcpListenConfig listenConfig = clusterPaxos->getListenConfig();
+                string address;
+                uint16_t port;
+
+                if(ddfsParseNodeAddress(localHostName, &address, &port) == false) {
+                    global_logger_cmp << ddfsLogger::LOG_WARNING
+                                << "clusterMemberPaxos :: Invalid port in " << localHostName << "\n";
+                    delete(tcpNetwork);
+                    return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+                }
+                if(localHostName.rfind(':') != string::npos)
+                    listenConfig.port = port;
+                tcpNetwork->setListenConfig(listenConfig);
+            }
+
+            network = tcpNetwork;
+            break;
+        }
+        case DDFS_NETWORK_LOOPBACK:
+            network = new ddfsLoopbackConnection<ddfsClusterMemberPaxos>(localHostName);
+            break;
+        case DDFS_NETWORK_SHM:
+            network = new ddfsShmConnection<ddfsClusterMemberPaxos>(localHostName);
+            break;
+        default:
+            global_logger_cmp << ddfsLogger::LOG_WARNING
+                        << "clusterMemberPaxos :: Network type " << networkType << " is not supported.\n";
+            return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+    }
 
     return (ddfsStatus(DDFS_OK));
 }
@@ -181,6 +251,26 @@ bool ddfsClusterMemberPaxos::isOnline() {
 	return online;
 }
 
+void ddfsClusterMemberPaxos::connectionStateChanged(bool connected) {
+    global_logger_cmp << ddfsLogger::LOG_INFO << "CMP: " << hostName
+                << (connected ? " is connected.\n" : " is disconnected.\n");
+
+	clusterMemberLock.lock();
+    if(connected == false) {
+        memberState.store(s_clusterMemberOffline);
+        /* It may come back running an older version */
+        peerWireVersion.store(DDFS_WIRE_VERSION_1);
+        streams.reset();
+    } else {
+        /* Keep the Paxos role of a member that comes back */
+        clusterMemberState state = memberState.load();
+        if(state == s_clusterMemberOffline || state == s_clusterMemberUnknown ||
+           state == s_clusterMemberDead)
+            memberState.store(s_clusterMemberOnline);
+    }
+	clusterMemberLock.unlock();
+}
+
 bool ddfsClusterMemberPaxos::isDead() {
 	bool dead = false;
 
@@ -211,7 +301,7 @@ ddfsStatus ddfsClusterMemberPaxos::setClusterID(int newClusterID) {
 	return (ddfsStatus(DDFS_OK));
 }
 
-void ddfsClusterMemberPaxos::setMemberID(int newMemberID) {
+void ddfsClusterMemberPaxos::setMemberID(uint64_t newMemberID) {
     global_logger_cmp << ddfsLogger::LOG_WARNING
                 << "Setting Member ID : " << newMemberID << "\n";
 	clusterMemberLock.lock();
@@ -219,11 +309,11 @@ void ddfsClusterMemberPaxos::setMemberID(int newMemberID) {
 	clusterMemberLock.unlock();
 }
 
-int ddfsClusterMemberPaxos::getMemberID() {
+uint64_t ddfsClusterMemberPaxos::getMemberID() {
 	return memberID;
 }
 
-void ddfsClusterMemberPaxos::setUniqueIdentification(int newUniqueID) {
+void ddfsClusterMemberPaxos::setUniqueIdentification(uint64_t newUniqueID) {
 
 	if(isLocalNode() == false)
         	return;
@@ -234,7 +324,7 @@ void ddfsClusterMemberPaxos::setUniqueIdentification(int newUniqueID) {
                     << "ddfsClusterMemberPaxos:: Unique id set to " << uniqueIdentification << "\n";
 }
 
-int ddfsClusterMemberPaxos::getUniqueIdentification() {
+uint64_t ddfsClusterMemberPaxos::getUniqueIdentification() {
 	if(isLocalNode() == false)
         	return 0;
     global_logger_cmp << ddfsLogger::LOG_WARNING
@@ -280,9 +370,8 @@ ddfsStatus ddfsClusterMemberPaxos::processMessage(ddfsClusterMessage *message) {
 
 void ddfsClusterMemberPaxos::callback(void *data, int size) {
     //ddfsClusterMemberPaxos *member = (ddfsClusterMemberPaxos *) thisInstance;
-    uint8_t numberOfDdfsMessages;
-    ddfsClusterHeader *ddfsHeader;
-    //uint16_t typeOfService, totalLength;
+    ddfsClusterMessage scratch;
+    ddfsClusterMessage *message;
     ddfsStatus status(DDFS_FAILURE);
 
     global_logger_cmp << ddfsLogger::LOG_WARNING
@@ -297,12 +386,30 @@ void ddfsClusterMemberPaxos::callback(void *data, int size) {
         return;
     }
 
-    ddfsHeader = (ddfsClusterHeader *) data;
+    /* Lengths and checksum are verified here, nothing corrupted gets to processMessage */
+    ddfsClusterPacketView packet(data, size);
+    status = packet.getStatus();
+    if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+        global_logger_cmp << ddfsLogger::LOG_WARNING << "CMP:: Discarding a packet from " << hostName
+                    << ". " << status.statusToString() << "\n";
+        return;
+    }
+
+    int wireVersion = packet.getPeerVersion();
+    if(peerWireVersion.exchange(wireVersion) != wireVersion) {
+        global_logger_cmp << ddfsLogger::LOG_INFO << "CMP: Sending wire version " << wireVersion
+                    << " to " << hostName << "\n";
+    }
+
+    /* An empty packet in an older version is the member asking what we speak */
+    if(packet.getMessageCount() == 0 && packet.getVersion() != wireVersion &&
+       packet.getTypeOfService() == CLUSTER_MESSAGE_TOF_CLUSTER_MGMT) {
+        sendHello(wireVersion);
+        return;
+    }
 
-    global_logger_cmp << ddfsLogger::LOG_INFO << "CMP: v: " << ddfsHeader->version << ". tOS: " << ddfsHeader->typeOfService << "\n";
-    global_logger_cmp << ddfsLogger::LOG_INFO << "CMP: tl:" << ddfsHeader->totalLength << ".ID: " << ddfsHeader->uniqueID << "\n";
-    global_logger_cmp << ddfsLogger::LOG_INFO << "CMP: sizeof(ddfsClusterHeader) : " << sizeof(ddfsClusterHeader) << "\n";
-    global_logger_cmp << ddfsLogger::LOG_INFO << "CMP: sizeof(ddfsClusterMessage) : " << sizeof(ddfsClusterMessage) << "\n";
+    global_logger_cmp << ddfsLogger::LOG_INFO << "CMP: v: " << (int) packet.getVersion() << ". tOS: " << (int) packet.getTypeOfService() << "\n";
+    global_logger_cmp << ddfsLogger::LOG_INFO << "CMP: tl:" << packet.getTotalLength() << ".ID: " << packet.getUniqueID() << "\n";
 
 #if 0
     global_logger_cmp << ddfsLogger::LOG_INFO
@@ -312,13 +419,18 @@ void ddfsClusterMemberPaxos::callback(void *data, int size) {
                 << entry->data[8] << entry->data[9] << entry->data[10] << entry->data[11]
                 << entry->data[12] << entry->data[13] << entry->data[14] << entry->data[15] << "\n";
 #endif
-    if(ddfsHeader->typeOfService == CLUSTER_MESSAGE_TOF_CLUSTER_MGMT) {
-                numberOfDdfsMessages = ((ddfsHeader->totalLength)-sizeof(ddfsClusterHeader))/sizeof(ddfsClusterMessage);
-
-        global_logger_cmp << ddfsLogger::LOG_WARNING << "Total DDFS Messages in this packet is : " << numberOfDdfsMessages << "\n";
-        for (int i = 0; i < numberOfDdfsMessages; i++) {
-            ddfsClusterMessage *message = (ddfsClusterMessage *)((uint8_t *) data + sizeof(ddfsClusterHeader) + (i*sizeof(ddfsClusterMessage)));
+    if(packet.getTypeOfService() == CLUSTER_MESSAGE_TOF_CLUSTER_STREAM) {
+        status = streams.processPacket(packet);
+        if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+            global_logger_cmp << ddfsLogger::LOG_WARNING << "CMP:: Dropped a stream packet from " << hostName
+                        << ". " << status.statusToString() << "\n";
+        }
+        return;
+    }
 
+    if(packet.getTypeOfService() == CLUSTER_MESSAGE_TOF_CLUSTER_MGMT) {
+        global_logger_cmp << ddfsLogger::LOG_WARNING << "Total DDFS Messages in this packet is : " << packet.getMessageCount() << "\n";
+        while((message = packet.nextMessage(&scratch)) != NULL) {
             global_logger_cmp << ddfsLogger::LOG_INFO << "CMP: Message Type : " << message->messageType << "\n";
             if((message->messageType >= CLUSTER_MESSAGE_LE_TYPE_PREPARE) && (message->messageType <= CLUSTER_MESSAGE_LE_LEADER_ELECTED)) {
                     status = clusterPaxos->processMessage(this, message);
@@ -338,7 +450,6 @@ void ddfsClusterMemberPaxos::callback(void *data, int size) {
 ddfsStatus ddfsClusterMemberPaxos::sendClusterMetaData(ddfsClusterMessagePaxos *message) {
     /* Need to have a reference of network packet and send the buffer to it */
     //requestQEntry *request = NULL;
-    ddfsClusterHeader *packetHeader = NULL;
 
     if(message == NULL) {
         global_logger_cmp << ddfsLogger::LOG_WARNING
@@ -352,13 +463,18 @@ ddfsStatus ddfsClusterMemberPaxos::sendClusterMetaData(ddfsClusterMessagePaxos *
     
     //request = new requestQEntry;
 
-    uint8_t packet[2048];
-    message->returnBuffer(&packet);
-
-    packetHeader = (ddfsClusterHeader *) packet;
+    /* Encoded straight into the buffer that goes to the network */
+    ddfsPooledBuffer packet(message->returnBufferSize());
+    int wireVersion = peerWireVersion.load();
+    size_t packetLength = message->serialize(wireVersion, packet.getData(), packet.getCapacity());
+    if(packetLength == 0) {
+        global_logger_cmp << ddfsLogger::LOG_WARNING
+                    << "CMP:: Unable to encode the message for " << hostName << ".\n";
+        return (ddfsStatus(DDFS_FAILURE));
+    }
 
     global_logger_cmp << ddfsLogger::LOG_INFO
-            << "sendClusterMetaData :: packetDetail : " << packetHeader->version << " " << packetHeader->typeOfService << " " << packetHeader->totalLength << "\n";
+            << "sendClusterMetaData :: packetDetail : " << wireVersion << " " << (int) message->returnBufferSize() << " " << packetLength << "\n";
     
 #if 0
     /* Create the Request queue entry for this packet */
@@ -381,16 +497,64 @@ ddfsStatus ddfsClusterMemberPaxos::sendClusterMetaData(ddfsClusterMessagePaxos *
     packetHeader = (ddfsClusterHeader *) request->data;
 #endif
 
-    global_logger_cmp << ddfsLogger::LOG_INFO
-            << "sendClusterMetaData :: packetDetail for Request : " << packetHeader->version << " " << packetHeader->typeOfService << " " << packetHeader->totalLength << "\n";
-    
     //reqQueue.push(request);
     /* Push the data to the request queue */
-    network->sendData(packet, packetHeader->totalLength, networkPrivatePtr);
+    network->sendData(packet.getData(), packetLength, networkPrivatePtr, DDFS_TRAFFIC_CONSENSUS);
 	return (ddfsStatus(DDFS_OK));
 }
 
 
+ddfsStatus ddfsClusterMemberPaxos::sendStream(const void *data, size_t size, uint64_t *streamID,
+                    ddfsTrafficClass trafficClass) {
+    /* Streams are v2 only. A member we have not talked to yet is asked
+     * what it speaks, and given a moment to answer.
+     */
+    if(peerWireVersion.load() != DDFS_WIRE_VERSION_2) {
+        sendHello(peerWireVersion.load());
+
+        for(int waited = 0; waited < s_helloTimeoutMs; waited += s_helloPollMs) {
+            if(peerWireVersion.load() == DDFS_WIRE_VERSION_2)
+                break;
+            usleep(s_helloPollMs * 1000);
+        }
+    }
+
+    if(peerWireVersion.load() != DDFS_WIRE_VERSION_2) {
+        global_logger_cmp << ddfsLogger::LOG_WARNING
+                    << "CMP:: " << hostName << " does not take streams.\n";
+        return (ddfsStatus(DDFS_FAILURE));
+    }
+
+    return streams.send(data, size, streamID, trafficClass);
+}
+
+void ddfsClusterMemberPaxos::setStreamHandler(ddfsClusterStreamHandler handler) {
+    streams.setHandler(handler);
+}
+
+void ddfsClusterMemberPaxos::setStreamService(uint8_t service, ddfsClusterStreamHandler handler) {
+    streams.setService(service, handler);
+}
+
+ddfsStatus ddfsClusterMemberPaxos::sendHello(int wireVersion) {
+    uint8_t packet[sizeof(ddfsClusterHeader)];
+    ddfsClusterPacketBuilder builder(wireVersion, CLUSTER_MESSAGE_TOF_CLUSTER_MGMT,
+                    uniqueIdentification, 0, packet, sizeof(packet));
+
+    size_t length = builder.finish();
+    if(length == 0)
+        return (ddfsStatus(DDFS_FAILURE));
+
+    return sendPacket(packet, length, DDFS_TRAFFIC_CONSENSUS);
+}
+
+ddfsStatus ddfsClusterMemberPaxos::sendPacket(void *data, int size, ddfsTrafficClass trafficClass) {
+    if(network == NULL)
+        return (ddfsStatus(DDFS_FAILURE));
+
+    return network->sendData(data, size, networkPrivatePtr, trafficClass);
+}
+
 string ddfsClusterMemberPaxos::getHostName() {
     return hostName;
 }
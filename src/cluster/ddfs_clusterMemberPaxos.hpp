@@ -20,7 +20,11 @@
 
 #include "ddfs_clusterMember.hpp"
 #include "ddfs_clusterMessagesPaxos.hpp"
+#include "ddfs_clusterWire.hpp"
+#include "ddfs_clusterStream.hpp"
 #include "../network/ddfs_tcpConnection.hpp"
+#include "../network/ddfs_loopbackConnection.hpp"
+#include "../network/ddfs_shmConnection.hpp"
 #include "../global/ddfs_status.hpp"
 #include "../logger/ddfs_fileLogger.hpp"
 
@@ -48,16 +52,14 @@ enum clusterMemberState {
 /*
  * T_clusterMemberState = clusterMemberState
  * T_clusterID = int
- * T_memberID = int
- * T_uniqueID = string
+ * T_memberID = uint64_t
+ * T_uniqueID = uint64_t
  */
-class ddfsClusterMemberPaxos : public ddfsClusterMember<clusterMemberState, int, ddfsClusterMessagePaxos, int, int, ddfsTcpConnection<ddfsClusterMemberPaxos> > {
+class ddfsClusterMemberPaxos : public ddfsClusterMember<clusterMemberState, int, ddfsClusterMessagePaxos, uint64_t, uint64_t, Network<string, ddfsClusterMemberPaxos, DDFS_NETWORK_TYPE> > {
 public:
 	ddfsClusterMemberPaxos();
 
-	ddfsClusterMemberPaxos(ddfsClusterPaxos *cp) {
-		clusterPaxos = cp;
-	}
+	ddfsClusterMemberPaxos(ddfsClusterPaxos *cp, DDFS_NETWORK_TYPE type = DDFS_NETWORK_TCP);
 
 	~ddfsClusterMemberPaxos();
 	ddfsStatus init(string hostn, ddfsClusterMemberPaxos* localNode);
@@ -69,17 +71,29 @@ public:
 	int getClusterID();
 	ddfsStatus setClusterID(int);
 
-	void setMemberID(int);
-	int getMemberID();
+	void setMemberID(uint64_t);
+	uint64_t getMemberID();
+
+	void setUniqueIdentification(uint64_t );
+	uint64_t getUniqueIdentification();
 
-	void setUniqueIdentification(int );
-	int getUniqueIdentification();
+	/* ID of the node "a.b.c.d[:port]", s_invalid_memberID if it is not one */
+	static uint64_t memberIDFor(string hostn);
+	static const uint64_t s_invalid_memberID = 0;
 
 	string getHostName();
 
 	ddfsStatus sendClusterMetaData(ddfsClusterMessagePaxos *);
+	/* Large payloads, chunked and flow controlled. See ddfs_clusterStream.hpp */
+	ddfsStatus sendStream(const void *data, size_t size, uint64_t *streamID,
+				ddfsTrafficClass trafficClass = DDFS_TRAFFIC_REPLICATION);
+	void setStreamHandler(ddfsClusterStreamHandler handler);
+	/* Streams whose payload starts with service go to handler */
+	void setStreamService(uint8_t service, ddfsClusterStreamHandler handler);
     void processingResponses();
     void callback(void *data, int size);
+    /* Network went up or down for this member */
+    void connectionStateChanged(bool connected);
 
     bool isLocalNode() {
         return _isLocalNode;
@@ -90,16 +104,17 @@ private:
 	int clusterID;
 	static const int s_invalid_clusterID = -1;
 	/* memberID : This is unique ID of a cluster member */
-	int memberID;
-	static const int s_invalid_memberID = -1;
+	uint64_t memberID;
 	/* uniqueIdentifier for using it as Number in Paxos algorithm */
-	/* This is mac address shifted left by 12 bits */
-	uint32_t uniqueIdentification;
+	/* This is the IPv4 address shifted left by 16 bits, or'ed with the port */
+	uint64_t uniqueIdentification;
 
 	/* TODO: Should make it  */
 	std::atomic<clusterMemberState> memberState;
 	/* The network class */
-	ddfsTcpConnection <ddfsClusterMemberPaxos> *network;
+	Network <string, ddfsClusterMemberPaxos, DDFS_NETWORK_TYPE> *network;
+	/* Type of network created by init() */
+	DDFS_NETWORK_TYPE networkType;
 	/* Mutex lock for this object */
 	std::mutex clusterMemberLock;
 
@@ -109,11 +124,24 @@ private:
     /* Request and Response queues shared with network layer */
     void *networkPrivatePtr;
 
+    /* Wire version used when sending to this member, see ddfs_clusterWire.hpp */
+    std::atomic<int> peerWireVersion;
+
+    /* Streams to and from this member */
+    ddfsClusterStreams streams;
+
 	bool _isLocalNode;
 
     //std::vector<std::thread> workingThreadQ;
 
     ddfsStatus processMessage(ddfsClusterMessage *);
+    /* Encoded packet to the network */
+    ddfsStatus sendPacket(void *data, int size, ddfsTrafficClass trafficClass);
+    /* Packet without messages, tells the member which version we speak */
+    ddfsStatus sendHello(int wireVersion);
+    static const int s_helloTimeoutMs = 1000;
+    static const int s_helloPollMs = 10;
+    ddfsStatus createNetwork(string localHostName);
 
     std::condition_variable needToProcess;
     std::mutex responseQLock;
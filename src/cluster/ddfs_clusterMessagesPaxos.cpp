@@ -16,6 +16,7 @@
 #include <stdlib.h>
 
 #include "ddfs_clusterMessagesPaxos.hpp"
+#include "ddfs_clusterWire.hpp"
 #include "../global/ddfs_status.hpp"
 
 /**
@@ -31,72 +32,71 @@
 
 #define SIZE_OF_HEADER		sizeof(ddfsClusterHeader)
 #define SIZE_OF_MESSAGE		sizeof(ddfsClusterMessage)
-#define MAX_NUM_OF_MESSAGES	4
-#define MAX_SIZE_OF_MESSAGES	(SIZE_OF_MESSAGE * MAX_NUM_OF_MESSAGES) 
 
 void ddfsClusterMessagePaxos::init() {
-	ddfsHeader.version = 111;
+	ddfsHeader.version = DDFS_WIRE_VERSION_1;
 	ddfsHeader.typeOfService = CLUSTER_MESSAGE_TOF_CLUSTER_UNKNOWN;
 	ddfsHeader.totalLength = SIZE_OF_HEADER;
 	ddfsHeader.uniqueID = 10;
-    ddfsHeader.Reserved1 = 250;
-    ddfsHeader.Reserved2 = 189;
-	memset(&ddfsMessage, 0, sizeof(ddfsClusterMessage));
+    ddfsHeader.internalIndex = 0;
+    ddfsHeader.Reserved1 = DDFS_WIRE_VERSION_MAX;
+    ddfsHeader.Reserved2 = 0;
+    numberOfMessages = 0;
 }
 
 ddfsClusterMessagePaxos::ddfsClusterMessagePaxos() {
     init();
-	message = (void *)malloc(SIZE_OF_HEADER + MAX_SIZE_OF_MESSAGES);
 }
 
 ddfsClusterMessagePaxos::~ddfsClusterMessagePaxos() {
-    free(message);
 }
 
 ddfsStatus ddfsClusterMessagePaxos::addMessage(uint64_t roundNumber, uint16_t messageType,
             uint64_t proposalNumber, uint64_t lastAcceptedProposalNumber, uint64_t lastAcceptedValue) {
-	ddfsMessage.messageType = messageType;
-    ddfsMessage.Reserved1 = 0;
-	/* In case of cluster meta data this is the proposal number */
-    ddfsMessage.roundNumber = roundNumber;
-	ddfsMessage.proposalNumber = proposalNumber;
-	ddfsMessage.lastAcceptedProposalNumber = lastAcceptedProposalNumber;
-	ddfsMessage.lastAcceptedValue = lastAcceptedValue;
-
-	ddfsHeader.typeOfService = CLUSTER_MESSAGE_TOF_CLUSTER_MGMT;
-
 	/* Maximum four messages at a time are supported */
-	if(ddfsHeader.totalLength == MAX_SIZE_OF_MESSAGES)
+	if(numberOfMessages == MAX_NUM_OF_MESSAGES)
 		return (ddfsStatus(DDFS_FAILURE));
 
-	memcpy((uint8_t *)message + ddfsHeader.totalLength,
-            &ddfsMessage, sizeof(ddfsMessage));
+    ddfsClusterMessage *ddfsMessage = &ddfsMessages[numberOfMessages];
+
+	ddfsMessage->messageType = messageType;
+    ddfsMessage->Reserved1 = 0;
+	/* In case of cluster meta data this is the proposal number */
+    ddfsMessage->roundNumber = roundNumber;
+	ddfsMessage->proposalNumber = proposalNumber;
+	ddfsMessage->lastAcceptedProposalNumber = lastAcceptedProposalNumber;
+	ddfsMessage->lastAcceptedValue = lastAcceptedValue;
 
+	ddfsHeader.typeOfService = CLUSTER_MESSAGE_TOF_CLUSTER_MGMT;
 	ddfsHeader.totalLength += SIZE_OF_MESSAGE;
+    numberOfMessages++;
 
 	return (ddfsStatus(DDFS_OK));
 }
 
 void ddfsClusterMessagePaxos::returnBuffer(void *outputBuffer) {
-
-	memcpy(message, &ddfsHeader, sizeof(ddfsHeader));
-#if 0
-	memcpy(message, &ddfsHeader.version, sizeof(ddfsHeader.version));
-	memcpy((uint8_t *)message + sizeof(ddfsHeader.version),
-		&ddfsHeader.typeOfService, sizeof(ddfsHeader.typeOfService));
-	
-	memcpy((uint8_t *)message + sizeof(ddfsHeader.version) + sizeof(ddfsHeader.typeOfService),
-		&ddfsHeader.totalLength, sizeof(ddfsHeader.totalLength));
-#endif
-    memcpy(outputBuffer, message, ddfsHeader.totalLength);
+    serialize(DDFS_WIRE_VERSION_1, outputBuffer, returnBufferSize());
 }
 
 uint64_t ddfsClusterMessagePaxos::returnBufferSize() {
     return ddfsHeader.totalLength;
 }
 
+size_t ddfsClusterMessagePaxos::serialize(uint8_t wireVersion, void *outputBuffer, size_t bufferSize) {
+    ddfsClusterPacketBuilder builder(wireVersion, ddfsHeader.typeOfService, ddfsHeader.uniqueID,
+                    ddfsHeader.internalIndex, (uint8_t *) outputBuffer, bufferSize);
+
+    for(int i = 0; i < numberOfMessages; i++) {
+        ddfsStatus status = builder.addMessage(ddfsMessages[i].messageType, ddfsMessages[i].roundNumber,
+                    ddfsMessages[i].proposalNumber, ddfsMessages[i].lastAcceptedProposalNumber,
+                    ddfsMessages[i].lastAcceptedValue);
+        if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+            return 0;
+    }
+
+    return builder.finish();
+}
 
 void ddfsClusterMessagePaxos::clearBuffer() {
-    bzero(message, sizeof(SIZE_OF_HEADER + MAX_SIZE_OF_MESSAGES));
     init();
 }
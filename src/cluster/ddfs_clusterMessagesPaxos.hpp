@@ -31,7 +31,9 @@
 enum clusterMessageTypeOfService {
 	CLUSTER_MESSAGE_TOF_CLUSTER_MGMT = 76,
 	CLUSTER_MESSAGE_TOF_CLUSTER_DATA,
-	CLUSTER_MESSAGE_TOF_CLUSTER_UNKNOWN
+	CLUSTER_MESSAGE_TOF_CLUSTER_UNKNOWN,
+	/* Chunk of a large payload, see ddfs_clusterStream.hpp */
+	CLUSTER_MESSAGE_TOF_CLUSTER_STREAM
 };
 
 enum clusterMessageType {
@@ -55,6 +57,13 @@ enum clusterMessageType {
     /*  Backup related messsages */
     CLUSTER_MESSAGE_CREATE_BOOKMARK_REQUEST = 20,
     CLUSTER_MESSAGE_CREATE_BOOKMARK_REPLY = 21,
+    /*  File INFO held by a client changed */
+    CLUSTER_MESSAGE_FILE_INFORMATION_INVALIDATE = 22,
+    CLUSTER_MESSAGE_FILE_INFORMATION_INVALIDATED = 23,
+    /*  Metadata followers of the leader */
+    CLUSTER_MESSAGE_METADATA_UPDATE = 24,
+    CLUSTER_MESSAGE_METADATA_CATCHUP_REQUEST = 25,
+    CLUSTER_MESSAGE_METADATA_CATCHUP_REPLY = 26,
 };
 
 /******************************************************************
@@ -143,7 +152,7 @@ typedef struct {
 /* TODO: Not see any usage of this */
 typedef struct {
     uint8_t typeOfService;
-    uint16_t totalLength;
+    uint32_t totalLength;
     uint8_t data[MAX_REQUEST_SIZE];
     /* Following entries in used only for internal data manipulation */
     uint64_t uniqueID;
@@ -152,25 +161,31 @@ typedef struct {
 
 typedef struct {
     uint8_t typeOfService;
-    uint16_t totalLength;
+    uint32_t totalLength;
     void *data;
 } responseQEntry; 
 
+/* Most messages carried by one packet */
+#define MAX_NUM_OF_MESSAGES	4
+
 /*!
  *  \class  ddfsClusterMessagePaxos
  *  \brief  This is the class for creating cluster message.
  *  
  *   These messages are essential for correct working of
  *   the cluster.
+ *
+ *   Only the message fields are kept here. The packet is encoded once
+ *   per member, straight into the buffer handed to the network.
  */
 class ddfsClusterMessagePaxos {
 private:
     ddfsClusterHeader ddfsHeader;
-    ddfsClusterMessage ddfsMessage;
+    ddfsClusterMessage ddfsMessages[MAX_NUM_OF_MESSAGES];
+    int numberOfMessages;
 #if 0
     ddfsClusterData ddfsData;
 #endif
-    void* message;
     void init();
 public:
 	ddfsClusterMessagePaxos();
@@ -179,9 +194,12 @@ public:
             uint64_t proposalNumber, uint64_t lastAcceptedProposalNumber,
             uint64_t lastAcceptedValue);
 
+	/* v1 encoding, the buffer must hold returnBufferSize() bytes */
 	virtual void returnBuffer(void *);
     virtual void clearBuffer();
 	uint64_t returnBufferSize();
+    /* Encode in the given wire version, returns the length or 0 if it does not fit */
+    size_t serialize(uint8_t wireVersion, void *outputBuffer, size_t bufferSize);
 };
 
 #endif	/* Ending DDFS_CLUSTER_MESSAGES_PAXOS_H */
@@ -0,0 +1,527 @@
+/*
+ * @file ddfs_clusterMetadataCache.cpp
+ *
+ * @brief Client cache of file metadata and chunk locations, with leases.
+ *
+ * @author Harman Patial <harman.patial@gmail.com>
+ *
+ */
+
+#include "ddfs_clusterMetadataCache.hpp"
+#include "ddfs_clusterWire.hpp"
+#include "ddfs_clusterMessagesPaxos.hpp"
+#include "../logger/ddfs_fileLogger.hpp"
+
+using namespace std;
+
+ddfsLogger &global_logger_cmc = ddfsLogger::getInstance();
+
+static void appendVarint(vector<uint8_t> &payload, uint64_t value) {
+    uint8_t buffer[10];
+    size_t length = ddfsClusterWire::putVarint(buffer, value);
+    payload.insert(payload.end(), buffer, buffer + length);
+}
+
+static void appendString(vector<uint8_t> &payload, const string &value) {
+    appendVarint(payload, value.size());
+    payload.insert(payload.end(), value.begin(), value.end());
+}
+
+/* Reads a varint at cursor, false if it runs past end */
+static bool takeVarint(const uint8_t *&cursor, const uint8_t *end, uint64_t *value) {
+    size_t used = ddfsClusterWire::getVarint(cursor, end, value);
+    cursor += used;
+    return (used != 0);
+}
+
+static bool takeString(const uint8_t *&cursor, const uint8_t *end, string *value) {
+    uint64_t length;
+    if(takeVarint(cursor, end, &length) == false || length > (uint64_t) (end - cursor))
+        return false;
+    value->assign((const char *) cursor, length);
+    cursor += length;
+    return true;
+}
+
+static DDFS_STATUS statusCode(ddfsStatus status) {
+    for(int code = DDFS_OK; code <= DDFS_FAILURE; code++) {
+        if(status.compareStatus(ddfsStatus((DDFS_STATUS) code)))
+            return (DDFS_STATUS) code;
+    }
+    return DDFS_FAILURE;
+}
+
+/*
+ *  ddfsMetadataWorker
+ */
+ddfsMetadataWorker::ddfsMetadataWorker() : stopWorker(false) {
+    worker = std::thread(&ddfsMetadataWorker::workerRoutine, this);
+}
+
+ddfsMetadataWorker::~ddfsMetadataWorker() {
+    {
+        std::lock_guard<std::mutex> guard(workerLock);
+        stopWorker = true;
+    }
+    jobQueued.notify_all();
+    worker.join();
+}
+
+void ddfsMetadataWorker::queue(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> guard(workerLock);
+        jobs.push_back(job);
+    }
+    jobQueued.notify_one();
+}
+
+void ddfsMetadataWorker::workerRoutine() {
+    std::unique_lock<std::mutex> guard(workerLock);
+
+    while(true) {
+        jobQueued.wait(guard, [this] { return stopWorker || jobs.empty() == false; });
+        /* Jobs left at shutdown would answer for a dead object */
+        if(stopWorker)
+            return;
+
+        std::function<void()> job = jobs.front();
+        jobs.pop_front();
+
+        guard.unlock();
+        job();
+        guard.lock();
+    }
+}
+
+/*
+ *  ddfsMetadataLeaseServer
+ */
+ddfsMetadataLeaseServer::ddfsMetadataLeaseServer(ddfsClusterPaxos *c, ddfsMetadataLookup l, int ms) :
+                    cluster(c), lookup(l), leaseMs(ms), nextInvalidationID(1) {
+    for(unsigned int i = 0; i < cluster->clusterMembers.size(); i++) {
+        ddfsClusterMemberPaxos *member = cluster->clusterMembers[i];
+        if(member->isLocalNode())
+            continue;
+
+        ddfsClusterStreamHandler handler = [this, member](uint64_t streamID, vector<uint8_t> &payload) {
+            receive(member, payload);
+        };
+        member->setStreamService(CLUSTER_MESSAGE_FILE_INFORMATION_REQUEST, handler);
+        member->setStreamService(CLUSTER_MESSAGE_FILE_INFORMATION_INVALIDATED, handler);
+    }
+}
+
+ddfsMetadataLeaseServer::~ddfsMetadataLeaseServer() {
+    for(unsigned int i = 0; i < cluster->clusterMembers.size(); i++) {
+        ddfsClusterMemberPaxos *member = cluster->clusterMembers[i];
+        if(member->isLocalNode())
+            continue;
+
+        member->setStreamService(CLUSTER_MESSAGE_FILE_INFORMATION_REQUEST, ddfsClusterStreamHandler());
+        member->setStreamService(CLUSTER_MESSAGE_FILE_INFORMATION_INVALIDATED, ddfsClusterStreamHandler());
+    }
+}
+
+int ddfsMetadataLeaseServer::grant(const string &path, const string &holder, ddfsClusterMemberPaxos *member,
+                    ddfsMetadataCache *localCache) {
+    std::lock_guard<std::mutex> guard(serverLock);
+
+    leaseHolder &lease = leases[path][holder];
+    lease.member = member;
+    lease.localCache = localCache;
+    lease.expires = chrono::steady_clock::now() + chrono::milliseconds(leaseMs);
+
+    return leaseMs;
+}
+
+ddfsStatus ddfsMetadataLeaseServer::grantLocal(const string &path, ddfsMetadataCache *cache,
+                    ddfsFileInformation *info, int *ms) {
+    /* The lease first, an invalidation from here on reaches the cache */
+    *ms = grant(path, cluster->getLocalNode()->getHostName(), NULL, cache);
+    return lookup(path, info);
+}
+
+void ddfsMetadataLeaseServer::answer(ddfsClusterMemberPaxos *from, uint64_t requestID, string path) {
+    ddfsFileInformation info;
+
+    int ms = grant(path, from->getHostName(), from, NULL);
+    ddfsStatus status = lookup(path, &info);
+
+    vector<uint8_t> payload;
+    payload.push_back(CLUSTER_MESSAGE_FILE_INFORMATION_REPLY);
+    appendVarint(payload, requestID);
+    appendVarint(payload, statusCode(status));
+    appendVarint(payload, ms);
+    appendVarint(payload, info.inode);
+    appendVarint(payload, info.size);
+    appendVarint(payload, info.mode);
+    appendVarint(payload, info.version);
+    appendVarint(payload, info.chunkLocations.size());
+    for(size_t i = 0; i < info.chunkLocations.size(); i++) {
+        appendVarint(payload, info.chunkLocations[i].size());
+        for(size_t j = 0; j < info.chunkLocations[i].size(); j++)
+            appendString(payload, info.chunkLocations[i][j]);
+    }
+
+    status = from->sendStream(&payload[0], payload.size(), NULL, DDFS_TRAFFIC_CLIENT);
+    if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+        global_logger_cmc << ddfsLogger::LOG_WARNING << "CMC:: Reply for " << path << " to "
+                    << from->getHostName() << " failed. " << status.statusToString() << "\n";
+    }
+}
+
+void ddfsMetadataLeaseServer::receive(ddfsClusterMemberPaxos *from, vector<uint8_t> &payload) {
+    const uint8_t *cursor = &payload[0];
+    const uint8_t *end = cursor + payload.size();
+    uint8_t kind = *cursor++;
+    uint64_t id;
+
+    if(takeVarint(cursor, end, &id) == false)
+        return;
+
+    if(kind == CLUSTER_MESSAGE_FILE_INFORMATION_REQUEST) {
+        string path;
+        if(takeString(cursor, end, &path) == false)
+            return;
+        /* The lookup may take a while, not on the network thread */
+        worker.queue([this, from, id, path] { answer(from, id, path); });
+        return;
+    }
+
+    if(kind == CLUSTER_MESSAGE_FILE_INFORMATION_INVALIDATED) {
+        std::lock_guard<std::mutex> guard(serverLock);
+        unordered_map<uint64_t, int>::iterator ack = pendingAcks.find(id);
+        if(ack != pendingAcks.end() && ack->second > 0)
+            ack->second--;
+        ackArrived.notify_all();
+    }
+}
+
+ddfsStatus ddfsMetadataLeaseServer::invalidate(const string &path) {
+    vector<leaseHolder> holders;
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    chrono::steady_clock::time_point lastExpiry = now;
+    uint64_t id;
+    int remote = 0;
+
+    {
+        std::lock_guard<std::mutex> guard(serverLock);
+        unordered_map<string, unordered_map<string, leaseHolder> >::iterator pathLeases = leases.find(path);
+        if(pathLeases == leases.end())
+            return (ddfsStatus(DDFS_OK));
+
+        unordered_map<string, leaseHolder>::iterator iter;
+        for(iter = pathLeases->second.begin(); iter != pathLeases->second.end(); iter++) {
+            if(iter->second.expires <= now)
+                continue;
+            holders.push_back(iter->second);
+            if(iter->second.expires > lastExpiry)
+                lastExpiry = iter->second.expires;
+            if(iter->second.member != NULL)
+                remote++;
+        }
+        leases.erase(pathLeases);
+
+        id = nextInvalidationID++;
+        pendingAcks[id] = remote;
+    }
+
+    vector<uint8_t> payload;
+    payload.push_back(CLUSTER_MESSAGE_FILE_INFORMATION_INVALIDATE);
+    appendVarint(payload, id);
+    appendString(payload, path);
+
+    for(size_t i = 0; i < holders.size(); i++) {
+        if(holders[i].member == NULL) {
+            holders[i].localCache->invalidateLocal(path);
+            continue;
+        }
+
+        /* A holder out of reach keeps its copy till the lease runs out */
+        ddfsStatus status = holders[i].member->sendStream(&payload[0], payload.size(), NULL,
+                    DDFS_TRAFFIC_CLIENT);
+        if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+            global_logger_cmc << ddfsLogger::LOG_WARNING << "CMC:: Invalidating " << path << " on "
+                        << holders[i].member->getHostName() << " failed. " << status.statusToString() << "\n";
+        }
+    }
+
+    std::unique_lock<std::mutex> guard(serverLock);
+    bool acknowledged = ackArrived.wait_until(guard, lastExpiry, [this, id] { return pendingAcks[id] == 0; });
+    pendingAcks.erase(id);
+
+    if(acknowledged == false) {
+        global_logger_cmc << ddfsLogger::LOG_INFO << "CMC:: Leases on " << path
+                    << " ran out before every holder answered.\n";
+        return (ddfsStatus(DDFS_NETWORK_RETRY));
+    }
+
+    return (ddfsStatus(DDFS_OK));
+}
+
+int ddfsMetadataLeaseServer::getLeaseCount() {
+    std::lock_guard<std::mutex> guard(serverLock);
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    int count = 0;
+
+    unordered_map<string, unordered_map<string, leaseHolder> >::iterator pathLeases;
+    for(pathLeases = leases.begin(); pathLeases != leases.end();) {
+        unordered_map<string, leaseHolder>::iterator iter = pathLeases->second.begin();
+        while(iter != pathLeases->second.end()) {
+            if(iter->second.expires <= now) {
+                iter = pathLeases->second.erase(iter);
+            } else {
+                count++;
+                iter++;
+            }
+        }
+
+        if(pathLeases->second.empty())
+            pathLeases = leases.erase(pathLeases);
+        else
+            pathLeases++;
+    }
+
+    return count;
+}
+
+/*
+ *  ddfsMetadataCache
+ */
+ddfsMetadataCache::ddfsMetadataCache(ddfsClusterPaxos *c, ddfsMetadataLeaseServer *server, size_t entriesMax) :
+                    cluster(c), localServer(server), maxEntries(entriesMax == 0 ? 1 : entriesMax),
+                    nextRequestID(1), hits(0), misses(0) {
+    for(unsigned int i = 0; i < cluster->clusterMembers.size(); i++) {
+        ddfsClusterMemberPaxos *member = cluster->clusterMembers[i];
+        if(member->isLocalNode())
+            continue;
+
+        ddfsClusterStreamHandler handler = [this, member](uint64_t streamID, vector<uint8_t> &payload) {
+            receive(member, payload);
+        };
+        member->setStreamService(CLUSTER_MESSAGE_FILE_INFORMATION_REPLY, handler);
+        member->setStreamService(CLUSTER_MESSAGE_FILE_INFORMATION_INVALIDATE, handler);
+    }
+}
+
+ddfsMetadataCache::~ddfsMetadataCache() {
+    for(unsigned int i = 0; i < cluster->clusterMembers.size(); i++) {
+        ddfsClusterMemberPaxos *member = cluster->clusterMembers[i];
+        if(member->isLocalNode())
+            continue;
+
+        member->setStreamService(CLUSTER_MESSAGE_FILE_INFORMATION_REPLY, ddfsClusterStreamHandler());
+        member->setStreamService(CLUSTER_MESSAGE_FILE_INFORMATION_INVALIDATE, ddfsClusterStreamHandler());
+    }
+}
+
+void ddfsMetadataCache::setInvalidationHandler(ddfsMetadataInvalidated handler) {
+    std::lock_guard<std::mutex> guard(cacheLock);
+    invalidationHandler = handler;
+}
+
+uint64_t ddfsMetadataCache::getHits() {
+    std::lock_guard<std::mutex> guard(cacheLock);
+    return hits;
+}
+
+uint64_t ddfsMetadataCache::getMisses() {
+    std::lock_guard<std::mutex> guard(cacheLock);
+    return misses;
+}
+
+void ddfsMetadataCache::dropLocked(const string &path) {
+    unordered_map<string, cacheEntry>::iterator entry = entries.find(path);
+    if(entry != entries.end()) {
+        lru.erase(entry->second.lruPosition);
+        entries.erase(entry);
+    }
+
+    /* A reply still on its way carries what was just invalidated */
+    unordered_map<uint64_t, pendingRequest>::iterator request;
+    for(request = pending.begin(); request != pending.end(); request++) {
+        if(request->second.path == path)
+            request->second.stale = true;
+    }
+}
+
+void ddfsMetadataCache::invalidate(const string &path) {
+    std::lock_guard<std::mutex> guard(cacheLock);
+    dropLocked(path);
+}
+
+void ddfsMetadataCache::invalidateLocal(const string &path) {
+    ddfsMetadataInvalidated handler;
+    {
+        std::lock_guard<std::mutex> guard(cacheLock);
+        dropLocked(path);
+        handler = invalidationHandler;
+    }
+
+    if(handler)
+        handler(path);
+}
+
+void ddfsMetadataCache::store(const string &path, const ddfsFileInformation &info, const string &leader,
+                    chrono::steady_clock::time_point expires) {
+    unordered_map<string, cacheEntry>::iterator entry = entries.find(path);
+    if(entry != entries.end()) {
+        lru.erase(entry->second.lruPosition);
+        entries.erase(entry);
+    }
+
+    while(entries.size() >= maxEntries && lru.empty() == false) {
+        entries.erase(lru.back());
+        lru.pop_back();
+    }
+
+    lru.push_front(path);
+    cacheEntry &added = entries[path];
+    added.info = info;
+    added.expires = expires;
+    added.leader = leader;
+    added.lruPosition = lru.begin();
+}
+
+void ddfsMetadataCache::receive(ddfsClusterMemberPaxos *from, vector<uint8_t> &payload) {
+    const uint8_t *cursor = &payload[0];
+    const uint8_t *end = cursor + payload.size();
+    uint8_t kind = *cursor++;
+    uint64_t id;
+
+    if(takeVarint(cursor, end, &id) == false)
+        return;
+
+    if(kind == CLUSTER_MESSAGE_FILE_INFORMATION_INVALIDATE) {
+        string path;
+        if(takeString(cursor, end, &path) == false)
+            return;
+
+        invalidateLocal(path);
+
+        /* Acknowledge from the worker, the network thread does not send */
+        worker.queue([from, id] {
+            vector<uint8_t> ack;
+            ack.push_back(CLUSTER_MESSAGE_FILE_INFORMATION_INVALIDATED);
+            appendVarint(ack, id);
+            from->sendStream(&ack[0], ack.size(), NULL, DDFS_TRAFFIC_CLIENT);
+        });
+        return;
+    }
+
+    if(kind != CLUSTER_MESSAGE_FILE_INFORMATION_REPLY)
+        return;
+
+    uint64_t status, ms, mode, chunks;
+    ddfsFileInformation info;
+
+    if(takeVarint(cursor, end, &status) == false || takeVarint(cursor, end, &ms) == false ||
+       takeVarint(cursor, end, &info.inode) == false || takeVarint(cursor, end, &info.size) == false ||
+       takeVarint(cursor, end, &mode) == false || takeVarint(cursor, end, &info.version) == false ||
+       takeVarint(cursor, end, &chunks) == false || chunks > (uint64_t) (end - cursor))
+        return;
+
+    info.mode = (uint32_t) mode;
+    info.chunkLocations.resize(chunks);
+    for(uint64_t i = 0; i < chunks; i++) {
+        uint64_t replicas;
+        if(takeVarint(cursor, end, &replicas) == false || replicas > (uint64_t) (end - cursor))
+            return;
+        info.chunkLocations[i].resize(replicas);
+        for(uint64_t j = 0; j < replicas; j++) {
+            if(takeString(cursor, end, &info.chunkLocations[i][j]) == false)
+                return;
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(cacheLock);
+    unordered_map<uint64_t, pendingRequest>::iterator request = pending.find(id);
+    if(request == pending.end())
+        return;
+
+    request->second.status = (status <= DDFS_FAILURE) ? (DDFS_STATUS) status : DDFS_FAILURE;
+    request->second.leaseMs = (int) ms;
+    request->second.info = info;
+    request->second.done = true;
+    replyArrived.notify_all();
+}
+
+ddfsStatus ddfsMetadataCache::lookup(const string &path, ddfsFileInformation *info) {
+    ddfsClusterMemberPaxos *leader = cluster->getLeader();
+    if(leader == NULL)
+        return (ddfsStatus(DDFS_HOST_DOWN));
+
+    string leaderHost = leader->getHostName();
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    uint64_t id;
+
+    {
+        std::lock_guard<std::mutex> guard(cacheLock);
+        unordered_map<string, cacheEntry>::iterator entry = entries.find(path);
+        if(entry != entries.end()) {
+            if(entry->second.leader == leaderHost && now < entry->second.expires) {
+                hits++;
+                *info = entry->second.info;
+                lru.splice(lru.begin(), lru, entry->second.lruPosition);
+                return (ddfsStatus(DDFS_OK));
+            }
+            lru.erase(entry->second.lruPosition);
+            entries.erase(entry);
+        }
+        misses++;
+
+        id = nextRequestID++;
+        pendingRequest &request = pending[id];
+        request.path = path;
+        request.done = false;
+        request.stale = false;
+        request.status = DDFS_FAILURE;
+        request.leaseMs = 0;
+    }
+
+    ddfsStatus status(DDFS_OK);
+    int ms = 0;
+
+    if(leader->isLocalNode()) {
+        if(localServer == NULL) {
+            status = ddfsStatus(DDFS_HOST_DOWN);
+        } else {
+            status = localServer->grantLocal(path, this, info, &ms);
+        }
+    } else {
+        vector<uint8_t> payload;
+        payload.push_back(CLUSTER_MESSAGE_FILE_INFORMATION_REQUEST);
+        appendVarint(payload, id);
+        appendString(payload, path);
+
+        status = leader->sendStream(&payload[0], payload.size(), NULL, DDFS_TRAFFIC_CLIENT);
+        if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+            status = ddfsStatus(DDFS_HOST_DOWN);
+    }
+
+    std::unique_lock<std::mutex> guard(cacheLock);
+
+    if(leader->isLocalNode() == false && status.compareStatus(ddfsStatus(DDFS_OK))) {
+        bool replied = replyArrived.wait_for(guard, chrono::milliseconds((int) s_requestTimeoutMs),
+                    [this, id] { return pending[id].done; });
+        if(replied == false) {
+            status = ddfsStatus(DDFS_NETWORK_RETRY);
+        } else {
+            status = ddfsStatus(pending[id].status);
+            ms = pending[id].leaseMs;
+            *info = pending[id].info;
+        }
+    }
+
+    bool stale = pending[id].stale;
+    pending.erase(id);
+
+    if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+        return status;
+
+    /* The lease counts from before the request left */
+    if(stale == false && ms > (int) s_clockMarginMs)
+        store(path, *info, leaderHost, now + chrono::milliseconds(ms - (int) s_clockMarginMs));
+
+    return (ddfsStatus(DDFS_OK));
+}
@@ -0,0 +1,265 @@
+/*
+ * @file ddfs_clusterMetadataCache.hpp
+ *
+ * @brief Client cache of file metadata and chunk locations, with leases.
+ *
+ * A client asks the leader for the information of a path once, with
+ * CLUSTER_MESSAGE_FILE_INFORMATION_REQUEST, and keeps the reply for as
+ * long as the lease that comes with it. Opens and reads of the path in
+ * that time are answered from memory, the leader is not asked again.
+ *
+ * The leader remembers who holds a lease on which path. Before a change
+ * to a path is visible it sends CLUSTER_MESSAGE_FILE_INFORMATION_INVALIDATE
+ * to every holder and waits for CLUSTER_MESSAGE_FILE_INFORMATION_INVALIDATED.
+ * A holder that does not answer can still use its copy until its lease
+ * runs out, so the leader waits for that instead. Either way no client
+ * uses the old information once invalidate() returns.
+ *
+ *   client                               leader
+ *     | --- REQUEST (path) ----------------> |  lease for client
+ *     | <-- REPLY (information, lease) ----- |
+ *     |          ... cache hits ...          |
+ *     | <-- INVALIDATE (path) -------------- |  path changes
+ *     | --- INVALIDATED -------------------> |
+ *
+ * The client counts the lease from the moment it sent the request, less
+ * s_clockMarginMs, it always runs out on the client before the leader.
+ * No clocks need to agree. Entries are tied to the leader that granted
+ * them, a new leader knows nothing of them and they are dropped.
+ *
+ * Messages travel as streams (see ddfs_clusterStream.hpp) in the client
+ * traffic class, the message type is the first byte of the payload:
+ *
+ *   REQUEST        Type, request ID, path.
+ *   REPLY          Type, request ID, status, lease ms, inode, size,
+ *                  mode, version, chunk count, replicas of every chunk.
+ *   INVALIDATE     Type, invalidation ID, path.
+ *   INVALIDATED    Type, invalidation ID.
+ *
+ * @author Harman Patial <harman.patial@gmail.com>
+ *
+ */
+#ifndef DDFS_CLUSTER_METADATA_CACHE_H
+#define DDFS_CLUSTER_METADATA_CACHE_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <stdint.h>
+
+#include "ddfs_clusterPaxos.hpp"
+#include "ddfs_clusterMemberPaxos.hpp"
+#include "../global/ddfs_status.hpp"
+
+using namespace std;
+
+/* Lease the leader grants unless told otherwise */
+#define DDFS_METADATA_LEASE_MS          10000
+/* Paths a client keeps */
+#define DDFS_METADATA_CACHE_ENTRIES     4096
+
+/*!
+ *  \class  ddfsFileInformation
+ *  \brief  What a client needs to open and read a file.
+ */
+class ddfsFileInformation {
+public:
+    ddfsFileInformation() : inode(0), size(0), mode(0), version(0) {}
+
+    uint64_t inode;
+    uint64_t size;
+    uint32_t mode;
+    /* Bumped by every change of the file */
+    uint64_t version;
+    /* Members holding chunk i, the primary first */
+    vector<vector<string> > chunkLocations;
+};
+
+/* Fills info for path from the metadata of the leader */
+typedef std::function<ddfsStatus(const string &path, ddfsFileInformation *info)> ddfsMetadataLookup;
+/* path was invalidated by the leader */
+typedef std::function<void(const string &path)> ddfsMetadataInvalidated;
+
+/*!
+ *  \class  ddfsMetadataWorker
+ *  \brief  Runs jobs off the network threads, in the order queued.
+ */
+class ddfsMetadataWorker {
+public:
+    ddfsMetadataWorker();
+    ~ddfsMetadataWorker();
+
+    void queue(std::function<void()> job);
+
+private:
+    std::mutex workerLock;
+    std::condition_variable jobQueued;
+    deque<std::function<void()> > jobs;
+    bool stopWorker;
+    std::thread worker;
+
+    void workerRoutine();
+
+    ddfsMetadataWorker(ddfsMetadataWorker const&);     // Don't Implement
+    void operator=(ddfsMetadataWorker const&);         // Don't implement
+};
+
+class ddfsMetadataCache;
+
+/*!
+ *  \class  ddfsMetadataLeaseServer
+ *  \brief  Answers file information requests on the leader and keeps
+ *          track of the leases it handed out.
+ */
+class ddfsMetadataLeaseServer {
+public:
+    ddfsMetadataLeaseServer(ddfsClusterPaxos *cluster, ddfsMetadataLookup lookup,
+                    int leaseMs = DDFS_METADATA_LEASE_MS);
+    ~ddfsMetadataLeaseServer();
+
+    /*
+     * @brief Take away every lease on path.
+     *
+     * Call after the change to path is made, lookups already return the
+     * new information. Returns once every holder dropped its copy or its
+     * lease ran out.
+     *
+     * @return DDFS_OK                  No client uses the old information
+     * @return DDFS_NETWORK_RETRY       Some holders never answered, their
+     *                                  leases ran out
+     */
+    ddfsStatus invalidate(const string &path);
+
+    /* Leases not run out yet */
+    int getLeaseCount();
+
+    /* Grant to a cache on this node, see ddfsMetadataCache */
+    ddfsStatus grantLocal(const string &path, ddfsMetadataCache *cache,
+                    ddfsFileInformation *info, int *leaseMs);
+
+private:
+    struct leaseHolder {
+        /* NULL for a cache on this node */
+        ddfsClusterMemberPaxos *member;
+        ddfsMetadataCache *localCache;
+        chrono::steady_clock::time_point expires;
+    };
+
+    ddfsClusterPaxos *cluster;
+    ddfsMetadataLookup lookup;
+    int leaseMs;
+
+    std::mutex serverLock;
+    std::condition_variable ackArrived;
+    /* Path to its holders, keyed by host name */
+    unordered_map<string, unordered_map<string, leaseHolder> > leases;
+    /* Invalidations waiting for acknowledgements, ID to holders left */
+    unordered_map<uint64_t, int> pendingAcks;
+    uint64_t nextInvalidationID;
+
+    ddfsMetadataWorker worker;
+
+    void receive(ddfsClusterMemberPaxos *from, vector<uint8_t> &payload);
+    void answer(ddfsClusterMemberPaxos *from, uint64_t requestID, string path);
+    /* Record the lease of holder on path, returns its length in ms */
+    int grant(const string &path, const string &holder, ddfsClusterMemberPaxos *member,
+                    ddfsMetadataCache *localCache);
+
+    ddfsMetadataLeaseServer(ddfsMetadataLeaseServer const&);     // Don't Implement
+    void operator=(ddfsMetadataLeaseServer const&);              // Don't implement
+};
+
+/*!
+ *  \class  ddfsMetadataCache
+ *  \brief  File information of the paths a client uses, under lease.
+ *
+ *   localServer answers when the local node is the leader, leave it
+ *   NULL when this node never leads.
+ */
+class ddfsMetadataCache {
+public:
+    ddfsMetadataCache(ddfsClusterPaxos *cluster, ddfsMetadataLeaseServer *localServer = NULL,
+                    size_t maxEntries = DDFS_METADATA_CACHE_ENTRIES);
+    ~ddfsMetadataCache();
+
+    /*
+     * @brief File information of path, from memory while the lease holds.
+     *
+     * @return DDFS_OK              info is filled in
+     * @return DDFS_HOST_DOWN       No leader, or it can not be reached
+     * @return DDFS_NETWORK_RETRY   No reply in s_requestTimeoutMs
+     * @return Anything else the leader's lookup failed with
+     */
+    ddfsStatus lookup(const string &path, ddfsFileInformation *info);
+
+    /* Forget path, the next lookup asks the leader */
+    void invalidate(const string &path);
+
+    /* Called for every path the leader invalidates */
+    void setInvalidationHandler(ddfsMetadataInvalidated handler);
+
+    uint64_t getHits();
+    uint64_t getMisses();
+
+private:
+    static const int s_requestTimeoutMs = 5000;
+    /* Taken off every lease, for the time the reply was on its way */
+    static const int s_clockMarginMs = 100;
+
+    struct cacheEntry {
+        ddfsFileInformation info;
+        chrono::steady_clock::time_point expires;
+        /* Leader that granted the lease */
+        string leader;
+        list<string>::iterator lruPosition;
+    };
+
+    struct pendingRequest {
+        string path;
+        bool done;
+        /* Invalidated while on its way, used once but not kept */
+        bool stale;
+        DDFS_STATUS status;
+        int leaseMs;
+        ddfsFileInformation info;
+    };
+
+    ddfsClusterPaxos *cluster;
+    ddfsMetadataLeaseServer *localServer;
+    size_t maxEntries;
+
+    std::mutex cacheLock;
+    std::condition_variable replyArrived;
+    unordered_map<string, cacheEntry> entries;
+    /* Most recently used first */
+    list<string> lru;
+    unordered_map<uint64_t, pendingRequest> pending;
+    uint64_t nextRequestID;
+    uint64_t hits;
+    uint64_t misses;
+    ddfsMetadataInvalidated invalidationHandler;
+
+    ddfsMetadataWorker worker;
+
+    friend class ddfsMetadataLeaseServer;
+
+    void receive(ddfsClusterMemberPaxos *from, vector<uint8_t> &payload);
+    /* Leader took path away. Called with cacheLock held */
+    void dropLocked(const string &path);
+    void store(const string &path, const ddfsFileInformation &info, const string &leader,
+                    chrono::steady_clock::time_point expires);
+    /* Invalidation from the lease server on this node */
+    void invalidateLocal(const string &path);
+
+    ddfsMetadataCache(ddfsMetadataCache const&);     // Don't Implement
+    void operator=(ddfsMetadataCache const&);        // Don't implement
+};
+
+#endif /* Ending DDFS_CLUSTER_METADATA_CACHE_H */
@@ -0,0 +1,282 @@
+/*
+ * @file ddfs_clusterMetadataReplica.cpp
+ *
+ * @brief Followers of the metadata of the leader, kept up to date with
+ *        incremental checkpoints and the journal tail.
+ *
+ * @author Harman Patial <harman.patial@gmail.com>
+ *
+ */
+
+#include "ddfs_clusterMetadataReplica.hpp"
+#include "ddfs_clusterWire.hpp"
+#include "ddfs_clusterMessagesPaxos.hpp"
+#include "../logger/ddfs_fileLogger.hpp"
+
+using namespace std;
+
+ddfsLogger &global_logger_cmr = ddfsLogger::getInstance();
+
+static void appendVarint(vector<uint8_t> &payload, uint64_t value) {
+    uint8_t buffer[10];
+    size_t length = ddfsClusterWire::putVarint(buffer, value);
+    payload.insert(payload.end(), buffer, buffer + length);
+}
+
+/* Reads a varint at cursor, false if it runs past end */
+static bool takeVarint(const uint8_t *&cursor, const uint8_t *end, uint64_t *value) {
+    size_t used = ddfsClusterWire::getVarint(cursor, end, value);
+    cursor += used;
+    return (used != 0);
+}
+
+static DDFS_STATUS statusCode(ddfsStatus status) {
+    for(int code = DDFS_OK; code <= DDFS_FAILURE; code++) {
+        if(status.compareStatus(ddfsStatus((DDFS_STATUS) code)))
+            return (DDFS_STATUS) code;
+    }
+    return DDFS_FAILURE;
+}
+
+/*
+ *  ddfsMetadataShipper
+ */
+ddfsMetadataShipper::ddfsMetadataShipper(ddfsClusterPaxos *c, ddfsReplicaCatchUp take) :
+                    cluster(c), catchUp(take), shippedBytes(0) {
+    for(unsigned int i = 0; i < cluster->clusterMembers.size(); i++) {
+        ddfsClusterMemberPaxos *member = cluster->clusterMembers[i];
+        if(member->isLocalNode())
+            continue;
+
+        member->setStreamService(CLUSTER_MESSAGE_METADATA_CATCHUP_REQUEST,
+                    [this, member](uint64_t streamID, vector<uint8_t> &payload) {
+            receive(member, payload);
+        });
+    }
+}
+
+ddfsMetadataShipper::~ddfsMetadataShipper() {
+    for(unsigned int i = 0; i < cluster->clusterMembers.size(); i++) {
+        ddfsClusterMemberPaxos *member = cluster->clusterMembers[i];
+        if(member->isLocalNode())
+            continue;
+
+        member->setStreamService(CLUSTER_MESSAGE_METADATA_CATCHUP_REQUEST, ddfsClusterStreamHandler());
+    }
+}
+
+void ddfsMetadataShipper::ship(const vector<uint8_t> &update) {
+    vector<uint8_t> payload;
+    payload.reserve(update.size() + 1);
+    payload.push_back(CLUSTER_MESSAGE_METADATA_UPDATE);
+    payload.insert(payload.end(), update.begin(), update.end());
+
+    /* Called with the namespace locked, the sending is left to the worker */
+    worker.queue([this, payload] { send(payload); });
+}
+
+void ddfsMetadataShipper::send(const vector<uint8_t> &payload) {
+    for(unsigned int i = 0; i < cluster->clusterMembers.size(); i++) {
+        ddfsClusterMemberPaxos *member = cluster->clusterMembers[i];
+        if(member->isLocalNode() || member->isDead())
+            continue;
+
+        /* A follower that misses one catches up when the next arrives */
+        ddfsStatus status = member->sendStream(&payload[0], payload.size(), NULL, DDFS_TRAFFIC_REPLICATION);
+        if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+            global_logger_cmr << ddfsLogger::LOG_INFO << "CMR:: Update to " << member->getHostName()
+                        << " failed. " << status.statusToString() << "\n";
+            continue;
+        }
+        shippedBytes += payload.size();
+    }
+}
+
+void ddfsMetadataShipper::answer(ddfsClusterMemberPaxos *from, uint64_t requestID, uint64_t since) {
+    vector<uint8_t> updates;
+    ddfsStatus status = catchUp(since, &updates);
+
+    vector<uint8_t> payload;
+    payload.reserve(updates.size() + 24);
+    payload.push_back(CLUSTER_MESSAGE_METADATA_CATCHUP_REPLY);
+    appendVarint(payload, requestID);
+    appendVarint(payload, statusCode(status));
+    payload.insert(payload.end(), updates.begin(), updates.end());
+
+    status = from->sendStream(&payload[0], payload.size(), NULL, DDFS_TRAFFIC_REPLICATION);
+    if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+        global_logger_cmr << ddfsLogger::LOG_WARNING << "CMR:: Catch-up of " << from->getHostName()
+                    << " from checkpoint " << since << " failed. " << status.statusToString() << "\n";
+        return;
+    }
+    shippedBytes += payload.size();
+}
+
+void ddfsMetadataShipper::receive(ddfsClusterMemberPaxos *from, vector<uint8_t> &payload) {
+    const uint8_t *cursor = &payload[0];
+    const uint8_t *end = cursor + payload.size();
+    uint8_t kind = *cursor++;
+    uint64_t id, since;
+
+    if(kind != CLUSTER_MESSAGE_METADATA_CATCHUP_REQUEST || takeVarint(cursor, end, &id) == false ||
+       takeVarint(cursor, end, &since) == false)
+        return;
+
+    /* Behind the updates queued so far, the follower drops those */
+    worker.queue([this, from, id, since] { answer(from, id, since); });
+}
+
+/*
+ *  ddfsMetadataFollower
+ */
+ddfsMetadataFollower::ddfsMetadataFollower(ddfsClusterPaxos *c, ddfsReplicaApply take,
+                    ddfsReplicaCheckpoint at) :
+                    cluster(c), apply(take), checkpoint(at), catchUpBytes(0), outstanding(0),
+                    nextRequestID(1), lastCaughtUp(0), lastStatus(DDFS_OK) {
+    for(unsigned int i = 0; i < cluster->clusterMembers.size(); i++) {
+        ddfsClusterMemberPaxos *member = cluster->clusterMembers[i];
+        if(member->isLocalNode())
+            continue;
+
+        member->setStreamService(CLUSTER_MESSAGE_METADATA_UPDATE,
+                    [this, member](uint64_t streamID, vector<uint8_t> &payload) {
+            receive(member, payload);
+        });
+        member->setStreamService(CLUSTER_MESSAGE_METADATA_CATCHUP_REPLY,
+                    [this, member](uint64_t streamID, vector<uint8_t> &payload) {
+            receive(member, payload);
+        });
+    }
+}
+
+ddfsMetadataFollower::~ddfsMetadataFollower() {
+    for(unsigned int i = 0; i < cluster->clusterMembers.size(); i++) {
+        ddfsClusterMemberPaxos *member = cluster->clusterMembers[i];
+        if(member->isLocalNode())
+            continue;
+
+        member->setStreamService(CLUSTER_MESSAGE_METADATA_UPDATE, ddfsClusterStreamHandler());
+        member->setStreamService(CLUSTER_MESSAGE_METADATA_CATCHUP_REPLY, ddfsClusterStreamHandler());
+    }
+}
+
+void ddfsMetadataFollower::receive(ddfsClusterMemberPaxos *from, vector<uint8_t> &payload) {
+    if(payload.empty())
+        return;
+
+    /* Not on the network thread */
+    vector<uint8_t> copy(payload);
+    if(payload[0] == CLUSTER_MESSAGE_METADATA_UPDATE)
+        worker.queue([this, from, copy] { applyUpdate(from, copy); });
+    else if(payload[0] == CLUSTER_MESSAGE_METADATA_CATCHUP_REPLY)
+        worker.queue([this, copy] { applyCatchUp(copy); });
+}
+
+uint64_t ddfsMetadataFollower::request(ddfsClusterMemberPaxos *leader, uint64_t since) {
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> guard(followerLock);
+        id = nextRequestID++;
+        outstanding = id;
+        outstandingSince = chrono::steady_clock::now();
+    }
+
+    vector<uint8_t> payload;
+    payload.push_back(CLUSTER_MESSAGE_METADATA_CATCHUP_REQUEST);
+    appendVarint(payload, id);
+    appendVarint(payload, since);
+
+    ddfsStatus status = leader->sendStream(&payload[0], payload.size(), NULL, DDFS_TRAFFIC_REPLICATION);
+    if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+        global_logger_cmr << ddfsLogger::LOG_WARNING << "CMR:: Catch-up request to " << leader->getHostName()
+                    << " from checkpoint " << since << " failed. " << status.statusToString() << "\n";
+        std::lock_guard<std::mutex> guard(followerLock);
+        if(outstanding == id)
+            outstanding = 0;
+    }
+    return id;
+}
+
+void ddfsMetadataFollower::applyUpdate(ddfsClusterMemberPaxos *from, vector<uint8_t> payload) {
+    bool newLeader;
+    {
+        std::lock_guard<std::mutex> guard(followerLock);
+        /* The catch-up on its way has this one in it already */
+        if(outstanding != 0 && chrono::steady_clock::now() - outstandingSince <
+                        chrono::milliseconds((int) s_requestTimeoutMs))
+            return;
+
+        newLeader = following.empty() == false && following != from->getHostName();
+        following = from->getHostName();
+    }
+
+    if(newLeader) {
+        global_logger_cmr << ddfsLogger::LOG_INFO << "CMR:: Now following " << from->getHostName()
+                    << ", catching up in full.\n";
+        request(from, 0);
+        return;
+    }
+
+    ddfsStatus status = apply(&payload[1], payload.size() - 1);
+    if(status.compareStatus(ddfsStatus(DDFS_NETWORK_RETRY))) {
+        request(from, checkpoint());
+    } else if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+        global_logger_cmr << ddfsLogger::LOG_WARNING << "CMR:: Update from " << from->getHostName()
+                    << " can not be applied. " << status.statusToString() << "\n";
+    }
+}
+
+void ddfsMetadataFollower::applyCatchUp(vector<uint8_t> payload) {
+    const uint8_t *cursor = &payload[0];
+    const uint8_t *end = cursor + payload.size();
+    uint64_t id, code;
+
+    cursor++;
+    if(takeVarint(cursor, end, &id) == false || takeVarint(cursor, end, &code) == false)
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(followerLock);
+        if(id != outstanding)
+            return;
+    }
+
+    ddfsStatus status((code <= DDFS_FAILURE) ? (DDFS_STATUS) code : DDFS_FAILURE);
+    if(status.compareStatus(ddfsStatus(DDFS_OK))) {
+        status = apply(cursor, (size_t) (end - cursor));
+        catchUpBytes += (uint64_t) (end - cursor);
+    }
+    if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+        global_logger_cmr << ddfsLogger::LOG_WARNING << "CMR:: Catch-up failed. "
+                    << status.statusToString() << "\n";
+    }
+
+    std::lock_guard<std::mutex> guard(followerLock);
+    if(outstanding == id)
+        outstanding = 0;
+    lastCaughtUp = id;
+    lastStatus = statusCode(status);
+    caughtUp.notify_all();
+}
+
+ddfsStatus ddfsMetadataFollower::catchUp() {
+    ddfsClusterMemberPaxos *leader = cluster->getLeader();
+    if(leader == NULL)
+        return (ddfsStatus(DDFS_HOST_DOWN));
+    if(leader->isLocalNode())
+        return (ddfsStatus(DDFS_OK));
+
+    {
+        std::lock_guard<std::mutex> guard(followerLock);
+        following = leader->getHostName();
+    }
+    uint64_t id = request(leader, checkpoint());
+
+    std::unique_lock<std::mutex> guard(followerLock);
+    if(outstanding != id && lastCaughtUp != id)
+        return (ddfsStatus(DDFS_HOST_DOWN));
+    if(caughtUp.wait_for(guard, chrono::milliseconds((int) s_requestTimeoutMs),
+                    [this, id] { return lastCaughtUp == id; }) == false)
+        return (ddfsStatus(DDFS_NETWORK_RETRY));
+    return (ddfsStatus(lastStatus));
+}
@@ -0,0 +1,155 @@
+/*
+ * @file ddfs_clusterMetadataReplica.hpp
+ *
+ * @brief Followers of the metadata of the leader, kept up to date with
+ *        incremental checkpoints and the journal tail.
+ *
+ * The leader ships every metadata transaction as it commits, and every
+ * checkpoint as the blocks that changed since the one before it, both
+ * compressed (see ddfs_metadataCheckpoint.hpp). A follower applies them
+ * in order to its own tables. One that finds a gap, that restarted, or
+ * that just joined, asks the leader to catch it up from the checkpoint
+ * it has: it gets the blocks changed since and the tail after them, an
+ * amount of data proportional to the churn while it was away and not
+ * to the size of the namespace. A follower that sees a new leader asks
+ * for everything once, the new leader may not have had the last few
+ * transactions of the old one.
+ *
+ *   leader                                  follower
+ *     | --- UPDATE (transaction) ------------> |  applied
+ *     | --- UPDATE (checkpoint delta) -------> |  applied, written out
+ *     | --- UPDATE (transaction) ------------> |  gap
+ *     | <-- CATCHUP_REQUEST (checkpoint) ----- |
+ *     | --- CATCHUP_REPLY (delta, tail) -----> |  applied
+ *
+ * Messages travel as streams (see ddfs_clusterStream.hpp) in the
+ * replication traffic class, the message type is the first byte of the
+ * payload:
+ *
+ *   UPDATE             Type, updates.
+ *   CATCHUP_REQUEST    Type, request ID, checkpoint.
+ *   CATCHUP_REPLY      Type, request ID, status, updates.
+ *
+ * Updates are sent and applied off the network thread, each side in
+ * the order it made or got them.
+ *
+ * @author Harman Patial <harman.patial@gmail.com>
+ *
+ */
+#ifndef DDFS_CLUSTER_METADATA_REPLICA_H
+#define DDFS_CLUSTER_METADATA_REPLICA_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <stdint.h>
+
+#include "ddfs_clusterPaxos.hpp"
+#include "ddfs_clusterMemberPaxos.hpp"
+#include "ddfs_clusterMetadataCache.hpp"
+#include "../global/ddfs_status.hpp"
+
+using namespace std;
+
+/* Updates that take a follower at checkpoint since to now */
+typedef std::function<ddfsStatus(uint64_t since, vector<uint8_t> *updates)> ddfsReplicaCatchUp;
+/* Apply updates of the leader, DDFS_NETWORK_RETRY if some are missing */
+typedef std::function<ddfsStatus(const uint8_t *updates, size_t length)> ddfsReplicaApply;
+/* Checkpoint the follower is at */
+typedef std::function<uint64_t()> ddfsReplicaCheckpoint;
+
+/*!
+ *  \class  ddfsMetadataShipper
+ *  \brief  Sends the updates of the leader to every follower, and catches
+ *          them up.
+ */
+class ddfsMetadataShipper {
+public:
+    ddfsMetadataShipper(ddfsClusterPaxos *cluster, ddfsReplicaCatchUp catchUp);
+    ~ddfsMetadataShipper();
+
+    /* For every follower, the update handler of the filesystem */
+    void ship(const vector<uint8_t> &update);
+
+    /* Bytes of updates and catch-ups sent, to one follower each */
+    uint64_t getShippedBytes() {
+        return shippedBytes;
+    }
+
+private:
+    ddfsClusterPaxos *cluster;
+    ddfsReplicaCatchUp catchUp;
+    std::atomic<uint64_t> shippedBytes;
+    /* Updates and catch-ups leave in the order they are made */
+    ddfsMetadataWorker worker;
+
+    void send(const vector<uint8_t> &payload);
+    void receive(ddfsClusterMemberPaxos *from, vector<uint8_t> &payload);
+    void answer(ddfsClusterMemberPaxos *from, uint64_t requestID, uint64_t since);
+
+    ddfsMetadataShipper(ddfsMetadataShipper const&);     // Don't Implement
+    void operator=(ddfsMetadataShipper const&);          // Don't implement
+};
+
+/*!
+ *  \class  ddfsMetadataFollower
+ *  \brief  Applies the updates of the leader, catching up when it has to.
+ */
+class ddfsMetadataFollower {
+public:
+    ddfsMetadataFollower(ddfsClusterPaxos *cluster, ddfsReplicaApply apply,
+                    ddfsReplicaCheckpoint checkpoint);
+    ~ddfsMetadataFollower();
+
+    /*
+     * @brief Catch up with the leader and wait for it, eg. at startup.
+     *
+     * @return DDFS_OK              Caught up, or this is the leader
+     * @return DDFS_HOST_DOWN       No leader, or it can not be reached
+     * @return DDFS_NETWORK_RETRY   No reply in s_requestTimeoutMs
+     * @return Anything else the leader or applying the updates failed with
+     */
+    ddfsStatus catchUp();
+
+    /* Bytes of catch-up replies applied */
+    uint64_t getCatchUpBytes() {
+        return catchUpBytes;
+    }
+
+private:
+    static const int s_requestTimeoutMs = 5000;
+
+    ddfsClusterPaxos *cluster;
+    ddfsReplicaApply apply;
+    ddfsReplicaCheckpoint checkpoint;
+    std::atomic<uint64_t> catchUpBytes;
+
+    std::mutex followerLock;
+    std::condition_variable caughtUp;
+    /* Host of the leader updates were last taken from */
+    string following;
+    /* The catch-up asked for, 0 if none */
+    uint64_t outstanding;
+    chrono::steady_clock::time_point outstandingSince;
+    uint64_t nextRequestID;
+    /* Request ID and outcome of the last catch-up applied */
+    uint64_t lastCaughtUp;
+    DDFS_STATUS lastStatus;
+    /* Updates are applied one at a time, in the order they came */
+    ddfsMetadataWorker worker;
+
+    void receive(ddfsClusterMemberPaxos *from, vector<uint8_t> &payload);
+    void applyUpdate(ddfsClusterMemberPaxos *from, vector<uint8_t> payload);
+    void applyCatchUp(vector<uint8_t> payload);
+    /* Ask leader for the updates after since, returns the request ID */
+    uint64_t request(ddfsClusterMemberPaxos *leader, uint64_t since);
+
+    ddfsMetadataFollower(ddfsMetadataFollower const&);     // Don't Implement
+    void operator=(ddfsMetadataFollower const&);           // Don't implement
+};
+
+#endif /* Ending DDFS_CLUSTER_METADATA_REPLICA_H */
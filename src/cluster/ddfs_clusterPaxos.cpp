@@ -23,17 +23,26 @@
 
 ddfsLogger &global_logger_cp = ddfsLogger::getInstance();
  
-ddfsClusterPaxos::ddfsClusterPaxos(string localHostName) {
+ddfsClusterPaxos::ddfsClusterPaxos(string localHostName, DDFS_NETWORK_TYPE networkType,
+                                const ddfsTcpListenConfig &listenConfig,
+                                const ddfsTcpSocketOptions &socketOptions) {
 	clusterID = s_clusterIDInvalid;
 	paxosProposalNumber = 88;
-
-	localClusterMember = new ddfsClusterMemberPaxos();
+	clusterMemberCount = 0;
+	leaderClusterMember = NULL;
+	internalRoundNumber = 0;
+	clusterNetworkType = networkType;
+	clusterListenConfig = listenConfig;
+	clusterSocketOptions = socketOptions;
+
+	localClusterMember = new ddfsClusterMemberPaxos(this, clusterNetworkType);
     clusterMembers.push_back(localClusterMember);
     clusterMemberCount++;
 
     leaderPaxosInstance = new ddfsClusterPaxosInstance();
     /* Initialize the local node */
     localClusterMember->init(localHostName, NULL);
+    clusterPlacement.addMember(localHostName);
 	return;
 }
 
@@ -49,11 +58,13 @@ uint64_t ddfsClusterPaxos::getProposalNumber() {
     paxosProposalNumber++;
 
     /* This is the right way to get the proposal number. */
-    /*  ProposalNumber  */
-    uint64_t realNumber = (uint64_t)(paxosProposalNumber << 16);
+    /*  ProposalNumber : 15 bits of count and the 48 bit unique ID of the
+     *  local node, two nodes never propose the same number. Sign bit is
+     *  left clear for the int64_t of the message. */
+    uint64_t realNumber = (paxosProposalNumber & 0x7FFF) << 48;
     global_logger_cp << ddfsLogger::LOG_INFO
-                << "First 48 bits of Proposal Number : " << realNumber << "\n"; 
-    uint16_t uniq = (uint16_t) getLocalNode()->getUniqueIdentification();
+                << "First 15 bits of Proposal Number : " << realNumber << "\n"; 
+    uint64_t uniq = getLocalNode()->getUniqueIdentification() & 0xFFFFFFFFFFFFULL;
     realNumber |= uniq;
     global_logger_cp << ddfsLogger::LOG_INFO
                 << "Current Proposal Number : " << realNumber << "\n"; 
@@ -66,7 +77,7 @@ ddfsStatus ddfsClusterPaxos::leaderElection() {
     uint8_t retryCount = s_retryCountLE;
     bool leaderElectionCompleted = false;
 	ddfsStatus status(DDFS_FAILURE);
-    int newLeader = -1;
+    uint64_t newLeader = ddfsClusterMemberPaxos::s_invalid_memberID;
 	
     while(leaderElectionCompleted == false) {
 
@@ -90,7 +101,7 @@ ddfsStatus ddfsClusterPaxos::leaderElection() {
          *         sync. completion.
          */
         /* Execute the Paxos Instance */
-		int pr = getProposalNumber();
+		uint64_t pr = getProposalNumber();
         int roundNumber = 0;
 
         status = leaderPaxosInstance->execute(roundNumber, pr, localClusterMember->getMemberID(), clusterMembers, &newLeader);
@@ -172,7 +183,7 @@ ddfsStatus ddfsClusterPaxos::processMessage (ddfsClusterMemberPaxos *member, ddf
                     << "Discarding the Message. Ideally should be sending my vote in round -- message->roundNumber\n";
                 break;
             }
-            if(leaderPaxosInstance->getLastPromised() < message->proposalNumber) {
+            if(leaderPaxosInstance->getLastPromised() < (uint64_t) message->proposalNumber) {
                 /* Accept the proposal value */
                 global_logger_cp << ddfsLogger::LOG_INFO << "Accepting the propose request : " << message->proposalNumber << ".\n";
                 leaderPaxosInstance->setLastPromised(message->proposalNumber);
@@ -188,13 +199,13 @@ ddfsStatus ddfsClusterPaxos::processMessage (ddfsClusterMemberPaxos *member, ddf
 		}
 		case CLUSTER_MESSAGE_LE_TYPE_PROMISE:
 		{
-			if((leaderPaxosInstance->getState() == s_paxosState_PREPARE) && (leaderPaxosInstance->getLastPromised() == message->proposalNumber)) {
+			if((leaderPaxosInstance->getState() == s_paxosState_PREPARE) && (leaderPaxosInstance->getLastPromised() == (uint64_t) message->proposalNumber)) {
                 global_logger_cp << ddfsLogger::LOG_INFO << "Got one Promise.\n";
                 leaderPaxosInstance->incrementPromiseCount();
                 global_logger_cp << ddfsLogger::LOG_INFO << "Total Promises so far : " << leaderPaxosInstance->getPromiseCount() << ".\n";
             }
             /*  This is considered vote <lastAcceptedProposalNumber, lastAcceptedProposalValue> */
-            if((message->lastAcceptedProposalNumber != 0) && (message->lastAcceptedValue != leaderPaxosInstance->getLastAcceptedValue())) {
+            if((message->lastAcceptedProposalNumber != 0) && ((uint64_t) message->lastAcceptedValue != leaderPaxosInstance->getLastAcceptedValue())) {
                 leaderPaxosInstance->setLastAcceptedProposalNumber(message->lastAcceptedProposalNumber);
                 leaderPaxosInstance->setLastAcceptedValue(message->lastAcceptedValue);
             }
@@ -202,7 +213,7 @@ ddfsStatus ddfsClusterPaxos::processMessage (ddfsClusterMemberPaxos *member, ddf
 		}
 		case CLUSTER_MESSAGE_LE_ACCEPT_REQUESTED:
 		{	
-			if(leaderPaxosInstance->getLastPromised() == message->proposalNumber) {
+			if(leaderPaxosInstance->getLastPromised() == (uint64_t) message->proposalNumber) {
                 leaderPaxosInstance->setLastAcceptedProposalNumber(message->proposalNumber);
                 leaderPaxosInstance->setLastAcceptedValue(message->lastAcceptedValue);
 
@@ -221,7 +232,7 @@ ddfsStatus ddfsClusterPaxos::processMessage (ddfsClusterMemberPaxos *member, ddf
 		{
             global_logger_cp << ddfsLogger::LOG_INFO << "last accepted proposal number : "
                             << leaderPaxosInstance->getLastAcceptedProposalNumber() << "\n";
-			if(leaderPaxosInstance->getLastAcceptedProposalNumber() == message->lastAcceptedProposalNumber) {
+			if(leaderPaxosInstance->getLastAcceptedProposalNumber() == (uint64_t) message->lastAcceptedProposalNumber) {
                     global_logger_cp << ddfsLogger::LOG_INFO << "Got one Accepted.\n";
                     leaderPaxosInstance->incrementAcceptedCount();
                     global_logger_cp << ddfsLogger::LOG_INFO << "Total Accepted so far : " << leaderPaxosInstance->getAcceptedCount() << ".\n";
@@ -266,18 +277,29 @@ ddfsStatus ddfsClusterPaxos::processMessage (ddfsClusterMemberPaxos *member, ddf
 }
 
 ddfsStatus ddfsClusterPaxos::addMember(string newHostName) {
+    return addMember(newHostName, clusterNetworkType);
+}
+
+ddfsStatus ddfsClusterPaxos::addMember(string newHostName, DDFS_NETWORK_TYPE networkType) {
     
     vector<ddfsClusterMemberPaxos *>::iterator clusterMemberIter;
+    uint64_t newMemberID = ddfsClusterMemberPaxos::memberIDFor(newHostName);
     
     global_logger_cp << ddfsLogger::LOG_WARNING << "Add Member Node.\n";
 
+    if(newMemberID == ddfsClusterMemberPaxos::s_invalid_memberID) {
+        global_logger_cp << ddfsLogger::LOG_WARNING << "Node "
+                        << newHostName << " is not a valid node address\n";
+        return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+    }
+
+    /* Paxos orders the proposals and picks the leader by member ID */
     for(clusterMemberIter = clusterMembers.begin(); clusterMemberIter != clusterMembers.end(); clusterMemberIter++) {
             global_logger_cp << ddfsLogger::LOG_INFO << "host Name : " << (*clusterMemberIter)->getHostName() << "\n";
-            continue;
-            if((*clusterMemberIter)->getHostName().compare(newHostName) == 0) {
+            if((*clusterMemberIter)->getMemberID() == newMemberID) {
                 global_logger_cp << ddfsLogger::LOG_WARNING << "Node "
-                                << (*clusterMemberIter)->getUniqueIdentification()
-                                << " is already configured to be part of cluster";
+                                << (*clusterMemberIter)->getHostName()
+                                << " is already configured to be part of cluster\n";
                 return (ddfsStatus(DDFS_CLUSTER_ALREADY_MEMBER)); 
             }
     }
@@ -291,12 +313,13 @@ ddfsStatus ddfsClusterPaxos::addMember(string newHostName) {
 	global_logger_cp << ddfsLogger::LOG_INFO << "CLUSTER :: Adding node "
 					<< newHostName << " to the cluster\n";
 
-    ddfsClusterMemberPaxos *newMember = new ddfsClusterMemberPaxos(this);
+    ddfsClusterMemberPaxos *newMember = new ddfsClusterMemberPaxos(this, networkType);
 
     newMember->init(newHostName, getLocalNode());
 
     clusterMembers.push_back(newMember);
     clusterMemberCount++;
+    clusterPlacement.addMember(newHostName);
 	return (ddfsStatus(DDFS_OK));
 }
 
@@ -323,6 +346,7 @@ ddfsStatus ddfsClusterPaxos::removeMember(string removeHostName) {
 	if(exists == true) {
     	delete(deletedMember);
 	    clusterMemberCount--;
+	    clusterPlacement.removeMember(removeHostName);
 	}
 	return (ddfsStatus(DDFS_OK));
 }
@@ -337,7 +361,7 @@ ddfsClusterMemberPaxos* ddfsClusterPaxos::getLocalNode() {
 
 ddfsClusterMemberPaxos* ddfsClusterPaxos::getLeader() { return leaderClusterMember; }
 
-void ddfsClusterPaxos::setLeader(int leaderMemberID) {
+void ddfsClusterPaxos::setLeader(uint64_t leaderMemberID) {
 	vector<ddfsClusterMemberPaxos *>::iterator iter;
 	ddfsClusterMessagePaxos message = ddfsClusterMessagePaxos();
 
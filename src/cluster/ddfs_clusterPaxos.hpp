@@ -20,6 +20,9 @@
 #include "ddfs_clusterMessagesPaxos.hpp"
 // Harman #include "ddfs_clusterMemberPaxos.hpp"
 #include "ddfs_clusterPaxosInstance.hpp"
+#include "ddfs_clusterPlacement.hpp"
+#include "../network/ddfs_network.hpp"
+#include "../network/ddfs_tcpAcceptor.hpp"
 #include "../global/ddfs_status.hpp"
 
 using namespace std;
@@ -58,6 +61,18 @@ private:
     ddfsClusterPaxosInstance *leaderPaxosInstance;
     int64_t internalRoundNumber;
 
+    /* Network used to reach the members of this cluster */
+    DDFS_NETWORK_TYPE clusterNetworkType;
+
+    /* Where the local node accepts TCP connections. A port in the local
+     * host name "a.b.c.d:port" takes the place of the configured one. */
+    ddfsTcpListenConfig clusterListenConfig;
+    /* Applied to every TCP connection with the members */
+    ddfsTcpSocketOptions clusterSocketOptions;
+
+    /* Chunk placement, follows addMember and removeMember */
+    ddfsClusterPlacement clusterPlacement;
+
 public:
 	ddfsStatus init();
     /* All the cluster Members including the local Node */
@@ -84,6 +99,9 @@ public:
 	void asyncEventHandling(void *buffer, int bufferCount);
 	ddfsStatus processMessage (ddfsClusterMemberPaxos *member, ddfsClusterMessage *message);
 	ddfsStatus addMember(string addHostName);
+	/* Reach this member through networkType instead of the cluster default.
+	 * Eg. DDFS_NETWORK_SHM for a node running on the same host. */
+	ddfsStatus addMember(string addHostName, DDFS_NETWORK_TYPE networkType);
 	ddfsStatus addMembers();    /* Does nothing at this point */
 	ddfsStatus removeMember(string removeHostName);
 	ddfsStatus removeMembers(); /* Does nothing at this point */
@@ -93,11 +111,26 @@ public:
 	ddfsClusterMemberPaxos* getLeader();
 	ddfsClusterMemberPaxos* getMemberByID();
 
+	const ddfsTcpListenConfig &getListenConfig() {
+		return clusterListenConfig;
+	}
+
+	const ddfsTcpSocketOptions &getSocketOptions() {
+		return clusterSocketOptions;
+	}
+
+	/* Members join with DDFS_PLACEMENT_DEFAULT_CAPACITY, setCapacity() corrects it */
+	ddfsClusterPlacement &getPlacement() {
+		return clusterPlacement;
+	}
+
 public:
-	ddfsClusterPaxos(string localHostName);
+	ddfsClusterPaxos(string localHostName, DDFS_NETWORK_TYPE networkType = DDFS_NETWORK_TCP,
+					const ddfsTcpListenConfig &listenConfig = ddfsTcpListenConfig(),
+					const ddfsTcpSocketOptions &socketOptions = ddfsTcpSocketOptions());
 	~ddfsClusterPaxos();
 	static const int s_clusterIDInvalid = -1;
-	void setLeader(int leaderMemberID);
+	void setLeader(uint64_t leaderMemberID);
 }; // class end
 
 #endif /* Ending DDFS_CLUSTER_PAXOS_H */
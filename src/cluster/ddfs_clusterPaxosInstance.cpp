@@ -26,7 +26,7 @@ ddfsLogger &global_logger_cpi = ddfsLogger::getInstance();
 
 ddfsClusterPaxosInstance::ddfsClusterPaxosInstance () {
     global_logger_cpi << ddfsLogger::LOG_WARNING << "ddfsClusterPaxosInstance: Constructor Enter.\n";
-	internalProposalNumber = -1;
+	internalProposalNumber = 0;
     state = s_paxosState_NONE;
     quorum = 0;
 
@@ -43,7 +43,7 @@ ddfsClusterPaxosInstance::ddfsClusterPaxosInstance () {
 ddfsClusterPaxosInstance::~ddfsClusterPaxosInstance () {}
 
 ddfsStatus ddfsClusterPaxosInstance::execute (uint64_t roundNumber, uint64_t proposalNumber,
-                    uint64_t value, vector<ddfsClusterMemberPaxos *>& allMembers, int *consensusValue)
+                    uint64_t value, vector<ddfsClusterMemberPaxos *>& allMembers, uint64_t *consensusValue)
 {
     vector<ddfsClusterMemberPaxos *> participatingMembers;
 	vector<ddfsClusterMemberPaxos *>::iterator clusterMemberIter;
@@ -143,6 +143,13 @@ ddfsStatus ddfsClusterPaxosInstance::execute (uint64_t roundNumber, uint64_t pro
         global_logger_cpi << ddfsLogger::LOG_INFO
             << "Paxos :: Prepare :: " << internalProposalNumber << "\n";
 
+        /* Local Node is accepting this Paxos Proposal. Done before sending,
+         * the promises can come back before the send loop is over. */
+        incrementPromiseCount();
+        setLastPromised(internalProposalNumber);
+
+        state = s_paxosState_PREPARE;
+
         message.clearBuffer();
         message.addMessage(roundNumber, CLUSTER_MESSAGE_LE_TYPE_PREPARE, internalProposalNumber, 0, 0);
    
@@ -159,11 +166,6 @@ ddfsStatus ddfsClusterPaxosInstance::execute (uint64_t roundNumber, uint64_t pro
 			}
 		}
 
-        /* Local Node is accepting this Paxos Proposal */
-        incrementPromiseCount();
-        setLastPromised(internalProposalNumber);
-
-        state = s_paxosState_PREPARE;
 
 		/*  Wait for the Promise response from Quorum */
 		sleep(s_timeout);
@@ -199,6 +201,21 @@ ddfsStatus ddfsClusterPaxosInstance::execute (uint64_t roundNumber, uint64_t pro
         message.clearBuffer();
         message.addMessage(roundNumber, CLUSTER_MESSAGE_LE_ACCEPT_REQUESTED, internalProposalNumber, getLastAcceptedProposalNumber(), getLastAcceptedValue());
 
+        /* Local Node accepts first, the Accepted replies are matched
+         * against the last accepted proposal number. */
+        state = s_paxosState_ACCEPT_REQUESTED;
+
+        incrementAcceptedCount();
+
+        if(getLastAcceptedProposalNumber() < internalProposalNumber) {
+            global_logger_cpi << ddfsLogger::LOG_INFO << "ddfsClusterPaxosInstance :: Setting the last accepted proposal number to "
+                                << internalProposalNumber << "\n";
+            setLastAcceptedProposalNumber(internalProposalNumber);
+        }
+
+        if(getLastAcceptedValue() == 0)
+            setLastAcceptedValue(value);
+
 		/* Send the accept request to the nodes */
 		/* TODO: Should only send the accept request to the set of nodes that responded 
 		 * positively to the prepare request.
@@ -215,18 +232,6 @@ ddfsStatus ddfsClusterPaxosInstance::execute (uint64_t roundNumber, uint64_t pro
 		    }
         }
 		
-        state = s_paxosState_ACCEPT_REQUESTED;
-
-        incrementAcceptedCount();
-
-        if(getLastAcceptedProposalNumber() < internalProposalNumber) {
-            global_logger_cpi << ddfsLogger::LOG_INFO << "ddfsClusterPaxosInstance :: Setting the last accepted proposal number to "
-                                << internalProposalNumber << "\n";
-            setLastAcceptedProposalNumber(internalProposalNumber);
-        }
-
-        if(getLastAcceptedValue() == 0)
-            setLastAcceptedValue(value);
 
 		/*  Wait for the Accept response from Quorum */
 		sleep(s_timeout);
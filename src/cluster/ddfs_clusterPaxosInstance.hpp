@@ -21,6 +21,7 @@
 #define DDFS_CLUSTER_PAXOS_INSTANCE_H
 
 #include <vector>
+#include <atomic>
 
 #include "ddfs_clusterMessagesPaxos.hpp"
 #include "../global/ddfs_status.hpp"
@@ -60,7 +61,7 @@ class ddfsClusterPaxosInstance
 		~ddfsClusterPaxosInstance ();                            /* destructor */    
 
 		/* ====================  ACCESSORS     ======================================= */
-		ddfsStatus execute(uint64_t roundNumber, uint64_t proposalNumber, uint64_t value, vector <ddfsClusterMemberPaxos *>& allMembers, int *consesusValue);
+		ddfsStatus execute(uint64_t roundNumber, uint64_t proposalNumber, uint64_t value, vector <ddfsClusterMemberPaxos *>& allMembers, uint64_t *consesusValue);
 		//ddfsStatus executeAsync(uint64_t proposalNumber, vector <ddfsClusterMemberPaxos *>& participatingMembers, ddfsClusterPaxos& cluster);
 		/* ====================  MUTATORS      ======================================= */
 		void abandon();
@@ -89,14 +90,14 @@ class ddfsClusterPaxosInstance
             }
         }
 
-		int getLastPromised() { return lastPromised; }
-		void setLastPromised(int newV) { lastPromised = newV; }
+		uint64_t getLastPromised() { return lastPromised; }
+		void setLastPromised(uint64_t newV) { lastPromised = newV; }
 
-		int getLastAcceptedProposalNumber() { return lastAcceptedProposalNumber; }
-		void setLastAcceptedProposalNumber(int newV) { lastAcceptedProposalNumber = newV; }
+		uint64_t getLastAcceptedProposalNumber() { return lastAcceptedProposalNumber; }
+		void setLastAcceptedProposalNumber(uint64_t newV) { lastAcceptedProposalNumber = newV; }
 
-		int getLastAcceptedValue() { return lastAcceptedValue; }
-		void setLastAcceptedValue(int newV) { lastAcceptedValue = newV; }
+		uint64_t getLastAcceptedValue() { return lastAcceptedValue; }
+		void setLastAcceptedValue(uint64_t newV) { lastAcceptedValue = newV; }
 
 		void incrementPromiseCount() { promisesRecieved++; }
 		int getPromiseCount() { return promisesRecieved; }
@@ -120,11 +121,12 @@ class ddfsClusterPaxosInstance
 		static const unsigned int s_quorum = 2; // This is a factor value. 2 means totalParticipatingMembers/2. So, half of the all members.
 
 		/* ====================  DATA MEMBERS  ======================================= */
-		int internalProposalNumber;
+		uint64_t internalProposalNumber;
         paxosState state;
         int quorum;
-        int promisesRecieved;
-        int acceptedRecieved;
+        /* Replies arrive on the network threads of the members */
+        std::atomic<int> promisesRecieved;
+        std::atomic<int> acceptedRecieved;
 //		list <ddfsClusterMemberPaxos>& participatingMembers;
 		uint64_t lastPromised;
 		uint64_t lastAcceptedProposalNumber;
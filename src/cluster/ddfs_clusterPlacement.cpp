@@ -0,0 +1,163 @@
+/*
+ * @file ddfs_clusterPlacement.cpp
+ *
+ * @brief Placement of chunks on cluster members, consistent hashing.
+ *
+ * @author Harman Patial <harman.patial@gmail.com>
+ *
+ */
+
+#include "ddfs_clusterPlacement.hpp"
+#include "../logger/ddfs_fileLogger.hpp"
+
+using namespace std;
+
+ddfsLogger &global_logger_cpl = ddfsLogger::getInstance();
+
+ddfsClusterPlacement::ddfsClusterPlacement(uint64_t perPoint) :
+                    capacityPerPoint(perPoint == 0 ? DDFS_PLACEMENT_CAPACITY_PER_POINT : perPoint) {
+}
+
+/* splitmix64 finalizer, spreads close values all over the ring */
+uint64_t ddfsClusterPlacement::mix(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xBF58476D1CE4E5B9ULL;
+    value ^= value >> 27;
+    value *= 0x94D049BB133111EBULL;
+    value ^= value >> 31;
+    return value;
+}
+
+int ddfsClusterPlacement::pointsFor(uint64_t capacity) {
+    uint64_t points = (capacity + capacityPerPoint / 2) / capacityPerPoint;
+
+    /* Even the smallest member takes some chunks */
+    if(points == 0)
+        return 1;
+    if(points > DDFS_PLACEMENT_MAX_POINTS)
+        return DDFS_PLACEMENT_MAX_POINTS;
+    return (int) points;
+}
+
+uint64_t ddfsClusterPlacement::pointPosition(const string &hostName, int index) {
+    /* FNV-1a of the host name, the same on every node */
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for(size_t i = 0; i < hostName.size(); i++) {
+        hash ^= (uint8_t) hostName[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return mix(hash + mix((uint64_t) index + 1));
+}
+
+void ddfsClusterPlacement::insertPoints(const string &hostName, int from, int to) {
+    for(int i = from; i < to; i++) {
+        /* Another member on the same position keeps it, one point less for us */
+        ring.insert(make_pair(pointPosition(hostName, i), hostName));
+    }
+}
+
+void ddfsClusterPlacement::erasePoints(const string &hostName, int from, int to) {
+    for(int i = from; i < to; i++) {
+        map<uint64_t, string>::iterator iter = ring.find(pointPosition(hostName, i));
+        if(iter != ring.end() && iter->second == hostName)
+            ring.erase(iter);
+    }
+}
+
+ddfsStatus ddfsClusterPlacement::addMember(const string &hostName, uint64_t capacity) {
+    std::lock_guard<std::mutex> guard(placementLock);
+
+    if(members.find(hostName) != members.end())
+        return (ddfsStatus(DDFS_CLUSTER_ALREADY_MEMBER));
+
+    int points = pointsFor(capacity);
+    insertPoints(hostName, 0, points);
+    members[hostName] = points;
+
+    global_logger_cpl << ddfsLogger::LOG_INFO << "PLACEMENT:: Added " << hostName
+                << " with " << points << " points, ring has " << ring.size() << ".\n";
+
+    return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsClusterPlacement::removeMember(const string &hostName) {
+    std::lock_guard<std::mutex> guard(placementLock);
+
+    unordered_map<string, int>::iterator iter = members.find(hostName);
+    if(iter == members.end())
+        return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+    erasePoints(hostName, 0, iter->second);
+    members.erase(iter);
+
+    global_logger_cpl << ddfsLogger::LOG_INFO << "PLACEMENT:: Removed " << hostName
+                << ", ring has " << ring.size() << ".\n";
+
+    return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsClusterPlacement::setCapacity(const string &hostName, uint64_t capacity) {
+    std::lock_guard<std::mutex> guard(placementLock);
+
+    unordered_map<string, int>::iterator iter = members.find(hostName);
+    if(iter == members.end())
+        return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+    int points = pointsFor(capacity);
+
+    /* Only the points past the smaller of the two counts change hands */
+    if(points > iter->second)
+        insertPoints(hostName, iter->second, points);
+    else
+        erasePoints(hostName, points, iter->second);
+    iter->second = points;
+
+    return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsClusterPlacement::getReplicas(uint64_t chunkID, int count, vector<string> *replicas) {
+    std::lock_guard<std::mutex> guard(placementLock);
+
+    replicas->clear();
+    if(ring.empty() || count <= 0)
+        return (count <= 0 ? ddfsStatus(DDFS_OK) : ddfsStatus(DDFS_CLUSTER_INSUFFICIENT_NODES));
+
+    int wanted = count;
+    if(wanted > (int) members.size())
+        wanted = (int) members.size();
+
+    map<uint64_t, string>::iterator iter = ring.lower_bound(mix(chunkID));
+
+    /* Walk clockwise, skipping members already picked, once around at most */
+    for(size_t steps = 0; steps < ring.size() && (int) replicas->size() < wanted; steps++) {
+        if(iter == ring.end())
+            iter = ring.begin();
+
+        bool picked = false;
+        for(size_t i = 0; i < replicas->size(); i++)
+            picked = picked || ((*replicas)[i] == iter->second);
+        if(picked == false)
+            replicas->push_back(iter->second);
+
+        iter++;
+    }
+
+    if((int) replicas->size() < count)
+        return (ddfsStatus(DDFS_CLUSTER_INSUFFICIENT_NODES));
+
+    return (ddfsStatus(DDFS_OK));
+}
+
+int ddfsClusterPlacement::getMemberCount() {
+    std::lock_guard<std::mutex> guard(placementLock);
+    return (int) members.size();
+}
+
+int ddfsClusterPlacement::getPoints(const string &hostName) {
+    std::lock_guard<std::mutex> guard(placementLock);
+
+    unordered_map<string, int>::iterator iter = members.find(hostName);
+    if(iter == members.end())
+        return 0;
+    return iter->second;
+}
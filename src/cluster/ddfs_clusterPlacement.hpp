@@ -0,0 +1,118 @@
+/*
+ * @file ddfs_clusterPlacement.hpp
+ *
+ * @brief Placement of chunks on cluster members, consistent hashing.
+ *
+ * Every member owns points on a 64 bit hash ring, as many as its
+ * capacity is worth: one point per DDFS_PLACEMENT_CAPACITY_PER_POINT
+ * bytes. A chunk hashes onto the ring and its replicas are the owners
+ * of the points that follow it, clockwise, each member taken once. A
+ * member with twice the capacity owns twice the points and so gets
+ * twice the chunks.
+ *
+ * Membership changes touch the ring of that member only. Adding a
+ * member inserts its points, and the chunks that move are the ones
+ * that now land on them, about its share of the cluster. Removing it
+ * takes its points out again and only its chunks go elsewhere. A
+ * capacity change adds or takes away points at the end of the member's
+ * list, the rest stay where they are.
+ *
+ *   chunk ---hash--->  ... [B] [A] [B] [C] [A] ...
+ *                           ^   ^       ^
+ *                        primary second third
+ *
+ * @author Harman Patial <harman.patial@gmail.com>
+ *
+ */
+#ifndef DDFS_CLUSTER_PLACEMENT_H
+#define DDFS_CLUSTER_PLACEMENT_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <stdint.h>
+
+#include "../global/ddfs_status.hpp"
+
+using namespace std;
+
+/* Capacity behind one point of the ring */
+#define DDFS_PLACEMENT_CAPACITY_PER_POINT   (8ULL * 1024 * 1024 * 1024)
+/* Capacity of a member that did not say, 1TB */
+#define DDFS_PLACEMENT_DEFAULT_CAPACITY     (1024ULL * 1024 * 1024 * 1024)
+/* Bigger members are treated as this many points, 128TB */
+#define DDFS_PLACEMENT_MAX_POINTS           16384
+
+/*!
+ *  \class  ddfsClusterPlacement
+ *  \brief  Maps chunk IDs to the members holding their replicas.
+ *
+ *   Safe to use from several threads.
+ */
+class ddfsClusterPlacement {
+public:
+    ddfsClusterPlacement(uint64_t capacityPerPoint = DDFS_PLACEMENT_CAPACITY_PER_POINT);
+
+    /*
+     * @brief Put a member on the ring, weighted by capacity bytes.
+     *
+     * @return DDFS_OK                      Member placed
+     * @return DDFS_CLUSTER_ALREADY_MEMBER  Member is on the ring already
+     */
+    ddfsStatus addMember(const string &hostName, uint64_t capacity = DDFS_PLACEMENT_DEFAULT_CAPACITY);
+
+    /*
+     * @brief Take a member off the ring.
+     *
+     * @return DDFS_OK                      Member removed
+     * @return DDFS_GENERAL_PARAM_INVALID   Not a member
+     */
+    ddfsStatus removeMember(const string &hostName);
+
+    /*
+     * @brief Change the capacity of a member.
+     *
+     * @return DDFS_OK                      Points adjusted
+     * @return DDFS_GENERAL_PARAM_INVALID   Not a member
+     */
+    ddfsStatus setCapacity(const string &hostName, uint64_t capacity);
+
+    /*
+     * @brief Members holding the replicas of a chunk, the primary first.
+     *
+     * @return DDFS_OK                          replicas holds count members
+     * @return DDFS_CLUSTER_INSUFFICIENT_NODES  Fewer members than count,
+     *                                          replicas holds all of them
+     */
+    ddfsStatus getReplicas(uint64_t chunkID, int count, vector<string> *replicas);
+
+    int getMemberCount();
+
+    /* Points of a member on the ring, 0 if it is not a member */
+    int getPoints(const string &hostName);
+
+private:
+    /* Points a member of capacity bytes owns */
+    int pointsFor(uint64_t capacity);
+    /* Position of point index of a member */
+    uint64_t pointPosition(const string &hostName, int index);
+    void insertPoints(const string &hostName, int from, int to);
+    void erasePoints(const string &hostName, int from, int to);
+
+    static uint64_t mix(uint64_t value);
+
+    uint64_t capacityPerPoint;
+
+    /* Position on the ring to the member owning it */
+    map<uint64_t, string> ring;
+    /* Member to the number of points it owns */
+    unordered_map<string, int> members;
+    std::mutex placementLock;
+
+    ddfsClusterPlacement(ddfsClusterPlacement const&);     // Don't Implement
+    void operator=(ddfsClusterPlacement const&);           // Don't implement
+};
+
+#endif /* Ending DDFS_CLUSTER_PLACEMENT_H */
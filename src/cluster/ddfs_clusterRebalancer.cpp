@@ -0,0 +1,270 @@
+/*
+ * @file ddfs_clusterRebalancer.cpp
+ *
+ * @brief Restores the replicas of chunks after members go away.
+ *
+ * @author Harman Patial <harman.patial@gmail.com>
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+
+#include "ddfs_clusterRebalancer.hpp"
+#include "ddfs_clusterMemberPaxos.hpp"
+#include "../logger/ddfs_fileLogger.hpp"
+
+using namespace std;
+
+ddfsLogger &global_logger_crb = ddfsLogger::getInstance();
+
+ddfsClusterRebalancer::ddfsClusterRebalancer(ddfsClusterPaxos *c, ddfsChunkCopier cp, ddfsChunkDropper d,
+                    int factor, uint64_t bytesPerSecond) :
+                    cluster(c), copier(cp), dropper(d), replicationFactor(factor),
+                    bucket(bytesPerSecond, DDFS_REBALANCE_BURST), running(false),
+                    scanRequested(true), idle(false), lostChunks(0), copiedBytes(0),
+                    stopWorker(false) {
+    worker = std::thread(&ddfsClusterRebalancer::workerRoutine, this);
+}
+
+ddfsClusterRebalancer::~ddfsClusterRebalancer() {
+    {
+        std::lock_guard<std::mutex> guard(rebalanceLock);
+        stopWorker = true;
+    }
+    workChanged.notify_all();
+    worker.join();
+}
+
+void ddfsClusterRebalancer::recordChunk(uint64_t chunkID, uint64_t size, const vector<string> &holders) {
+    std::lock_guard<std::mutex> guard(rebalanceLock);
+    chunkRecord &record = chunks[chunkID];
+    record.size = size;
+    record.holders = holders;
+}
+
+void ddfsClusterRebalancer::forgetChunk(uint64_t chunkID) {
+    std::lock_guard<std::mutex> guard(rebalanceLock);
+    chunks.erase(chunkID);
+}
+
+void ddfsClusterRebalancer::kick() {
+    {
+        std::lock_guard<std::mutex> guard(rebalanceLock);
+        scanRequested = true;
+        idle = false;
+    }
+    workChanged.notify_all();
+}
+
+void ddfsClusterRebalancer::setRate(uint64_t bytesPerSecond) {
+    bucket.setRate(bytesPerSecond);
+}
+
+int ddfsClusterRebalancer::getPendingTasks() {
+    std::lock_guard<std::mutex> guard(rebalanceLock);
+    return (int) tasks.size() + (running ? 1 : 0);
+}
+
+int ddfsClusterRebalancer::getLostChunks() {
+    std::lock_guard<std::mutex> guard(rebalanceLock);
+    return lostChunks;
+}
+
+uint64_t ddfsClusterRebalancer::getCopiedBytes() {
+    std::lock_guard<std::mutex> guard(rebalanceLock);
+    return copiedBytes;
+}
+
+bool ddfsClusterRebalancer::waitIdle(int timeoutMs) {
+    std::unique_lock<std::mutex> guard(rebalanceLock);
+
+    /* Whatever changed before this call is looked at again */
+    scanRequested = true;
+    idle = false;
+    workChanged.notify_all();
+
+    return workChanged.wait_for(guard, chrono::milliseconds(timeoutMs),
+                    [this] { return idle || stopWorker; }) && idle;
+}
+
+set<string> ddfsClusterRebalancer::liveMembers() {
+    set<string> live;
+    ddfsClusterPlacement &placement = cluster->getPlacement();
+
+    for(size_t i = 0; i < cluster->clusterMembers.size(); i++) {
+        ddfsClusterMemberPaxos *member = cluster->clusterMembers[i];
+        if(member->isDead())
+            continue;
+        /* Removed members are off the ring already */
+        if(placement.getPoints(member->getHostName()) == 0)
+            continue;
+        live.insert(member->getHostName());
+    }
+
+    return live;
+}
+
+vector<string> ddfsClusterRebalancer::targetsFor(uint64_t chunkID, const set<string> &live) {
+    ddfsClusterPlacement &placement = cluster->getPlacement();
+    vector<string> candidates, targets;
+
+    /* Dead members are still on the ring, walk past as many of them */
+    int skipped = placement.getMemberCount() - (int) live.size();
+    if(skipped < 0)
+        skipped = 0;
+    placement.getReplicas(chunkID, replicationFactor + skipped, &candidates);
+
+    for(size_t i = 0; i < candidates.size() && (int) targets.size() < replicationFactor; i++) {
+        if(live.count(candidates[i]))
+            targets.push_back(candidates[i]);
+    }
+
+    return targets;
+}
+
+void ddfsClusterRebalancer::trimMisplaced(uint64_t chunkID, chunkRecord &record, const set<string> &live) {
+    vector<string> targets = targetsFor(chunkID, live);
+
+    for(size_t i = 0; i < targets.size(); i++) {
+        if(find(record.holders.begin(), record.holders.end(), targets[i]) == record.holders.end())
+            return;
+    }
+
+    /* Every target has its copy, the live ones elsewhere are surplus */
+    vector<string>::iterator iter = record.holders.begin();
+    while(iter != record.holders.end()) {
+        if(live.count(*iter) && find(targets.begin(), targets.end(), *iter) == targets.end()) {
+            drops.push_back(make_pair(chunkID, *iter));
+            iter = record.holders.erase(iter);
+        } else {
+            iter++;
+        }
+    }
+}
+
+void ddfsClusterRebalancer::scan() {
+    set<string> live = liveMembers();
+    int underReplicated = 0;
+
+    tasks.clear();
+    lostChunks = 0;
+
+    for(unordered_map<uint64_t, chunkRecord>::iterator iter = chunks.begin(); iter != chunks.end(); iter++) {
+        chunkRecord &record = iter->second;
+        vector<string> survivors;
+
+        for(size_t i = 0; i < record.holders.size(); i++) {
+            if(live.count(record.holders[i]))
+                survivors.push_back(record.holders[i]);
+        }
+
+        if(survivors.empty()) {
+            lostChunks++;
+            continue;
+        }
+
+        vector<string> targets = targetsFor(iter->first, live);
+        bool missing = false;
+
+        for(size_t i = 0; i < targets.size(); i++) {
+            if(find(survivors.begin(), survivors.end(), targets[i]) != survivors.end())
+                continue;
+
+            copyTask task;
+            task.survivors = (int) survivors.size();
+            task.chunkID = iter->first;
+            task.source = survivors[0];
+            task.target = targets[i];
+            tasks.insert(task);
+            missing = true;
+        }
+
+        if(missing == false)
+            trimMisplaced(iter->first, record, live);
+        else if((int) survivors.size() < replicationFactor)
+            underReplicated++;
+    }
+
+    if(lostChunks > 0 || tasks.empty() == false) {
+        global_logger_crb << ddfsLogger::LOG_INFO << "REBALANCE:: " << chunks.size() << " chunks, "
+                    << underReplicated << " under-replicated, " << lostChunks << " lost, "
+                    << tasks.size() << " copies to make.\n";
+    }
+}
+
+void ddfsClusterRebalancer::workerRoutine() {
+    std::unique_lock<std::mutex> guard(rebalanceLock);
+    chrono::steady_clock::time_point nextScan = chrono::steady_clock::now();
+
+    while(stopWorker == false) {
+        if(scanRequested || chrono::steady_clock::now() >= nextScan) {
+            scanRequested = false;
+            scan();
+            nextScan = chrono::steady_clock::now() + chrono::milliseconds((int) s_scanIntervalMs);
+            idle = tasks.empty() && drops.empty();
+            workChanged.notify_all();
+        }
+
+        if(drops.empty() == false) {
+            pair<uint64_t, string> drop = drops.front();
+            drops.pop_front();
+
+            guard.unlock();
+            ddfsStatus status(DDFS_OK);
+            if(dropper)
+                status = dropper(drop.first, drop.second);
+            guard.lock();
+
+            if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+                global_logger_crb << ddfsLogger::LOG_WARNING << "REBALANCE:: Dropping chunk " << drop.first
+                            << " from " << drop.second << " failed. " << status.statusToString() << "\n";
+            continue;
+        }
+
+        if(tasks.empty()) {
+            workChanged.wait_until(guard, nextScan, [this] { return stopWorker || scanRequested; });
+            continue;
+        }
+
+        copyTask task = *tasks.begin();
+        tasks.erase(tasks.begin());
+
+        unordered_map<uint64_t, chunkRecord>::iterator iter = chunks.find(task.chunkID);
+        if(iter == chunks.end())
+            continue;
+        uint64_t size = iter->second.size;
+
+        running = true;
+        guard.unlock();
+
+        bucket.acquire(size);
+        ddfsStatus status = copier(task.chunkID, size, task.source, task.target);
+
+        guard.lock();
+        running = false;
+
+        if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+            /* The next scan finds the copy missing again */
+            global_logger_crb << ddfsLogger::LOG_WARNING << "REBALANCE:: Copying chunk " << task.chunkID
+                        << " from " << task.source << " to " << task.target << " failed. "
+                        << status.statusToString() << "\n";
+            continue;
+        }
+
+        copiedBytes += size;
+
+        /* The chunk may have been forgotten or recorded anew meanwhile */
+        iter = chunks.find(task.chunkID);
+        if(iter != chunks.end()) {
+            chunkRecord &record = iter->second;
+            if(find(record.holders.begin(), record.holders.end(), task.target) == record.holders.end())
+                record.holders.push_back(task.target);
+            trimMisplaced(task.chunkID, record, liveMembers());
+        }
+
+        /* Make sure nothing was missed before calling it idle */
+        if(tasks.empty())
+            scanRequested = true;
+    }
+}
@@ -0,0 +1,158 @@
+/*
+ * @file ddfs_clusterRebalancer.hpp
+ *
+ * @brief Restores the replicas of chunks after members go away.
+ *
+ * The rebalancer knows which members hold every chunk. It compares that
+ * with where ddfsClusterPlacement wants the chunk, counting only members
+ * that are still in the cluster and not dead:
+ *
+ *   under-replicated   Fewer live copies than the replication factor.
+ *   misplaced          Enough copies, some on members the chunk does
+ *                      not belong on any more, eg. after a member joined.
+ *
+ * Every missing copy becomes a copy task from a live holder to the
+ * member that should have it. Tasks run one at a time on a background
+ * thread, the chunks with the fewest live copies first: a chunk down to
+ * its last copy is one failure away from being lost, a misplaced one
+ * is not at risk at all. Copies of misplaced chunks are dropped from the
+ * old holder once the chunk is fully where it belongs.
+ *
+ * Copies go through a token bucket, so recovery takes a bounded share
+ * of the bandwidth and foreground I/O keeps its latency. The rate can
+ * be raised while chunks are at risk and lowered again later.
+ *
+ * The cluster is rescanned every s_scanIntervalMs, and at once after
+ * kick(). Moving the bytes is up to the copier, there is no chunk store
+ * protocol between the members yet.
+ *
+ * @author Harman Patial <harman.patial@gmail.com>
+ *
+ */
+#ifndef DDFS_CLUSTER_REBALANCER_H
+#define DDFS_CLUSTER_REBALANCER_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <stdint.h>
+
+#include "ddfs_clusterPaxos.hpp"
+#include "ddfs_clusterReplication.hpp"
+#include "../global/ddfs_tokenBucket.hpp"
+#include "../global/ddfs_status.hpp"
+
+using namespace std;
+
+/* Recovery bandwidth unless set otherwise, 64MB/s */
+#define DDFS_REBALANCE_DEFAULT_RATE     (64ULL * 1024 * 1024)
+/* Bytes the rebalancer may send at once */
+#define DDFS_REBALANCE_BURST            (4ULL * 1024 * 1024)
+
+/* Copy a chunk of size bytes from source to target */
+typedef std::function<ddfsStatus(uint64_t chunkID, uint64_t size,
+                    const string &source, const string &target)> ddfsChunkCopier;
+/* Delete the copy of a chunk on holder */
+typedef std::function<ddfsStatus(uint64_t chunkID, const string &holder)> ddfsChunkDropper;
+
+/*!
+ *  \class  ddfsClusterRebalancer
+ *  \brief  Background re-replication of under-replicated and misplaced chunks.
+ */
+class ddfsClusterRebalancer {
+public:
+    ddfsClusterRebalancer(ddfsClusterPaxos *cluster, ddfsChunkCopier copier,
+                    ddfsChunkDropper dropper = ddfsChunkDropper(),
+                    int replicationFactor = DDFS_REPLICATION_MAX_CHAIN,
+                    uint64_t bytesPerSecond = DDFS_REBALANCE_DEFAULT_RATE);
+    ~ddfsClusterRebalancer();
+
+    /* Members holding a chunk right now, eg. after it was written */
+    void recordChunk(uint64_t chunkID, uint64_t size, const vector<string> &holders);
+    void forgetChunk(uint64_t chunkID);
+
+    /* Rescan now, eg. after a member was removed */
+    void kick();
+
+    void setRate(uint64_t bytesPerSecond);
+
+    /* Copy tasks queued or running */
+    int getPendingTasks();
+    /* Chunks without a single live copy at the last scan */
+    int getLostChunks();
+    uint64_t getCopiedBytes();
+
+    /*
+     * @brief Wait until a scan finds nothing left to do.
+     *
+     * @return true if that happened within timeoutMs
+     */
+    bool waitIdle(int timeoutMs);
+
+private:
+    static const int s_scanIntervalMs = 1000;
+
+    struct chunkRecord {
+        uint64_t size;
+        vector<string> holders;
+    };
+
+    struct copyTask {
+        /* Live copies at the time of the scan, fewest go first */
+        int survivors;
+        uint64_t chunkID;
+        string source;
+        string target;
+
+        bool operator<(const copyTask &other) const {
+            if(survivors != other.survivors)
+                return survivors < other.survivors;
+            if(chunkID != other.chunkID)
+                return chunkID < other.chunkID;
+            return target < other.target;
+        }
+    };
+
+    ddfsClusterPaxos *cluster;
+    ddfsChunkCopier copier;
+    ddfsChunkDropper dropper;
+    int replicationFactor;
+    ddfsTokenBucket bucket;
+
+    std::mutex rebalanceLock;
+    std::condition_variable workChanged;
+    unordered_map<uint64_t, chunkRecord> chunks;
+    /* Ordered by risk, the next task is the first one */
+    set<copyTask> tasks;
+    /* Copies to drop, chunk and holder */
+    deque<pair<uint64_t, string> > drops;
+    bool running;
+    bool scanRequested;
+    bool idle;
+    int lostChunks;
+    uint64_t copiedBytes;
+    bool stopWorker;
+    std::thread worker;
+
+    void workerRoutine();
+    /* Queue the tasks of every chunk. Called with rebalanceLock held */
+    void scan();
+    /* Members that are neither removed nor dead */
+    set<string> liveMembers();
+    /* Where a chunk should be, live members only */
+    vector<string> targetsFor(uint64_t chunkID, const set<string> &live);
+    /* Queue the copies outside the targets for dropping, once all
+     * targets have one. Called with rebalanceLock held */
+    void trimMisplaced(uint64_t chunkID, chunkRecord &record, const set<string> &live);
+
+    ddfsClusterRebalancer(ddfsClusterRebalancer const&);     // Don't Implement
+    void operator=(ddfsClusterRebalancer const&);            // Don't implement
+};
+
+#endif /* Ending DDFS_CLUSTER_REBALANCER_H */
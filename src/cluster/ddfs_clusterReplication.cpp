@@ -0,0 +1,442 @@
+/*
+ * @file ddfs_clusterReplication.cpp
+ *
+ * @brief Chain replication of file chunks.
+ *
+ * @author Harman Patial <harman.patial@gmail.com>
+ *
+ */
+
+#include <sstream>
+
+#include "ddfs_clusterReplication.hpp"
+#include "ddfs_clusterWire.hpp"
+#include "../logger/ddfs_fileLogger.hpp"
+
+using namespace std;
+
+ddfsLogger &global_logger_cr = ddfsLogger::getInstance();
+
+ddfsClusterReplication::ddfsClusterReplication(ddfsClusterPaxos *c, ddfsReplicaWriter w) :
+                    cluster(c), writer(w), nextRequestID(1), stopWorker(false) {
+    localHostName = cluster->getLocalNode()->getHostName();
+
+    for(unsigned int i = 0; i < cluster->clusterMembers.size(); i++) {
+        ddfsClusterMemberPaxos *member = cluster->clusterMembers[i];
+        if(member->isLocalNode())
+            continue;
+
+        member->setStreamHandler([this, member](uint64_t streamID, vector<uint8_t> &payload) {
+            receive(member, payload);
+        });
+    }
+
+    worker = std::thread(&ddfsClusterReplication::workerRoutine, this);
+}
+
+ddfsClusterReplication::~ddfsClusterReplication() {
+    for(unsigned int i = 0; i < cluster->clusterMembers.size(); i++) {
+        if(cluster->clusterMembers[i]->isLocalNode() == false)
+            cluster->clusterMembers[i]->setStreamHandler(ddfsClusterStreamHandler());
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(queueLock);
+        stopWorker = true;
+        queueChanged.notify_all();
+    }
+    worker.join();
+}
+
+ddfsStatus ddfsClusterReplication::replicate(const vector<string> &chain, uint64_t chunkID,
+                    const void *data, size_t size) {
+    if(chain.empty() || chain.size() > DDFS_REPLICATION_MAX_CHAIN)
+        return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+    /* The local node keeps its copy straight away, the rest goes out */
+    bool storeLocally = (chain[0] == localHostName);
+    vector<string> downstream(chain.begin() + (storeLocally ? 1 : 0), chain.end());
+    ddfsClusterMemberPaxos *target = NULL;
+
+    if(downstream.empty() == false) {
+        target = findMember(downstream[0]);
+        if(target == NULL) {
+            global_logger_cr << ddfsLogger::LOG_WARNING << "CR:: " << downstream[0]
+                        << " is not a member, can not replicate chunk " << chunkID << "\n";
+            return (ddfsStatus(DDFS_HOST_DOWN));
+        }
+        downstream.erase(downstream.begin());
+    }
+
+    uint64_t requestID;
+    {
+        std::lock_guard<std::mutex> guard(replicationLock);
+        requestID = nextRequestID++;
+        originEntry &entry = originEntries[requestID];
+        entry.done = false;
+        entry.status = DDFS_OK;
+    }
+
+    ddfsStatus status(DDFS_OK);
+    DDFS_STATUS localStatus = DDFS_OK;
+    const uint8_t *bytes = (const uint8_t *) data;
+    size_t offset = 0;
+    vector<uint8_t> payload;
+
+    do {
+        size_t packetSize = size - offset;
+        if(packetSize > DDFS_REPLICATION_PACKET_SIZE)
+            packetSize = DDFS_REPLICATION_PACKET_SIZE;
+
+        if(storeLocally && localStatus == DDFS_OK)
+            localStatus = statusCode(writer(chunkID, offset, bytes + offset, packetSize));
+
+        if(target != NULL) {
+            uint8_t flags = (offset + packetSize == size) ? s_flagLast : 0;
+            encodeData(payload, localHostName, requestID, chunkID, offset, size, flags,
+                        downstream, bytes + offset, packetSize);
+            status = target->sendStream(&payload[0], payload.size(), NULL, DDFS_TRAFFIC_REPLICATION);
+            if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+                break;
+        }
+
+        offset += packetSize;
+    } while(offset < size);
+
+    std::unique_lock<std::mutex> guard(replicationLock);
+
+    if(target != NULL && status.compareStatus(ddfsStatus(DDFS_OK)) == true) {
+        bool acknowledged = ackArrived.wait_for(guard, std::chrono::milliseconds((int) s_ackTimeoutMs),
+                    [this, requestID] { return originEntries[requestID].done; });
+
+        if(acknowledged == false)
+            status = ddfsStatus(DDFS_NETWORK_RETRY);
+        else
+            status = ddfsStatus(originEntries[requestID].status);
+    }
+    originEntries.erase(requestID);
+
+    if(localStatus != DDFS_OK)
+        status = ddfsStatus(localStatus);
+
+    if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+        global_logger_cr << ddfsLogger::LOG_WARNING << "CR:: Replicating chunk " << chunkID
+                    << " failed. " << status.statusToString() << "\n";
+    }
+
+    return status;
+}
+
+void ddfsClusterReplication::receive(ddfsClusterMemberPaxos *from, vector<uint8_t> &payload) {
+    replicationPacket packet;
+
+    if(decode(payload, &packet) == false) {
+        global_logger_cr << ddfsLogger::LOG_WARNING << "CR:: Dropping a malformed packet from "
+                    << from->getHostName() << "\n";
+        return;
+    }
+
+    if(packet.kind == REPLICATION_DATA)
+        receiveData(from, packet);
+    else
+        receiveAck(packet);
+}
+
+void ddfsClusterReplication::receiveData(ddfsClusterMemberPaxos *from, replicationPacket &packet) {
+    string key = entryKey(packet.origin, packet.requestID);
+    bool last = (packet.flags & s_flagLast) != 0;
+
+    DDFS_STATUS writeStatus = statusCode(writer(packet.chunkID, packet.offset, packet.data, packet.dataSize));
+
+    ddfsClusterMemberPaxos *next = NULL;
+    if(packet.chain.empty() == false)
+        next = findMember(packet.chain[0]);
+
+    bool forward = false, finished = false;
+    {
+        std::lock_guard<std::mutex> guard(replicationLock);
+
+        if(packet.offset == 0) {
+            /* Chunks whose acknowledgement never came */
+            chrono::steady_clock::time_point now = chrono::steady_clock::now();
+            for(unordered_map<string, chainEntry>::iterator it = chainEntries.begin(); it != chainEntries.end();) {
+                if(now - it->second.started > chrono::milliseconds((int) s_entryTimeoutMs))
+                    it = chainEntries.erase(it);
+                else
+                    ++it;
+            }
+
+            chainEntry &entry = chainEntries[key];
+            entry.origin = packet.origin;
+            entry.requestID = packet.requestID;
+            entry.upstream = from;
+            entry.hasDownstream = (next != NULL);
+            entry.localStatus = (packet.chain.empty() || next != NULL) ? DDFS_OK : DDFS_HOST_DOWN;
+            entry.started = now;
+        }
+
+        unordered_map<string, chainEntry>::iterator entry = chainEntries.find(key);
+        if(entry == chainEntries.end()) {
+            /* Failed or timed out already, the sender has been told */
+            return;
+        }
+
+        if(writeStatus != DDFS_OK && entry->second.localStatus == DDFS_OK)
+            entry->second.localStatus = writeStatus;
+
+        forward = entry->second.hasDownstream;
+        finished = last && (forward == false);
+    }
+
+    if(forward) {
+        vector<uint8_t> payload;
+        vector<string> chain(packet.chain.begin() + 1, packet.chain.end());
+
+        encodeData(payload, packet.origin, packet.requestID, packet.chunkID, packet.offset,
+                    packet.chunkLength, packet.flags, chain, packet.data, packet.dataSize);
+        enqueue(next, payload, key, last);
+    }
+
+    /* Tail of the chain, or the chain broke here */
+    if(finished)
+        complete(key, DDFS_OK);
+}
+
+void ddfsClusterReplication::receiveAck(replicationPacket &packet) {
+    string key = entryKey(packet.origin, packet.requestID);
+    DDFS_STATUS status = (packet.status <= DDFS_FAILURE) ? (DDFS_STATUS) packet.status : DDFS_FAILURE;
+
+    {
+        std::lock_guard<std::mutex> guard(replicationLock);
+
+        /* This node may be in the chain of its own chunk, that entry goes first */
+        if(chainEntries.count(key) == 0) {
+            if(packet.origin == localHostName) {
+                unordered_map<uint64_t, originEntry>::iterator entry = originEntries.find(packet.requestID);
+                if(entry != originEntries.end()) {
+                    entry->second.done = true;
+                    entry->second.status = status;
+                    ackArrived.notify_all();
+                }
+            }
+            return;
+        }
+    }
+
+    complete(key, status);
+}
+
+void ddfsClusterReplication::complete(string key, DDFS_STATUS status) {
+    ddfsClusterMemberPaxos *upstream;
+    string origin;
+    uint64_t requestID;
+
+    {
+        std::lock_guard<std::mutex> guard(replicationLock);
+
+        unordered_map<string, chainEntry>::iterator entry = chainEntries.find(key);
+        if(entry == chainEntries.end())
+            return;
+
+        /* Our own copy failing counts before anything downstream */
+        if(entry->second.localStatus != DDFS_OK)
+            status = entry->second.localStatus;
+
+        upstream = entry->second.upstream;
+        origin = entry->second.origin;
+        requestID = entry->second.requestID;
+        chainEntries.erase(entry);
+    }
+
+    vector<uint8_t> payload;
+    encodeAck(payload, origin, requestID, status);
+    enqueue(upstream, payload, "", false);
+}
+
+void ddfsClusterReplication::downstreamFailed(string key, DDFS_STATUS status, bool last) {
+    {
+        std::lock_guard<std::mutex> guard(replicationLock);
+
+        unordered_map<string, chainEntry>::iterator entry = chainEntries.find(key);
+        if(entry == chainEntries.end())
+            return;
+
+        /* The rest of the chunk stays here, the next packet finishes it */
+        entry->second.hasDownstream = false;
+        if(entry->second.localStatus == DDFS_OK)
+            entry->second.localStatus = status;
+    }
+
+    if(last)
+        complete(key, status);
+}
+
+void ddfsClusterReplication::enqueue(ddfsClusterMemberPaxos *member, vector<uint8_t> &payload,
+                    string key, bool last) {
+    std::lock_guard<std::mutex> guard(queueLock);
+
+    outgoing.push_back(outgoingPacket());
+    outgoingPacket &packet = outgoing.back();
+    packet.member = member;
+    packet.payload.swap(payload);
+    packet.key = key;
+    packet.last = last;
+
+    queueChanged.notify_one();
+}
+
+void ddfsClusterReplication::workerRoutine() {
+    while(true) {
+        outgoingPacket packet;
+
+        {
+            std::unique_lock<std::mutex> guard(queueLock);
+            queueChanged.wait(guard, [this] { return (stopWorker || outgoing.empty() == false); });
+
+            if(outgoing.empty())
+                return;
+
+            packet.member = outgoing.front().member;
+            packet.payload.swap(outgoing.front().payload);
+            packet.key = outgoing.front().key;
+            packet.last = outgoing.front().last;
+            outgoing.pop_front();
+        }
+
+        ddfsStatus status = packet.member->sendStream(&packet.payload[0], packet.payload.size(),
+                    NULL, DDFS_TRAFFIC_REPLICATION);
+        if(status.compareStatus(ddfsStatus(DDFS_OK)) == true)
+            continue;
+
+        global_logger_cr << ddfsLogger::LOG_WARNING << "CR:: Unable to send to "
+                    << packet.member->getHostName() << ". " << status.statusToString() << "\n";
+
+        if(packet.key.empty() == false)
+            downstreamFailed(packet.key, statusCode(status), packet.last);
+    }
+}
+
+ddfsClusterMemberPaxos *ddfsClusterReplication::findMember(const string &hostName) {
+    for(unsigned int i = 0; i < cluster->clusterMembers.size(); i++) {
+        ddfsClusterMemberPaxos *member = cluster->clusterMembers[i];
+        if(member->isLocalNode() == false && member->getHostName() == hostName)
+            return member;
+    }
+    return NULL;
+}
+
+string ddfsClusterReplication::entryKey(const string &origin, uint64_t requestID) {
+    ostringstream key;
+    key << origin << "/" << requestID;
+    return key.str();
+}
+
+static void appendVarint(vector<uint8_t> &payload, uint64_t value) {
+    uint8_t encoded[10];
+    size_t length = ddfsClusterWire::putVarint(encoded, value);
+    payload.insert(payload.end(), encoded, encoded + length);
+}
+
+static void appendString(vector<uint8_t> &payload, const string &value) {
+    appendVarint(payload, value.size());
+    payload.insert(payload.end(), value.begin(), value.end());
+}
+
+void ddfsClusterReplication::encodeData(vector<uint8_t> &payload, const string &origin, uint64_t requestID,
+                    uint64_t chunkID, uint64_t offset, uint64_t chunkLength, uint8_t flags,
+                    const vector<string> &chain, const uint8_t *data, size_t size) {
+    payload.clear();
+    payload.reserve(size + 64 + origin.size() + chain.size() * 32);
+
+    payload.push_back(REPLICATION_DATA);
+    appendString(payload, origin);
+    appendVarint(payload, requestID);
+    appendVarint(payload, chunkID);
+    appendVarint(payload, offset);
+    appendVarint(payload, chunkLength);
+    payload.push_back(flags);
+    appendVarint(payload, chain.size());
+    for(unsigned int i = 0; i < chain.size(); i++)
+        appendString(payload, chain[i]);
+    payload.insert(payload.end(), data, data + size);
+}
+
+void ddfsClusterReplication::encodeAck(vector<uint8_t> &payload, const string &origin, uint64_t requestID,
+                    DDFS_STATUS status) {
+    payload.clear();
+    payload.push_back(REPLICATION_ACK);
+    appendString(payload, origin);
+    appendVarint(payload, requestID);
+    appendVarint(payload, status);
+}
+
+/* Reads a varint at cursor, false if it runs past end */
+static bool takeVarint(const uint8_t *&cursor, const uint8_t *end, uint64_t *value) {
+    size_t used = ddfsClusterWire::getVarint(cursor, end, value);
+    cursor += used;
+    return (used != 0);
+}
+
+static bool takeString(const uint8_t *&cursor, const uint8_t *end, string *value) {
+    uint64_t length;
+    if(takeVarint(cursor, end, &length) == false || length > (uint64_t) (end - cursor))
+        return false;
+    value->assign((const char *) cursor, length);
+    cursor += length;
+    return true;
+}
+
+bool ddfsClusterReplication::decode(vector<uint8_t> &payload, replicationPacket *packet) {
+    if(payload.empty())
+        return false;
+
+    const uint8_t *cursor = &payload[0];
+    const uint8_t *end = cursor + payload.size();
+    uint64_t chainLength;
+
+    packet->kind = *cursor++;
+    if(takeString(cursor, end, &packet->origin) == false ||
+       takeVarint(cursor, end, &packet->requestID) == false)
+        return false;
+
+    if(packet->kind == REPLICATION_ACK)
+        return takeVarint(cursor, end, &packet->status);
+
+    if(packet->kind != REPLICATION_DATA)
+        return false;
+
+    if(takeVarint(cursor, end, &packet->chunkID) == false ||
+       takeVarint(cursor, end, &packet->offset) == false ||
+       takeVarint(cursor, end, &packet->chunkLength) == false ||
+       cursor == end)
+        return false;
+
+    packet->flags = *cursor++;
+
+    if(takeVarint(cursor, end, &chainLength) == false || chainLength >= DDFS_REPLICATION_MAX_CHAIN)
+        return false;
+
+    packet->chain.resize(chainLength);
+    for(unsigned int i = 0; i < chainLength; i++) {
+        if(takeString(cursor, end, &packet->chain[i]) == false)
+            return false;
+    }
+
+    packet->data = cursor;
+    packet->dataSize = end - cursor;
+
+    /* The packet has to stay inside the chunk */
+    if(packet->offset > packet->chunkLength ||
+       packet->dataSize > packet->chunkLength - packet->offset)
+        return false;
+
+    return true;
+}
+
+DDFS_STATUS ddfsClusterReplication::statusCode(ddfsStatus status) {
+    for(int code = DDFS_OK; code < DDFS_FAILURE; code++) {
+        if(status.compareStatus(ddfsStatus((DDFS_STATUS) code)))
+            return (DDFS_STATUS) code;
+    }
+    return DDFS_FAILURE;
+}
@@ -0,0 +1,187 @@
+/*
+ * @file ddfs_clusterReplication.hpp
+ *
+ * @brief Chain replication of file chunks.
+ *
+ * A chunk is written to every replica in its chain: the primary, the
+ * second and the third copy. The writer sends the chunk to the first
+ * replica only, in packets of DDFS_REPLICATION_PACKET_SIZE bytes. Each
+ * replica stores a packet and passes it on to the next one in the chain
+ * as soon as it has it, so all links of the chain are busy at the same
+ * time and every node sends one copy, not the writer three.
+ *
+ * Once the last replica has stored the whole chunk it acknowledges,
+ * and the acknowledgement travels back up the chain. A replica passes
+ * it on only after its own copy is stored, so the writer hearing OK
+ * means all copies are there. Any failure along the way is passed back
+ * the same way.
+ *
+ *   writer --DATA--> primary --DATA--> second --DATA--> third
+ *   writer <--ACK--- primary <--ACK--- second <--ACK--- third
+ *
+ * Packets travel as streams (see ddfs_clusterStream.hpp) in the
+ * replication traffic class, after the consensus traffic. Their payload:
+ *
+ *   DATA   Kind, origin host, request ID, chunk ID, offset, chunk
+ *          length, flags, rest of the chain, data bytes.
+ *   ACK    Kind, origin host, request ID, status.
+ *
+ * @author Harman Patial <harman.patial@gmail.com>
+ *
+ */
+#ifndef DDFS_CLUSTER_REPLICATION_H
+#define DDFS_CLUSTER_REPLICATION_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <stdint.h>
+
+#include "ddfs_clusterPaxos.hpp"
+#include "ddfs_clusterMemberPaxos.hpp"
+#include "../global/ddfs_status.hpp"
+
+using namespace std;
+
+/* Bytes of chunk data in one replication packet */
+#define DDFS_REPLICATION_PACKET_SIZE    (64 * 1024)
+/* Primary, second and third copy */
+#define DDFS_REPLICATION_MAX_CHAIN      3
+
+/* Stores size bytes at offset of a chunk on this node */
+typedef std::function<ddfsStatus(uint64_t chunkID, uint64_t offset,
+                    const uint8_t *data, size_t size)> ddfsReplicaWriter;
+
+/*!
+ *  \class  ddfsClusterReplication
+ *  \brief  Writes chunks down a chain of replicas.
+ *
+ *   One object per node. It takes over the stream handler of every
+ *   member of the cluster, packets for the chain arrive there. Packets
+ *   are passed on by a worker thread, a network thread never waits on
+ *   another member.
+ */
+class ddfsClusterReplication {
+public:
+    ddfsClusterReplication(ddfsClusterPaxos *cluster, ddfsReplicaWriter writer);
+    ~ddfsClusterReplication();
+
+    /*
+     * @brief Write size bytes of a chunk to every replica of chain.
+     *
+     * chain holds the host names of the replicas, the primary first.
+     * The local node may be one of them. Returns once every replica
+     * stored the chunk, or one of them failed.
+     *
+     * @return DDFS_OK                      All replicas have the chunk
+     * @return DDFS_GENERAL_PARAM_INVALID   Empty or too long chain
+     * @return DDFS_HOST_DOWN               A replica is not a member
+     * @return DDFS_NETWORK_RETRY           No acknowledgement in s_ackTimeoutMs
+     * @return Anything else a replica failed with
+     */
+    ddfsStatus replicate(const vector<string> &chain, uint64_t chunkID,
+                    const void *data, size_t size);
+
+private:
+    static const int s_ackTimeoutMs = 30000;
+    /* Chunks passing through are forgotten after this long */
+    static const int s_entryTimeoutMs = 2 * s_ackTimeoutMs;
+
+    enum replicationPacketKind {
+        REPLICATION_DATA = 1,
+        REPLICATION_ACK = 2
+    };
+
+    static const uint8_t s_flagLast = 0x1;
+
+    struct replicationPacket {
+        uint8_t kind;
+        string origin;
+        uint64_t requestID;
+        /* DATA */
+        uint64_t chunkID;
+        uint64_t offset;
+        uint64_t chunkLength;
+        uint8_t flags;
+        vector<string> chain;
+        const uint8_t *data;
+        size_t dataSize;
+        /* ACK */
+        uint64_t status;
+    };
+
+    /* A chunk passing through this node */
+    struct chainEntry {
+        string origin;
+        uint64_t requestID;
+        ddfsClusterMemberPaxos *upstream;
+        bool hasDownstream;
+        DDFS_STATUS localStatus;
+        chrono::steady_clock::time_point started;
+    };
+
+    /* A chunk this node is the writer of */
+    struct originEntry {
+        bool done;
+        DDFS_STATUS status;
+    };
+
+    /* Packet waiting for the worker */
+    struct outgoingPacket {
+        ddfsClusterMemberPaxos *member;
+        vector<uint8_t> payload;
+        /* Chunk to fail when a DATA packet can not be sent */
+        string key;
+        bool last;
+    };
+
+    ddfsClusterPaxos *cluster;
+    ddfsReplicaWriter writer;
+    string localHostName;
+
+    std::mutex replicationLock;
+    std::condition_variable ackArrived;
+    uint64_t nextRequestID;
+    /* Keyed by origin and request ID */
+    unordered_map<string, chainEntry> chainEntries;
+    unordered_map<uint64_t, originEntry> originEntries;
+
+    std::mutex queueLock;
+    std::condition_variable queueChanged;
+    deque<outgoingPacket> outgoing;
+    bool stopWorker;
+    std::thread worker;
+
+    void workerRoutine();
+    void enqueue(ddfsClusterMemberPaxos *member, vector<uint8_t> &payload, string key, bool last);
+
+    void receive(ddfsClusterMemberPaxos *from, vector<uint8_t> &payload);
+    void receiveData(ddfsClusterMemberPaxos *from, replicationPacket &packet);
+    void receiveAck(replicationPacket &packet);
+    /* Pass the outcome of a chunk to whoever sent it here */
+    void complete(string key, DDFS_STATUS status);
+    /* A DATA packet for key could not be sent on */
+    void downstreamFailed(string key, DDFS_STATUS status, bool last);
+
+    ddfsClusterMemberPaxos *findMember(const string &hostName);
+
+    static string entryKey(const string &origin, uint64_t requestID);
+    static void encodeData(vector<uint8_t> &payload, const string &origin, uint64_t requestID,
+                    uint64_t chunkID, uint64_t offset, uint64_t chunkLength, uint8_t flags,
+                    const vector<string> &chain, const uint8_t *data, size_t size);
+    static void encodeAck(vector<uint8_t> &payload, const string &origin, uint64_t requestID,
+                    DDFS_STATUS status);
+    static bool decode(vector<uint8_t> &payload, replicationPacket *packet);
+    static DDFS_STATUS statusCode(ddfsStatus status);
+
+    ddfsClusterReplication(ddfsClusterReplication const&);     // Don't Implement
+    void operator=(ddfsClusterReplication const&);             // Don't implement
+};
+
+#endif /* Ending DDFS_CLUSTER_REPLICATION_H */
@@ -0,0 +1,353 @@
+/*
+ * @file ddfs_clusterStream.cpp
+ *
+ * @brief Large payloads between two cluster members.
+ *
+ * @author Harman Patial <harman.patial@gmail.com>
+ *
+ */
+
+#include <chrono>
+#include <algorithm>
+
+#include "ddfs_clusterStream.hpp"
+#include "../logger/ddfs_fileLogger.hpp"
+
+using namespace std;
+
+ddfsLogger &global_logger_cs = ddfsLogger::getInstance();
+
+/* Room for the v2 header, IDs, the chunk header varints and the checksum */
+#define DDFS_STREAM_PACKET_OVERHEAD     (DDFS_WIRE_V2_HEADER_SIZE + 5 * 10 + DDFS_WIRE_CRC_SIZE)
+
+ddfsClusterStreams::ddfsClusterStreams(ddfsClusterStreamTransmit t) : transmit(t),
+                    nextStreamID(1), generation(0), incomingBytes(0), stopControl(false),
+                    chunkPool(DDFS_STREAM_CHUNK_SIZE + DDFS_STREAM_PACKET_OVERHEAD,
+                              DDFS_STREAM_WINDOW_SIZE / DDFS_STREAM_CHUNK_SIZE) {
+}
+
+ddfsClusterStreams::~ddfsClusterStreams() {
+    stop();
+}
+
+void ddfsClusterStreams::stop() {
+    {
+        std::lock_guard<std::mutex> guard(streamLock);
+        stopControl = true;
+        controls.clear();
+    }
+    controlQueued.notify_all();
+
+    if(controlThread.joinable())
+        controlThread.join();
+}
+
+void ddfsClusterStreams::setHandler(ddfsClusterStreamHandler h) {
+    std::lock_guard<std::mutex> guard(streamLock);
+    handler = h;
+}
+
+void ddfsClusterStreams::setService(uint8_t service, ddfsClusterStreamHandler h) {
+    std::lock_guard<std::mutex> guard(streamLock);
+    if(h)
+        services[service] = h;
+    else
+        services.erase(service);
+}
+
+ddfsStatus ddfsClusterStreams::send(const void *data, size_t size, uint64_t *streamID,
+                    ddfsTrafficClass trafficClass) {
+    if(size > DDFS_STREAM_MAX_SIZE)
+        return (ddfsStatus(DDFS_NETWORK_OVERRUN));
+
+    std::unique_lock<std::mutex> guard(streamLock);
+    uint64_t id = nextStreamID++;
+    uint64_t myGeneration = generation;
+
+    outgoingStream &stream = outgoing[id];
+    stream.creditLimit = DDFS_STREAM_WINDOW_SIZE;
+    stream.aborted = false;
+
+    if(streamID)
+        *streamID = id;
+
+    ddfsStatus status(DDFS_OK);
+    size_t offset = 0;
+
+    do {
+        size_t chunk = size - offset;
+        if(chunk > DDFS_STREAM_CHUNK_SIZE)
+            chunk = DDFS_STREAM_CHUNK_SIZE;
+
+        /* Wait till the receiver makes room for this chunk */
+        bool ready = creditArrived.wait_for(guard, std::chrono::milliseconds((int) s_creditTimeoutMs),
+                    [this, id, offset, chunk, myGeneration] {
+                        if(generation != myGeneration)
+                            return true;
+                        outgoingStream &s = outgoing[id];
+                        return (s.aborted || s.creditLimit >= offset + chunk);
+                    });
+
+        if(generation != myGeneration || outgoing[id].aborted) {
+            status = ddfsStatus(DDFS_FAILURE);
+            break;
+        }
+        if(ready == false) {
+            status = ddfsStatus(DDFS_NETWORK_RETRY);
+            break;
+        }
+
+        guard.unlock();
+
+        ddfsPooledBuffer packet(chunk + DDFS_STREAM_PACKET_OVERHEAD, chunkPool);
+        ddfsClusterPacketBuilder builder(DDFS_WIRE_VERSION_2, CLUSTER_MESSAGE_TOF_CLUSTER_STREAM,
+                    0, 0, packet.getData(), packet.getCapacity());
+
+        uint8_t flags = 0;
+        if(offset == 0)
+            flags |= CLUSTER_STREAM_FLAG_FIRST;
+        if(offset + chunk == size)
+            flags |= CLUSTER_STREAM_FLAG_LAST;
+
+        builder.setStreamHeader(CLUSTER_STREAM_DATA, flags);
+        builder.addVarint(id);
+        builder.addVarint(offset);
+        if(flags & CLUSTER_STREAM_FLAG_FIRST)
+            builder.addVarint(size);
+        builder.addBytes((const uint8_t *) data + offset, chunk);
+
+        size_t length = builder.finish();
+        if(length == 0)
+            status = ddfsStatus(DDFS_FAILURE);
+        else
+            status = transmit(packet.getData(), length, trafficClass);
+
+        guard.lock();
+
+        if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+            break;
+
+        offset += chunk;
+    } while(offset < size);
+
+    if(generation == myGeneration)
+        outgoing.erase(id);
+
+    if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+        global_logger_cs << ddfsLogger::LOG_WARNING << "CS:: Stream " << id << " failed after "
+                    << offset << " of " << size << " bytes. " << status.statusToString() << "\n";
+    }
+
+    return status;
+}
+
+ddfsStatus ddfsClusterStreams::sendControl(uint8_t kind, uint64_t streamID, uint64_t value) {
+    uint8_t packet[DDFS_STREAM_PACKET_OVERHEAD];
+    ddfsClusterPacketBuilder builder(DDFS_WIRE_VERSION_2, CLUSTER_MESSAGE_TOF_CLUSTER_STREAM,
+                    0, 0, packet, sizeof(packet));
+
+    builder.setStreamHeader(kind, 0);
+    builder.addVarint(streamID);
+    if(kind == CLUSTER_STREAM_CREDIT)
+        builder.addVarint(value);
+
+    size_t length = builder.finish();
+    if(length == 0)
+        return (ddfsStatus(DDFS_FAILURE));
+
+    return transmit(packet, length, DDFS_TRAFFIC_CONSENSUS);
+}
+
+void ddfsClusterStreams::queueControl(uint8_t kind, uint64_t streamID, uint64_t value) {
+    if(stopControl)
+        return;
+
+    /* Only the last credit of a stream counts */
+    for(std::deque<controlPacket>::iterator queued = controls.begin(); queued != controls.end(); queued++) {
+        if(kind == CLUSTER_STREAM_CREDIT && queued->kind == kind && queued->streamID == streamID) {
+            queued->value = value;
+            return;
+        }
+    }
+
+    controlPacket control = {kind, streamID, value};
+    controls.push_back(control);
+    if(controlThread.joinable() == false)
+        controlThread = std::thread(&ddfsClusterStreams::controlRoutine, this);
+    controlQueued.notify_one();
+}
+
+void ddfsClusterStreams::controlRoutine() {
+    std::unique_lock<std::mutex> guard(streamLock);
+
+    while(1) {
+        controlQueued.wait(guard, [this] { return stopControl || controls.empty() == false; });
+        if(stopControl)
+            return;
+
+        controlPacket control = controls.front();
+        controls.pop_front();
+
+        guard.unlock();
+        ddfsStatus status = sendControl(control.kind, control.streamID, control.value);
+        if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+            global_logger_cs << ddfsLogger::LOG_WARNING << "CS:: Unable to send "
+                        << (control.kind == CLUSTER_STREAM_CREDIT ? "credit" : "abort")
+                        << " for stream " << control.streamID << ". " << status.statusToString() << "\n";
+        }
+        guard.lock();
+    }
+}
+
+ddfsStatus ddfsClusterStreams::processPacket(ddfsClusterPacketView &packet) {
+    size_t length;
+    uint8_t *cursor = packet.getStreamPayload(&length);
+    uint8_t *end;
+    uint64_t streamID, value;
+    size_t used;
+
+    if(cursor == NULL)
+        return (ddfsStatus(DDFS_NETWORK_CORRUPTED));
+    end = cursor + length;
+
+    if((used = ddfsClusterWire::getVarint(cursor, end, &streamID)) == 0)
+        return (ddfsStatus(DDFS_NETWORK_CORRUPTED));
+    cursor += used;
+
+    switch(packet.getStreamKind()) {
+    case CLUSTER_STREAM_DATA:
+        return processData(packet, streamID, cursor, end);
+
+    case CLUSTER_STREAM_CREDIT:
+    {
+        if((used = ddfsClusterWire::getVarint(cursor, end, &value)) == 0)
+            return (ddfsStatus(DDFS_NETWORK_CORRUPTED));
+
+        std::lock_guard<std::mutex> guard(streamLock);
+        std::unordered_map<uint64_t, outgoingStream>::iterator stream = outgoing.find(streamID);
+        if(stream != outgoing.end() && value > stream->second.creditLimit) {
+            stream->second.creditLimit = value;
+            creditArrived.notify_all();
+        }
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    case CLUSTER_STREAM_ABORT:
+    {
+        std::lock_guard<std::mutex> guard(streamLock);
+        std::unordered_map<uint64_t, outgoingStream>::iterator stream = outgoing.find(streamID);
+        if(stream != outgoing.end()) {
+            stream->second.aborted = true;
+            creditArrived.notify_all();
+        }
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    default:
+        return (ddfsStatus(DDFS_NETWORK_CORRUPTED));
+    }
+}
+
+ddfsStatus ddfsClusterStreams::processData(ddfsClusterPacketView &packet, uint64_t streamID,
+                    uint8_t *cursor, uint8_t *end) {
+    uint64_t offset, totalLength = 0;
+    size_t used;
+
+    if((used = ddfsClusterWire::getVarint(cursor, end, &offset)) == 0)
+        return (ddfsStatus(DDFS_NETWORK_CORRUPTED));
+    cursor += used;
+
+    if(packet.getFlags() & CLUSTER_STREAM_FLAG_FIRST) {
+        if((used = ddfsClusterWire::getVarint(cursor, end, &totalLength)) == 0)
+            return (ddfsStatus(DDFS_NETWORK_CORRUPTED));
+        cursor += used;
+    }
+
+    size_t chunk = end - cursor;
+    bool aborting = false, complete = false;
+    std::vector<uint8_t> payload;
+    ddfsClusterStreamHandler deliver;
+
+    {
+        std::lock_guard<std::mutex> guard(streamLock);
+
+        if(packet.getFlags() & CLUSTER_STREAM_FLAG_FIRST) {
+            if(offset != 0 || totalLength > DDFS_STREAM_MAX_SIZE ||
+               incoming.size() >= DDFS_STREAM_MAX_INCOMING || incoming.count(streamID) ||
+               incomingBytes + totalLength > DDFS_STREAM_MAX_INCOMING_BYTES) {
+                aborting = true;
+            } else {
+                /* The payload grows as the chunks come in, the length the
+                 * sender claims is only counted against the member */
+                incomingStream &stream = incoming[streamID];
+                stream.totalLength = totalLength;
+                stream.creditLimit = DDFS_STREAM_WINDOW_SIZE;
+                stream.payload.reserve(std::min(totalLength, (uint64_t) DDFS_STREAM_WINDOW_SIZE));
+                incomingBytes += totalLength;
+            }
+        }
+
+        std::unordered_map<uint64_t, incomingStream>::iterator stream = incoming.find(streamID);
+        if(aborting == false && stream == incoming.end())
+            aborting = true;
+
+        /* Chunks come in order, anything else means the stream is broken */
+        if(aborting == false) {
+            incomingStream &s = stream->second;
+            if(offset != s.payload.size() || offset + chunk > s.totalLength ||
+               offset + chunk > s.creditLimit) {
+                incomingBytes -= s.totalLength;
+                incoming.erase(stream);
+                aborting = true;
+            } else {
+                /* Double up to the total length, never past it */
+                if(s.payload.capacity() < offset + chunk)
+                    s.payload.reserve(std::min(s.totalLength,
+                                std::max((uint64_t) s.payload.capacity() * 2, (uint64_t) (offset + chunk))));
+                s.payload.insert(s.payload.end(), cursor, end);
+
+                if(s.payload.size() == s.totalLength) {
+                    payload.swap(s.payload);
+                    incomingBytes -= s.totalLength;
+                    incoming.erase(stream);
+                    deliver = handler;
+                    if(payload.empty() == false) {
+                        std::map<uint8_t, ddfsClusterStreamHandler>::iterator service = services.find(payload[0]);
+                        if(service != services.end())
+                            deliver = service->second;
+                    }
+                    complete = true;
+                } else if(s.creditLimit - s.payload.size() <= DDFS_STREAM_WINDOW_SIZE / 2) {
+                    /* Half the window is used up, let the sender run on */
+                    s.creditLimit = s.payload.size() + DDFS_STREAM_WINDOW_SIZE;
+                    queueControl(CLUSTER_STREAM_CREDIT, streamID, s.creditLimit);
+                }
+            }
+        }
+
+        if(aborting)
+            queueControl(CLUSTER_STREAM_ABORT, streamID, 0);
+    }
+
+    if(aborting) {
+        global_logger_cs << ddfsLogger::LOG_WARNING << "CS:: Aborting incoming stream " << streamID
+                    << " at offset " << offset << "\n";
+        return (ddfsStatus(DDFS_FAILURE));
+    }
+
+    if(complete && deliver)
+        deliver(streamID, payload);
+
+    return (ddfsStatus(DDFS_OK));
+}
+
+void ddfsClusterStreams::reset() {
+    std::lock_guard<std::mutex> guard(streamLock);
+
+    generation++;
+    outgoing.clear();
+    incoming.clear();
+    incomingBytes = 0;
+    controls.clear();
+    creditArrived.notify_all();
+}
@@ -0,0 +1,172 @@
+/*
+ * @file ddfs_clusterStream.hpp
+ *
+ * @brief Large payloads between two cluster members.
+ *
+ * A payload is cut into chunks of at most DDFS_STREAM_CHUNK_SIZE bytes,
+ * each sent as its own packet and put back together by stream ID at the
+ * other end. Consensus packets are sent between chunks, so they never
+ * wait behind more than one chunk.
+ *
+ * Every stream has its own credit. The sender may run at most
+ * DDFS_STREAM_WINDOW_SIZE bytes ahead of what the receiver has taken in,
+ * and the receiver hands out more credit as chunks arrive. A bulk
+ * transfer can not fill the connection and the queues behind it.
+ *
+ * Stream packets, after the v2 header, unique ID and internal index:
+ *
+ *   DATA    Stream ID, offset, total length (FIRST only) as varints,
+ *           then the chunk bytes. Flags FIRST and LAST.
+ *   CREDIT  Stream ID, offset the sender may send up to.
+ *   ABORT   Stream ID. The receiver gave up on the stream.
+ *
+ * @author Harman Patial <harman.patial@gmail.com>
+ *
+ */
+#ifndef DDFS_CLUSTER_STREAM_H
+#define DDFS_CLUSTER_STREAM_H
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <stdint.h>
+
+#include "ddfs_clusterWire.hpp"
+#include "../network/ddfs_bufferPool.hpp"
+#include "../network/ddfs_network.hpp"
+#include "../global/ddfs_status.hpp"
+
+#define DDFS_STREAM_CHUNK_SIZE      (16 * 1024)
+#define DDFS_STREAM_WINDOW_SIZE     (256 * 1024)
+/* Largest payload accepted from a member */
+#define DDFS_STREAM_MAX_SIZE        (64 * 1024 * 1024)
+/* Incoming streams being put together at a time, per member */
+#define DDFS_STREAM_MAX_INCOMING    16
+/* Their total length, per member. A stream that does not fit is aborted. */
+#define DDFS_STREAM_MAX_INCOMING_BYTES  (2 * DDFS_STREAM_MAX_SIZE)
+
+enum clusterStreamKind {
+    CLUSTER_STREAM_DATA = 1,
+    CLUSTER_STREAM_CREDIT = 2,
+    CLUSTER_STREAM_ABORT = 3
+};
+
+enum clusterStreamFlags {
+    CLUSTER_STREAM_FLAG_FIRST = 0x1,
+    CLUSTER_STREAM_FLAG_LAST = 0x2
+};
+
+/* A complete payload arrived. payload may be moved out. */
+typedef std::function<void(uint64_t streamID, std::vector<uint8_t> &payload)> ddfsClusterStreamHandler;
+/* Hands one packet to the network */
+typedef std::function<ddfsStatus(void *data, int size, ddfsTrafficClass trafficClass)> ddfsClusterStreamTransmit;
+
+/*!
+ *  \class  ddfsClusterStreams
+ *  \brief  Streams to and from one cluster member.
+ *
+ *   send() runs on the caller's thread and blocks while the stream is
+ *   out of credit. processPacket() runs on the network thread and does
+ *   not wait for the connection: the credit and aborts it answers with
+ *   are queued for a thread of its own. Sending them there and then
+ *   would wait for a turn behind a chunk being sent, and that chunk may
+ *   be waiting for the member, whose network thread may be waiting the
+ *   same way for us.
+ */
+class ddfsClusterStreams {
+public:
+    ddfsClusterStreams(ddfsClusterStreamTransmit transmit);
+    ~ddfsClusterStreams();
+
+    void setHandler(ddfsClusterStreamHandler handler);
+
+    /* Payloads whose first byte is service go to handler instead, an
+     * empty handler removes the service. Users of the plain handler
+     * start their payloads with bytes no service takes. */
+    void setService(uint8_t service, ddfsClusterStreamHandler handler);
+
+    /*
+     * @brief Send size bytes at data as one stream.
+     *
+     * Returns once the last chunk is handed to the network. Chunks go
+     * in the trafficClass lane, credit and aborts in the consensus lane
+     * so a busy lane can not hold back its own credit.
+     *
+     * @return DDFS_OK                  All of it is sent
+     * @return DDFS_NETWORK_OVERRUN     size is over DDFS_STREAM_MAX_SIZE
+     * @return DDFS_NETWORK_RETRY       No credit for s_creditTimeoutMs
+     * @return DDFS_FAILURE             Network failed or the receiver aborted
+     */
+    ddfsStatus send(const void *data, size_t size, uint64_t *streamID,
+                    ddfsTrafficClass trafficClass);
+
+    /* A stream packet arrived from the member */
+    ddfsStatus processPacket(ddfsClusterPacketView &packet);
+
+    /* The connection went away, all streams are gone with it */
+    void reset();
+
+    /* Nothing is transmitted after it returns. Call before transmit
+     * stops working. */
+    void stop();
+
+private:
+    static const int s_creditTimeoutMs = 5000;
+
+    struct outgoingStream {
+        uint64_t creditLimit;       /* Offset the receiver allows up to */
+        bool aborted;
+    };
+
+    struct incomingStream {
+        uint64_t totalLength;
+        uint64_t creditLimit;       /* Last offset granted to the sender */
+        std::vector<uint8_t> payload;
+    };
+
+    struct controlPacket {
+        uint8_t kind;
+        uint64_t streamID;
+        uint64_t value;
+    };
+
+    ddfsClusterStreamTransmit transmit;
+    ddfsClusterStreamHandler handler;
+    std::map<uint8_t, ddfsClusterStreamHandler> services;
+
+    std::mutex streamLock;
+    std::condition_variable creditArrived;
+    uint64_t nextStreamID;
+    /* Bumped by reset(), senders of an older generation give up */
+    uint64_t generation;
+    std::unordered_map<uint64_t, outgoingStream> outgoing;
+    std::unordered_map<uint64_t, incomingStream> incoming;
+    /* Total length of the incoming streams */
+    uint64_t incomingBytes;
+
+    /* Credit and aborts for controlRoutine, started with the first one */
+    std::deque<controlPacket> controls;
+    std::condition_variable controlQueued;
+    bool stopControl;
+    std::thread controlThread;
+
+    /* Chunk sized buffers, kept apart from the small message pool */
+    ddfsBufferPool chunkPool;
+
+    ddfsStatus processData(ddfsClusterPacketView &packet, uint64_t streamID,
+                    uint8_t *cursor, uint8_t *end);
+    ddfsStatus sendControl(uint8_t kind, uint64_t streamID, uint64_t value);
+    /* sendControl() on controlThread, with streamLock held */
+    void queueControl(uint8_t kind, uint64_t streamID, uint64_t value);
+    void controlRoutine();
+
+    ddfsClusterStreams(ddfsClusterStreams const&);     // Don't Implement
+    void operator=(ddfsClusterStreams const&);         // Don't implement
+};
+
+#endif /* Ending DDFS_CLUSTER_STREAM_H */
@@ -0,0 +1,321 @@
+/*
+ * @file ddfs_clusterWire.cpp
+ *
+ * @brief Encoding of the cluster messages on the wire.
+ *
+ * @author Harman Patial <harman.patial@gmail.com>
+ *
+ */
+
+#include <cstring>
+
+#include "ddfs_clusterWire.hpp"
+#include "../global/ddfs_crc32c.hpp"
+
+size_t ddfsClusterWire::headerSize(uint8_t version) {
+    switch(version) {
+    case DDFS_WIRE_VERSION_1:
+        return sizeof(ddfsClusterHeader);
+    case DDFS_WIRE_VERSION_2:
+        return DDFS_WIRE_V2_HEADER_SIZE;
+    default:
+        return 0;
+    }
+}
+
+uint64_t ddfsClusterWire::frameLength(const uint8_t *header) {
+    if(header[0] == DDFS_WIRE_VERSION_2)
+        return getLittleEndian32(header + 4);
+
+    ddfsClusterHeader v1Header;
+    memcpy(&v1Header, header, sizeof(v1Header));
+    return v1Header.totalLength;
+}
+
+uint8_t ddfsClusterWire::typeOfService(const uint8_t *header) {
+    if(header[0] == DDFS_WIRE_VERSION_2)
+        return header[1];
+
+    ddfsClusterHeader v1Header;
+    memcpy(&v1Header, header, sizeof(v1Header));
+    return (uint8_t) v1Header.typeOfService;
+}
+
+ddfsClusterPacketView::ddfsClusterPacketView(void *data, size_t size) :
+                    packet((uint8_t *) data), packetSize(size), status(DDFS_FAILURE),
+                    version(0), typeOfService(0), uniqueID(0), advertisedVersion(0),
+                    messageCount(0), flags(0), streamKind(0),
+                    cursor(NULL), end(NULL), messagesRead(0) {
+    status = validate();
+}
+
+ddfsStatus ddfsClusterPacketView::validate() {
+    if(packet == NULL || packetSize < 1)
+        return (ddfsStatus(DDFS_NETWORK_UNDERRUN));
+
+    version = packet[0];
+    size_t headerSize = ddfsClusterWire::headerSize(version);
+    if(headerSize == 0)
+        return (ddfsStatus(DDFS_FAILURE));
+
+    if(packetSize < headerSize || packetSize < ddfsClusterWire::frameLength(packet))
+        return (ddfsStatus(DDFS_NETWORK_UNDERRUN));
+    if(packetSize > ddfsClusterWire::frameLength(packet))
+        return (ddfsStatus(DDFS_NETWORK_OVERRUN));
+
+    typeOfService = ddfsClusterWire::typeOfService(packet);
+
+    if(version == DDFS_WIRE_VERSION_1) {
+        ddfsClusterHeader header;
+        size_t payload = packetSize - sizeof(ddfsClusterHeader);
+
+        if(payload % sizeof(ddfsClusterMessage))
+            return (ddfsStatus(DDFS_NETWORK_CORRUPTED));
+        if(payload / sizeof(ddfsClusterMessage) > DDFS_WIRE_MAX_MESSAGES)
+            return (ddfsStatus(DDFS_NETWORK_OVERRUN));
+
+        memcpy(&header, packet, sizeof(header));
+        uniqueID = header.uniqueID;
+        advertisedVersion = header.Reserved1;
+        messageCount = payload / sizeof(ddfsClusterMessage);
+        cursor = packet + sizeof(ddfsClusterHeader);
+        end = packet + packetSize;
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    if(packetSize < DDFS_WIRE_V2_HEADER_SIZE + DDFS_WIRE_CRC_SIZE)
+        return (ddfsStatus(DDFS_NETWORK_UNDERRUN));
+
+    end = packet + packetSize - DDFS_WIRE_CRC_SIZE;
+    if(ddfsCrc32c(packet, end - packet) != ddfsClusterWire::getLittleEndian32(end))
+        return (ddfsStatus(DDFS_NETWORK_CORRUPTED));
+
+    flags = packet[2];
+
+    bool isStream = (typeOfService == CLUSTER_MESSAGE_TOF_CLUSTER_STREAM);
+    if(isStream == false && packet[3] > DDFS_WIRE_MAX_MESSAGES)
+        return (ddfsStatus(DDFS_NETWORK_OVERRUN));
+
+    uint64_t internalIndex, field;
+    size_t used;
+
+    cursor = packet + DDFS_WIRE_V2_HEADER_SIZE;
+    if((used = ddfsClusterWire::getVarint(cursor, end, &uniqueID)) == 0)
+        return (ddfsStatus(DDFS_NETWORK_CORRUPTED));
+    cursor += used;
+    if((used = ddfsClusterWire::getVarint(cursor, end, &internalIndex)) == 0)
+        return (ddfsStatus(DDFS_NETWORK_CORRUPTED));
+    cursor += used;
+
+    /* The stream code parses its own payload */
+    if(isStream) {
+        streamKind = packet[3];
+        advertisedVersion = DDFS_WIRE_VERSION_2;
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    /* Walk the messages once so nextMessage() can not run into bad data */
+    uint8_t *walk = cursor;
+    for(int i = 0; i < packet[3]; i++) {
+        for(int f = 0; f < 5; f++) {
+            if((used = ddfsClusterWire::getVarint(walk, end, &field)) == 0)
+                return (ddfsStatus(DDFS_NETWORK_CORRUPTED));
+            if(f == 0 && field > 0xFFFF)
+                return (ddfsStatus(DDFS_NETWORK_CORRUPTED));
+            walk += used;
+        }
+    }
+
+    /* Trailing bytes the checksum covered but no message claimed */
+    if(walk != end)
+        return (ddfsStatus(DDFS_NETWORK_CORRUPTED));
+
+    messageCount = packet[3];
+    advertisedVersion = DDFS_WIRE_VERSION_2;
+    return (ddfsStatus(DDFS_OK));
+}
+
+uint8_t ddfsClusterPacketView::getPeerVersion() {
+    /* Older nodes leave junk in Reserved1, take only a known version */
+    if(advertisedVersion == DDFS_WIRE_VERSION_2)
+        return DDFS_WIRE_VERSION_2;
+
+    return DDFS_WIRE_VERSION_1;
+}
+
+uint8_t *ddfsClusterPacketView::getStreamPayload(size_t *length) {
+    if(status.compareStatus(ddfsStatus(DDFS_OK)) == false || streamKind == 0)
+        return NULL;
+
+    *length = end - cursor;
+    return cursor;
+}
+
+ddfsClusterMessage *ddfsClusterPacketView::nextMessage(ddfsClusterMessage *scratch) {
+    if(status.compareStatus(ddfsStatus(DDFS_OK)) == false || messagesRead == messageCount)
+        return NULL;
+
+    messagesRead++;
+
+    if(version == DDFS_WIRE_VERSION_1) {
+        ddfsClusterMessage *message = (ddfsClusterMessage *) cursor;
+        cursor += sizeof(ddfsClusterMessage);
+        return message;
+    }
+
+    /* Already validated, the varints are all there */
+    uint64_t fields[5];
+    for(int f = 0; f < 5; f++)
+        cursor += ddfsClusterWire::getVarint(cursor, end, &fields[f]);
+
+    scratch->messageType = (uint16_t) fields[0];
+    scratch->Reserved1 = 0;
+    scratch->roundNumber = ddfsClusterWire::zigzagDecode(fields[1]);
+    scratch->proposalNumber = ddfsClusterWire::zigzagDecode(fields[2]);
+    scratch->lastAcceptedProposalNumber = ddfsClusterWire::zigzagDecode(fields[3]);
+    scratch->lastAcceptedValue = ddfsClusterWire::zigzagDecode(fields[4]);
+    return scratch;
+}
+
+ddfsClusterPacketBuilder::ddfsClusterPacketBuilder(uint8_t v, uint8_t tos,
+                    uint64_t id, uint64_t index, uint8_t *b, size_t c) :
+                    version(v), typeOfService(tos), uniqueID(id), internalIndex(index),
+                    buffer(b), capacity(c), length(0), messageCount(0), flags(0), streamKind(0),
+                    status(DDFS_OK) {
+    if(version == DDFS_WIRE_VERSION_1 && isStream() == false) {
+        length = sizeof(ddfsClusterHeader);
+    } else if(version == DDFS_WIRE_VERSION_2) {
+        length = DDFS_WIRE_V2_HEADER_SIZE + ddfsClusterWire::varintLength(uniqueID) +
+                    ddfsClusterWire::varintLength(internalIndex);
+    } else {
+        status = ddfsStatus(DDFS_FAILURE);
+        return;
+    }
+
+    if(buffer == NULL || length > capacity) {
+        status = ddfsStatus(DDFS_NETWORK_OVERRUN);
+        return;
+    }
+
+    if(version == DDFS_WIRE_VERSION_2) {
+        uint8_t *cursor = buffer + DDFS_WIRE_V2_HEADER_SIZE;
+        cursor += ddfsClusterWire::putVarint(cursor, uniqueID);
+        ddfsClusterWire::putVarint(cursor, internalIndex);
+    }
+}
+
+ddfsStatus ddfsClusterPacketBuilder::addMessage(uint16_t messageType, int64_t roundNumber,
+                    int64_t proposalNumber, int64_t lastAcceptedProposalNumber,
+                    int64_t lastAcceptedValue) {
+    if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+        return status;
+
+    if(messageCount == DDFS_WIRE_MAX_MESSAGES || isStream())
+        return (ddfsStatus(DDFS_NETWORK_OVERRUN));
+
+    if(version == DDFS_WIRE_VERSION_1) {
+        if(length + sizeof(ddfsClusterMessage) > capacity)
+            return (ddfsStatus(DDFS_NETWORK_OVERRUN));
+
+        /* Packed, so it can be written in place at any offset */
+        ddfsClusterMessage *message = (ddfsClusterMessage *) (buffer + length);
+        message->messageType = messageType;
+        message->Reserved1 = 0;
+        message->roundNumber = roundNumber;
+        message->proposalNumber = proposalNumber;
+        message->lastAcceptedProposalNumber = lastAcceptedProposalNumber;
+        message->lastAcceptedValue = lastAcceptedValue;
+
+        length += sizeof(ddfsClusterMessage);
+        messageCount++;
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    uint64_t fields[5] = { messageType,
+                    ddfsClusterWire::zigzagEncode(roundNumber),
+                    ddfsClusterWire::zigzagEncode(proposalNumber),
+                    ddfsClusterWire::zigzagEncode(lastAcceptedProposalNumber),
+                    ddfsClusterWire::zigzagEncode(lastAcceptedValue) };
+
+    size_t needed = DDFS_WIRE_CRC_SIZE;
+    for(int f = 0; f < 5; f++)
+        needed += ddfsClusterWire::varintLength(fields[f]);
+
+    if(length + needed > capacity)
+        return (ddfsStatus(DDFS_NETWORK_OVERRUN));
+
+    for(int f = 0; f < 5; f++)
+        length += ddfsClusterWire::putVarint(buffer + length, fields[f]);
+
+    messageCount++;
+    return (ddfsStatus(DDFS_OK));
+}
+
+void ddfsClusterPacketBuilder::setStreamHeader(uint8_t kind, uint8_t streamFlags) {
+    streamKind = kind;
+    flags = streamFlags;
+}
+
+ddfsStatus ddfsClusterPacketBuilder::addVarint(uint64_t value) {
+    if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+        return status;
+
+    if(version != DDFS_WIRE_VERSION_2 || isStream() == false)
+        return (ddfsStatus(DDFS_FAILURE));
+
+    if(length + ddfsClusterWire::varintLength(value) + DDFS_WIRE_CRC_SIZE > capacity)
+        return (ddfsStatus(DDFS_NETWORK_OVERRUN));
+
+    length += ddfsClusterWire::putVarint(buffer + length, value);
+    return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsClusterPacketBuilder::addBytes(const void *data, size_t size) {
+    if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+        return status;
+
+    if(version != DDFS_WIRE_VERSION_2 || isStream() == false)
+        return (ddfsStatus(DDFS_FAILURE));
+
+    if(length + size + DDFS_WIRE_CRC_SIZE > capacity)
+        return (ddfsStatus(DDFS_NETWORK_OVERRUN));
+
+    memcpy(buffer + length, data, size);
+    length += size;
+    return (ddfsStatus(DDFS_OK));
+}
+
+size_t ddfsClusterPacketBuilder::finish() {
+    if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+        return 0;
+
+    if(version == DDFS_WIRE_VERSION_1) {
+        ddfsClusterHeader header;
+
+        header.version = DDFS_WIRE_VERSION_1;
+        header.typeOfService = typeOfService;
+        header.totalLength = length;
+        header.uniqueID = uniqueID;
+        header.internalIndex = internalIndex;
+        /* Let the member know it can switch to a newer version */
+        header.Reserved1 = DDFS_WIRE_VERSION_MAX;
+        header.Reserved2 = 0;
+
+        memcpy(buffer, &header, sizeof(header));
+        return length;
+    }
+
+    /* addMessage() kept room for the checksum, but there may be no message */
+    if(length + DDFS_WIRE_CRC_SIZE > capacity)
+        return 0;
+
+    buffer[0] = DDFS_WIRE_VERSION_2;
+    buffer[1] = typeOfService;
+    buffer[2] = flags;
+    buffer[3] = isStream() ? streamKind : (uint8_t) messageCount;
+    ddfsClusterWire::putLittleEndian32(buffer + 4, (uint32_t) (length + DDFS_WIRE_CRC_SIZE));
+
+    ddfsClusterWire::putLittleEndian32(buffer + length, ddfsCrc32c(buffer, length));
+
+    return (length + DDFS_WIRE_CRC_SIZE);
+}
@@ -0,0 +1,301 @@
+/*
+ * @file ddfs_clusterWire.hpp
+ *
+ * @brief Encoding of the cluster messages on the wire.
+ *
+ * Two formats are understood, told apart by the first byte:
+ *
+ * v1 (version 111) is ddfsClusterHeader followed by ddfsClusterMessage
+ * structures, in host byte order and without a checksum. Reserved1 of
+ * the header carries the highest version the sender understands.
+ *
+ * v2 (version 2) is a little endian 8 byte header, varint encoded
+ * fields and a CRC32C trailer over everything before it.
+ *
+0                   1                   2                   3
+0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
++-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+|    Version    |Type of Service|     Flags     | Count or Kind |
++-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+|                 Total Length (header to CRC)                  |
++-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+|  Unique ID (varint)  |  Internal Index (varint)  |  Messages ...
++-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+|                            CRC32C                             |
++-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ * A message is the message type as a varint followed by the round
+ * number, proposal number, last accepted proposal number and last
+ * accepted value as zigzag varints. Proposal numbers hold the 48 bit
+ * member ID (see ddfsClusterPaxos::getProposalNumber()) and take 8
+ * bytes, a member ID as the value 7: a PREPARE is 12 bytes and an
+ * ACCEPT 25, instead of 36. A packet with one ACCEPT is 39 bytes, 92
+ * in v1.
+ *
+ * Stream packets (CLUSTER_MESSAGE_TOF_CLUSTER_STREAM) carry the stream
+ * packet kind in place of the message count and their own payload
+ * after the internal index, see ddfs_clusterStream.hpp. Streams are
+ * v2 only.
+ *
+ * Every node starts out sending v1 to a member and moves to the
+ * highest common version once it hears what the member understands.
+ *
+ * @author Harman Patial <harman.patial@gmail.com>
+ *
+ */
+#ifndef DDFS_CLUSTER_WIRE_H
+#define DDFS_CLUSTER_WIRE_H
+
+#include <cstddef>
+#include <stdint.h>
+
+#include "ddfs_clusterMessagesPaxos.hpp"
+#include "../global/ddfs_status.hpp"
+
+#define DDFS_WIRE_VERSION_1         111
+#define DDFS_WIRE_VERSION_2         2
+/* Highest version this node speaks */
+#define DDFS_WIRE_VERSION_MAX       DDFS_WIRE_VERSION_2
+
+#define DDFS_WIRE_V2_HEADER_SIZE    8
+#define DDFS_WIRE_CRC_SIZE          4
+/* Bytes a stream transport reads before it knows the header size */
+#define DDFS_WIRE_PREFIX_SIZE       8
+/* Most messages carried by one packet */
+#define DDFS_WIRE_MAX_MESSAGES      MAX_NUM_OF_MESSAGES
+
+/*!
+ *  \class  ddfsClusterWire
+ *  \brief  Encodes and decodes cluster packets.
+ *
+ *   No object of this class is allowed.
+ */
+class ddfsClusterWire {
+public:
+    /*
+     * @brief Size of the header of a packet starting with version.
+     *
+     * @return 0 for a version that is not understood.
+     */
+    static size_t headerSize(uint8_t version);
+
+    /*
+     * @brief Total length of the packet whose header is at header.
+     *
+     * header must hold headerSize(header[0]) bytes.
+     */
+    static uint64_t frameLength(const uint8_t *header);
+
+    /* Type of service of the packet whose header is at header */
+    static uint8_t typeOfService(const uint8_t *header);
+
+    /* Bytes putVarint() writes for value */
+    static size_t varintLength(uint64_t value) {
+        size_t length = 1;
+        while(value >= 0x80) {
+            value >>= 7;
+            length++;
+        }
+        return length;
+    }
+
+    /* Unsigned LEB128. Returns bytes written, at most 10. */
+    static size_t putVarint(uint8_t *buffer, uint64_t value) {
+        size_t length = 0;
+        while(value >= 0x80) {
+            buffer[length++] = (uint8_t) (value | 0x80);
+            value >>= 7;
+        }
+        buffer[length++] = (uint8_t) value;
+        return length;
+    }
+
+    /* Returns bytes consumed, 0 if the varint runs past end or 64 bits */
+    static size_t getVarint(const uint8_t *buffer, const uint8_t *end, uint64_t *value) {
+        uint64_t result = 0;
+        for(size_t i = 0; i < 10 && buffer + i < end; i++) {
+            result |= (uint64_t) (buffer[i] & 0x7F) << (7 * i);
+            if((buffer[i] & 0x80) == 0) {
+                if(i == 9 && buffer[i] > 1)
+                    return 0;
+                *value = result;
+                return (i + 1);
+            }
+        }
+        return 0;
+    }
+
+    /* Small negative numbers get small encodings too */
+    static uint64_t zigzagEncode(int64_t value) {
+        return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+    }
+
+    static int64_t zigzagDecode(uint64_t value) {
+        return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+    }
+
+    static void putLittleEndian32(uint8_t *buffer, uint32_t value) {
+        buffer[0] = (uint8_t) value;
+        buffer[1] = (uint8_t) (value >> 8);
+        buffer[2] = (uint8_t) (value >> 16);
+        buffer[3] = (uint8_t) (value >> 24);
+    }
+
+    static uint32_t getLittleEndian32(const uint8_t *buffer) {
+        return (uint32_t) buffer[0] | ((uint32_t) buffer[1] << 8) |
+                ((uint32_t) buffer[2] << 16) | ((uint32_t) buffer[3] << 24);
+    }
+
+private:
+    ddfsClusterWire();
+    ddfsClusterWire(ddfsClusterWire const&);   // Don't Implement
+    void operator=(ddfsClusterWire const&);    // Don't implement
+};
+
+/*!
+ *  \class  ddfsClusterPacketView
+ *  \brief  Reads a received packet where it lies.
+ *
+ *   The whole packet is checked when the view is created: lengths,
+ *   message count, the v2 checksum and every varint. Nothing is read
+ *   past size afterwards. v1 messages are handed out as pointers into
+ *   the packet, v2 messages are decoded one at a time.
+ */
+class ddfsClusterPacketView {
+public:
+    ddfsClusterPacketView(void *data, size_t size);
+
+    /*
+     * @return DDFS_OK                  The packet can be read
+     * @return DDFS_NETWORK_UNDERRUN    Packet is truncated
+     * @return DDFS_NETWORK_OVERRUN     Packet is longer than its header says,
+     *                                  or has too many messages
+     * @return DDFS_NETWORK_CORRUPTED   Checksum or encoding is wrong
+     * @return DDFS_FAILURE             Unknown version
+     */
+    ddfsStatus getStatus() {
+        return status;
+    }
+
+    uint8_t getVersion() {
+        return version;
+    }
+
+    uint8_t getTypeOfService() {
+        return typeOfService;
+    }
+
+    uint64_t getUniqueID() {
+        return uniqueID;
+    }
+
+    uint64_t getTotalLength() {
+        return packetSize;
+    }
+
+    int getMessageCount() {
+        return messageCount;
+    }
+
+    uint8_t getFlags() {
+        return flags;
+    }
+
+    /* Kind of a stream packet */
+    uint8_t getStreamKind() {
+        return streamKind;
+    }
+
+    /*
+     * @brief Bytes behind the internal index of a stream packet.
+     *
+     * @return NULL for anything else.
+     */
+    uint8_t *getStreamPayload(size_t *length);
+
+    /* Version to send back to the sender of this packet */
+    uint8_t getPeerVersion();
+
+    /*
+     * @brief The next message of the packet, NULL after the last one.
+     *
+     * scratch holds a decoded v2 message, it is not touched for v1.
+     * The returned message is valid until the next call.
+     */
+    ddfsClusterMessage *nextMessage(ddfsClusterMessage *scratch);
+
+private:
+    uint8_t *packet;
+    size_t packetSize;
+    ddfsStatus status;
+
+    uint8_t version;
+    uint8_t typeOfService;
+    uint64_t uniqueID;
+    uint64_t advertisedVersion;
+    int messageCount;
+    uint8_t flags;
+    uint8_t streamKind;
+
+    /* Iteration state */
+    uint8_t *cursor;
+    uint8_t *end;
+    int messagesRead;
+
+    ddfsStatus validate();
+};
+
+/*!
+ *  \class  ddfsClusterPacketBuilder
+ *  \brief  Encodes a packet straight into the caller's buffer.
+ *
+ *   Messages are written where they end up on the wire, the header and
+ *   checksum are filled in by finish(). Every write is checked against
+ *   the capacity of the buffer.
+ */
+class ddfsClusterPacketBuilder {
+public:
+    ddfsClusterPacketBuilder(uint8_t version, uint8_t typeOfService,
+                    uint64_t uniqueID, uint64_t internalIndex,
+                    uint8_t *buffer, size_t capacity);
+
+    /*
+     * @return DDFS_OK                  Message is written
+     * @return DDFS_NETWORK_OVERRUN     Buffer or message count is full
+     * @return DDFS_FAILURE             Unknown version
+     */
+    ddfsStatus addMessage(uint16_t messageType, int64_t roundNumber,
+                    int64_t proposalNumber, int64_t lastAcceptedProposalNumber,
+                    int64_t lastAcceptedValue);
+
+    /*
+     * @brief Stream packets, header bytes and payload.
+     *
+     * Only valid when the packet was started as a v2 stream packet.
+     */
+    void setStreamHeader(uint8_t kind, uint8_t flags);
+    ddfsStatus addVarint(uint64_t value);
+    ddfsStatus addBytes(const void *data, size_t size);
+
+    /* Complete the packet. Returns its length, 0 if anything failed. */
+    size_t finish();
+
+private:
+    uint8_t version;
+    uint8_t typeOfService;
+    uint64_t uniqueID;
+    uint64_t internalIndex;
+    uint8_t *buffer;
+    size_t capacity;
+    size_t length;
+    int messageCount;
+    uint8_t flags;
+    uint8_t streamKind;
+    ddfsStatus status;
+
+    bool isStream() {
+        return (typeOfService == CLUSTER_MESSAGE_TOF_CLUSTER_STREAM);
+    }
+};
+
+#endif /* Ending DDFS_CLUSTER_WIRE_H */
@@ -0,0 +1,268 @@
+/*!
+ *    \file  ddfs_directoryTable.cpp
+ *   \brief  Directory entries, names mapped to inode numbers.
+ *
+ *  \author  Harman Patial, harman.patial@gmail.com
+ *
+ *  \internal
+ *      Compiler:  g++
+ *     Copyright:
+ *
+ *  This source code is released for free distribution under the terms of the
+ *  GNU General Public License as published by the Free Software Foundation.
+ */
+
+#include <cstdio>
+
+#include <unistd.h>
+
+#include "ddfs_directoryTable.hpp"
+#include "../global/ddfs_epoch.hpp"
+#include "../logger/ddfs_fileLogger.hpp"
+
+using namespace std;
+
+ddfsLogger &global_logger_dir = ddfsLogger::getInstance();
+
+bool ddfsDirectoryTable::isValidName(const string &name) {
+	if(name.empty() || name.size() > DDFS_MAX_NAME_LENGTH)
+		return false;
+	if(name == "." || name == "..")
+		return false;
+	return name.find('/') == string::npos && name.find('\0') == string::npos;
+}
+
+void ddfsDirectoryTable::setWriteHook(ddfsDirectoryWriteHook hook) {
+	writeHook = hook;
+}
+
+void ddfsDirectoryTable::addDirectory(uint64_t directory) {
+	if(find(directory) == NULL) {
+		beforeWrite(directory, NULL);
+		{
+			std::lock_guard<ddfsRWLock> guard(indexLock);
+			directories[directory];
+		}
+		names.set(directory, string(), directory);
+	}
+}
+
+void ddfsDirectoryTable::removeDirectory(uint64_t directory) {
+	map<string, uint64_t> *entries = find(directory);
+	if(entries != NULL) {
+		beforeWrite(directory, entries);
+		names.remove(directory, string());
+		for(map<string, uint64_t>::iterator entry = entries->begin(); entry != entries->end(); entry++)
+			names.remove(directory, entry->first);
+
+		std::lock_guard<ddfsRWLock> guard(indexLock);
+		directories.erase(directory);
+	}
+}
+
+bool ddfsDirectoryTable::hasDirectory(uint64_t directory) {
+	ddfsEpochGuard epoch;
+	uint64_t self;
+	return names.lookup(directory, string(), &self);
+}
+
+ddfsStatus ddfsDirectoryTable::lookup(uint64_t directory, const string &name, uint64_t *inode) {
+	ddfsEpochGuard epoch;
+	uint64_t self;
+
+	/* The empty name is the directory itself, not an entry */
+	if(name.empty() == false && names.lookup(directory, name, inode))
+		return (ddfsStatus(DDFS_OK));
+	if(names.lookup(directory, string(), &self) == false)
+		return (ddfsStatus(DDFS_FILESYSTEM_NOT_A_DIRECTORY));
+	return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+}
+
+ddfsStatus ddfsDirectoryTable::insert(uint64_t directory, const string &name, uint64_t inode) {
+	if(isValidName(name) == false)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	map<string, uint64_t> *entries = find(directory);
+	if(entries == NULL)
+		return (ddfsStatus(DDFS_FILESYSTEM_NOT_A_DIRECTORY));
+
+	if(entries->count(name) != 0)
+		return (ddfsStatus(DDFS_FILESYSTEM_FILE_EXISTS));
+
+	beforeWrite(directory, entries, &name);
+	(*entries)[name] = inode;
+	names.set(directory, name, inode);
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsDirectoryTable::set(uint64_t directory, const string &name, uint64_t inode) {
+	if(isValidName(name) == false)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	map<string, uint64_t> *entries = find(directory);
+	if(entries == NULL)
+		return (ddfsStatus(DDFS_FILESYSTEM_NOT_A_DIRECTORY));
+
+	beforeWrite(directory, entries, &name);
+	(*entries)[name] = inode;
+	names.set(directory, name, inode);
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsDirectoryTable::remove(uint64_t directory, const string &name) {
+	map<string, uint64_t> *entries = find(directory);
+	if(entries == NULL)
+		return (ddfsStatus(DDFS_FILESYSTEM_NOT_A_DIRECTORY));
+
+	map<string, uint64_t>::iterator entry = entries->find(name);
+	if(entry == entries->end())
+		return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+
+	beforeWrite(directory, entries, &name);
+	entries->erase(entry);
+	names.remove(directory, name);
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsDirectoryTable::list(uint64_t directory, vector<pair<string, uint64_t> > *result) {
+	map<string, uint64_t> *entries = find(directory);
+	if(entries == NULL)
+		return (ddfsStatus(DDFS_FILESYSTEM_NOT_A_DIRECTORY));
+
+	result->assign(entries->begin(), entries->end());
+	return (ddfsStatus(DDFS_OK));
+}
+
+size_t ddfsDirectoryTable::getEntryCount(uint64_t directory) {
+	map<string, uint64_t> *entries = find(directory);
+	return entries == NULL ? 0 : entries->size();
+}
+
+const map<string, uint64_t> *ddfsDirectoryTable::getEntries(uint64_t directory) {
+	return find(directory);
+}
+
+void ddfsDirectoryTable::getDirectories(vector<uint64_t> *result) {
+	ddfsSharedGuard guard(indexLock);
+	result->clear();
+	result->reserve(directories.size());
+
+	unordered_map<uint64_t, map<string, uint64_t> >::iterator dir;
+	for(dir = directories.begin(); dir != directories.end(); dir++)
+		result->push_back(dir->first);
+}
+
+void ddfsDirectoryTable::assign(uint64_t directory, const map<string, uint64_t> &entries) {
+	map<string, uint64_t> *existing = find(directory);
+	beforeWrite(directory, existing);
+	if(existing != NULL) {
+		for(map<string, uint64_t>::iterator entry = existing->begin(); entry != existing->end(); entry++) {
+			if(entries.count(entry->first) == 0)
+				names.remove(directory, entry->first);
+		}
+		*existing = entries;
+	} else {
+		std::lock_guard<ddfsRWLock> guard(indexLock);
+		directories[directory] = entries;
+	}
+
+	names.set(directory, string(), directory);
+	for(map<string, uint64_t>::const_iterator entry = entries.begin(); entry != entries.end(); entry++)
+		names.set(directory, entry->first, entry->second);
+}
+
+void ddfsDirectoryTable::clear() {
+	std::lock_guard<ddfsRWLock> guard(indexLock);
+	directories.clear();
+	names.clear();
+}
+
+ddfsStatus ddfsDirectoryTable::save(string path) {
+	string temporary = path + ".tmp";
+	FILE *file = fopen(temporary.c_str(), "wb");
+
+	if(file == NULL) {
+		global_logger_dir << ddfsLogger::LOG_WARNING << "DIRECTORY:: Can not write " << temporary << "\n";
+		return (ddfsStatus(DDFS_FAILURE));
+	}
+
+	ddfsSharedGuard guard(indexLock);
+	bool written = true;
+	uint64_t magic = s_magic, count = directories.size();
+	written &= fwrite(&magic, sizeof(magic), 1, file) == 1;
+	written &= fwrite(&count, sizeof(count), 1, file) == 1;
+
+	unordered_map<uint64_t, map<string, uint64_t> >::iterator dir;
+	for(dir = directories.begin(); dir != directories.end() && written; dir++) {
+		uint64_t entries = dir->second.size();
+		written &= fwrite(&dir->first, sizeof(dir->first), 1, file) == 1;
+		written &= fwrite(&entries, sizeof(entries), 1, file) == 1;
+
+		for(map<string, uint64_t>::iterator entry = dir->second.begin(); entry != dir->second.end(); entry++) {
+			uint32_t length = (uint32_t) entry->first.size();
+			written &= fwrite(&entry->second, sizeof(entry->second), 1, file) == 1;
+			written &= fwrite(&length, sizeof(length), 1, file) == 1;
+			written &= fwrite(entry->first.data(), 1, length, file) == length;
+		}
+	}
+
+	written &= fflush(file) == 0 && fsync(fileno(file)) == 0;
+	fclose(file);
+
+	if(written == false || rename(temporary.c_str(), path.c_str()) != 0) {
+		unlink(temporary.c_str());
+		return (ddfsStatus(DDFS_FAILURE));
+	}
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsDirectoryTable::load(string path) {
+	FILE *file = fopen(path.c_str(), "rb");
+
+	if(file == NULL)
+		return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+
+	unordered_map<uint64_t, map<string, uint64_t> > loaded;
+	uint64_t magic = 0, count = 0;
+	bool good = fread(&magic, sizeof(magic), 1, file) == 1 && magic == s_magic &&
+					fread(&count, sizeof(count), 1, file) == 1;
+
+	for(uint64_t d = 0; d < count && good; d++) {
+		uint64_t directory, entries;
+		good = fread(&directory, sizeof(directory), 1, file) == 1 &&
+						fread(&entries, sizeof(entries), 1, file) == 1;
+
+		map<string, uint64_t> &names = loaded[directory];
+		for(uint64_t e = 0; e < entries && good; e++) {
+			uint64_t inode;
+			uint32_t length;
+			good = fread(&inode, sizeof(inode), 1, file) == 1 &&
+							fread(&length, sizeof(length), 1, file) == 1 &&
+							length <= DDFS_MAX_NAME_LENGTH;
+			if(good == false)
+				break;
+
+			string name(length, '\0');
+			good = fread(&name[0], 1, length, file) == length;
+			names[name] = inode;
+		}
+	}
+	fclose(file);
+
+	if(good == false) {
+		global_logger_dir << ddfsLogger::LOG_WARNING << "DIRECTORY:: " << path << " is corrupted.\n";
+		return (ddfsStatus(DDFS_FILESYSTEM_CORRUPTED));
+	}
+
+	std::lock_guard<ddfsRWLock> guard(indexLock);
+	directories.swap(loaded);
+
+	names.clear();
+	unordered_map<uint64_t, map<string, uint64_t> >::iterator dir;
+	for(dir = directories.begin(); dir != directories.end(); dir++) {
+		names.set(dir->first, string(), dir->first);
+		for(map<string, uint64_t>::iterator entry = dir->second.begin(); entry != dir->second.end(); entry++)
+			names.set(dir->first, entry->first, entry->second);
+	}
+	return (ddfsStatus(DDFS_OK));
+}
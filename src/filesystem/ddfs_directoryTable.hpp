@@ -0,0 +1,148 @@
+/*!
+ *    \file  ddfs_directoryTable.hpp
+ *   \brief  Directory entries, names mapped to inode numbers.
+ *
+ *  A directory is its inode number and a sorted map of the names in it
+ *  to their inode numbers. An entry costs its name and 8 bytes, nothing
+ *  about the file is kept here, that is all in the inode record (see
+ *  ddfs_inodeTable.hpp).
+ *
+ *  The table is saved whole to a file and loaded from it. It locks the
+ *  index of directories itself, never around the write hook. The
+ *  entries of a directory are the caller's to lock: the filesystem
+ *  locks a directory by its number for its entries, to add it and to
+ *  remove it.
+ *
+ *  lookup() and hasDirectory() take no lock, they go to a hash of every
+ *  entry read inside an epoch (see ddfs_nameIndex.hpp). A directory is
+ *  in it too, as an entry of its own with the empty name.
+ *
+ *  The write hook, if set, sees a directory as it is just before each
+ *  change to it, snapshots keep their copy from there. It is told the
+ *  name of the entry about to change, or NULL when all of it may.
+ *
+ *  \author  Harman Patial, harman.patial@gmail.com
+ *
+ *  \internal
+ *      Compiler:  g++
+ *     Copyright:
+ *
+ *  This source code is released for free distribution under the terms of the
+ *  GNU General Public License as published by the Free Software Foundation.
+ */
+
+#ifndef DDFS_DIRECTORYTABLE_HPP
+#define DDFS_DIRECTORYTABLE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <stdint.h>
+
+#include "../global/ddfs_status.hpp"
+#include "../global/ddfs_rwLock.hpp"
+#include "ddfs_nameIndex.hpp"
+
+using namespace std;
+
+#define DDFS_MAX_NAME_LENGTH            255
+
+/* Entries of directory before a change, NULL if it does not exist yet,
+ * and the name of the one entry changed, NULL if it is not just one */
+typedef std::function<void(uint64_t directory, const map<string, uint64_t> *entries,
+				const string *name)> ddfsDirectoryWriteHook;
+
+/*!
+ *  \class  ddfsDirectoryTable
+ *  \brief  Entries of every directory, by directory inode number.
+ */
+class ddfsDirectoryTable {
+public:
+	ddfsDirectoryTable() {}
+
+	/* Start an empty directory */
+	void addDirectory(uint64_t directory);
+	/* Forget a directory, its entries with it */
+	void removeDirectory(uint64_t directory);
+	/* No lock, as lookup() */
+	bool hasDirectory(uint64_t directory);
+
+	/*
+	 * @brief The entry of name, without a lock. It may change as soon as
+	 *        it is returned unless the caller locks the directory.
+	 *
+	 * @return DDFS_OK                              *inode is the entry of name
+	 * @return DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST  No such entry
+	 * @return DDFS_FILESYSTEM_NOT_A_DIRECTORY      directory is not one
+	 */
+	ddfsStatus lookup(uint64_t directory, const string &name, uint64_t *inode);
+
+	/*
+	 * @return DDFS_OK                              Added
+	 * @return DDFS_FILESYSTEM_FILE_EXISTS          name is taken
+	 * @return DDFS_FILESYSTEM_NOT_A_DIRECTORY      directory is not one
+	 * @return DDFS_GENERAL_PARAM_INVALID           name can not be a file name
+	 */
+	ddfsStatus insert(uint64_t directory, const string &name, uint64_t inode);
+	/* As insert, but name may be taken, it points at inode from now on */
+	ddfsStatus set(uint64_t directory, const string &name, uint64_t inode);
+
+	/*
+	 * @return DDFS_OK                              Removed
+	 * @return DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST  No such entry
+	 * @return DDFS_FILESYSTEM_NOT_A_DIRECTORY      directory is not one
+	 */
+	ddfsStatus remove(uint64_t directory, const string &name);
+
+	/* Entries of directory, in name order */
+	ddfsStatus list(uint64_t directory, vector<pair<string, uint64_t> > *entries);
+	size_t getEntryCount(uint64_t directory);
+	/* Entries of directory as they are, NULL if it is not one. Good
+	 * until the next change to the table. */
+	const map<string, uint64_t> *getEntries(uint64_t directory);
+	/* Every directory, in no order */
+	void getDirectories(vector<uint64_t> *directories);
+	/* directory holds entries and nothing else from now on, made if it
+	 * does not exist */
+	void assign(uint64_t directory, const map<string, uint64_t> &entries);
+
+	/* Whole table to and from path, written to a temporary and renamed */
+	ddfsStatus save(string path);
+	ddfsStatus load(string path);
+	void clear();
+
+	static bool isValidName(const string &name);
+
+	/* Not called by load() and clear() */
+	void setWriteHook(ddfsDirectoryWriteHook hook);
+
+private:
+	static const uint64_t s_magic = 0x0052494453464444ULL;   /* "DDFSDIR" */
+
+	/* Guards the index, not the entries of the directories in it */
+	ddfsRWLock indexLock;
+	unordered_map<uint64_t, map<string, uint64_t> > directories;
+	/* Every entry of every directory, for lookup() */
+	ddfsNameIndex names;
+	ddfsDirectoryWriteHook writeHook;
+
+	/* Entries of directory, NULL if it is not one. They do not move
+	 * when other directories come and go. */
+	map<string, uint64_t> *find(uint64_t directory) {
+		ddfsSharedGuard guard(indexLock);
+		unordered_map<uint64_t, map<string, uint64_t> >::iterator dir = directories.find(directory);
+		return dir == directories.end() ? NULL : &dir->second;
+	}
+
+	void beforeWrite(uint64_t directory, const map<string, uint64_t> *entries, const string *name = NULL) {
+		if(writeHook)
+			writeHook(directory, entries, name);
+	}
+
+	ddfsDirectoryTable(ddfsDirectoryTable const&);     // Don't Implement
+	void operator=(ddfsDirectoryTable const&);         // Don't implement
+};
+
+#endif /* Ending DDFS_DIRECTORYTABLE_HPP */
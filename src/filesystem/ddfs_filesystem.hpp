@@ -18,15 +18,32 @@
 #ifndef DDFS_FILESYSTEM_HPP
 #define DDFS_FILESYSTEM_HPP
 
+#include <stdint.h>
 #include <string>
+#include <utility>
+#include <vector>
 #include "../global/ddfs_status.hpp"
 
 using namespace std;
 
+/* What a directory listing tells of each entry */
+struct ddfsFileAttributes {
+	/* Number of the file, unique while it exists */
+	uint64_t inode;
+	uint64_t size;
+	/* Nanoseconds since the epoch */
+	uint64_t accessTime;
+	uint64_t modifyTime;
+	uint64_t changeTime;
+	/* Type and permission bits */
+	uint32_t mode;
+};
+
 template <typename T_fileHandler>
 class ddfsFileSystem {
 public:
-	virtual ddfsStatus openFile(string path, int mode, T_fileHandler handler) = 0;
+	/* Sets handler to the handle of the open file */
+	virtual ddfsStatus openFile(string path, int mode, T_fileHandler *handler) = 0;
 	virtual ddfsStatus closeFile(T_fileHandler handler) = 0;
 
 	virtual ddfsStatus readFile(T_fileHandler handler, int size, void *buffer) = 0;
@@ -35,11 +52,28 @@ public:
 	virtual ddfsStatus writeFile(T_fileHandler handler, int size, void *buffer, int offset) = 0;
 	
 	virtual ddfsStatus seekFile(T_fileHandler handler, int offset) = 0;
+	/* Data written so far is in storage once this returns */
+	virtual ddfsStatus syncFile(T_fileHandler handler) = 0;
 
 	virtual ddfsStatus createFile(string directory, string fileName, int mode) = 0;
-	virtual ddfsStatus makeForectory(string directory, string directoryName) = 0;
+	virtual ddfsStatus makedirectory(string directory, string directoryName) = 0;
+	/* Every one of names in directory, in one commit: all or none */
+	virtual ddfsStatus createFiles(string directory, const vector<string> &names, int mode) = 0;
+	/*
+	 * Move oldPath to newPath in one step, replacing a file or an empty
+	 * directory at newPath. No one ever sees both names, or neither.
+	 */
+	virtual ddfsStatus renameFile(string oldPath, string newPath) = 0;
 
 	virtual ddfsStatus deleteFile(T_fileHandler handler) = 0;
+	/*
+	 * Take path out of the namespace, with everything below it. It is
+	 * gone once this returns, what was below it is deleted in the
+	 * background.
+	 */
+	virtual ddfsStatus removeTree(string path) = 0;
+	/* Entries of the directory at path in name order, each with its attributes */
+	virtual ddfsStatus readDirectory(string path, vector<pair<string, ddfsFileAttributes> > *entries) = 0;
 };
 
 #endif /* Ending DDFS_FILESYSTEM_HPP */
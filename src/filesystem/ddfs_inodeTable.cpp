@@ -0,0 +1,286 @@
+/*!
+ *    \file  ddfs_inodeTable.cpp
+ *   \brief  Dense table of fixed-size inode records, by inode number.
+ *
+ *  \author  Harman Patial, harman.patial@gmail.com
+ *
+ *  \internal
+ *      Compiler:  g++
+ *     Copyright:
+ *
+ *  This source code is released for free distribution under the terms of the
+ *  GNU General Public License as published by the Free Software Foundation.
+ */
+
+#include <cstring>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ddfs_inodeTable.hpp"
+#include "../global/ddfs_epoch.hpp"
+#include "../logger/ddfs_fileLogger.hpp"
+
+using namespace std;
+
+ddfsLogger &global_logger_ino = ddfsLogger::getInstance();
+
+static_assert(sizeof(ddfsInode) == DDFS_INODE_SIZE, "ddfsInode must be DDFS_INODE_SIZE bytes");
+
+ddfsInodeTable::ddfsInodeTable() : fd(-1), records(NULL), mapped(NULL), maxInodes(0) {
+}
+
+ddfsInodeTable::~ddfsInodeTable() {
+	/* Nobody can be reading a table being destroyed */
+	std::lock_guard<std::mutex> guard(tableLock);
+	unmap(false);
+}
+
+ddfsStatus ddfsInodeTable::open(string path, uint64_t max) {
+	close();
+
+	std::lock_guard<std::mutex> guard(tableLock);
+	bool fresh = true;
+
+	if(max < DDFS_INODE_ROOT + 1)
+		max = DDFS_INODE_ROOT + 1;
+
+	if(path.empty()) {
+		void *base = mmap(NULL, max * DDFS_INODE_SIZE, PROT_READ | PROT_WRITE,
+						MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if(base == MAP_FAILED)
+			return (ddfsStatus(DDFS_FAILURE));
+		records = (ddfsInode *) base;
+	} else {
+		fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+		if(fd < 0) {
+			global_logger_ino << ddfsLogger::LOG_WARNING << "INODES:: Can not open " << path << "\n";
+			return (ddfsStatus(DDFS_FAILURE));
+		}
+
+		struct stat info;
+		if(fstat(fd, &info) != 0) {
+			::close(fd);
+			fd = -1;
+			return (ddfsStatus(DDFS_FAILURE));
+		}
+
+		if(info.st_size > 0) {
+			tableHeader existing;
+			if(info.st_size < (off_t) DDFS_INODE_SIZE ||
+							pread(fd, &existing, sizeof(existing), 0) != (ssize_t) sizeof(existing) ||
+							existing.magic != s_magic || existing.recordSize != DDFS_INODE_SIZE) {
+				global_logger_ino << ddfsLogger::LOG_WARNING << "INODES:: " << path
+							<< " is not an inode table.\n";
+				::close(fd);
+				fd = -1;
+				return (ddfsStatus(DDFS_FILESYSTEM_CORRUPTED));
+			}
+			/* The table keeps the size it was made with */
+			max = existing.maxInodes;
+			fresh = false;
+		}
+
+		/* Sparse, only the records in use take room */
+		if((uint64_t) info.st_size < max * DDFS_INODE_SIZE && ftruncate(fd, max * DDFS_INODE_SIZE) != 0) {
+			::close(fd);
+			fd = -1;
+			return (ddfsStatus(DDFS_FAILURE));
+		}
+
+		void *base = mmap(NULL, max * DDFS_INODE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(base == MAP_FAILED) {
+			::close(fd);
+			fd = -1;
+			return (ddfsStatus(DDFS_FAILURE));
+		}
+		records = (ddfsInode *) base;
+	}
+
+	maxInodes = max;
+
+	if(fresh) {
+		tableHeader *h = header();
+		memset(h, 0, DDFS_INODE_SIZE);
+		h->magic = s_magic;
+		h->version = 1;
+		h->recordSize = DDFS_INODE_SIZE;
+		h->maxInodes = max;
+		h->highWater = DDFS_INODE_ROOT;
+		h->used = 0;
+		h->checkpoint = 0;
+	}
+
+	/* Lowest free numbers are given out first */
+	freeNumbers.clear();
+	for(uint64_t number = header()->highWater; number > DDFS_INODE_ROOT; number--) {
+		if(records[number - 1].inode != number - 1)
+			freeNumbers.push_back(number - 1);
+	}
+
+	mapped.store(records, std::memory_order_release);
+	return (ddfsStatus(DDFS_OK));
+}
+
+void ddfsInodeTable::close() {
+	std::lock_guard<std::mutex> guard(tableLock);
+	unmap(true);
+}
+
+bool ddfsInodeTable::read(uint64_t number, ddfsInode *copy) {
+	ddfsInode *base = mapped.load(std::memory_order_acquire);
+
+	/* The header is fixed while it is mapped */
+	if(base == NULL || number == 0 || number >= ((tableHeader *) base)->maxInodes)
+		return false;
+	memcpy(copy, &base[number], sizeof(*copy));
+	return copy->inode == number;
+}
+
+void ddfsInodeTable::unmap(bool deferred) {
+	mapped.store(NULL, std::memory_order_release);
+
+	if(records != NULL) {
+		void *base = records;
+		size_t length = maxInodes * DDFS_INODE_SIZE;
+
+		if(fd >= 0)
+			msync(base, length, MS_SYNC);
+		if(deferred)
+			ddfsEpoch::retire([base, length] { munmap(base, length); });
+		else
+			munmap(base, length);
+		records = NULL;
+	}
+	if(fd >= 0) {
+		::close(fd);
+		fd = -1;
+	}
+	maxInodes = 0;
+	freeNumbers.clear();
+}
+
+void ddfsInodeTable::setWriteHook(ddfsInodeWriteHook hook) {
+	std::lock_guard<std::mutex> guard(tableLock);
+	writeHook = hook;
+}
+
+ddfsStatus ddfsInodeTable::allocate(ddfsInode **inode) {
+	uint64_t number;
+
+	ddfsStatus status = reserve(&number);
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+		return status;
+
+	*inode = claim(number);
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsInodeTable::reserve(uint64_t *number) {
+	std::lock_guard<std::mutex> guard(tableLock);
+
+	if(records == NULL)
+		return (ddfsStatus(DDFS_FAILURE));
+
+	if(freeNumbers.empty() == false) {
+		*number = freeNumbers.back();
+		freeNumbers.pop_back();
+	} else if(header()->highWater < maxInodes) {
+		*number = header()->highWater++;
+	} else {
+		return (ddfsStatus(DDFS_FAILURE));
+	}
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsInode *ddfsInodeTable::claim(uint64_t number) {
+	std::lock_guard<std::mutex> guard(tableLock);
+
+	ddfsInode *record = &records[number];
+	uint64_t generation = record->generation + 1;
+	beforeWrite(number);
+	memset(record, 0, sizeof(ddfsInode));
+	record->inode = number;
+	record->generation = generation;
+	header()->used++;
+	return record;
+}
+
+void ddfsInodeTable::unreserve(uint64_t number) {
+	std::lock_guard<std::mutex> guard(tableLock);
+	freeNumbers.push_back(number);
+}
+
+void ddfsInodeTable::release(uint64_t number) {
+	std::lock_guard<std::mutex> guard(tableLock);
+	ddfsInode *record = get(number);
+
+	if(record == NULL)
+		return;
+
+	beforeWrite(number);
+	uint64_t generation = record->generation;
+	memset(record, 0, sizeof(ddfsInode));
+	record->generation = generation;
+	header()->used--;
+	freeNumbers.push_back(number);
+}
+
+void ddfsInodeTable::restore(const ddfsInode &inode) {
+	std::lock_guard<std::mutex> guard(tableLock);
+	uint64_t number = inode.inode;
+
+	if(records == NULL || number == 0 || number >= maxInodes)
+		return;
+
+	/* Numbers skipped on the way up are free */
+	while(header()->highWater <= number) {
+		uint64_t skipped = header()->highWater++;
+		if(skipped != number)
+			freeNumbers.push_back(skipped);
+	}
+
+	if(records[number].inode != number) {
+		vector<uint64_t>::iterator found = find(freeNumbers.begin(), freeNumbers.end(), number);
+		if(found != freeNumbers.end())
+			freeNumbers.erase(found);
+		header()->used++;
+	}
+
+	beforeWrite(number);
+	records[number] = inode;
+}
+
+ddfsStatus ddfsInodeTable::sync() {
+	std::lock_guard<std::mutex> guard(tableLock);
+
+	if(records == NULL)
+		return (ddfsStatus(DDFS_FAILURE));
+	if(fd >= 0 && msync(records, maxInodes * DDFS_INODE_SIZE, MS_SYNC) != 0)
+		return (ddfsStatus(DDFS_FAILURE));
+	return (ddfsStatus(DDFS_OK));
+}
+
+uint64_t ddfsInodeTable::getUsedCount() {
+	std::lock_guard<std::mutex> guard(tableLock);
+	return records == NULL ? 0 : header()->used;
+}
+
+uint64_t ddfsInodeTable::getHighWater() {
+	std::lock_guard<std::mutex> guard(tableLock);
+	return records == NULL ? 0 : header()->highWater;
+}
+
+uint64_t ddfsInodeTable::getCheckpoint() {
+	std::lock_guard<std::mutex> guard(tableLock);
+	return records == NULL ? 0 : header()->checkpoint;
+}
+
+void ddfsInodeTable::setCheckpoint(uint64_t checkpoint) {
+	std::lock_guard<std::mutex> guard(tableLock);
+	if(records != NULL)
+		header()->checkpoint = checkpoint;
+}
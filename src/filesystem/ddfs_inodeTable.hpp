@@ -0,0 +1,261 @@
+/*!
+ *    \file  ddfs_inodeTable.hpp
+ *   \brief  Dense table of fixed-size inode records, by inode number.
+ *
+ *  Every file and directory is an inode, a ddfsInode record of
+ *  DDFS_INODE_SIZE bytes at its inode number in a flat array. Finding
+ *  the record of an inode is one multiplication, stat is O(1) once the
+ *  number is known. Names live elsewhere, in directory entries pointing
+ *  at inode numbers (see ddfs_directoryTable.hpp), so a rename touches
+ *  one entry and none of the records below it.
+ *
+ *  The array is a file mapped into memory, record 0 is the header. The
+ *  file is made as large as maxInodes up front, sparse, and mapped
+ *  once: records never move and pointers to them stay good while the
+ *  table is open. Without a file the array is anonymous memory.
+ *
+ *  read() copies a record without any lock, for readers that check the
+ *  copy afterwards (see ddfsRWLock::readValidate()). The mapping it
+ *  copies from stays until every epoch it may be read in has ended,
+ *  close() and open() leave the unmapping of the old one to ddfsEpoch.
+ *
+ *  A free record has inode 0. Numbers of deleted inodes are reused, the
+ *  generation of the record tells the reuses apart.
+ *
+ *  Records are changed in blocks of DDFS_INODE_BLOCK_RECORDS. The write
+ *  hook, if set, sees the block as it is before each change, snapshots
+ *  keep their copy of it from there. Changes go through modify() or the
+ *  calls below, never through a pointer from get().
+ *
+ *  The table keeps its own free list and header consistent. A record
+ *  is the caller's to lock, the filesystem locks it by its number.
+ *
+ *  There are no hard links: every inode has exactly one parent.
+ *
+ *  \author  Harman Patial, harman.patial@gmail.com
+ *
+ *  \internal
+ *      Compiler:  g++
+ *     Copyright:
+ *
+ *  This source code is released for free distribution under the terms of the
+ *  GNU General Public License as published by the Free Software Foundation.
+ */
+
+#ifndef DDFS_INODETABLE_HPP
+#define DDFS_INODETABLE_HPP
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+
+#include "../global/ddfs_status.hpp"
+#include "../global/ddfs_reedSolomon.hpp"
+
+using namespace std;
+
+#define DDFS_INODE_SIZE                 128
+#define DDFS_INODE_DEFAULT_MAX          (1024 * 1024)
+#define DDFS_INODE_ROOT                 1
+/* 4KB of records, the unit of copy-on-write */
+#define DDFS_INODE_BLOCK_RECORDS        32
+
+/* Type bits of ddfsInode::mode, as in stat(2) */
+#define DDFS_INODE_TYPE_MASK            0170000
+#define DDFS_INODE_TYPE_FILE            0100000
+#define DDFS_INODE_TYPE_DIRECTORY       0040000
+
+/* ddfsRedundancy::scheme */
+#define DDFS_REDUNDANCY_REPLICATED      0
+#define DDFS_REDUNDANCY_ERASURE_CODED   1
+
+/*!
+ *  \class  ddfsRedundancy
+ *  \brief  How the data of a file is kept, fixed when it is created.
+ *
+ *  Replicated data has no fragment counts. Erasure coded data is kept
+ *  as dataFragments + parityFragments fragments of every chunk (see
+ *  ddfs_reedSolomon.hpp). Records written before there was a scheme
+ *  have zeroes here, which reads as replicated.
+ */
+struct ddfsRedundancy {
+	uint8_t scheme;
+	uint8_t dataFragments;
+	uint8_t parityFragments;
+
+	bool isValid() const {
+		if(scheme == DDFS_REDUNDANCY_REPLICATED)
+			return dataFragments == 0 && parityFragments == 0;
+		return scheme == DDFS_REDUNDANCY_ERASURE_CODED && dataFragments >= 1 && parityFragments >= 1 &&
+					dataFragments + parityFragments <= DDFS_RS_MAX_FRAGMENTS;
+	}
+};
+
+/*!
+ *  \class  ddfsInode
+ *  \brief  Record of one file or directory, DDFS_INODE_SIZE bytes.
+ */
+struct ddfsInode {
+	/* Own number, 0 while the record is free */
+	uint64_t inode;
+	/* Directory holding the only link to it */
+	uint64_t parent;
+	uint64_t size;
+	/* First block of the extent map, 0 while data is addressed by
+	 * inode and offset alone */
+	uint64_t extentRoot;
+	/* Nanoseconds since the epoch */
+	uint64_t accessTime;
+	uint64_t modifyTime;
+	uint64_t changeTime;
+	/* Bumped every time the number is given out */
+	uint64_t generation;
+	/* Type and permission bits */
+	uint32_t mode;
+	uint32_t flags;
+	/* Of a file, zeroes for a directory */
+	ddfsRedundancy redundancy;
+	uint8_t reserved[53];
+
+	bool isDirectory() const {
+		return (mode & DDFS_INODE_TYPE_MASK) == DDFS_INODE_TYPE_DIRECTORY;
+	}
+};
+
+/* Block before a change, records are its DDFS_INODE_BLOCK_RECORDS records */
+typedef std::function<void(uint64_t block, const ddfsInode *records)> ddfsInodeWriteHook;
+
+/*!
+ *  \class  ddfsInodeTable
+ *  \brief  The inode array, mapped from a file or anonymous.
+ */
+class ddfsInodeTable {
+public:
+	ddfsInodeTable();
+	~ddfsInodeTable();
+
+	/*
+	 * @brief Map the table of path, made if it does not exist.
+	 *
+	 * An empty path keeps the table in memory only. A table open
+	 * already is closed first.
+	 *
+	 * @return DDFS_OK                      Mapped
+	 * @return DDFS_FILESYSTEM_CORRUPTED    path is not an inode table
+	 * @return DDFS_FAILURE                 It could not be opened or mapped
+	 */
+	ddfsStatus open(string path, uint64_t maxInodes = DDFS_INODE_DEFAULT_MAX);
+	void close();
+
+	/*
+	 * @brief Give out a free inode number, its record zeroed but for
+	 *        the number and generation.
+	 *
+	 * @return DDFS_OK          *inode is the new record
+	 * @return DDFS_FAILURE     The table is full
+	 */
+	ddfsStatus allocate(ddfsInode **inode);
+	/*
+	 * @brief allocate() in two steps: take a free number, nothing is
+	 *        written, then claim() it, eg. once the caller has locked
+	 *        it. One not claimed goes back with unreserve().
+	 *
+	 * @return DDFS_OK          *number is reserved
+	 * @return DDFS_FAILURE     The table is full
+	 */
+	ddfsStatus reserve(uint64_t *number);
+	ddfsInode *claim(uint64_t number);
+	void unreserve(uint64_t number);
+	/* Free the record of number */
+	void release(uint64_t number);
+	/* Put a record back as it was, in use or not, eg. from the journal */
+	void restore(const ddfsInode &inode);
+
+	/* Record of number, NULL if out of range or free */
+	ddfsInode *get(uint64_t number) {
+		if(number == 0 || number >= maxInodes || records == NULL)
+			return NULL;
+		ddfsInode *inode = &records[number];
+		return inode->inode == number ? inode : NULL;
+	}
+	/*
+	 * @brief Copy of the record of number, without a lock. Within an
+	 *        epoch, the copy may be torn by a writer of it.
+	 *
+	 * @return false if it is out of range or free
+	 */
+	bool read(uint64_t number, ddfsInode *copy);
+	/* get() for a change to the record */
+	ddfsInode *modify(uint64_t number) {
+		ddfsInode *inode = get(number);
+		if(inode != NULL)
+			beforeWrite(number);
+		return inode;
+	}
+
+	void setWriteHook(ddfsInodeWriteHook hook);
+
+	/* Write the mapped records back to the file */
+	ddfsStatus sync();
+
+	uint64_t getUsedCount();
+	uint64_t getMaxInodes() {
+		return maxInodes;
+	}
+	/* Numbers at or above it were never given out */
+	uint64_t getHighWater();
+
+	/* Number of the checkpoint the records on file belong to, kept in
+	 * the header and written with them by sync() */
+	uint64_t getCheckpoint();
+	void setCheckpoint(uint64_t checkpoint);
+
+	/* Base of the array, record 0 is the header */
+	uint8_t *getBase() {
+		return (uint8_t *) records;
+	}
+
+private:
+	struct tableHeader {
+		uint64_t magic;
+		uint32_t version;
+		uint32_t recordSize;
+		uint64_t maxInodes;
+		/* Numbers at or above this were never given out */
+		uint64_t highWater;
+		uint64_t used;
+		/* 0 in a table that never saw one */
+		uint64_t checkpoint;
+	};
+
+	static const uint64_t s_magic = 0x444f4e4953464444ULL;  /* "DDFSINOD" */
+
+	std::mutex tableLock;
+	int fd;
+	ddfsInode *records;
+	/* records, for read(). Set once they are ready, cleared first */
+	std::atomic<ddfsInode *> mapped;
+	uint64_t maxInodes;
+	vector<uint64_t> freeNumbers;
+	ddfsInodeWriteHook writeHook;
+
+	tableHeader *header() {
+		return (tableHeader *) records;
+	}
+
+	/* Unmap now, or once no reader can still be on it */
+	void unmap(bool deferred);
+
+	void beforeWrite(uint64_t number) {
+		if(writeHook)
+			writeHook(number / DDFS_INODE_BLOCK_RECORDS, &records[number - number % DDFS_INODE_BLOCK_RECORDS]);
+	}
+
+	ddfsInodeTable(ddfsInodeTable const&);     // Don't Implement
+	void operator=(ddfsInodeTable const&);     // Don't implement
+};
+
+#endif /* Ending DDFS_INODETABLE_HPP */
@@ -0,0 +1,333 @@
+/*!
+ *    \file  ddfs_metadataCheckpoint.cpp
+ *   \brief  Incremental checkpoints of the metadata, and the updates that
+ *           carry them and the journal tail to followers.
+ *
+ *  \author  Harman Patial, harman.patial@gmail.com
+ *
+ *  \internal
+ *      Compiler:  g++
+ *     Copyright:
+ *
+ *  This source code is released for free distribution under the terms of the
+ *  GNU General Public License as published by the Free Software Foundation.
+ */
+
+#include <cstring>
+
+#include "ddfs_metadataCheckpoint.hpp"
+#include "../global/ddfs_compress.hpp"
+
+using namespace std;
+
+/* kind, base, checkpoint, index and raw length */
+#define DDFS_UPDATE_HEADER_BYTES        29
+/* Stamped entries a directory may have beyond its live ones */
+#define DDFS_CHECKPOINT_ENTRY_SLACK     64
+
+/* How a directory is in a delta */
+enum deltaDirectory {
+	DELTA_DIRECTORY_REMOVED = 0,
+	DELTA_DIRECTORY_WHOLE,
+	/* Just the entries changed, inode 0 for one removed */
+	DELTA_DIRECTORY_ENTRIES
+};
+
+static void put(vector<uint8_t> *out, const void *data, size_t length) {
+	const uint8_t *bytes = (const uint8_t *) data;
+	out->insert(out->end(), bytes, bytes + length);
+}
+
+template <typename T>
+static bool take(const uint8_t **data, const uint8_t *end, T *value) {
+	if((size_t) (end - *data) < sizeof(T))
+		return false;
+	memcpy(value, *data, sizeof(T));
+	*data += sizeof(T);
+	return true;
+}
+
+void ddfsMetadataUpdate::encode(vector<uint8_t> *out) const {
+	vector<uint8_t> compressed;
+	ddfsCompress(body.empty() ? NULL : &body[0], body.size(), &compressed);
+
+	uint32_t length = (uint32_t) (DDFS_UPDATE_HEADER_BYTES + compressed.size());
+	uint8_t type = (uint8_t) kind;
+	uint32_t raw = (uint32_t) body.size();
+
+	put(out, &length, sizeof(length));
+	put(out, &type, sizeof(type));
+	put(out, &base, sizeof(base));
+	put(out, &checkpoint, sizeof(checkpoint));
+	put(out, &index, sizeof(index));
+	put(out, &raw, sizeof(raw));
+	put(out, compressed.empty() ? NULL : &compressed[0], compressed.size());
+}
+
+bool ddfsMetadataUpdate::decode(const uint8_t **data, const uint8_t *end) {
+	const uint8_t *cursor = *data;
+	uint32_t length, raw;
+	uint8_t type;
+
+	if(take(&cursor, end, &length) == false || length < DDFS_UPDATE_HEADER_BYTES ||
+					length > (size_t) (end - cursor))
+		return false;
+
+	const uint8_t *last = cursor + length;
+	take(&cursor, last, &type);
+	take(&cursor, last, &base);
+	take(&cursor, last, &checkpoint);
+	take(&cursor, last, &index);
+	take(&cursor, last, &raw);
+
+	if(type != METADATA_UPDATE_TRANSACTION && type != METADATA_UPDATE_CHECKPOINT)
+		return false;
+	kind = (ddfsMetadataUpdateKind) type;
+	if(ddfsDecompress(cursor, (size_t) (last - cursor), &body, raw) == false)
+		return false;
+
+	*data = last;
+	return true;
+}
+
+ddfsCheckpointTracker::ddfsCheckpointTracker() : current(0), knownSince(0) {
+}
+
+void ddfsCheckpointTracker::reset(uint64_t checkpoint) {
+	current = knownSince = checkpoint;
+	blockStamps.clear();
+	directoryStamps.clear();
+	entryStamps.clear();
+}
+
+void ddfsCheckpointTracker::advance(uint64_t checkpoint) {
+	current = checkpoint;
+}
+
+void ddfsCheckpointTracker::inodeBlockChanged(uint64_t block) {
+	if(block >= blockStamps.size())
+		blockStamps.resize(block + 1, 0);
+	blockStamps[block] = current + 1;
+}
+
+void ddfsCheckpointTracker::directoryChanged(uint64_t directory, const map<string, uint64_t> *entries,
+				const string *name) {
+	if(name != NULL) {
+		unordered_map<string, uint64_t> &stamps = entryStamps[directory];
+		stamps[*name] = current + 1;
+
+		size_t live = entries == NULL ? 0 : entries->size();
+		if(stamps.size() <= 2 * live + DDFS_CHECKPOINT_ENTRY_SLACK)
+			return;
+	}
+
+	/* Whatever is stamped on its entries is older */
+	directoryStamps[directory] = current + 1;
+	entryStamps.erase(directory);
+}
+
+/* The records of block, free ones past the end of the table */
+static void putBlock(vector<uint8_t> *body, ddfsInodeTable &inodes, uint64_t block) {
+	uint64_t first = block * DDFS_INODE_BLOCK_RECORDS;
+	uint64_t records = inodes.getMaxInodes() > first ? inodes.getMaxInodes() - first : 0;
+	if(records > DDFS_INODE_BLOCK_RECORDS)
+		records = DDFS_INODE_BLOCK_RECORDS;
+
+	put(body, &block, sizeof(block));
+	put(body, inodes.getBase() + first * DDFS_INODE_SIZE, records * DDFS_INODE_SIZE);
+	body->resize(body->size() + (DDFS_INODE_BLOCK_RECORDS - records) * DDFS_INODE_SIZE, 0);
+}
+
+static void putEntry(vector<uint8_t> *body, const string &name, uint64_t inode) {
+	uint32_t length = (uint32_t) name.size();
+	put(body, &inode, sizeof(inode));
+	put(body, &length, sizeof(length));
+	put(body, name.data(), length);
+}
+
+static void putDirectory(vector<uint8_t> *body, uint64_t directory, const map<string, uint64_t> *entries) {
+	uint8_t state = entries == NULL ? DELTA_DIRECTORY_REMOVED : DELTA_DIRECTORY_WHOLE;
+	uint64_t count = entries == NULL ? 0 : entries->size();
+
+	put(body, &directory, sizeof(directory));
+	put(body, &state, sizeof(state));
+	put(body, &count, sizeof(count));
+	if(entries == NULL)
+		return;
+
+	for(map<string, uint64_t>::const_iterator entry = entries->begin(); entry != entries->end(); entry++)
+		putEntry(body, entry->first, entry->second);
+}
+
+/* The entries of directory stamped after since, false if there are none */
+static bool putEntries(vector<uint8_t> *body, uint64_t directory, const map<string, uint64_t> *entries,
+				const unordered_map<string, uint64_t> &stamps, uint64_t since) {
+	uint8_t state = DELTA_DIRECTORY_ENTRIES;
+	uint64_t count = 0;
+	size_t countAt;
+
+	put(body, &directory, sizeof(directory));
+	put(body, &state, sizeof(state));
+	countAt = body->size();
+	put(body, &count, sizeof(count));
+
+	for(unordered_map<string, uint64_t>::const_iterator stamp = stamps.begin(); stamp != stamps.end(); stamp++) {
+		if(stamp->second <= since)
+			continue;
+		map<string, uint64_t>::const_iterator entry;
+		if(entries == NULL || (entry = entries->find(stamp->first)) == entries->end())
+			putEntry(body, stamp->first, 0);
+		else
+			putEntry(body, entry->first, entry->second);
+		count++;
+	}
+
+	if(count == 0) {
+		body->resize(countAt - sizeof(directory) - sizeof(state));
+		return false;
+	}
+	memcpy(&(*body)[countAt], &count, sizeof(count));
+	return true;
+}
+
+void ddfsCheckpointTracker::encodeDelta(uint64_t since, ddfsInodeTable &inodes, ddfsDirectoryTable &directories,
+				vector<uint8_t> *body, uint64_t *blocks, uint64_t *directoryCount) {
+	uint8_t full = since == 0 || since < knownSince || since > current;
+	uint64_t highWater = inodes.getHighWater();
+	uint64_t blockCount = 0, dirCount = 0;
+	size_t countAt;
+
+	body->clear();
+	put(body, &full, sizeof(full));
+	put(body, &highWater, sizeof(highWater));
+
+	/* Counts are filled in once known */
+	countAt = body->size();
+	put(body, &blockCount, sizeof(blockCount));
+	if(full) {
+		for(uint64_t block = 0; block * DDFS_INODE_BLOCK_RECORDS < highWater; block++, blockCount++)
+			putBlock(body, inodes, block);
+	} else {
+		for(uint64_t block = 0; block < blockStamps.size(); block++) {
+			if(blockStamps[block] > since) {
+				putBlock(body, inodes, block);
+				blockCount++;
+			}
+		}
+	}
+	memcpy(&(*body)[countAt], &blockCount, sizeof(blockCount));
+
+	countAt = body->size();
+	put(body, &dirCount, sizeof(dirCount));
+	if(full) {
+		vector<uint64_t> all;
+		directories.getDirectories(&all);
+		for(vector<uint64_t>::iterator dir = all.begin(); dir != all.end(); dir++, dirCount++)
+			putDirectory(body, *dir, directories.getEntries(*dir));
+	} else {
+		unordered_map<uint64_t, uint64_t>::iterator stamp;
+		for(stamp = directoryStamps.begin(); stamp != directoryStamps.end(); stamp++) {
+			if(stamp->second > since) {
+				putDirectory(body, stamp->first, directories.getEntries(stamp->first));
+				dirCount++;
+			}
+		}
+
+		unordered_map<uint64_t, unordered_map<string, uint64_t> >::iterator names;
+		for(names = entryStamps.begin(); names != entryStamps.end(); names++) {
+			/* Sent whole already */
+			stamp = directoryStamps.find(names->first);
+			if(stamp != directoryStamps.end() && stamp->second > since)
+				continue;
+			if(putEntries(body, names->first, directories.getEntries(names->first), names->second, since))
+				dirCount++;
+		}
+	}
+	memcpy(&(*body)[countAt], &dirCount, sizeof(dirCount));
+
+	if(blocks != NULL)
+		*blocks = blockCount;
+	if(directoryCount != NULL)
+		*directoryCount = dirCount;
+}
+
+bool ddfsCheckpointTracker::isFullDelta(const vector<uint8_t> &body) {
+	return body.empty() == false && body[0] != 0;
+}
+
+ddfsStatus ddfsCheckpointTracker::applyDelta(const vector<uint8_t> &body, ddfsInodeTable &inodes,
+				ddfsDirectoryTable &directories) {
+	const uint8_t *cursor = body.empty() ? NULL : &body[0], *end = cursor + body.size();
+	uint8_t full;
+	uint64_t highWater, count;
+
+	if(take(&cursor, end, &full) == false || take(&cursor, end, &highWater) == false ||
+					take(&cursor, end, &count) == false)
+		return (ddfsStatus(DDFS_FILESYSTEM_CORRUPTED));
+
+	if(full) {
+		directories.clear();
+		/* What the leader never gave out is free */
+		for(uint64_t number = inodes.getHighWater(); number > highWater; number--)
+			inodes.release(number - 1);
+	}
+
+	for(uint64_t b = 0; b < count; b++) {
+		uint64_t block;
+		if(take(&cursor, end, &block) == false ||
+						(size_t) (end - cursor) < DDFS_INODE_BLOCK_RECORDS * DDFS_INODE_SIZE)
+			return (ddfsStatus(DDFS_FILESYSTEM_CORRUPTED));
+
+		for(uint64_t i = 0; i < DDFS_INODE_BLOCK_RECORDS; i++, cursor += DDFS_INODE_SIZE) {
+			uint64_t number = block * DDFS_INODE_BLOCK_RECORDS + i;
+			ddfsInode record;
+			memcpy(&record, cursor, sizeof(record));
+
+			/* Record 0 is the header of the table */
+			if(number == 0 || number >= inodes.getMaxInodes())
+				continue;
+			if(record.inode == number)
+				inodes.restore(record);
+			else if(inodes.get(number) != NULL)
+				inodes.release(number);
+		}
+	}
+
+	if(take(&cursor, end, &count) == false)
+		return (ddfsStatus(DDFS_FILESYSTEM_CORRUPTED));
+
+	for(uint64_t d = 0; d < count; d++) {
+		uint64_t directory, entries;
+		uint8_t state;
+		if(take(&cursor, end, &directory) == false || take(&cursor, end, &state) == false ||
+						take(&cursor, end, &entries) == false || state > DELTA_DIRECTORY_ENTRIES)
+			return (ddfsStatus(DDFS_FILESYSTEM_CORRUPTED));
+
+		if(state == DELTA_DIRECTORY_REMOVED) {
+			directories.removeDirectory(directory);
+			continue;
+		}
+
+		map<string, uint64_t> names;
+		for(uint64_t e = 0; e < entries; e++) {
+			uint64_t inode;
+			uint32_t length;
+			if(take(&cursor, end, &inode) == false || take(&cursor, end, &length) == false ||
+							length > DDFS_MAX_NAME_LENGTH || length > (size_t) (end - cursor))
+				return (ddfsStatus(DDFS_FILESYSTEM_CORRUPTED));
+			string name((const char *) cursor, length);
+			cursor += length;
+
+			if(state == DELTA_DIRECTORY_WHOLE)
+				names[name] = inode;
+			else if(inode == 0)
+				directories.remove(directory, name);
+			else
+				directories.set(directory, name, inode);
+		}
+		if(state == DELTA_DIRECTORY_WHOLE)
+			directories.assign(directory, names);
+	}
+
+	return cursor == end ? ddfsStatus(DDFS_OK) : ddfsStatus(DDFS_FILESYSTEM_CORRUPTED);
+}
@@ -0,0 +1,147 @@
+/*!
+ *    \file  ddfs_metadataCheckpoint.hpp
+ *   \brief  Incremental checkpoints of the metadata, and the updates that
+ *           carry them and the journal tail to followers.
+ *
+ *  Checkpoints are numbered. The tracker stamps every block of inode
+ *  records (DDFS_INODE_BLOCK_RECORDS of them) and every directory entry
+ *  with the number of the checkpoint its last change will go into, so
+ *  the change since any checkpoint it knows of is found without looking
+ *  at what did not change. A follower behind by a few checkpoints is
+ *  sent the blocks and entries stamped after its own, how many there
+ *  are depends on the churn, not on the size of the namespace. A
+ *  directory made or removed is stamped whole, and so is one whose
+ *  stamped entries come to outnumber its live ones, which bounds what
+ *  the tracker keeps of names long gone.
+ *
+ *  A follower catches up from a checkpoint delta and the transactions
+ *  after it, the tail of the journal. Both travel as updates:
+ *
+ *   +--------+------+---------+------------+---------+-----------+------------+
+ *   | length | kind | base    | checkpoint | index   | raw bytes | body, LZ   |
+ *   | 4      | 1    | 8 bytes | 8 bytes    | 8 bytes | 4         | compressed |
+ *   +--------+------+---------+------------+---------+-----------+------------+
+ *
+ *  A transaction update is the index-th transaction after checkpoint
+ *  base, its body is the transaction as in the journal. A checkpoint
+ *  update takes a follower at base, or at any checkpoint between base
+ *  and checkpoint, to checkpoint, its body is the delta. A full delta is
+ *  the whole metadata and takes a follower from anywhere. Updates are
+ *  whole in themselves, any number of them back to back is a catch-up.
+ *
+ *  Like the snapshots, no locking of its own.
+ *
+ *  \author  Harman Patial, harman.patial@gmail.com
+ *
+ *  \internal
+ *      Compiler:  g++
+ *     Copyright:
+ *
+ *  This source code is released for free distribution under the terms of the
+ *  GNU General Public License as published by the Free Software Foundation.
+ */
+
+#ifndef DDFS_METADATACHECKPOINT_HPP
+#define DDFS_METADATACHECKPOINT_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <stdint.h>
+
+#include "ddfs_inodeTable.hpp"
+#include "ddfs_directoryTable.hpp"
+#include "../global/ddfs_status.hpp"
+
+using namespace std;
+
+enum ddfsMetadataUpdateKind {
+	METADATA_UPDATE_TRANSACTION = 1,
+	METADATA_UPDATE_CHECKPOINT
+};
+
+/* Gets every update as it is made, whole and encoded */
+typedef std::function<void(const vector<uint8_t> &update)> ddfsMetadataUpdateHandler;
+
+/*!
+ *  \class  ddfsMetadataUpdate
+ *  \brief  One transaction or checkpoint delta on its way to a follower.
+ */
+struct ddfsMetadataUpdate {
+	ddfsMetadataUpdateKind kind;
+	uint64_t base;
+	uint64_t checkpoint;
+	/* From 1, 0 for a checkpoint */
+	uint64_t index;
+	/* Not compressed */
+	vector<uint8_t> body;
+
+	/* Compressed, appended to out */
+	void encode(vector<uint8_t> *out) const;
+	/* Take the update at *data, false if there is not a whole one */
+	bool decode(const uint8_t **data, const uint8_t *end);
+};
+
+/*!
+ *  \class  ddfsCheckpointTracker
+ *  \brief  What changed in the metadata after which checkpoint.
+ */
+class ddfsCheckpointTracker {
+public:
+	ddfsCheckpointTracker();
+
+	/* Nothing before checkpoint is known, eg. after loading it */
+	void reset(uint64_t checkpoint);
+	/* Changes from now on go into checkpoint + 1 */
+	void advance(uint64_t checkpoint);
+	/* The last checkpoint */
+	uint64_t getCheckpoint() {
+		return current;
+	}
+
+	/* Write hooks of the tables */
+	void inodeBlockChanged(uint64_t block);
+	/* name is the entry about to change, NULL for the whole directory */
+	void directoryChanged(uint64_t directory, const map<string, uint64_t> *entries, const string *name);
+
+	/*
+	 * @brief Delta of everything changed after checkpoint since, into
+	 *        body. Full when since is 0 or not known, ie. before the
+	 *        last reset or after the last checkpoint.
+	 *
+	 * blocks and directories, if not NULL, count what went in.
+	 */
+	void encodeDelta(uint64_t since, ddfsInodeTable &inodes, ddfsDirectoryTable &directories,
+					vector<uint8_t> *body, uint64_t *blocks = NULL, uint64_t *directoryCount = NULL);
+
+	/* true if body is a full delta */
+	static bool isFullDelta(const vector<uint8_t> &body);
+	/*
+	 * @brief Make the tables as the delta has them. A full delta clears
+	 *        them first.
+	 *
+	 * @return DDFS_OK                      Applied
+	 * @return DDFS_FILESYSTEM_CORRUPTED    body is not a delta, the tables
+	 *                                      may be half way
+	 */
+	static ddfsStatus applyDelta(const vector<uint8_t> &body, ddfsInodeTable &inodes,
+					ddfsDirectoryTable &directories);
+
+private:
+	uint64_t current;
+	uint64_t knownSince;
+	/* Checkpoint the last change of each block went into, 0 if none */
+	vector<uint64_t> blockStamps;
+	/* Kept after a directory is removed, the removal is a change too */
+	unordered_map<uint64_t, uint64_t> directoryStamps;
+	/* Entries changed since the directory was last stamped whole, kept
+	 * after they are removed too */
+	unordered_map<uint64_t, unordered_map<string, uint64_t> > entryStamps;
+
+	ddfsCheckpointTracker(ddfsCheckpointTracker const&);     // Don't Implement
+	void operator=(ddfsCheckpointTracker const&);            // Don't implement
+};
+
+#endif /* Ending DDFS_METADATACHECKPOINT_HPP */
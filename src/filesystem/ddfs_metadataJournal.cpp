@@ -0,0 +1,380 @@
+/*!
+ *    \file  ddfs_metadataJournal.cpp
+ *   \brief  Transactions on the metadata and the journal that makes them atomic.
+ *
+ *  \author  Harman Patial, harman.patial@gmail.com
+ *
+ *  \internal
+ *      Compiler:  g++
+ *     Copyright:
+ *
+ *  This source code is released for free distribution under the terms of the
+ *  GNU General Public License as published by the Free Software Foundation.
+ */
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ddfs_metadataJournal.hpp"
+#include "../global/ddfs_crc32c.hpp"
+#include "../logger/ddfs_fileLogger.hpp"
+
+using namespace std;
+
+ddfsLogger &global_logger_jnl = ddfsLogger::getInstance();
+
+/* length and CRC32C ahead of every record */
+#define DDFS_JOURNAL_RECORD_HEADER      8
+
+static void put(vector<uint8_t> *out, const void *data, size_t length) {
+	const uint8_t *bytes = (const uint8_t *) data;
+	out->insert(out->end(), bytes, bytes + length);
+}
+
+template <typename T>
+static bool take(const uint8_t **data, const uint8_t *end, T *value) {
+	if((size_t) (end - *data) < sizeof(T))
+		return false;
+	memcpy(value, *data, sizeof(T));
+	*data += sizeof(T);
+	return true;
+}
+
+void ddfsMetadataTransaction::setInode(const ddfsInode &inode) {
+	operation op;
+	op.type = JOURNAL_SET_INODE;
+	op.directory = 0;
+	op.number = inode.inode;
+	op.inode = inode;
+	operations.push_back(op);
+}
+
+void ddfsMetadataTransaction::freeInode(uint64_t number) {
+	operation op;
+	op.type = JOURNAL_FREE_INODE;
+	op.directory = 0;
+	op.number = number;
+	operations.push_back(op);
+}
+
+void ddfsMetadataTransaction::link(uint64_t directory, const string &name, uint64_t inode) {
+	operation op;
+	op.type = JOURNAL_LINK;
+	op.directory = directory;
+	op.number = inode;
+	op.name = name;
+	operations.push_back(op);
+}
+
+void ddfsMetadataTransaction::unlink(uint64_t directory, const string &name) {
+	operation op;
+	op.type = JOURNAL_UNLINK;
+	op.directory = directory;
+	op.number = 0;
+	op.name = name;
+	operations.push_back(op);
+}
+
+void ddfsMetadataTransaction::addDirectory(uint64_t directory) {
+	operation op;
+	op.type = JOURNAL_ADD_DIRECTORY;
+	op.directory = directory;
+	op.number = 0;
+	operations.push_back(op);
+}
+
+void ddfsMetadataTransaction::removeDirectory(uint64_t directory) {
+	operation op;
+	op.type = JOURNAL_REMOVE_DIRECTORY;
+	op.directory = directory;
+	op.number = 0;
+	operations.push_back(op);
+}
+
+void ddfsMetadataTransaction::apply(ddfsInodeTable &inodes, ddfsDirectoryTable &directories,
+				vector<uint64_t> *freed) const {
+	for(vector<operation>::const_iterator op = operations.begin(); op != operations.end(); op++) {
+		switch(op->type) {
+		case JOURNAL_SET_INODE:
+			inodes.restore(op->inode);
+			break;
+		case JOURNAL_FREE_INODE:
+			if(freed != NULL)
+				freed->push_back(op->number);
+			else
+				inodes.release(op->number);
+			break;
+		case JOURNAL_LINK:
+			directories.set(op->directory, op->name, op->number);
+			break;
+		case JOURNAL_UNLINK:
+			/* Gone already when replayed over a later checkpoint */
+			directories.remove(op->directory, op->name);
+			break;
+		case JOURNAL_ADD_DIRECTORY:
+			directories.addDirectory(op->directory);
+			break;
+		case JOURNAL_REMOVE_DIRECTORY:
+			directories.removeDirectory(op->directory);
+			break;
+		}
+	}
+}
+
+void ddfsMetadataTransaction::encode(vector<uint8_t> *out) const {
+	uint32_t count = (uint32_t) operations.size();
+	put(out, &count, sizeof(count));
+
+	for(vector<operation>::const_iterator op = operations.begin(); op != operations.end(); op++) {
+		uint32_t type = (uint32_t) op->type;
+		uint32_t length = (uint32_t) op->name.size();
+		put(out, &type, sizeof(type));
+		put(out, &op->directory, sizeof(op->directory));
+		put(out, &op->number, sizeof(op->number));
+		put(out, &length, sizeof(length));
+		put(out, op->name.data(), length);
+		if(op->type == JOURNAL_SET_INODE)
+			put(out, &op->inode, sizeof(op->inode));
+	}
+}
+
+bool ddfsMetadataTransaction::decode(const uint8_t *data, size_t length) {
+	const uint8_t *end = data + length;
+	uint32_t count;
+
+	operations.clear();
+	if(take(&data, end, &count) == false)
+		return false;
+
+	for(uint32_t i = 0; i < count; i++) {
+		operation op;
+		uint32_t type, nameLength;
+
+		if(take(&data, end, &type) == false || type < JOURNAL_SET_INODE || type > JOURNAL_REMOVE_DIRECTORY ||
+						take(&data, end, &op.directory) == false ||
+						take(&data, end, &op.number) == false ||
+						take(&data, end, &nameLength) == false ||
+						nameLength > DDFS_MAX_NAME_LENGTH || (size_t) (end - data) < nameLength)
+			return false;
+
+		op.type = (ddfsJournalOperation) type;
+		op.name.assign((const char *) data, nameLength);
+		data += nameLength;
+
+		if(op.type == JOURNAL_SET_INODE && take(&data, end, &op.inode) == false)
+			return false;
+		operations.push_back(op);
+	}
+
+	return data == end;
+}
+
+ddfsMetadataJournal::ddfsMetadataJournal() : fd(-1), appendedSequence(0), durableSequence(0),
+			size(0), commits(0), syncs(0), syncing(false), failed(false) {
+}
+
+ddfsMetadataJournal::~ddfsMetadataJournal() {
+	close();
+}
+
+ddfsStatus ddfsMetadataJournal::open(string path, std::function<void(const ddfsMetadataTransaction &)> replay) {
+	close();
+
+	std::lock_guard<std::mutex> guard(journalLock);
+	if(path.empty())
+		return (ddfsStatus(DDFS_OK));
+
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if(fd < 0) {
+		global_logger_jnl << ddfsLogger::LOG_WARNING << "JOURNAL:: Can not open " << path << "\n";
+		return (ddfsStatus(DDFS_FAILURE));
+	}
+
+	struct stat info;
+	vector<uint8_t> contents;
+	if(fstat(fd, &info) == 0 && info.st_size > 0) {
+		contents.resize((size_t) info.st_size);
+		if(pread(fd, contents.data(), contents.size(), 0) != (ssize_t) contents.size())
+			contents.clear();
+	}
+
+	/* Replay up to the first record that is not whole */
+	size_t offset = 0;
+	uint64_t replayed = 0;
+	while(contents.size() - offset >= DDFS_JOURNAL_RECORD_HEADER) {
+		uint32_t length, crc;
+		uint64_t sequence;
+		memcpy(&length, &contents[offset], sizeof(length));
+		memcpy(&crc, &contents[offset + sizeof(length)], sizeof(crc));
+
+		const uint8_t *body = &contents[offset + DDFS_JOURNAL_RECORD_HEADER];
+		if(length < sizeof(sequence) || contents.size() - offset - DDFS_JOURNAL_RECORD_HEADER < length ||
+						ddfsCrc32c(body, length) != crc)
+			break;
+
+		ddfsMetadataTransaction transaction;
+		memcpy(&sequence, body, sizeof(sequence));
+		if(transaction.decode(body + sizeof(sequence), length - sizeof(sequence)) == false)
+			break;
+
+		replay(transaction);
+		appendedSequence = durableSequence = sequence;
+		offset += DDFS_JOURNAL_RECORD_HEADER + length;
+		replayed++;
+	}
+
+	if(offset < contents.size()) {
+		global_logger_jnl << ddfsLogger::LOG_WARNING << "JOURNAL:: Dropping " << (uint64_t) (contents.size() - offset)
+					<< " bytes of torn transaction at the end of " << path << "\n";
+		if(ftruncate(fd, offset) != 0 || fdatasync(fd) != 0) {
+			::close(fd);
+			fd = -1;
+			return (ddfsStatus(DDFS_FAILURE));
+		}
+	}
+
+	if(lseek(fd, offset, SEEK_SET) < 0) {
+		::close(fd);
+		fd = -1;
+		return (ddfsStatus(DDFS_FAILURE));
+	}
+	size = offset;
+
+	if(replayed > 0)
+		global_logger_jnl << ddfsLogger::LOG_INFO << "JOURNAL:: Replayed " << replayed
+					<< " transactions of " << path << "\n";
+	return (ddfsStatus(DDFS_OK));
+}
+
+void ddfsMetadataJournal::close() {
+	flush();
+
+	std::lock_guard<std::mutex> guard(journalLock);
+	if(fd >= 0) {
+		::close(fd);
+		fd = -1;
+	}
+	pending.clear();
+	appendedSequence = durableSequence = 0;
+	size = 0;
+	failed = false;
+}
+
+uint64_t ddfsMetadataJournal::append(const ddfsMetadataTransaction &transaction) {
+	std::lock_guard<std::mutex> guard(journalLock);
+	uint64_t sequence = ++appendedSequence;
+
+	commits++;
+	if(fd < 0) {
+		durableSequence = sequence;
+		return sequence;
+	}
+
+	size_t start = pending.size();
+	pending.resize(start + DDFS_JOURNAL_RECORD_HEADER);
+	put(&pending, &sequence, sizeof(sequence));
+	transaction.encode(&pending);
+
+	uint32_t length = (uint32_t) (pending.size() - start - DDFS_JOURNAL_RECORD_HEADER);
+	uint32_t crc = ddfsCrc32c(&pending[start + DDFS_JOURNAL_RECORD_HEADER], length);
+	memcpy(&pending[start], &length, sizeof(length));
+	memcpy(&pending[start + sizeof(length)], &crc, sizeof(crc));
+
+	size += pending.size() - start;
+	return sequence;
+}
+
+ddfsStatus ddfsMetadataJournal::waitDurable(uint64_t sequence) {
+	std::unique_lock<std::mutex> lock(journalLock);
+
+	while(true) {
+		if(durableSequence >= sequence)
+			return (ddfsStatus(DDFS_OK));
+		if(failed)
+			return (ddfsStatus(DDFS_FAILURE));
+		if(syncing) {
+			synced.wait(lock);
+			continue;
+		}
+
+		/* Write for everyone waiting, and for whoever appended meanwhile */
+		vector<uint8_t> batch;
+		batch.swap(pending);
+		uint64_t upto = appendedSequence;
+		syncing = true;
+		lock.unlock();
+
+		bool written = true;
+		for(size_t done = 0; done < batch.size() && written; ) {
+			ssize_t wrote = write(fd, batch.data() + done, batch.size() - done);
+			written = wrote > 0;
+			if(written)
+				done += (size_t) wrote;
+		}
+		written = written && fdatasync(fd) == 0;
+
+		lock.lock();
+		syncing = false;
+		if(written) {
+			durableSequence = upto;
+			syncs++;
+		} else {
+			global_logger_jnl << ddfsLogger::LOG_WARNING << "JOURNAL:: Write failed, "
+						<< "no metadata change is durable until the next checkpoint.\n";
+			failed = true;
+		}
+		synced.notify_all();
+	}
+}
+
+ddfsStatus ddfsMetadataJournal::flush() {
+	uint64_t sequence;
+	{
+		std::lock_guard<std::mutex> guard(journalLock);
+		sequence = appendedSequence;
+	}
+	return waitDurable(sequence);
+}
+
+ddfsStatus ddfsMetadataJournal::reset() {
+	flush();
+
+	std::unique_lock<std::mutex> lock(journalLock);
+	while(syncing)
+		synced.wait(lock);
+	if(fd < 0)
+		return (ddfsStatus(DDFS_OK));
+
+	/* The checkpoint holds everything, a failed journal starts over too */
+	if(ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0 || fdatasync(fd) != 0)
+		return (ddfsStatus(DDFS_FAILURE));
+
+	pending.clear();
+	durableSequence = appendedSequence;
+	size = 0;
+	failed = false;
+	return (ddfsStatus(DDFS_OK));
+}
+
+uint64_t ddfsMetadataJournal::getDurableSequence() {
+	std::lock_guard<std::mutex> guard(journalLock);
+	return durableSequence;
+}
+
+uint64_t ddfsMetadataJournal::getSize() {
+	std::lock_guard<std::mutex> guard(journalLock);
+	return size;
+}
+
+uint64_t ddfsMetadataJournal::getCommits() {
+	std::lock_guard<std::mutex> guard(journalLock);
+	return commits;
+}
+
+uint64_t ddfsMetadataJournal::getSyncs() {
+	std::lock_guard<std::mutex> guard(journalLock);
+	return syncs;
+}
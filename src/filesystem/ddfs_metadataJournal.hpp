@@ -0,0 +1,174 @@
+/*!
+ *    \file  ddfs_metadataJournal.hpp
+ *   \brief  Transactions on the metadata and the journal that makes them atomic.
+ *
+ *  A change to the namespace usually touches several things at once: a
+ *  create writes the new inode, an entry in its directory and the times
+ *  of the directory, a rename takes an entry out of one directory, puts
+ *  it in another and changes the parent of the inode. Such a change is
+ *  a ddfsMetadataTransaction, a list of operations with the full new
+ *  state of everything it touches.
+ *
+ *  A transaction is applied to the tables in memory and appended to the
+ *  journal as one record, with a CRC over all of it. It is done once
+ *  the record is on disk. After a crash the journal is replayed over the
+ *  last checkpoint of the tables. A torn record at the end fails its
+ *  CRC and is dropped whole, a transaction is either all there or not at
+ *  all. Operations carry the state after the change, not the change,
+ *  so replaying one that is already in the checkpoint does no harm.
+ *
+ *  Transactions committed at the same time share one fdatasync: the
+ *  first committer writes everything appended so far and syncs, the
+ *  others wait for it. A thousand renames in flight cost a handful of
+ *  syncs, not a thousand.
+ *
+ *  Journal record:
+ *
+ *   +---------+---------+-----------------------------------------+
+ *   | length  | CRC32C  | sequence | count | operation ...         |
+ *   | 4 bytes | 4 bytes | 8 bytes  | 4     |                       |
+ *   +---------+---------+-----------------------------------------+
+ *
+ *  \author  Harman Patial, harman.patial@gmail.com
+ *
+ *  \internal
+ *      Compiler:  g++
+ *     Copyright:
+ *
+ *  This source code is released for free distribution under the terms of the
+ *  GNU General Public License as published by the Free Software Foundation.
+ */
+
+#ifndef DDFS_METADATAJOURNAL_HPP
+#define DDFS_METADATAJOURNAL_HPP
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+#include "ddfs_inodeTable.hpp"
+#include "ddfs_directoryTable.hpp"
+#include "../global/ddfs_status.hpp"
+
+using namespace std;
+
+/* Journal size at which the filesystem checkpoints on its own */
+#define DDFS_JOURNAL_CHECKPOINT_BYTES   (64ULL * 1024 * 1024)
+
+enum ddfsJournalOperation {
+	JOURNAL_SET_INODE = 1,
+	JOURNAL_FREE_INODE,
+	JOURNAL_LINK,
+	JOURNAL_UNLINK,
+	JOURNAL_ADD_DIRECTORY,
+	JOURNAL_REMOVE_DIRECTORY
+};
+
+/*!
+ *  \class  ddfsMetadataTransaction
+ *  \brief  Operations on the metadata that happen together or not at all.
+ */
+class ddfsMetadataTransaction {
+public:
+	ddfsMetadataTransaction() {}
+
+	/* The record of inode.inode becomes inode */
+	void setInode(const ddfsInode &inode);
+	void freeInode(uint64_t number);
+	/* name in directory points at inode, replacing what it pointed at */
+	void link(uint64_t directory, const string &name, uint64_t inode);
+	void unlink(uint64_t directory, const string &name);
+	void addDirectory(uint64_t directory);
+	void removeDirectory(uint64_t directory);
+
+	bool empty() {
+		return operations.empty();
+	}
+
+	/* Make the changes to the tables, in order. With freed, the numbers
+	 * to free go there instead, for the caller to release once the
+	 * transaction is on disk. */
+	void apply(ddfsInodeTable &inodes, ddfsDirectoryTable &directories,
+					vector<uint64_t> *freed = NULL) const;
+
+	void encode(vector<uint8_t> *out) const;
+	/* false if data is not a whole transaction */
+	bool decode(const uint8_t *data, size_t length);
+
+private:
+	struct operation {
+		ddfsJournalOperation type;
+		uint64_t directory;
+		uint64_t number;
+		string name;
+		ddfsInode inode;
+	};
+
+	vector<operation> operations;
+};
+
+/*!
+ *  \class  ddfsMetadataJournal
+ *  \brief  Write-ahead log of metadata transactions, with group commit.
+ */
+class ddfsMetadataJournal {
+public:
+	ddfsMetadataJournal();
+	~ddfsMetadataJournal();
+
+	/*
+	 * @brief Open the journal at path and replay what is in it.
+	 *
+	 * An empty path keeps nothing, every commit is done at once.
+	 *
+	 * @return DDFS_OK          replay saw every whole transaction, a torn
+	 *                          one at the end is cut off
+	 * @return DDFS_FAILURE     path could not be opened
+	 */
+	ddfsStatus open(string path, std::function<void(const ddfsMetadataTransaction &)> replay);
+	void close();
+
+	/* Queue a transaction, returns its sequence number */
+	uint64_t append(const ddfsMetadataTransaction &transaction);
+	/*
+	 * @brief Wait until transaction sequence and all before it are on disk.
+	 *
+	 * @return DDFS_OK          They are
+	 * @return DDFS_FAILURE     The journal could not be written, nothing
+	 *                          after the failure is durable
+	 */
+	ddfsStatus waitDurable(uint64_t sequence);
+	/* Everything appended so far on disk */
+	ddfsStatus flush();
+	/* Last sequence on disk, with all before it */
+	uint64_t getDurableSequence();
+
+	/* Empty the journal once the tables are checkpointed. Nothing may be
+	 * appended meanwhile. */
+	ddfsStatus reset();
+
+	uint64_t getSize();
+	uint64_t getCommits();
+	uint64_t getSyncs();
+
+private:
+	std::mutex journalLock;
+	std::condition_variable synced;
+	int fd;
+	vector<uint8_t> pending;
+	uint64_t appendedSequence;
+	uint64_t durableSequence;
+	uint64_t size;
+	uint64_t commits;
+	uint64_t syncs;
+	bool syncing;
+	bool failed;
+
+	ddfsMetadataJournal(ddfsMetadataJournal const&);     // Don't Implement
+	void operator=(ddfsMetadataJournal const&);          // Don't implement
+};
+
+#endif /* Ending DDFS_METADATAJOURNAL_HPP */
@@ -0,0 +1,163 @@
+/*!
+ *    \file  ddfs_nameIndex.cpp
+ *   \brief  Hash of directory entries, read without a lock.
+ *
+ *  \author  Harman Patial, harman.patial@gmail.com
+ *
+ *  \internal
+ *      Compiler:  g++
+ *     Copyright:
+ *
+ *  This source code is released for free distribution under the terms of the
+ *  GNU General Public License as published by the Free Software Foundation.
+ */
+
+#include <functional>
+
+#include "ddfs_nameIndex.hpp"
+#include "../global/ddfs_epoch.hpp"
+
+using namespace std;
+
+/* A bucket is always under one stripe, there are never fewer buckets */
+static_assert(DDFS_NAME_INDEX_BUCKETS >= DDFS_NAME_INDEX_STRIPES &&
+			(DDFS_NAME_INDEX_STRIPES & (DDFS_NAME_INDEX_STRIPES - 1)) == 0,
+			"Stripes must be a power of two, at most the buckets");
+
+ddfsNameIndex::table::table(uint64_t size) : mask(size - 1), buckets(new std::atomic<node *>[size]) {
+	for(uint64_t b = 0; b < size; b++)
+		buckets[b].store(NULL, std::memory_order_relaxed);
+}
+
+ddfsNameIndex::table::~table() {
+	for(uint64_t b = 0; b <= mask; b++) {
+		node *n = buckets[b].load(std::memory_order_relaxed);
+		while(n != NULL) {
+			node *next = n->next.load(std::memory_order_relaxed);
+			delete n;
+			n = next;
+		}
+	}
+}
+
+ddfsNameIndex::ddfsNameIndex() : current(new table(DDFS_NAME_INDEX_BUCKETS)), count(0) {
+}
+
+ddfsNameIndex::~ddfsNameIndex() {
+	delete current.load(std::memory_order_relaxed);
+}
+
+uint64_t ddfsNameIndex::hashOf(uint64_t directory, const string &name) {
+	uint64_t hash = (uint64_t) std::hash<string>()(name) ^ (directory * 0x9E3779B97F4A7C15ULL);
+	return hash ^ (hash >> 29);
+}
+
+bool ddfsNameIndex::lookup(uint64_t directory, const string &name, uint64_t *inode) {
+	uint64_t hash = hashOf(directory, name);
+	table *t = current.load(std::memory_order_acquire);
+
+	node *n = t->buckets[hash & t->mask].load(std::memory_order_acquire);
+	for(; n != NULL; n = n->next.load(std::memory_order_acquire)) {
+		if(n->hash == hash && n->directory == directory && n->name == name) {
+			*inode = n->inode;
+			return true;
+		}
+	}
+	return false;
+}
+
+void ddfsNameIndex::set(uint64_t directory, const string &name, uint64_t inode) {
+	uint64_t hash = hashOf(directory, name), buckets;
+	{
+		std::lock_guard<std::mutex> guard(stripes[hash & (DDFS_NAME_INDEX_STRIPES - 1)]);
+		/* Only grow() swaps it, with every stripe held */
+		table *t = current.load(std::memory_order_relaxed);
+		std::atomic<node *> *link = &t->buckets[hash & t->mask];
+		node *n;
+
+		while((n = link->load(std::memory_order_relaxed)) != NULL) {
+			if(n->hash == hash && n->directory == directory && n->name == name) {
+				if(n->inode == inode)
+					return;
+				/* Readers see the old entry or the new one, whole */
+				link->store(new node(hash, directory, name, inode, n->next.load(std::memory_order_relaxed)),
+							std::memory_order_release);
+				ddfsEpoch::retire([n] { delete n; });
+				return;
+			}
+			link = &n->next;
+		}
+
+		std::atomic<node *> &bucket = t->buckets[hash & t->mask];
+		bucket.store(new node(hash, directory, name, inode, bucket.load(std::memory_order_relaxed)),
+					std::memory_order_release);
+		buckets = t->mask + 1;
+	}
+
+	if(count.fetch_add(1, std::memory_order_relaxed) + 1 > buckets)
+		grow();
+}
+
+void ddfsNameIndex::remove(uint64_t directory, const string &name) {
+	uint64_t hash = hashOf(directory, name);
+	std::lock_guard<std::mutex> guard(stripes[hash & (DDFS_NAME_INDEX_STRIPES - 1)]);
+	table *t = current.load(std::memory_order_relaxed);
+	std::atomic<node *> *link = &t->buckets[hash & t->mask];
+	node *n;
+
+	while((n = link->load(std::memory_order_relaxed)) != NULL) {
+		if(n->hash == hash && n->directory == directory && n->name == name) {
+			/* A reader on it goes on down the chain from it */
+			link->store(n->next.load(std::memory_order_relaxed), std::memory_order_release);
+			count.fetch_sub(1, std::memory_order_relaxed);
+			ddfsEpoch::retire([n] { delete n; });
+			return;
+		}
+		link = &n->next;
+	}
+}
+
+void ddfsNameIndex::clear() {
+	lockAll();
+	table *old = current.load(std::memory_order_relaxed);
+	current.store(new table(DDFS_NAME_INDEX_BUCKETS), std::memory_order_release);
+	count.store(0, std::memory_order_relaxed);
+	unlockAll();
+
+	ddfsEpoch::retire([old] { delete old; });
+}
+
+void ddfsNameIndex::grow() {
+	lockAll();
+	table *old = current.load(std::memory_order_relaxed);
+	if(count.load(std::memory_order_relaxed) <= old->mask + 1) {
+		/* Another writer grew it first */
+		unlockAll();
+		return;
+	}
+
+	/* Copies, the chains of the old table stay as readers on it expect */
+	table *bigger = new table((old->mask + 1) * 2);
+	for(uint64_t b = 0; b <= old->mask; b++) {
+		node *n = old->buckets[b].load(std::memory_order_relaxed);
+		for(; n != NULL; n = n->next.load(std::memory_order_relaxed)) {
+			std::atomic<node *> &bucket = bigger->buckets[n->hash & bigger->mask];
+			bucket.store(new node(n->hash, n->directory, n->name, n->inode, bucket.load(std::memory_order_relaxed)),
+						std::memory_order_relaxed);
+		}
+	}
+	current.store(bigger, std::memory_order_release);
+	unlockAll();
+
+	ddfsEpoch::retire([old] { delete old; });
+}
+
+void ddfsNameIndex::lockAll() {
+	for(unsigned int s = 0; s < DDFS_NAME_INDEX_STRIPES; s++)
+		stripes[s].lock();
+}
+
+void ddfsNameIndex::unlockAll() {
+	for(unsigned int s = DDFS_NAME_INDEX_STRIPES; s > 0; s--)
+		stripes[s - 1].unlock();
+}
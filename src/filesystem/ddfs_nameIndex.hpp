@@ -0,0 +1,101 @@
+/*!
+ *    \file  ddfs_nameIndex.hpp
+ *   \brief  Hash of directory entries, read without a lock.
+ *
+ *  Maps a directory inode number and a name to the inode number of the
+ *  entry, for path lookups. Readers take no lock at all: they walk the
+ *  chains inside an epoch (see ddfs_epoch.hpp), and every node they can
+ *  reach stays as it is until they leave. A node is never changed once
+ *  linked in. A writer replaces it with a new one, or unlinks it, with
+ *  one atomic store, and retires the old one to the epoch.
+ *
+ *  Writers lock the chain they change, by stripe of the hash. Growing
+ *  takes every stripe, builds the table at twice the size from copies
+ *  of the nodes and swaps it in whole; readers on the old one finish on
+ *  it. The table grows, it does not shrink.
+ *
+ *  The index holds a copy of every name, next to the sorted entries of
+ *  ddfsDirectoryTable that listing and saving use.
+ *
+ *  \author  Harman Patial, harman.patial@gmail.com
+ *
+ *  \internal
+ *      Compiler:  g++
+ *     Copyright:
+ *
+ *  This source code is released for free distribution under the terms of the
+ *  GNU General Public License as published by the Free Software Foundation.
+ */
+
+#ifndef DDFS_NAMEINDEX_HPP
+#define DDFS_NAMEINDEX_HPP
+
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <stdint.h>
+
+using namespace std;
+
+#define DDFS_NAME_INDEX_BUCKETS         1024
+#define DDFS_NAME_INDEX_STRIPES         256
+
+/*!
+ *  \class  ddfsNameIndex
+ *  \brief  (directory, name) to inode number, lock-free lookups.
+ */
+class ddfsNameIndex {
+public:
+	ddfsNameIndex();
+	~ddfsNameIndex();
+
+	/* Within an epoch, or a lock that keeps the entry from changing */
+	bool lookup(uint64_t directory, const string &name, uint64_t *inode);
+
+	/* Add the entry, or point it at inode */
+	void set(uint64_t directory, const string &name, uint64_t inode);
+	void remove(uint64_t directory, const string &name);
+	void clear();
+
+	uint64_t getCount() {
+		return count.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct node {
+		node(uint64_t h, uint64_t d, const string &n, uint64_t i, node *after) :
+					hash(h), directory(d), inode(i), name(n), next(after) {}
+
+		const uint64_t hash;
+		const uint64_t directory;
+		const uint64_t inode;
+		const string name;
+		std::atomic<node *> next;
+	};
+
+	struct table {
+		explicit table(uint64_t size);
+		/* The nodes too */
+		~table();
+
+		uint64_t mask;
+		std::unique_ptr<std::atomic<node *>[]> buckets;
+	};
+
+	std::atomic<table *> current;
+	std::atomic<uint64_t> count;
+	/* Writers of the chains, by hash */
+	std::mutex stripes[DDFS_NAME_INDEX_STRIPES];
+
+	static uint64_t hashOf(uint64_t directory, const string &name);
+	/* Twice the buckets, if there are more entries than buckets */
+	void grow();
+	void lockAll();
+	void unlockAll();
+
+	ddfsNameIndex(ddfsNameIndex const&);       // Don't Implement
+	void operator=(ddfsNameIndex const&);      // Don't implement
+};
+
+#endif /* Ending DDFS_NAMEINDEX_HPP */
@@ -0,0 +1,78 @@
+/*!
+ *    \file  ddfs_openFileTable.cpp
+ *   \brief  Open files of a filesystem, behind integer handles.
+ *
+ *  \author  Harman Patial, harman.patial@gmail.com
+ *
+ *  \internal
+ *      Compiler:  g++
+ *     Copyright:
+ *
+ *  This source code is released for free distribution under the terms of the
+ *  GNU General Public License as published by the Free Software Foundation.
+ */
+
+#include "ddfs_openFileTable.hpp"
+
+using namespace std;
+
+ddfsOpenFileTable::ddfsOpenFileTable(uint32_t count) : slotCount(count),
+					slots(new ddfsOpenFile[count]) {
+	/* Lowest slots are handed out first */
+	for(uint32_t i = count; i > 0; i--)
+		freeSlots.push_back(i - 1);
+}
+
+ddfsStatus ddfsOpenFileTable::allocate(ddfsFileHandle *handle, ddfsOpenFile **slot) {
+	uint32_t index;
+
+	{
+		std::lock_guard<std::mutex> guard(tableLock);
+		if(freeSlots.empty())
+			return (ddfsStatus(DDFS_FAILURE));
+		index = freeSlots.back();
+		freeSlots.pop_back();
+	}
+
+	ddfsOpenFile *s = &slots[index];
+	uint64_t generation = (s->tag.load() >> 32) + 1;
+	/* Generation 0 would make handle 0 of slot 0 */
+	if((generation & 0xFFFFFFFFULL) == 0)
+		generation = 1;
+	generation &= 0xFFFFFFFFULL;
+
+	s->fileID = 0;
+	s->inode = NULL;
+	s->generation = 0;
+	s->changed = false;
+	s->accessed = 0;
+	s->mode = 0;
+	s->offset = 0;
+	s->transferred = 0;
+	s->readahead.reset();
+	s->writeBuffer.reset();
+	s->tag.store((generation << 32) | 1, std::memory_order_release);
+
+	*handle = (generation << 32) | index;
+	*slot = s;
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsOpenFileTable::release(ddfsFileHandle handle) {
+	ddfsOpenFile *s = lookup(handle);
+
+	if(s == NULL)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	s->writeBuffer.reset();
+	s->tag.store(handle & 0xFFFFFFFF00000000ULL, std::memory_order_release);
+
+	std::lock_guard<std::mutex> guard(tableLock);
+	freeSlots.push_back((uint32_t) (handle & 0xFFFFFFFFULL));
+	return (ddfsStatus(DDFS_OK));
+}
+
+uint32_t ddfsOpenFileTable::getOpenCount() {
+	std::lock_guard<std::mutex> guard(tableLock);
+	return slotCount - (uint32_t) freeSlots.size();
+}
@@ -0,0 +1,132 @@
+/*!
+ *    \file  ddfs_openFileTable.hpp
+ *   \brief  Open files of a filesystem, behind integer handles.
+ *
+ *  The table is a fixed array of slots, allocated once. Opening a file
+ *  resolves its path to an inode once and keeps everything the data
+ *  path needs in a free slot: the inode, the offset, the readahead
+ *  state and the write buffer. Reads, writes and seeks find the slot from
+ *  the handle by index, without a lock and without the path.
+ *
+ *  A handle is the slot index in the low 32 bits and the generation of
+ *  the slot in the high 32 bits. Closing a file bumps the generation, so
+ *  a handle used after close, or after its slot was given to another
+ *  open, is told apart from the current one and refused.
+ *
+ *  One handle is used by one thread at a time, as with file descriptors.
+ *
+ *  \author  Harman Patial, harman.patial@gmail.com
+ *
+ *  \internal
+ *      Compiler:  g++
+ *     Copyright:
+ *
+ *  This source code is released for free distribution under the terms of the
+ *  GNU General Public License as published by the Free Software Foundation.
+ */
+
+#ifndef DDFS_OPENFILETABLE_HPP
+#define DDFS_OPENFILETABLE_HPP
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+
+#include "ddfs_pageCache.hpp"
+#include "ddfs_writeBack.hpp"
+#include "ddfs_inodeTable.hpp"
+#include "../global/ddfs_status.hpp"
+
+using namespace std;
+
+#define DDFS_OPEN_FILE_SLOTS            4096
+#define DDFS_INVALID_FILE_HANDLE        0
+
+typedef uint64_t ddfsFileHandle;
+
+/*!
+ *  \class  ddfsOpenFile
+ *  \brief  A slot of the open-file table.
+ */
+class ddfsOpenFile {
+public:
+	ddfsOpenFile() : tag(0), fileID(0), inode(NULL), generation(0), changed(false), accessed(0), mode(0),
+				offset(0), transferred(0) {}
+
+	/* Generation in the high half, 1 in the low one while open */
+	std::atomic<uint64_t> tag;
+
+	/* Inode number */
+	uint64_t fileID;
+	ddfsInode *inode;
+	/* Of the inode when opened, the file is gone once the record's differs */
+	uint64_t generation;
+	/* Size or times changed since the inode was last journaled */
+	bool changed;
+	/* Time of the last read, for the inode once closed or synced */
+	uint64_t accessed;
+	int mode;
+	uint64_t offset;
+	/* Bytes moved by the last read or write, fewer than asked at the end of the file */
+	size_t transferred;
+	ddfsReadahead readahead;
+	/* Writes not in storage yet */
+	std::shared_ptr<ddfsWriteBuffer> writeBuffer;
+
+private:
+	ddfsOpenFile(ddfsOpenFile const&);       // Don't Implement
+	void operator=(ddfsOpenFile const&);     // Don't implement
+};
+
+/*!
+ *  \class  ddfsOpenFileTable
+ *  \brief  Fixed table of open files, indexed by handle.
+ */
+class ddfsOpenFileTable {
+public:
+	ddfsOpenFileTable(uint32_t slots = DDFS_OPEN_FILE_SLOTS);
+
+	/*
+	 * @brief Take a free slot.
+	 *
+	 * @return DDFS_OK                  handle and slot are set, the slot
+	 *                                  is reset
+	 * @return DDFS_FAILURE             Every slot is in use
+	 */
+	ddfsStatus allocate(ddfsFileHandle *handle, ddfsOpenFile **slot);
+
+	/* Slot of an open handle, NULL for a closed or made up one */
+	ddfsOpenFile *lookup(ddfsFileHandle handle) {
+		uint32_t index = (uint32_t) (handle & 0xFFFFFFFFULL);
+		if(index >= slotCount)
+			return NULL;
+
+		ddfsOpenFile *slot = &slots[index];
+		if(slot->tag.load(std::memory_order_acquire) != tagOf(handle))
+			return NULL;
+		return slot;
+	}
+
+	/* Give the slot back, the handle is refused from now on */
+	ddfsStatus release(ddfsFileHandle handle);
+
+	uint32_t getOpenCount();
+
+private:
+	uint32_t slotCount;
+	std::unique_ptr<ddfsOpenFile[]> slots;
+
+	std::mutex tableLock;
+	vector<uint32_t> freeSlots;
+
+	static uint64_t tagOf(ddfsFileHandle handle) {
+		return (handle & 0xFFFFFFFF00000000ULL) | 1;
+	}
+
+	ddfsOpenFileTable(ddfsOpenFileTable const&);     // Don't Implement
+	void operator=(ddfsOpenFileTable const&);        // Don't implement
+};
+
+#endif /* Ending DDFS_OPENFILETABLE_HPP */
@@ -0,0 +1,366 @@
+/*!
+ *    \file  ddfs_pageCache.cpp
+ *   \brief  Userspace page cache beneath the filesystem reads.
+ *
+ *  \author  Harman Patial, harman.patial@gmail.com
+ *
+ *  \internal
+ *      Compiler:  g++
+ *     Copyright:
+ *
+ *  This source code is released for free distribution under the terms of the
+ *  GNU General Public License as published by the Free Software Foundation.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "ddfs_pageCache.hpp"
+#include "../logger/ddfs_fileLogger.hpp"
+
+using namespace std;
+
+ddfsLogger &global_logger_pgc = ddfsLogger::getInstance();
+
+ddfsPageCache::ddfsPageCache(ddfsPageReader r, uint64_t capacityBytes) :
+					reader(r), hits(0), misses(0), readaheadPages(0),
+					stopReadahead(false) {
+	pagesPerShard = (size_t) (capacityBytes / DDFS_PAGE_SIZE / DDFS_PAGE_CACHE_SHARDS);
+	if(pagesPerShard < 2)
+		pagesPerShard = 2;
+
+	for(int i = 0; i < DDFS_READAHEAD_THREADS; i++)
+		aheadThreads.push_back(std::thread(&ddfsPageCache::readaheadRoutine, this));
+}
+
+ddfsPageCache::~ddfsPageCache() {
+	{
+		std::lock_guard<std::mutex> guard(aheadLock);
+		stopReadahead = true;
+	}
+	aheadQueued.notify_all();
+	for(size_t i = 0; i < aheadThreads.size(); i++)
+		aheadThreads[i].join();
+
+	/* Nobody holds a pin any more */
+	for(int i = 0; i < DDFS_PAGE_CACHE_SHARDS; i++) {
+		unordered_map<pageKey, page *, pageKeyHash>::iterator iter;
+		for(iter = shards[i].pages.begin(); iter != shards[i].pages.end(); iter++)
+			delete iter->second;
+	}
+}
+
+ddfsPageCache::shard &ddfsPageCache::shardOf(const pageKey &key) {
+	/* The low bits pick the bucket in the shard, use the high ones */
+	return shards[(pageKeyHash()(key) >> 32) % DDFS_PAGE_CACHE_SHARDS];
+}
+
+void ddfsPageCache::remember(ghostList &ghosts, const pageKey &key) {
+	ghosts.order.push_front(key);
+	ghosts.where[key] = ghosts.order.begin();
+}
+
+void ddfsPageCache::forgetOldest(ghostList &ghosts) {
+	if(ghosts.order.empty())
+		return;
+	ghosts.where.erase(ghosts.order.back());
+	ghosts.order.pop_back();
+}
+
+void ddfsPageCache::detach(shard &s, page *p) {
+	s.pages.erase(p->key);
+	if(p->list == LIST_T1)
+		s.t1.erase(p->position);
+	else
+		s.t2.erase(p->position);
+
+	p->detached = true;
+	if(p->state == PAGE_LOADING)
+		p->stale = true;
+	if(p->pins == 0)
+		delete p;
+}
+
+void ddfsPageCache::replace(shard &s, bool ghostInB2) {
+	if(s.t1.size() + s.t2.size() < pagesPerShard)
+		return;
+
+	bool fromT1 = s.t1.empty() == false &&
+					(s.t1.size() > s.target || (ghostInB2 && s.t1.size() == s.target));
+
+	/* Oldest unpinned page of the list ARC picks, or else of the other */
+	for(int attempt = 0; attempt < 2; attempt++, fromT1 = !fromT1) {
+		std::list<page *> &candidates = fromT1 ? s.t1 : s.t2;
+
+		for(std::list<page *>::reverse_iterator iter = candidates.rbegin(); iter != candidates.rend(); iter++) {
+			page *victim = *iter;
+			if(victim->pins > 0)
+				continue;
+
+			pageKey key = victim->key;
+			detach(s, victim);
+			remember(fromT1 ? s.b1 : s.b2, key);
+			return;
+		}
+	}
+
+	/* Everything is pinned, the shard goes over its share for now */
+}
+
+ddfsPageCache::page *ddfsPageCache::lookup(shard &s, const pageKey &key, bool ahead,
+					std::unique_lock<std::mutex> &guard) {
+	unordered_map<pageKey, page *, pageKeyHash>::iterator found = s.pages.find(key);
+	if(found != s.pages.end()) {
+		page *p = found->second;
+		if(ahead)
+			return NULL;
+
+		/* Second use, the page is frequent now */
+		if(p->list == LIST_T1)
+			s.t1.erase(p->position);
+		else
+			s.t2.erase(p->position);
+		s.t2.push_front(p);
+		p->list = LIST_T2;
+		p->position = s.t2.begin();
+
+		p->pins++;
+		hits++;
+		s.pageLoaded.wait(guard, [p] { return p->state != PAGE_LOADING; });
+		return p;
+	}
+
+	size_t capacity = pagesPerShard;
+	pageList into = LIST_T1;
+
+	if(s.b1.where.count(key)) {
+		/* T1 was too small to keep this one */
+		size_t delta = max((size_t) 1, s.b2.order.size() / s.b1.order.size());
+		s.target = min(capacity, s.target + delta);
+		replace(s, false);
+		s.b1.order.erase(s.b1.where[key]);
+		s.b1.where.erase(key);
+		into = LIST_T2;
+	} else if(s.b2.where.count(key)) {
+		/* T2 was too small to keep this one */
+		size_t delta = max((size_t) 1, s.b1.order.size() / s.b2.order.size());
+		s.target = s.target > delta ? s.target - delta : 0;
+		replace(s, true);
+		s.b2.order.erase(s.b2.where[key]);
+		s.b2.where.erase(key);
+		into = LIST_T2;
+	} else {
+		size_t l1 = s.t1.size() + s.b1.order.size();
+		size_t total = l1 + s.t2.size() + s.b2.order.size();
+
+		if(l1 >= capacity) {
+			if(s.b1.order.empty() == false)
+				forgetOldest(s.b1);
+			replace(s, false);
+		} else if(total >= capacity) {
+			if(total >= 2 * capacity)
+				forgetOldest(s.b2);
+			replace(s, false);
+		}
+	}
+
+	page *p = new page();
+	p->key = key;
+	p->pins = 1;
+	p->list = into;
+	if(into == LIST_T1) {
+		s.t1.push_front(p);
+		p->position = s.t1.begin();
+	} else {
+		s.t2.push_front(p);
+		p->position = s.t2.begin();
+	}
+	s.pages[key] = p;
+
+	if(ahead)
+		readaheadPages++;
+	else
+		misses++;
+
+	/* Others asking for the page wait on it meanwhile */
+	guard.unlock();
+	size_t valid = 0;
+	ddfsStatus status = reader(key.fileID, key.index * DDFS_PAGE_SIZE, p->data.data(),
+					DDFS_PAGE_SIZE, &valid);
+	guard.lock();
+
+	p->status = status;
+	if(status.compareStatus(ddfsStatus(DDFS_OK))) {
+		p->valid = min(valid, (size_t) DDFS_PAGE_SIZE);
+		p->state = PAGE_READY;
+	} else {
+		global_logger_pgc << ddfsLogger::LOG_WARNING << "PAGECACHE:: Reading page " << key.index
+					<< " of file " << key.fileID << " failed. " << status.statusToString() << "\n";
+		p->state = PAGE_FAILED;
+		/* The next reader tries again */
+		if(p->detached == false)
+			detach(s, p);
+	}
+	s.pageLoaded.notify_all();
+
+	return p;
+}
+
+ddfsPageCache::page *ddfsPageCache::acquire(const pageKey &key, bool ahead) {
+	shard &s = shardOf(key);
+	std::unique_lock<std::mutex> guard(s.shardLock);
+
+	for(;;) {
+		page *p = lookup(s, key, ahead, guard);
+		if(p == NULL || p->stale == false)
+			return p;
+
+		/* Stale pages are detached, the next lookup gets a new one */
+		p->pins--;
+		if(p->pins == 0)
+			delete p;
+	}
+}
+
+void ddfsPageCache::release(page *p) {
+	shard &s = shardOf(p->key);
+	std::lock_guard<std::mutex> guard(s.shardLock);
+
+	p->pins--;
+	if(p->pins == 0 && p->detached)
+		delete p;
+}
+
+void ddfsPageCache::scheduleReadahead(uint64_t fileID, uint64_t lastPage, ddfsReadahead *readahead) {
+	uint64_t from = max(lastPage + 1, readahead->aheadUntil);
+	uint64_t to = lastPage + readahead->windowPages;
+
+	if(from > to)
+		return;
+
+	{
+		std::lock_guard<std::mutex> guard(aheadLock);
+		for(uint64_t index = from; index <= to; index++) {
+			if((int) aheadQueue.size() >= (int) s_maxQueuedAhead)
+				break;
+			pageKey key;
+			key.fileID = fileID;
+			key.index = index;
+			aheadQueue.push_back(key);
+			readahead->aheadUntil = index + 1;
+		}
+	}
+	aheadQueued.notify_all();
+}
+
+void ddfsPageCache::readaheadRoutine() {
+	std::unique_lock<std::mutex> guard(aheadLock);
+
+	while(true) {
+		aheadQueued.wait(guard, [this] { return stopReadahead || aheadQueue.empty() == false; });
+		if(stopReadahead)
+			return;
+
+		pageKey key = aheadQueue.front();
+		aheadQueue.pop_front();
+
+		guard.unlock();
+		page *p = acquire(key, true);
+		if(p != NULL)
+			release(p);
+		guard.lock();
+	}
+}
+
+ddfsStatus ddfsPageCache::read(uint64_t fileID, uint64_t offset, size_t size, void *buffer,
+					size_t *bytesRead, ddfsReadahead *readahead) {
+	uint8_t *out = (uint8_t *) buffer;
+
+	*bytesRead = 0;
+	if(size == 0)
+		return (ddfsStatus(DDFS_OK));
+
+	uint64_t firstPage = offset / DDFS_PAGE_SIZE;
+	uint64_t lastPage = (offset + size - 1) / DDFS_PAGE_SIZE;
+
+	/* Queue the pages ahead first, they load while this read waits */
+	if(readahead != NULL) {
+		if(offset == readahead->nextOffset) {
+			if(readahead->windowPages == 0)
+				readahead->windowPages = DDFS_READAHEAD_INITIAL_PAGES;
+			else
+				readahead->windowPages = min(readahead->windowPages * 2, DDFS_READAHEAD_MAX_PAGES);
+			scheduleReadahead(fileID, lastPage, readahead);
+		} else {
+			readahead->windowPages = 0;
+			readahead->aheadUntil = 0;
+		}
+		readahead->nextOffset = offset + size;
+	}
+
+	for(uint64_t index = firstPage; index <= lastPage; index++) {
+		pageKey key;
+		key.fileID = fileID;
+		key.index = index;
+
+		page *p = acquire(key, false);
+		if(p->state == PAGE_FAILED) {
+			ddfsStatus status = p->status;
+			release(p);
+			return status;
+		}
+
+		size_t inPage = (index == firstPage) ? (size_t) (offset % DDFS_PAGE_SIZE) : 0;
+		size_t valid = p->valid;
+		if(valid <= inPage) {
+			release(p);
+			break;
+		}
+
+		size_t length = min(valid - inPage, size - *bytesRead);
+		memcpy(out + *bytesRead, p->data.data() + inPage, length);
+		*bytesRead += length;
+		release(p);
+
+		/* A short page is the end of the file */
+		if(valid < DDFS_PAGE_SIZE)
+			break;
+	}
+
+	return (ddfsStatus(DDFS_OK));
+}
+
+void ddfsPageCache::invalidate(uint64_t fileID) {
+	for(int i = 0; i < DDFS_PAGE_CACHE_SHARDS; i++) {
+		shard &s = shards[i];
+		std::lock_guard<std::mutex> guard(s.shardLock);
+
+		vector<page *> victims;
+		unordered_map<pageKey, page *, pageKeyHash>::iterator iter;
+		for(iter = s.pages.begin(); iter != s.pages.end(); iter++) {
+			if(iter->first.fileID == fileID)
+				victims.push_back(iter->second);
+		}
+
+		for(size_t j = 0; j < victims.size(); j++)
+			detach(s, victims[j]);
+	}
+}
+
+void ddfsPageCache::invalidate(uint64_t fileID, uint64_t offset, size_t size) {
+	if(size == 0)
+		return;
+
+	uint64_t lastPage = (offset + size - 1) / DDFS_PAGE_SIZE;
+	for(uint64_t index = offset / DDFS_PAGE_SIZE; index <= lastPage; index++) {
+		pageKey key;
+		key.fileID = fileID;
+		key.index = index;
+
+		shard &s = shardOf(key);
+		std::lock_guard<std::mutex> guard(s.shardLock);
+		unordered_map<pageKey, page *, pageKeyHash>::iterator found = s.pages.find(key);
+		if(found != s.pages.end())
+			detach(s, found->second);
+	}
+}
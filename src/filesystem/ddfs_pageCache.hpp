@@ -0,0 +1,247 @@
+/*!
+ *    \file  ddfs_pageCache.hpp
+ *   \brief  Userspace page cache beneath the filesystem reads.
+ *
+ *  File data is cached in pages of DDFS_PAGE_SIZE bytes, keyed by file
+ *  ID and page index. The cache is cut into DDFS_PAGE_CACHE_SHARDS
+ *  shards by the hash of the key, each with its own lock, so readers of
+ *  different pages seldom meet.
+ *
+ *  Every shard replaces pages with ARC. Pages read once sit on T1,
+ *  pages read again move to T2, and the keys of pages evicted from
+ *  either are remembered on the ghost lists B1 and B2. A miss that hits
+ *  a ghost moves the split between T1 and T2 towards the list that
+ *  would have kept it. A scan passes through T1 and leaves the hot
+ *  pages on T2 alone.
+ *
+ *  A page being read from storage is in the cache already, pinned and
+ *  LOADING. A second reader of it waits for the first instead of
+ *  reading it again. Pinned pages are never evicted, a shard may go over
+ *  its share while all of its pages are pinned.
+ *
+ *  Sequential reads through a ddfsReadahead ramp up a readahead window,
+ *  4 pages at first and doubling up to DDFS_READAHEAD_MAX_PAGES. The
+ *  pages ahead are read by background threads while the reader works
+ *  on the ones it has. A read elsewhere in the file closes the window.
+ *
+ *  \author  Harman Patial, harman.patial@gmail.com
+ *
+ *  \internal
+ *      Compiler:  g++
+ *     Copyright:
+ *
+ *  This source code is released for free distribution under the terms of the
+ *  GNU General Public License as published by the Free Software Foundation.
+ */
+
+#ifndef DDFS_PAGECACHE_HPP
+#define DDFS_PAGECACHE_HPP
+
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <stdint.h>
+
+#include "../global/ddfs_status.hpp"
+
+using namespace std;
+
+#define DDFS_PAGE_SIZE                  (64 * 1024)
+#define DDFS_PAGE_CACHE_SHARDS          16
+#define DDFS_PAGE_CACHE_DEFAULT_BYTES   (256ULL * 1024 * 1024)
+#define DDFS_READAHEAD_INITIAL_PAGES    4
+#define DDFS_READAHEAD_MAX_PAGES        64
+/* Threads reading ahead, storage behind them may be the network */
+#define DDFS_READAHEAD_THREADS          4
+
+/*
+ * Reads size bytes of a file at offset from storage. Sets bytesRead,
+ * less than size only at the end of the file.
+ */
+typedef std::function<ddfsStatus(uint64_t fileID, uint64_t offset, uint8_t *buffer,
+					size_t size, size_t *bytesRead)> ddfsPageReader;
+
+/*!
+ *  \class  ddfsReadahead
+ *  \brief  Readahead state of one open file, used by one thread at a time.
+ */
+class ddfsReadahead {
+public:
+	ddfsReadahead() : nextOffset(0), windowPages(0), aheadUntil(0) {}
+
+	void reset() {
+		nextOffset = 0;
+		windowPages = 0;
+		aheadUntil = 0;
+	}
+
+	int getWindow() {
+		return windowPages;
+	}
+
+private:
+	friend class ddfsPageCache;
+
+	/* Where the next read starts if the reader is sequential */
+	uint64_t nextOffset;
+	int windowPages;
+	/* Pages before this index were handed to readahead already */
+	uint64_t aheadUntil;
+};
+
+/*!
+ *  \class  ddfsPageCache
+ *  \brief  Sharded ARC cache of file pages.
+ */
+class ddfsPageCache {
+public:
+	ddfsPageCache(ddfsPageReader reader, uint64_t capacityBytes = DDFS_PAGE_CACHE_DEFAULT_BYTES);
+	~ddfsPageCache();
+
+	/*
+	 * @brief Read size bytes of a file at offset, through the cache.
+	 *
+	 * readahead may be NULL for a one-off read.
+	 *
+	 * @return DDFS_OK      bytesRead bytes are in buffer, fewer than size
+	 *                      at the end of the file
+	 * @return Anything else the storage failed with
+	 */
+	ddfsStatus read(uint64_t fileID, uint64_t offset, size_t size, void *buffer,
+					size_t *bytesRead, ddfsReadahead *readahead = NULL);
+
+	/* Forget every page of a file, eg. when it changed underneath */
+	void invalidate(uint64_t fileID);
+	/* Forget the pages holding size bytes at offset, eg. after a write */
+	void invalidate(uint64_t fileID, uint64_t offset, size_t size);
+
+	uint64_t getHits() {
+		return hits.load();
+	}
+
+	uint64_t getMisses() {
+		return misses.load();
+	}
+
+	uint64_t getReadaheadPages() {
+		return readaheadPages.load();
+	}
+
+private:
+	static const int s_maxQueuedAhead = DDFS_READAHEAD_MAX_PAGES * 8;
+
+	enum pageState {
+		PAGE_LOADING,
+		PAGE_READY,
+		PAGE_FAILED
+	};
+
+	enum pageList {
+		LIST_T1,
+		LIST_T2
+	};
+
+	struct pageKey {
+		uint64_t fileID;
+		uint64_t index;
+
+		bool operator==(const pageKey &other) const {
+			return fileID == other.fileID && index == other.index;
+		}
+	};
+
+	struct pageKeyHash {
+		size_t operator()(const pageKey &key) const {
+			uint64_t value = key.fileID * 0x9E3779B97F4A7C15ULL ^ (key.index + 0x632BE59BD9B4E019ULL);
+			value ^= value >> 29;
+			return (size_t) (value * 0xBF58476D1CE4E5B9ULL);
+		}
+	};
+
+	struct page {
+		page() : state(PAGE_LOADING), status(DDFS_OK), pins(0), list(LIST_T1),
+						detached(false), stale(false), valid(0), data(DDFS_PAGE_SIZE) {}
+
+		pageKey key;
+		pageState state;
+		ddfsStatus status;
+		int pins;
+		pageList list;
+		std::list<page *>::iterator position;
+		/* Out of the cache, freed by the last one to unpin it */
+		bool detached;
+		/* Detached while loading, what is being read may predate the
+		 * change that detached it */
+		bool stale;
+		/* Bytes of data, less than DDFS_PAGE_SIZE for the last page */
+		size_t valid;
+		vector<uint8_t> data;
+	};
+
+	/* Keys of evicted pages, most recently evicted at the front */
+	struct ghostList {
+		std::list<pageKey> order;
+		unordered_map<pageKey, std::list<pageKey>::iterator, pageKeyHash> where;
+	};
+
+	struct shard {
+		shard() : target(0) {}
+
+		std::mutex shardLock;
+		std::condition_variable pageLoaded;
+		unordered_map<pageKey, page *, pageKeyHash> pages;
+		/* Most recently used at the front */
+		std::list<page *> t1, t2;
+		ghostList b1, b2;
+		/* ARC target size of T1, in pages */
+		size_t target;
+	};
+
+	ddfsPageReader reader;
+	size_t pagesPerShard;
+	shard shards[DDFS_PAGE_CACHE_SHARDS];
+
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> misses;
+	std::atomic<uint64_t> readaheadPages;
+
+	/* Queued pages ahead of readers, never more than s_maxQueuedAhead */
+	std::mutex aheadLock;
+	std::condition_variable aheadQueued;
+	deque<pageKey> aheadQueue;
+	bool stopReadahead;
+	vector<std::thread> aheadThreads;
+
+	shard &shardOf(const pageKey &key);
+	/*
+	 * Returns the page pinned, loaded from storage if need be. NULL
+	 * only for a readahead page that is cached already. A page that
+	 * goes stale while it loads is loaded again.
+	 */
+	page *acquire(const pageKey &key, bool ahead);
+	void release(page *p);
+	/* The rest are called with the shard lock held */
+	/* acquire() once, the lock held by guard is let go while the page
+	 * loads */
+	page *lookup(shard &s, const pageKey &key, bool ahead, std::unique_lock<std::mutex> &guard);
+	/* Make room for one more page */
+	void replace(shard &s, bool ghostInB2);
+	/* Take p out of the cache, without remembering it on a ghost list */
+	void detach(shard &s, page *p);
+	void forgetOldest(ghostList &ghosts);
+	void remember(ghostList &ghosts, const pageKey &key);
+	void readaheadRoutine();
+	void scheduleReadahead(uint64_t fileID, uint64_t lastPage, ddfsReadahead *readahead);
+
+	ddfsPageCache(ddfsPageCache const&);     // Don't Implement
+	void operator=(ddfsPageCache const&);    // Don't implement
+};
+
+#endif /* Ending DDFS_PAGECACHE_HPP */
@@ -15,65 +15,1495 @@
  */
 
 #include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <set>
+#include <unordered_map>
 
 #include "ddfs_simplefilesystem.hpp"
+#include "../global/ddfs_epoch.hpp"
+
+static uint64_t nowNs() {
+	return (uint64_t) chrono::duration_cast<chrono::nanoseconds>(
+					chrono::system_clock::now().time_since_epoch()).count();
+}
+
+ddfsSimpleFilesystem::ddfsSimpleFilesystem(uint64_t cacheBytes) :
+			stripes(DDFS_NAMESPACE_LOCK_STRIPES), checkpointDue(false), tailIndex(0), appliedIndex(0),
+			pageCache([this] (uint64_t fileID, uint64_t offset, uint8_t *buffer, size_t size,
+							size_t *bytesRead) {
+						return readStorage(fileID, offset, buffer, size, bytesRead);
+					}, cacheBytes),
+			writeBack([this] (uint64_t fileID, uint64_t offset, const uint8_t *buffer, size_t size) {
+						return writeStorage(fileID, offset, buffer, size);
+					}), removing(false), loadCount(0), following(false), stopRemover(false) {
+	std::lock_guard<ddfsRWLock> guard(namespaceLock);
+	/* Snapshots see every change before it is made, checkpoints that it is */
+	inodes.setWriteHook([this] (uint64_t block, const ddfsInode *records) {
+				std::lock_guard<std::mutex> hooked(hookLock);
+				snapshots.beforeInodeWrite(block, records);
+				tracker.inodeBlockChanged(block);
+			});
+	directories.setWriteHook([this] (uint64_t directory, const map<string, uint64_t> *entries,
+							const string *name) {
+				std::lock_guard<std::mutex> hooked(hookLock);
+				snapshots.beforeDirectoryWrite(directory, entries);
+				tracker.directoryChanged(directory, entries, name);
+			});
+	inodes.open("");
+	makeRoot();
+	remover = std::thread(&ddfsSimpleFilesystem::removerRoutine, this);
+}
+
+ddfsSimpleFilesystem::~ddfsSimpleFilesystem() {
+	{
+		std::lock_guard<std::mutex> guard(removalLock);
+		stopRemover = true;
+	}
+	removalWake.notify_all();
+	removalDone.notify_all();
+	remover.join();
+}
+
+void ddfsSimpleFilesystem::setDataReader(ddfsDataReader reader) {
+	dataReader = reader;
+}
+
+void ddfsSimpleFilesystem::setDataWriter(ddfsDataWriter writer) {
+	dataWriter = writer;
+}
+
+ddfsPageCache &ddfsSimpleFilesystem::getPageCache() {
+	return pageCache;
+}
+
+ddfsWriteBack &ddfsSimpleFilesystem::getWriteBack() {
+	return writeBack;
+}
+
+ddfsOpenFileTable &ddfsSimpleFilesystem::getOpenFiles() {
+	return openFiles;
+}
+
+ddfsMetadataJournal &ddfsSimpleFilesystem::getJournal() {
+	return journal;
+}
+
+ddfsStatus ddfsSimpleFilesystem::readStorage(uint64_t fileID, uint64_t offset, uint8_t *buffer,
+				size_t size, size_t *bytesRead) {
+	ddfsRedundancy redundancy;
+
+	if(!dataReader)
+		return (ddfsStatus(DDFS_FAILURE));
+	if(redundancyOf(fileID, &redundancy) == false)
+		return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+	return dataReader(fileID, redundancy, offset, buffer, size, bytesRead);
+}
+
+ddfsStatus ddfsSimpleFilesystem::writeStorage(uint64_t fileID, uint64_t offset, const uint8_t *buffer,
+				size_t size) {
+	ddfsRedundancy redundancy;
+
+	if(!dataWriter)
+		return (ddfsStatus(DDFS_FAILURE));
+	/* Deleted since it was written, nothing to keep */
+	if(redundancyOf(fileID, &redundancy) == false)
+		return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+
+	ddfsStatus status = dataWriter(fileID, redundancy, offset, buffer, size);
+	/* Even a failed write may have changed some of it */
+	pageCache.invalidate(fileID, offset, size);
+	return status;
+}
+
+/* Fixed when the file was made, a copy of the record will do */
+bool ddfsSimpleFilesystem::redundancyOf(uint64_t fileID, ddfsRedundancy *redundancy) {
+	ddfsEpochGuard epoch;
+	ddfsInode copy;
+
+	if(inodes.read(fileID, &copy) == false)
+		return false;
+	*redundancy = copy.redundancy;
+	return true;
+}
+
+ddfsStatus ddfsSimpleFilesystem::makeRoot() {
+	ddfsInode *root = inodes.get(DDFS_INODE_ROOT);
+
+	if(root == NULL) {
+		ddfsStatus status = inodes.allocate(&root);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+			return status;
+		/* The first number of a new table */
+		if(root->inode != DDFS_INODE_ROOT) {
+			inodes.release(root->inode);
+			return (ddfsStatus(DDFS_FILESYSTEM_CORRUPTED));
+		}
+
+		root->parent = DDFS_INODE_ROOT;
+		root->mode = DDFS_INODE_TYPE_DIRECTORY | 0755;
+		root->accessTime = root->modifyTime = root->changeTime = nowNs();
+	}
+
+	if(directories.hasDirectory(DDFS_INODE_ROOT) == false)
+		directories.addDirectory(DDFS_INODE_ROOT);
+	return (ddfsStatus(DDFS_OK));
+}
 
 ddfsStatus ddfsSimpleFilesystem::init() {
-	metaData.init("/tmp/ddfsMetaDatafile");
-	return metaData.fillInMemDirectoryTree();
+	return init("/tmp/ddfsMetaDatafile");
 }
 
-ddfsStatus ddfsSimpleFilesystem::init(string metaFileName) {
-	metaData.init(metaFileName);
-	return metaData.fillInMemDirectoryTree();
+ddfsStatus ddfsSimpleFilesystem::init(string fileName) {
+	std::lock_guard<ddfsRWLock> guard(namespaceLock);
+
+	if(openFiles.getOpenCount() > 0)
+		return (ddfsStatus(DDFS_FAILURE));
+	/* They were of the tables about to be replaced */
+	snapshots.clear();
+	{
+		std::lock_guard<std::mutex> removal(removalLock);
+		loadCount++;
+		removals.clear();
+	}
+	{
+		std::lock_guard<std::mutex> freeing(freeLock);
+		pendingFrees.clear();
+	}
+
+	ddfsStatus status = inodes.open(fileName + ".inodes");
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+		global_logger_dsf << ddfsLogger::LOG_WARNING << "SIMPLEFS:: Inode table "
+					<< fileName << ".inodes can not be used. " << status.statusToString() << "\n";
+		inodes.open("");
+		directories.clear();
+		journal.close();
+		metaFileName.clear();
+		tracker.reset(0);
+		makeRoot();
+		return status;
+	}
+	/* Changes from the journal on go into the next checkpoint */
+	tracker.reset(inodes.getCheckpoint());
+	tail.clear();
+	tailIndex = appliedIndex = 0;
+
+	status = directories.load(fileName + ".dirs");
+	if(status.compareStatus(ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST))) {
+		/* A new filesystem */
+		directories.clear();
+	} else if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+		return status;
+	}
+
+	/* What happened after the checkpoint */
+	status = journal.open(fileName + ".journal", [this] (const ddfsMetadataTransaction &transaction) {
+				transaction.apply(inodes, directories);
+			});
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+		return status;
+
+	metaFileName = fileName;
+	status = makeRoot();
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+		return status;
+
+	/* The records on file may be ahead of the journal, the directories
+	 * are not: a create that did not make it is linked from nowhere, a
+	 * move or a removeTree() has a parent it did not get */
+	unordered_map<uint64_t, uint64_t> linkedFrom;
+	vector<uint64_t> all;
+	directories.getDirectories(&all);
+	for(size_t i = 0; i < all.size(); i++) {
+		const map<string, uint64_t> *entries = directories.getEntries(all[i]);
+		map<string, uint64_t>::const_iterator entry = entries->begin();
+		for(; entry != entries->end(); entry++)
+			linkedFrom[entry->second] = all[i];
+	}
+
+	for(uint64_t number = DDFS_INODE_ROOT + 1; number < inodes.getHighWater(); number++) {
+		ddfsInode *inode = inodes.get(number);
+		if(inode == NULL)
+			continue;
+
+		unordered_map<uint64_t, uint64_t>::iterator link = linkedFrom.find(number);
+		if(link != linkedFrom.end()) {
+			if(inode->parent != link->second)
+				inodes.modify(number)->parent = link->second;
+		} else if(directories.hasDirectory(number)) {
+			/* Trees a removeTree() before a crash left half removed */
+			if(inode->parent != 0)
+				inodes.modify(number)->parent = 0;
+			queueRemoval(number);
+		} else {
+			inodes.release(number);
+		}
+	}
+	return checkpoint();
 }
 
-ddfsStatus ddfsSimpleFilesystem::openFile(string path, int mode, void *handler) {
-	return (ddfsStatus(DDFS_FAILURE));
+ddfsStatus ddfsSimpleFilesystem::sync() {
+	std::lock_guard<ddfsRWLock> guard(namespaceLock);
+	return checkpoint();
+}
+
+ddfsStatus ddfsSimpleFilesystem::checkpoint() {
+	checkpointDue = false;
+
+	/* The inode records may reach the file before their transaction, the
+	 * directories only ever do here, with the journal behind them */
+	ddfsStatus status = journal.flush();
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+		global_logger_dsf << ddfsLogger::LOG_WARNING << "SIMPLEFS:: Journal failed, checkpointing.\n";
+	/* The checkpoint holds the frees, whether the journal does or not */
+	releaseFreed(true);
+
+	/* Followers get what changed since the last one, not the files */
+	if(updateHandler) {
+		ddfsMetadataUpdate update;
+		update.kind = METADATA_UPDATE_CHECKPOINT;
+		update.base = tracker.getCheckpoint();
+		update.checkpoint = update.base + 1;
+		update.index = 0;
+		tracker.encodeDelta(update.base, inodes, directories, &update.body);
+
+		tracker.advance(update.checkpoint);
+		inodes.setCheckpoint(update.checkpoint);
+		tail.clear();
+		tailIndex = 0;
+
+		vector<uint8_t> encoded;
+		update.encode(&encoded);
+		updateHandler(encoded);
+	}
+
+	status = inodes.sync();
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false || metaFileName.empty())
+		return status;
+
+	status = directories.save(metaFileName + ".dirs");
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+		return status;
+	return journal.reset();
 }
 
-ddfsStatus ddfsSimpleFilesystem::closeFile(void * handler) {
-	return (ddfsStatus(DDFS_FAILURE));
+uint64_t ddfsSimpleFilesystem::commit(const ddfsMetadataTransaction &transaction) {
+	/* Transactions that touch the same things hold the same stripes, they
+	 * are applied in the order they go into the journal */
+	vector<uint64_t> freed;
+	transaction.apply(inodes, directories, &freed);
 
+	std::lock_guard<std::mutex> guard(commitLock);
+	uint64_t sequence = journal.append(transaction);
+
+	if(freed.empty() == false) {
+		/* Without a journal file there is nothing to wait for, the
+		 * stripes of the freed inodes are still held */
+		bool durable = journal.getDurableSequence() >= sequence;
+		std::lock_guard<std::mutex> freeing(freeLock);
+		for(size_t i = 0; i < freed.size(); i++) {
+			ddfsInode *inode = inodes.get(freed[i]);
+			if(inode == NULL)
+				continue;
+			if(durable) {
+				inodes.release(freed[i]);
+			} else {
+				pendingFree free = { sequence, freed[i], inode->generation };
+				pendingFrees.push_back(free);
+			}
+		}
+	}
+
+	if(updateHandler) {
+		ddfsMetadataUpdate update;
+		update.kind = METADATA_UPDATE_TRANSACTION;
+		update.base = update.checkpoint = tracker.getCheckpoint();
+		update.index = ++tailIndex;
+		transaction.encode(&update.body);
+
+		size_t start = tail.size();
+		update.encode(&tail);
+		updateHandler(vector<uint8_t>(tail.begin() + start, tail.end()));
+	}
+
+	/* Bound the replay after a crash, and the catch-up of a follower */
+	if((metaFileName.empty() == false && journal.getSize() >= DDFS_JOURNAL_CHECKPOINT_BYTES) ||
+					tail.size() >= DDFS_JOURNAL_CHECKPOINT_BYTES)
+		checkpointDue = true;
+	return sequence;
 }
-ddfsStatus ddfsSimpleFilesystem::readFile(void *handler, int size, void *buffer) {
-	return (ddfsStatus(DDFS_FAILURE));
 
+ddfsStatus ddfsSimpleFilesystem::waitDurable(uint64_t sequence) {
+	ddfsStatus status = journal.waitDurable(sequence);
+	releaseFreed(false);
+	return status;
+}
+
+void ddfsSimpleFilesystem::releaseFreed(bool all) {
+	if(all == false) {
+		{
+			std::lock_guard<std::mutex> freeing(freeLock);
+			if(pendingFrees.empty())
+				return;
+		}
+		/* Not into the tables of an init() that came in between */
+		namespaceLock.lockShared();
+	}
+
+	uint64_t durable = journal.getDurableSequence();
+	vector<pendingFree> ready;
+	{
+		std::lock_guard<std::mutex> freeing(freeLock);
+		vector<pendingFree>::iterator kept = pendingFrees.begin();
+		for(vector<pendingFree>::iterator free = pendingFrees.begin(); free != pendingFrees.end(); free++) {
+			if(all || free->sequence <= durable)
+				ready.push_back(*free);
+			else
+				*kept++ = *free;
+		}
+		pendingFrees.erase(kept, pendingFrees.end());
+	}
+
+	if(ready.empty() == false) {
+		/* Exclusive, namespaceLock keeps every stripe free already */
+		vector<uint64_t> keys;
+		for(size_t i = 0; all == false && i < ready.size(); i++)
+			keys.push_back(ready[i].number);
+		ddfsStripeGuard locked(stripes, keys, true);
+
+		for(size_t i = 0; i < ready.size(); i++) {
+			ddfsInode *inode = inodes.get(ready[i].number);
+			/* A follower may have been given the number again since */
+			if(inode != NULL && inode->generation == ready[i].generation)
+				inodes.release(ready[i].number);
+		}
+	}
+
+	if(all == false)
+		namespaceLock.unlockShared();
 }
 
-ddfsStatus ddfsSimpleFilesystem::readFile(void * handler, int size, void *buffer, int offset) {
-	return (ddfsStatus(DDFS_FAILURE));
+void ddfsSimpleFilesystem::checkpointIfDue() {
+	if(checkpointDue == false)
+		return;
 
+	std::lock_guard<ddfsRWLock> guard(namespaceLock);
+	/* Another operation may have got here first */
+	if(checkpointDue)
+		checkpoint();
 }
 
-ddfsStatus ddfsSimpleFilesystem::writeFile(void * handler, int size, void *buffer) {
-	return (ddfsStatus(DDFS_FAILURE));
+void ddfsSimpleFilesystem::setUpdateHandler(ddfsMetadataUpdateHandler handler) {
+	std::lock_guard<ddfsRWLock> guard(namespaceLock);
 
+	updateHandler = handler;
+	tail.clear();
+	tailIndex = 0;
+	/* The tail starts from a checkpoint the followers can get to */
+	if(updateHandler)
+		checkpoint();
 }
 
-ddfsStatus ddfsSimpleFilesystem::writeFile(void * handler, int size, void *buffer, int offset) {
-	return (ddfsStatus(DDFS_FAILURE));
+uint64_t ddfsSimpleFilesystem::getCheckpoint() {
+	ddfsSharedGuard guard(namespaceLock);
+	return tracker.getCheckpoint();
+}
 
-}	
+ddfsStatus ddfsSimpleFilesystem::catchUp(uint64_t since, vector<uint8_t> *updates) {
+	std::lock_guard<ddfsRWLock> guard(namespaceLock);
 
-ddfsStatus ddfsSimpleFilesystem::seekFile(void * handler, int offset){
-	return (ddfsStatus(DDFS_FAILURE));
+	if(updates == NULL)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+	if(!updateHandler)
+		return (ddfsStatus(DDFS_FAILURE));
 
+	updates->clear();
+	/* At the last checkpoint already, the tail is all there is */
+	if(since != tracker.getCheckpoint()) {
+		ddfsMetadataUpdate update;
+		update.kind = METADATA_UPDATE_CHECKPOINT;
+		update.base = since;
+		update.checkpoint = tracker.getCheckpoint();
+		update.index = 0;
+		tracker.encodeDelta(since, inodes, directories, &update.body);
+		update.encode(updates);
+	}
+	updates->insert(updates->end(), tail.begin(), tail.end());
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsSimpleFilesystem::applyUpdates(const uint8_t *data, size_t length) {
+	std::lock_guard<ddfsRWLock> guard(namespaceLock);
+	const uint8_t *cursor = data, *end = data + length;
+
+	if(updateHandler)
+		return (ddfsStatus(DDFS_FAILURE));
+	following = true;
+
+	while(cursor < end) {
+		ddfsMetadataUpdate update;
+		if(update.decode(&cursor, end) == false)
+			return (ddfsStatus(DDFS_FILESYSTEM_CORRUPTED));
+
+		uint64_t at = tracker.getCheckpoint();
+
+		if(update.kind == METADATA_UPDATE_TRANSACTION) {
+			if(update.base != at || update.index > appliedIndex + 1)
+				return (ddfsStatus(DDFS_NETWORK_RETRY));
+			if(update.index <= appliedIndex)
+				continue;
+
+			ddfsMetadataTransaction transaction;
+			if(transaction.decode(update.body.empty() ? NULL : &update.body[0], update.body.size()) == false)
+				return (ddfsStatus(DDFS_FILESYSTEM_CORRUPTED));
+			/* Journaled here too, a restart replays it */
+			commit(transaction);
+			appliedIndex = update.index;
+			continue;
+		}
+
+		/* A full delta goes anywhere, the rest only forward from a
+		 * checkpoint this one knows */
+		bool full = ddfsCheckpointTracker::isFullDelta(update.body);
+		if(full == false && update.checkpoint <= at)
+			continue;
+		if(full == false && update.base > at)
+			return (ddfsStatus(DDFS_NETWORK_RETRY));
+
+		/* The tables are about to change under the snapshots */
+		if(full) {
+			snapshots.clear();
+			std::lock_guard<std::mutex> freeing(freeLock);
+			pendingFrees.clear();
+		}
+		ddfsStatus status = ddfsCheckpointTracker::applyDelta(update.body, inodes, directories);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+			return status;
+		status = makeRoot();
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+			return status;
+
+		if(full)
+			tracker.reset(update.checkpoint);
+		else
+			tracker.advance(update.checkpoint);
+		inodes.setCheckpoint(update.checkpoint);
+		appliedIndex = 0;
+
+		/* Written out at the same checkpoint as the leader */
+		status = checkpoint();
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+			return status;
+	}
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsSimpleFilesystem::resolve(const string &path, uint64_t *inode, uint64_t snapshot) {
+	if(path.empty() || path[0] != '/')
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	uint64_t current = DDFS_INODE_ROOT;
+	size_t start = 1;
+	/* Live names are looked up without a lock, see ddfsDirectoryTable */
+	ddfsEpochGuard epoch;
+
+	while(start < path.size()) {
+		size_t end = path.find('/', start);
+		if(end == string::npos)
+			end = path.size();
+
+		/* Empty components, as in a//b or a trailing /, are skipped */
+		if(end > start) {
+			string name = path.substr(start, end - start);
+			ddfsStatus status(DDFS_OK);
+			if(snapshot == 0) {
+				status = directories.lookup(current, name, &current);
+			} else {
+				ddfsSharedGuard locked(stripes.forKey(current));
+				std::lock_guard<std::mutex> hooked(hookLock);
+				status = snapshots.lookup(snapshot, directories, current, name, &current);
+			}
+			if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+				return status;
+		}
+		start = end + 1;
+	}
+
+	*inode = current;
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsSimpleFilesystem::resolveParent(const string &path, uint64_t *directory, string *name) {
+	size_t end = path.find_last_not_of('/');
+	if(path.empty() || path[0] != '/' || end == string::npos)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	size_t slash = path.rfind('/', end);
+	*name = path.substr(slash + 1, end - slash);
+	if(ddfsDirectoryTable::isValidName(*name) == false)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	ddfsStatus status = resolve(slash == 0 ? string("/") : path.substr(0, slash), directory);
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+		return status;
+
+	/* Checked again by the caller, once it has the stripe */
+	if(directories.hasDirectory(*directory) == false)
+		return (ddfsStatus(DDFS_FILESYSTEM_NOT_A_DIRECTORY));
+	return (ddfsStatus(DDFS_OK));
+}
+
+bool ddfsSimpleFilesystem::isStale(ddfsOpenFile *handle) {
+	return handle->inode->inode != handle->fileID || handle->inode->generation != handle->generation;
+}
+
+bool ddfsSimpleFilesystem::isPendingFree(uint64_t number) {
+	std::lock_guard<std::mutex> freeing(freeLock);
+	for(size_t i = 0; i < pendingFrees.size(); i++) {
+		if(pendingFrees[i].number == number)
+			return true;
+	}
+	return false;
+}
+
+void ddfsSimpleFilesystem::noteAccess(ddfsOpenFile *handle) {
+	uint64_t accessed = handle->accessed;
+	handle->accessed = 0;
+
+	const ddfsInode *inode = handle->inode;
+	if(accessed <= inode->accessTime)
+		return;
+	if(inode->accessTime > inode->modifyTime && inode->accessTime > inode->changeTime &&
+					accessed - inode->accessTime < DDFS_ACCESS_TIME_INTERVAL_NS)
+		return;
+	inodes.modify(handle->fileID)->accessTime = accessed;
+}
+
+ddfsStatus ddfsSimpleFilesystem::createInode(uint64_t parent, const string &name, uint32_t mode, uint64_t number,
+				const ddfsRedundancy &redundancy, uint64_t now, ddfsMetadataTransaction *transaction) {
+	ddfsInode *parentInode = inodes.get(parent);
+	if(parentInode == NULL || directories.hasDirectory(parent) == false)
+		return (ddfsStatus(DDFS_FILESYSTEM_NOT_A_DIRECTORY));
+	if(ddfsDirectoryTable::isValidName(name) == false)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	uint64_t existing;
+	if(directories.lookup(parent, name, &existing).compareStatus(ddfsStatus(DDFS_OK)))
+		return (ddfsStatus(DDFS_FILESYSTEM_FILE_EXISTS));
+
+	ddfsInode inode = *inodes.claim(number);
+	inode.parent = parent;
+	inode.mode = mode;
+	if(inode.isDirectory() == false)
+		inode.redundancy = redundancy;
+	inode.accessTime = inode.modifyTime = inode.changeTime = now;
+
+	transaction->setInode(inode);
+	if(inode.isDirectory())
+		transaction->addDirectory(inode.inode);
+	transaction->link(parent, name, inode.inode);
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsSimpleFilesystem::create(const string &directory, const string &name, uint32_t mode,
+				const ddfsRedundancy &redundancy) {
+	ddfsMetadataTransaction transaction;
+	uint64_t sequence;
+
+	if(redundancy.isValid() == false)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+	{
+		ddfsSharedGuard guard(namespaceLock);
+		uint64_t parent, number;
+
+		ddfsStatus status = resolve(directory, &parent);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+			return status;
+		status = inodes.reserve(&number);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+			return status;
+
+		/* The new number too, a stale handle may still look at its record */
+		ddfsStripeGuard locked(stripes, {parent, number}, true);
+		uint64_t now = nowNs();
+		status = createInode(parent, name, mode, number, redundancy, now, &transaction);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+			inodes.unreserve(number);
+			return status;
+		}
+
+		ddfsInode directoryInode = *inodes.get(parent);
+		directoryInode.modifyTime = directoryInode.changeTime = now;
+		transaction.setInode(directoryInode);
+		sequence = commit(transaction);
+	}
+	checkpointIfDue();
+	return waitDurable(sequence);
+}
+
+ddfsStatus ddfsSimpleFilesystem::removeEntry(uint64_t directory, const string &name, uint64_t expected,
+				uint64_t *sequence, uint64_t *removed, bool *detached) {
+	for(;;) {
+		uint64_t number, found;
+
+		ddfsStatus status = directories.lookup(directory, name, &number);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+			return status;
+		if(expected != 0 && number != expected)
+			return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+
+		ddfsStripeGuard locked(stripes, {directory, number}, true);
+		status = directories.lookup(directory, name, &found);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+			return status;
+		if(found != number)
+			continue;
+
+		ddfsInode *inode = inodes.get(number), *parent = inodes.get(directory);
+		if(inode == NULL || parent == NULL)
+			return (ddfsStatus(DDFS_FILESYSTEM_CORRUPTED));
+
+		ddfsMetadataTransaction transaction;
+		uint64_t now = nowNs();
+		transaction.unlink(directory, name);
+
+		*detached = directories.getEntryCount(number) > 0;
+		if(*detached) {
+			/* Left whole for the remover, no longer anywhere */
+			ddfsInode orphan = *inode;
+			orphan.parent = 0;
+			orphan.changeTime = now;
+			transaction.setInode(orphan);
+		} else {
+			if(directories.hasDirectory(number))
+				transaction.removeDirectory(number);
+			transaction.freeInode(number);
+		}
+
+		ddfsInode from = *parent;
+		from.modifyTime = from.changeTime = now;
+		transaction.setInode(from);
+
+		*removed = number;
+		*sequence = commit(transaction);
+		return (ddfsStatus(DDFS_OK));
+	}
+}
+
+ddfsStatus ddfsSimpleFilesystem::createFiles(string directory, const vector<string> &names, int mode) {
+	ddfsMetadataTransaction transaction;
+	uint64_t sequence;
+	{
+		ddfsSharedGuard guard(namespaceLock);
+		uint64_t parent, existing;
+
+		ddfsStatus status = resolve(directory, &parent);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false || names.empty())
+			return status;
+
+		/* The parent and a number for every name, locked together */
+		vector<uint64_t> keys(1, parent);
+		for(size_t i = 0; i < names.size() && status.compareStatus(ddfsStatus(DDFS_OK)); i++) {
+			uint64_t number;
+			status = inodes.reserve(&number);
+			if(status.compareStatus(ddfsStatus(DDFS_OK)))
+				keys.push_back(number);
+		}
+
+		ddfsStripeGuard locked(stripes, keys, true);
+		ddfsInode *parentInode = inodes.get(parent);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) &&
+						(parentInode == NULL || directories.hasDirectory(parent) == false))
+			status = ddfsStatus(DDFS_FILESYSTEM_NOT_A_DIRECTORY);
+
+		/* Every name is checked before any is created */
+		set<string> seen;
+		for(size_t i = 0; i < names.size() && status.compareStatus(ddfsStatus(DDFS_OK)); i++) {
+			if(ddfsDirectoryTable::isValidName(names[i]) == false)
+				status = ddfsStatus(DDFS_GENERAL_PARAM_INVALID);
+			else if(seen.insert(names[i]).second == false ||
+							directories.lookup(parent, names[i], &existing).compareStatus(ddfsStatus(DDFS_OK)))
+				status = ddfsStatus(DDFS_FILESYSTEM_FILE_EXISTS);
+		}
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+			for(size_t k = 1; k < keys.size(); k++)
+				inodes.unreserve(keys[k]);
+			return status;
+		}
+
+		uint64_t now = nowNs();
+		ddfsRedundancy replicated = {DDFS_REDUNDANCY_REPLICATED, 0, 0};
+		for(size_t i = 0; i < names.size(); i++)
+			createInode(parent, names[i], DDFS_INODE_TYPE_FILE | (mode & 07777), keys[i + 1], replicated,
+							now, &transaction);
+
+		ddfsInode directoryInode = *parentInode;
+		directoryInode.modifyTime = directoryInode.changeTime = now;
+		transaction.setInode(directoryInode);
+		sequence = commit(transaction);
+	}
+	checkpointIfDue();
+	return waitDurable(sequence);
+}
+
+ddfsStatus ddfsSimpleFilesystem::openFile(string path, int mode, ddfsFileHandle *handler) {
+	ddfsInode *inode;
+	uint64_t number, generation;
+
+	if(handler == NULL)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	/* The only time the path is looked at */
+	{
+		ddfsSharedGuard guard(namespaceLock);
+		ddfsStatus status = resolve(path, &number);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+			return status;
+
+		/* Gone already if it was deleted since */
+		ddfsSharedGuard locked(stripes.forKey(number));
+		inode = inodes.get(number);
+		if(inode == NULL)
+			return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+		if(inode->isDirectory())
+			return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+		generation = inode->generation;
+	}
+
+	ddfsOpenFile *handle;
+	ddfsStatus status = openFiles.allocate(handler, &handle);
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+		global_logger_dsf << ddfsLogger::LOG_WARNING << "SIMPLEFS:: No slot left to open "
+					<< path << ".\n";
+		return status;
+	}
+
+	handle->fileID = number;
+	handle->inode = inode;
+	handle->generation = generation;
+	handle->mode = mode;
+	handle->writeBuffer = writeBack.open(number);
+
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsSimpleFilesystem::closeFile(ddfsFileHandle handler) {
+	ddfsOpenFile *handle = openFiles.lookup(handler);
+
+	if(handle == NULL)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	/* The pages stay cached for the next open */
+	ddfsStatus status = writeBack.close(handle->writeBuffer);
+
+	/* Journaled, not waited on: whatever commits next makes it durable */
+	if(handle->changed || handle->accessed != 0) {
+		{
+			ddfsSharedGuard guard(namespaceLock);
+			ddfsStripeGuard locked(stripes, {handle->fileID}, true);
+			if(isStale(handle) == false) {
+				noteAccess(handle);
+				if(handle->changed) {
+					ddfsMetadataTransaction transaction;
+					transaction.setInode(*handle->inode);
+					commit(transaction);
+				}
+			}
+		}
+		checkpointIfDue();
+	}
+
+	openFiles.release(handler);
+	return status;
+}
+
+ddfsStatus ddfsSimpleFilesystem::readAt(ddfsOpenFile *handle, int size, void *buffer, int offset) {
+	if(buffer == NULL || size < 0 || offset < 0)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	/* Nothing is read past the end of the file */
+	uint64_t fileSize;
+	{
+		ddfsSharedGuard guard(namespaceLock);
+		ddfsSharedGuard locked(stripes.forKey(handle->fileID));
+		if(isStale(handle))
+			return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+		fileSize = handle->inode->size;
+	}
+	handle->accessed = nowNs();
+	handle->transferred = 0;
+	if((uint64_t) offset >= fileSize)
+		return (ddfsStatus(DDFS_OK));
+	if((uint64_t) offset + size > fileSize)
+		size = (int) (fileSize - offset);
+
+	/* The handle reads what it wrote */
+	if(handle->writeBuffer->isDirty()) {
+		ddfsStatus status = writeBack.flush(handle->writeBuffer);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+			return status;
+	}
+
+	return pageCache.read(handle->fileID, (uint64_t) offset, (size_t) size, buffer,
+					&handle->transferred, &handle->readahead);
+}
+
+ddfsStatus ddfsSimpleFilesystem::writeAt(ddfsOpenFile *handle, int size, void *buffer, int offset) {
+	if(buffer == NULL || size < 0 || offset < 0)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	{
+		ddfsSharedGuard guard(namespaceLock);
+		ddfsSharedGuard locked(stripes.forKey(handle->fileID));
+		if(isStale(handle)) {
+			handle->transferred = 0;
+			return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+		}
+	}
+
+	ddfsStatus status = writeBack.write(handle->writeBuffer, (uint64_t) offset, buffer, (size_t) size);
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+		handle->transferred = 0;
+		return status;
+	}
+
+	handle->transferred = (size_t) size;
+
+	ddfsSharedGuard guard(namespaceLock);
+	ddfsStripeGuard locked(stripes, {handle->fileID}, true);
+	if(isStale(handle))
+		return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+
+	ddfsInode *inode = inodes.modify(handle->fileID);
+	if((uint64_t) offset + size > inode->size)
+		inode->size = (uint64_t) offset + size;
+	inode->modifyTime = nowNs();
+	handle->changed = true;
+	return status;
+}
+
+ddfsStatus ddfsSimpleFilesystem::readFile(ddfsFileHandle handler, int size, void *buffer) {
+	ddfsOpenFile *handle = openFiles.lookup(handler);
+
+	if(handle == NULL)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	ddfsStatus status = readAt(handle, size, buffer, (int) handle->offset);
+	handle->offset += handle->transferred;
+	return status;
+}
+
+ddfsStatus ddfsSimpleFilesystem::readFile(ddfsFileHandle handler, int size, void *buffer, int offset) {
+	ddfsOpenFile *handle = openFiles.lookup(handler);
+
+	if(handle == NULL)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	return readAt(handle, size, buffer, offset);
+}
+
+ddfsStatus ddfsSimpleFilesystem::writeFile(ddfsFileHandle handler, int size, void *buffer) {
+	ddfsOpenFile *handle = openFiles.lookup(handler);
+
+	if(handle == NULL)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	ddfsStatus status = writeAt(handle, size, buffer, (int) handle->offset);
+	handle->offset += handle->transferred;
+	return status;
+}
+
+ddfsStatus ddfsSimpleFilesystem::writeFile(ddfsFileHandle handler, int size, void *buffer, int offset) {
+	ddfsOpenFile *handle = openFiles.lookup(handler);
+
+	if(handle == NULL)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	return writeAt(handle, size, buffer, offset);
+}
+
+ddfsStatus ddfsSimpleFilesystem::seekFile(ddfsFileHandle handler, int offset){
+	ddfsOpenFile *handle = openFiles.lookup(handler);
+
+	if(handle == NULL || offset < 0)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	handle->offset = (uint64_t) offset;
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsSimpleFilesystem::syncFile(ddfsFileHandle handler) {
+	ddfsOpenFile *handle = openFiles.lookup(handler);
+
+	if(handle == NULL)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	ddfsStatus status = writeBack.flush(handle->writeBuffer);
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+		return status;
+
+	/* The size that goes with the data */
+	uint64_t sequence;
+	{
+		ddfsSharedGuard guard(namespaceLock);
+		ddfsStripeGuard locked(stripes, {handle->fileID}, true);
+		if(isStale(handle))
+			return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+
+		noteAccess(handle);
+		ddfsMetadataTransaction transaction;
+		transaction.setInode(*handle->inode);
+		sequence = commit(transaction);
+		handle->changed = false;
+	}
+	checkpointIfDue();
+	return waitDurable(sequence);
 }
 
 ddfsStatus ddfsSimpleFilesystem::createFile(string directory, string fileName, int mode) {
-	return (ddfsStatus(DDFS_FAILURE));
+	ddfsRedundancy replicated = {DDFS_REDUNDANCY_REPLICATED, 0, 0};
+	return create(directory, fileName, DDFS_INODE_TYPE_FILE | (mode & 07777), replicated);
+}
 
+ddfsStatus ddfsSimpleFilesystem::createFile(string directory, string fileName, int mode,
+				ddfsRedundancy redundancy) {
+	return create(directory, fileName, DDFS_INODE_TYPE_FILE | (mode & 07777), redundancy);
 }
 
 ddfsStatus ddfsSimpleFilesystem::makedirectory(string directory, string directoryName) {
-	return (ddfsStatus(DDFS_FAILURE));
+	ddfsRedundancy none = {DDFS_REDUNDANCY_REPLICATED, 0, 0};
+	return create(directory, directoryName, DDFS_INODE_TYPE_DIRECTORY | 0755, none);
+}
+
+ddfsStatus ddfsSimpleFilesystem::renameFile(string oldPath, string newPath) {
+	ddfsMetadataTransaction transaction;
+	uint64_t sequence, replaced = 0;
+	{
+		ddfsSharedGuard guard(namespaceLock);
+		uint64_t oldDirectory, newDirectory;
+		string oldName, newName;
+
+		ddfsStatus status = resolveParent(oldPath, &oldDirectory, &oldName);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+			return status;
+		status = resolveParent(newPath, &newDirectory, &newName);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+			return status;
+
+		/* Parents of directories stay put while the move is checked */
+		std::unique_lock<std::mutex> moving(renameLock, std::defer_lock);
+		if(oldDirectory != newDirectory)
+			moving.lock();
+
+		for(;;) {
+			uint64_t number, existing = 0, found = 0;
+
+			/* What the names are now, their stripes are taken with the
+			 * directories' below and the names looked up again */
+			{
+				ddfsStripeGuard looking(stripes, {oldDirectory, newDirectory}, false);
+				status = directories.lookup(oldDirectory, oldName, &number);
+				if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+					return status;
+				status = directories.lookup(newDirectory, newName, &existing);
+				if(status.compareStatus(ddfsStatus(DDFS_FILESYSTEM_NOT_A_DIRECTORY)))
+					return status;
+			}
+
+			/* A directory can not go below itself */
+			if(moving.owns_lock() && directories.hasDirectory(number)) {
+				for(uint64_t up = newDirectory; up != DDFS_INODE_ROOT; ) {
+					if(up == number)
+						return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+					ddfsSharedGuard locked(stripes.forKey(up));
+					ddfsInode *above = inodes.get(up);
+					if(above == NULL)
+						break;
+					up = above->parent;
+				}
+			}
+
+			ddfsStripeGuard locked(stripes, {oldDirectory, newDirectory, number, existing}, true);
+			status = directories.lookup(oldDirectory, oldName, &found);
+			if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+				return status;
+			if(found != number)
+				continue;
+			found = 0;
+			status = directories.lookup(newDirectory, newName, &found);
+			if(status.compareStatus(ddfsStatus(DDFS_FILESYSTEM_NOT_A_DIRECTORY)))
+				return status;
+			if(found != existing)
+				continue;
+
+			ddfsInode *source = inodes.get(number);
+			if(source == NULL)
+				return (ddfsStatus(DDFS_FILESYSTEM_CORRUPTED));
+
+			if(existing != 0) {
+				if(existing == number)
+					return (ddfsStatus(DDFS_OK));
+
+				ddfsInode *target = inodes.get(existing);
+				if(target == NULL)
+					return (ddfsStatus(DDFS_FILESYSTEM_CORRUPTED));
+				if(source->isDirectory() && target->isDirectory() == false)
+					return (ddfsStatus(DDFS_FILESYSTEM_NOT_A_DIRECTORY));
+				if(target->isDirectory() && (source->isDirectory() == false ||
+								directories.getEntryCount(existing) > 0))
+					return (ddfsStatus(DDFS_FILESYSTEM_FILE_EXISTS));
+
+				/* The link below takes the name over */
+				if(target->isDirectory())
+					transaction.removeDirectory(existing);
+				transaction.freeInode(existing);
+				replaced = existing;
+			}
+
+			uint64_t now = nowNs();
+			ddfsInode moved = *source;
+			moved.parent = newDirectory;
+			moved.changeTime = now;
+
+			transaction.unlink(oldDirectory, oldName);
+			transaction.link(newDirectory, newName, number);
+			transaction.setInode(moved);
+
+			ddfsInode from = *inodes.get(oldDirectory);
+			from.modifyTime = from.changeTime = now;
+			transaction.setInode(from);
+			if(newDirectory != oldDirectory) {
+				ddfsInode to = *inodes.get(newDirectory);
+				to.modifyTime = to.changeTime = now;
+				transaction.setInode(to);
+			}
+
+			sequence = commit(transaction);
+			break;
+		}
+	}
+	checkpointIfDue();
+
+	/* Nothing reads the replaced file again, its handles are stale */
+	if(replaced != 0)
+		pageCache.invalidate(replaced);
+	return waitDurable(sequence);
+}
+
+ddfsStatus ddfsSimpleFilesystem::statFile(string path, ddfsInode *info) {
+	uint64_t number;
+	{
+		/* Without a lock first. Kept if neither the namespace nor the
+		 * stripe of the record was written meanwhile */
+		ddfsEpochGuard epoch;
+		uint32_t whole = namespaceLock.readBegin();
+		ddfsStatus status = resolve(path, &number);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+			if(namespaceLock.readValidate(whole))
+				return status;
+		} else {
+			ddfsRWLock &record = stripes.forKey(number);
+			uint32_t begin = record.readBegin();
+			ddfsInode copy;
+			bool found = inodes.read(number, &copy);
+			if(record.readValidate(begin) && namespaceLock.readValidate(whole)) {
+				if(found == false)
+					return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+				*info = copy;
+				return (ddfsStatus(DDFS_OK));
+			}
+		}
+	}
+
+	ddfsSharedGuard guard(namespaceLock);
+	ddfsStatus status = resolve(path, &number);
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+		return status;
+
+	ddfsSharedGuard locked(stripes.forKey(number));
+	ddfsInode *inode = inodes.get(number);
+	if(inode == NULL)
+		return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+
+	*info = *inode;
+	return (ddfsStatus(DDFS_OK));
+}
 
+ddfsStatus ddfsSimpleFilesystem::statFile(ddfsFileHandle handler, ddfsInode *info) {
+	ddfsOpenFile *handle = openFiles.lookup(handler);
+
+	if(handle == NULL || info == NULL)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	{
+		/* As statFile(path), the record stays mapped within the epoch */
+		ddfsEpochGuard epoch;
+		ddfsRWLock &record = stripes.forKey(handle->fileID);
+		uint32_t whole = namespaceLock.readBegin(), begin = record.readBegin();
+		ddfsInode copy;
+		memcpy(&copy, handle->inode, sizeof(copy));
+		if(record.readValidate(begin) && namespaceLock.readValidate(whole)) {
+			if(copy.inode != handle->fileID || copy.generation != handle->generation)
+				return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+			*info = copy;
+			return (ddfsStatus(DDFS_OK));
+		}
+	}
+
+	ddfsSharedGuard guard(namespaceLock);
+	ddfsSharedGuard locked(stripes.forKey(handle->fileID));
+	if(isStale(handle))
+		return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+	*info = *handle->inode;
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsSimpleFilesystem::truncateFile(ddfsFileHandle handler, uint64_t size) {
+	ddfsOpenFile *handle = openFiles.lookup(handler);
+
+	if(handle == NULL)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	/* Buffered writes land before the new size takes effect */
+	ddfsStatus status = writeBack.flush(handle->writeBuffer);
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+		return status;
+
+	uint64_t oldSize;
+	{
+		ddfsSharedGuard guard(namespaceLock);
+		ddfsStripeGuard locked(stripes, {handle->fileID}, true);
+		if(isStale(handle))
+			return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+
+		ddfsMetadataTransaction transaction;
+		ddfsInode truncated = *handle->inode;
+		oldSize = truncated.size;
+		truncated.size = size;
+		truncated.modifyTime = truncated.changeTime = nowNs();
+		transaction.setInode(truncated);
+		commit(transaction);
+		handle->changed = false;
+	}
+	checkpointIfDue();
+
+	if(size < oldSize)
+		pageCache.invalidate(handle->fileID, size, (size_t) (oldSize - size));
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsSimpleFilesystem::readDirectory(string path, vector<pair<string, ddfsFileAttributes> > *entries) {
+	ddfsSharedGuard guard(namespaceLock);
+	vector<pair<string, uint64_t> > names;
+	uint64_t number;
+
+	if(entries == NULL)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	ddfsStatus status = resolve(path, &number);
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+		return status;
+	{
+		ddfsSharedGuard locked(stripes.forKey(number));
+		status = directories.list(number, &names);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+			return status;
+	}
+
+	/* Each record as a statFile() of it would find it, without a lock
+	 * unless it is being written */
+	entries->clear();
+	entries->reserve(names.size());
+	for(size_t i = 0; i < names.size(); i++) {
+		ddfsRWLock &record = stripes.forKey(names[i].second);
+		uint32_t begin = record.readBegin();
+		ddfsInode copy;
+		bool found = inodes.read(names[i].second, &copy);
+		if(record.readValidate(begin) == false) {
+			ddfsSharedGuard locked(record);
+			found = inodes.read(names[i].second, &copy);
+		}
+
+		/* Deleted or moved away since it was listed */
+		if(found == false || copy.parent != number)
+			continue;
+		ddfsFileAttributes attributes;
+		attributes.inode = copy.inode;
+		attributes.size = copy.size;
+		attributes.accessTime = copy.accessTime;
+		attributes.modifyTime = copy.modifyTime;
+		attributes.changeTime = copy.changeTime;
+		attributes.mode = copy.mode;
+		entries->push_back(make_pair(names[i].first, attributes));
+	}
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsSimpleFilesystem::createSnapshot(string name, uint64_t *id) {
+	if(id == NULL)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	/* Nothing is half way through a change while it is taken */
+	std::lock_guard<ddfsRWLock> guard(namespaceLock);
+	return snapshots.create(name, nowNs(), id);
+}
+
+ddfsStatus ddfsSimpleFilesystem::deleteSnapshot(uint64_t id) {
+	std::lock_guard<ddfsRWLock> guard(namespaceLock);
+	return snapshots.remove(id);
+}
+
+ddfsStatus ddfsSimpleFilesystem::findSnapshot(string name, uint64_t *id) {
+	ddfsSharedGuard guard(namespaceLock);
+	std::lock_guard<std::mutex> hooked(hookLock);
+	return snapshots.find(name, id);
+}
+
+void ddfsSimpleFilesystem::listSnapshots(vector<ddfsSnapshotInfo> *info) {
+	ddfsSharedGuard guard(namespaceLock);
+	std::lock_guard<std::mutex> hooked(hookLock);
+	snapshots.list(info);
+}
+
+ddfsStatus ddfsSimpleFilesystem::statSnapshot(uint64_t id, string path, ddfsInode *info) {
+	ddfsSharedGuard guard(namespaceLock);
+	uint64_t number;
+
+	if(id == 0 || info == NULL)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	ddfsStatus status = resolve(path, &number, id);
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+		return status;
+
+	ddfsSharedGuard locked(stripes.forKey(number));
+	std::lock_guard<std::mutex> hooked(hookLock);
+	return snapshots.getInode(id, inodes, number, info);
+}
+
+ddfsStatus ddfsSimpleFilesystem::listSnapshot(uint64_t id, string path, vector<pair<string, uint64_t> > *entries) {
+	ddfsSharedGuard guard(namespaceLock);
+	uint64_t number;
+
+	if(id == 0 || entries == NULL)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	ddfsStatus status = resolve(path, &number, id);
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+		return status;
+
+	ddfsSharedGuard locked(stripes.forKey(number));
+	std::lock_guard<std::mutex> hooked(hookLock);
+	return snapshots.list(id, directories, number, entries);
+}
+
+ddfsStatus ddfsSimpleFilesystem::deleteFile(ddfsFileHandle handler) {
+	ddfsOpenFile *handle = openFiles.lookup(handler);
+	uint64_t sequence, removed;
+	bool detached;
+
+	if(handle == NULL)
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+	{
+		ddfsSharedGuard guard(namespaceLock);
+		uint64_t lastDirectory = 0;
+		uint32_t lastWrites = 0;
+		for(;;) {
+			uint64_t directory;
+			string name;
+			{
+				ddfsSharedGuard locked(stripes.forKey(handle->fileID));
+				if(isStale(handle) || isPendingFree(handle->fileID))
+					return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+				directory = handle->inode->parent;
+			}
+
+			/* The one name of the file, by its number */
+			uint32_t writes;
+			{
+				ddfsRWLock &stripe = stripes.forKey(directory);
+				ddfsSharedGuard locked(stripe);
+				writes = stripe.readBegin();
+				const map<string, uint64_t> *entries = directories.getEntries(directory);
+				if(entries != NULL) {
+					map<string, uint64_t>::const_iterator entry = entries->begin();
+					for(; entry != entries->end() && name.empty(); entry++) {
+						if(entry->second == handle->fileID)
+							name = entry->first;
+					}
+				}
+			}
+
+			if(name.empty() == false) {
+				ddfsStatus status = removeEntry(directory, name, handle->fileID, &sequence, &removed,
+								&detached);
+				if(status.compareStatus(ddfsStatus(DDFS_OK)))
+					break;
+				if(status.compareStatus(ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST)) == false)
+					return status;
+			}
+
+			/* Moved or deleted in between, looked for again. With nothing
+			 * changed the record names a parent that does not link it. */
+			if(directory == lastDirectory && writes == lastWrites) {
+				global_logger_dsf << ddfsLogger::LOG_ERROR << "SIMPLEFS:: Inode " << handle->fileID
+							<< " is not in its directory " << directory << ".\n";
+				return (ddfsStatus(DDFS_FILESYSTEM_CORRUPTED));
+			}
+			lastDirectory = directory;
+			lastWrites = writes;
+		}
+	}
+	checkpointIfDue();
+
+	pageCache.invalidate(removed);
+	return waitDurable(sequence);
+}
+
+ddfsStatus ddfsSimpleFilesystem::removeTree(string path) {
+	uint64_t sequence, removed;
+	bool detached;
+	{
+		ddfsSharedGuard guard(namespaceLock);
+		uint64_t directory;
+		string name;
+
+		ddfsStatus status = resolveParent(path, &directory, &name);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+			return status;
+
+		/* A directory leaves its parent, as in a move */
+		std::lock_guard<std::mutex> moving(renameLock);
+		status = removeEntry(directory, name, 0, &sequence, &removed, &detached);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+			return status;
+		if(detached)
+			queueRemoval(removed);
+	}
+	checkpointIfDue();
+
+	if(detached == false)
+		pageCache.invalidate(removed);
+	return waitDurable(sequence);
 }
 
-ddfsStatus ddfsSimpleFilesystem::deleteFile(void *handler){
-	return (ddfsStatus(DDFS_FAILURE));
+void ddfsSimpleFilesystem::waitRemovals() {
+	std::unique_lock<std::mutex> guard(removalLock);
+	removalDone.wait(guard, [this] { return stopRemover || (removals.empty() && removing == false); });
+}
+
+void ddfsSimpleFilesystem::queueRemoval(uint64_t number) {
+	{
+		std::lock_guard<std::mutex> guard(removalLock);
+		removals.push_back(number);
+	}
+	removalWake.notify_one();
+}
+
+void ddfsSimpleFilesystem::removerRoutine() {
+	std::unique_lock<std::mutex> guard(removalLock);
 
+	for(;;) {
+		removalWake.wait(guard, [this] { return stopRemover || removals.empty() == false; });
+		if(stopRemover)
+			return;
+
+		vector<uint64_t> path(1, removals.front());
+		uint64_t loaded = loadCount;
+		removals.pop_front();
+		removing = true;
+		guard.unlock();
+
+		/* The namespace is let go between batches */
+		while(path.empty() == false && stopRemover == false)
+			removeBatch(loaded, &path);
+		/* The batches were not waited on, their numbers are given out
+		 * again once on disk */
+		journal.flush();
+		releaseFreed(false);
+
+		guard.lock();
+		removing = false;
+		removalDone.notify_all();
+	}
 }
 
+void ddfsSimpleFilesystem::removeBatch(uint64_t loaded, vector<uint64_t> *path) {
+	vector<uint64_t> freed;
+	{
+		ddfsSharedGuard guard(namespaceLock);
+
+		/* init() found what was left of it in the new tables, if anything */
+		if(following || loadCount != loaded) {
+			path->clear();
+			return;
+		}
 
+		uint64_t directory = path->back(), above = path->size() > 1 ? (*path)[path->size() - 2] : 0;
+		vector<pair<string, uint64_t> > batch;
+		{
+			ddfsSharedGuard looking(stripes.forKey(directory));
+			const map<string, uint64_t> *entries = directories.getEntries(directory);
+			if(entries != NULL) {
+				map<string, uint64_t>::const_iterator entry = entries->begin();
+				for(; entry != entries->end() && batch.size() < DDFS_REMOVE_BATCH; entry++)
+					batch.push_back(*entry);
+			}
+		}
+
+		vector<uint64_t> keys(1, directory);
+		for(size_t i = 0; i < batch.size(); i++)
+			keys.push_back(batch[i].second);
+		ddfsStripeGuard locked(stripes, keys, true);
+
+		/* A rename that found it before the tree was detached moved it out */
+		ddfsInode *inode = inodes.get(directory);
+		if(inode == NULL || inode->parent != above || directories.hasDirectory(directory) == false) {
+			path->pop_back();
+			return;
+		}
+
+		ddfsMetadataTransaction transaction;
+		if(batch.empty()) {
+			/* Something was created in it since it was listed */
+			if(directories.getEntryCount(directory) > 0)
+				return;
+			path->pop_back();
+			/* One below the top goes in a batch of its parent */
+			if(above != 0)
+				return;
+			transaction.removeDirectory(directory);
+			transaction.freeInode(directory);
+		}
+
+		size_t depth = path->size();
+		for(size_t i = 0; i < batch.size(); i++) {
+			uint64_t number = batch[i].second, found;
+			if(directories.lookup(directory, batch[i].first, &found).compareStatus(ddfsStatus(DDFS_OK)) == false ||
+							found != number)
+				continue;
+
+			if(directories.hasDirectory(number)) {
+				/* Emptied first, one at a time, its parent is the last of path */
+				if(directories.getEntryCount(number) > 0) {
+					if(path->size() == depth)
+						path->push_back(number);
+					continue;
+				}
+				transaction.removeDirectory(number);
+			}
+			transaction.unlink(directory, batch[i].first);
+			transaction.freeInode(number);
+			freed.push_back(number);
+		}
+
+		/* Journaled, not waited on, as closeFile() */
+		if(transaction.empty() == false)
+			commit(transaction);
+	}
+	checkpointIfDue();
+
+	for(size_t i = 0; i < freed.size(); i++)
+		pageCache.invalidate(freed[i]);
+}
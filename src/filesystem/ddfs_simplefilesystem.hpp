@@ -25,43 +25,273 @@
 #include <thread>
 #include <vector>
 #include <queue>
+#include <deque>
+#include <atomic>
+#include <stdint.h>
 
 #include "ddfs_filesystem.hpp"
-#include "ddfs_simplefilesystemMeta.hpp"
+#include "ddfs_pageCache.hpp"
+#include "ddfs_writeBack.hpp"
+#include "ddfs_openFileTable.hpp"
+#include "ddfs_inodeTable.hpp"
+#include "ddfs_directoryTable.hpp"
+#include "ddfs_metadataJournal.hpp"
+#include "ddfs_snapshot.hpp"
+#include "ddfs_metadataCheckpoint.hpp"
 #include "../global/ddfs_status.hpp"
+#include "../global/ddfs_rwLock.hpp"
 #include "../logger/ddfs_fileLogger.hpp"
 
 using namespace std;
 
+/* Of directory entries and inode records, see namespaceLock */
+#define DDFS_NAMESPACE_LOCK_STRIPES     1024
+/* Entries the remover deletes in one transaction */
+#define DDFS_REMOVE_BATCH               128
+/* Reads move the access time on only past the last change or this old */
+#define DDFS_ACCESS_TIME_INTERVAL_NS    (24ULL * 3600 * 1000000000)
+
+/* Storage beneath the page cache and the write buffers, as ddfsPageReader
+ * and ddfsPageWriter, told how the file keeps its data */
+typedef std::function<ddfsStatus(uint64_t fileID, const ddfsRedundancy &redundancy, uint64_t offset,
+					uint8_t *buffer, size_t size, size_t *bytesRead)> ddfsDataReader;
+typedef std::function<ddfsStatus(uint64_t fileID, const ddfsRedundancy &redundancy, uint64_t offset,
+					const uint8_t *buffer, size_t size)> ddfsDataWriter;
+
 ddfsLogger &global_logger_dsf = ddfsLogger::getInstance();
 
-class ddfsSimpleFilesystem: public ddfsFileSystem<void *> {
+class ddfsSimpleFilesystem: public ddfsFileSystem<ddfsFileHandle> {
 public:
-	ddfsStatus openFile(string path, int mode, void *handler);
-	ddfsStatus closeFile(void * handler);
+	ddfsStatus openFile(string path, int mode, ddfsFileHandle *handler);
+	ddfsStatus closeFile(ddfsFileHandle handler);
 
-	ddfsStatus readFile(void *handler, int size, void *buffer);
-	ddfsStatus readFile(void * handler, int size, void *buffer, int offset);
-	ddfsStatus writeFile(void * handler, int size, void *buffer);
-	ddfsStatus writeFile(void * handler, int size, void *buffer, int offset);
+	ddfsStatus readFile(ddfsFileHandle handler, int size, void *buffer);
+	ddfsStatus readFile(ddfsFileHandle handler, int size, void *buffer, int offset);
+	ddfsStatus writeFile(ddfsFileHandle handler, int size, void *buffer);
+	ddfsStatus writeFile(ddfsFileHandle handler, int size, void *buffer, int offset);
 	
-	ddfsStatus seekFile(void * handler, int offset);
+	ddfsStatus seekFile(ddfsFileHandle handler, int offset);
+	ddfsStatus syncFile(ddfsFileHandle handler);
 
 	ddfsStatus createFile(string directory, string fileName, int mode);
+	/* A file kept as redundancy says, DDFS_GENERAL_PARAM_INVALID if that
+	 * is not a scheme */
+	ddfsStatus createFile(string directory, string fileName, int mode, ddfsRedundancy redundancy);
 	ddfsStatus makedirectory(string directory, string directoryName);
+	ddfsStatus createFiles(string directory, const vector<string> &names, int mode);
+	ddfsStatus renameFile(string oldPath, string newPath);
+
+	/* The name of the open file goes, its handles are stale from then */
+	ddfsStatus deleteFile(ddfsFileHandle handler);
+	/*
+	 * A file or an empty directory is deleted there and then. Anything
+	 * else is detached whole, in one commit: its inode stays with no
+	 * parent and the remover thread deletes what is below it bottom up,
+	 * DDFS_REMOVE_BATCH entries per transaction. init() hands it trees
+	 * a crash left half deleted.
+	 */
+	ddfsStatus removeTree(string path);
+	/* Until the remover is done with every tree it was given */
+	void waitRemovals();
 
-	ddfsStatus deleteFile(void *handler);
+	/* Copy of the inode record, O(1) for an open file */
+	ddfsStatus statFile(string path, ddfsInode *info);
+	ddfsStatus statFile(ddfsFileHandle handler, ddfsInode *info);
+	ddfsStatus truncateFile(ddfsFileHandle handler, uint64_t size);
+	/* A listing and a statFile of every entry in one call */
+	ddfsStatus readDirectory(string path, vector<pair<string, ddfsFileAttributes> > *entries);
 
+	/* Snapshot of the namespace as it is now, O(1), see ddfs_snapshot.hpp */
+	ddfsStatus createSnapshot(string name, uint64_t *id);
+	ddfsStatus deleteSnapshot(uint64_t id);
+	ddfsStatus findSnapshot(string name, uint64_t *id);
+	void listSnapshots(vector<ddfsSnapshotInfo> *snapshots);
+	/* statFile and a directory listing, as they were in snapshot id */
+	ddfsStatus statSnapshot(uint64_t id, string path, ddfsInode *info);
+	ddfsStatus listSnapshot(uint64_t id, string path, vector<pair<string, uint64_t> > *entries);
+
+	/*
+	 * The metadata lives in metaFileName.inodes and metaFileName.dirs,
+	 * made if need be, changes since they were last written in
+	 * metaFileName.journal. Call before opening any file.
+	 */
 	ddfsStatus init();
 	ddfsStatus init(string metaFileName);
+	/* Checkpoint: write the metadata back to its files, empty the journal */
+	ddfsStatus sync();
+
+	/*
+	 * Followers, see ddfs_metadataCheckpoint.hpp. The leader hands every
+	 * transaction and checkpoint to the update handler as it commits
+	 * them, setting one starts a checkpoint for it to begin from.
+	 * Checkpoints only advance while there is a handler.
+	 */
+	void setUpdateHandler(ddfsMetadataUpdateHandler handler);
+	/*
+	 * @brief Updates that take a follower at checkpoint since to now.
+	 *
+	 * @return DDFS_OK          *updates is the delta and the tail after it
+	 * @return DDFS_FAILURE     No handler, the tail is not kept
+	 */
+	ddfsStatus catchUp(uint64_t since, vector<uint8_t> *updates);
+	/*
+	 * @brief Apply updates of the leader, back to back, on a follower.
+	 *
+	 * @return DDFS_OK                      All applied, or had been
+	 * @return DDFS_NETWORK_RETRY           Some are missing before them,
+	 *                                      catch up from getCheckpoint()
+	 * @return DDFS_FILESYSTEM_CORRUPTED    updates are not whole
+	 * @return DDFS_FAILURE                 This is the leader
+	 */
+	ddfsStatus applyUpdates(const uint8_t *updates, size_t length);
+	/* The last checkpoint, on a follower the one it caught up to */
+	uint64_t getCheckpoint();
+
+	/* Where file data comes from beneath the page cache */
+	void setDataReader(ddfsDataReader reader);
+	/* Where the write buffers go */
+	void setDataWriter(ddfsDataWriter writer);
+	ddfsPageCache &getPageCache();
+	ddfsWriteBack &getWriteBack();
+	ddfsOpenFileTable &getOpenFiles();
+	ddfsMetadataJournal &getJournal();
 
-	ddfsSimpleFilesystem() {}
-	~ddfsSimpleFilesystem() {}
+	/* Until init() the metadata is in memory only */
+	ddfsSimpleFilesystem(uint64_t cacheBytes = DDFS_PAGE_CACHE_DEFAULT_BYTES);
+	/* Trees not removed yet are left for the next init() */
+	~ddfsSimpleFilesystem();
 private:
-	ddfs_simplefilesystemMeta metaData;
+	/*
+	 * Locking, taken in this order:
+	 *
+	 * namespaceLock is shared by every operation and held exclusive by
+	 * the few on the whole namespace at once: init, checkpoints,
+	 * snapshots and followers. The stripes lock the entries of a
+	 * directory and the record of an inode, by inode number: shared to
+	 * look, exclusive to change. Operations in different directories
+	 * take different stripes and go on in parallel. A path is resolved
+	 * with no lock at all, inside an epoch, then the stripes of what is
+	 * to change are taken together and the lookups checked again.
+	 * statFile() tries first with no lock either, keeping what it read
+	 * if the sequence of namespaceLock and of the stripe of the record
+	 * did not move (see ddfsRWLock). renameLock is taken by moves
+	 * between directories and by removeTree(), the only changes to the
+	 * parent of a directory, before any stripe. commitLock
+	 * keeps the journal and the tail in one order, hookLock guards the
+	 * snapshots and the tracker.
+	 */
+	ddfsRWLock namespaceLock;
+	ddfsLockStripes stripes;
+	std::mutex renameLock;
+	std::mutex commitLock;
+	std::mutex hookLock;
+	/* A commit found the journal or the tail full, checkpointed once its
+	 * operation lets go of the namespace */
+	std::atomic<bool> checkpointDue;
+	string metaFileName;
+	ddfsInodeTable inodes;
+	ddfsDirectoryTable directories;
+	ddfsMetadataJournal journal;
+	/* Inodes freed by a transaction not on disk yet. The mapped records
+	 * may reach the file any time, so they are released only once the
+	 * journal holds the free: till then the number is not given out and
+	 * the record on file is still the one the directories link to.
+	 * freeLock is taken last, nothing else is taken under it. */
+	struct pendingFree {
+		uint64_t sequence;
+		uint64_t number;
+		uint64_t generation;
+	};
+	std::mutex freeLock;
+	vector<pendingFree> pendingFrees;
+	ddfsSnapshotTable snapshots;
+	ddfsCheckpointTracker tracker;
+	ddfsMetadataUpdateHandler updateHandler;
+	/* Leader: the updates of the transactions after the last checkpoint */
+	vector<uint8_t> tail;
+	uint64_t tailIndex;
+	/* Follower: the last transaction applied after the checkpoint */
+	uint64_t appliedIndex;
 
-	ddfsStatus fillInMemDirectoryTree();
+	ddfsDataReader dataReader;
+	ddfsDataWriter dataWriter;
+	ddfsPageCache pageCache;
+	/* After the page cache, its flushes on the way out invalidate pages */
+	ddfsWriteBack writeBack;
+	ddfsOpenFileTable openFiles;
+
+	/* Detached trees waiting for the remover, by the inode at the top.
+	 * removalLock is taken last, nothing else is taken under it. */
+	std::mutex removalLock;
+	std::condition_variable removalWake;
+	std::condition_variable removalDone;
+	std::deque<uint64_t> removals;
+	bool removing;
+	/* Bumped by init(), the tree being removed belongs to older tables */
+	uint64_t loadCount;
+	/* applyUpdates() was called: the leader removes trees, not this */
+	bool following;
+	std::atomic<bool> stopRemover;
+	/* Last, it runs on everything above */
+	std::thread remover;
+
+	ddfsStatus readStorage(uint64_t fileID, uint64_t offset, uint8_t *buffer,
+					size_t size, size_t *bytesRead);
+	ddfsStatus writeStorage(uint64_t fileID, uint64_t offset, const uint8_t *buffer,
+					size_t size);
+	/* Of a live file, with no lock held */
+	bool redundancyOf(uint64_t fileID, ddfsRedundancy *redundancy);
+	/* The data path, from an open file on */
+	ddfsStatus readAt(ddfsOpenFile *handle, int size, void *buffer, int offset);
+	ddfsStatus writeAt(ddfsOpenFile *handle, int size, void *buffer, int offset);
+
+	/* A file or directory, as createFile() */
+	ddfsStatus create(const string &directory, const string &name, uint32_t mode,
+					const ddfsRedundancy &redundancy);
+	/* The remover thread, and one batch of it below the last of path, the
+	 * directories from the top of a tree down */
+	void removerRoutine();
+	void removeBatch(uint64_t loaded, vector<uint64_t> *path);
+	void queueRemoval(uint64_t number);
+	/* The checkpoint a commit asked for, with no lock held */
+	void checkpointIfDue();
+	/* Freed by a commit, in use till the journal has it */
+	bool isPendingFree(uint64_t number);
+	/* Wait for sequence to be on disk and release what it freed, with
+	 * no lock held */
+	ddfsStatus waitDurable(uint64_t sequence);
+	/* Release the pending frees on disk already. With all, every one
+	 * of them and namespaceLock is held exclusive, else no lock. */
+	void releaseFreed(bool all);
+
+	/* The rest are called with namespaceLock held, shared at least */
+	ddfsStatus makeRoot();
+	/* Inode number of an absolute path, live or in a snapshot. A live one
+	 * takes no lock, one in a snapshot takes stripes: none may be held */
+	ddfsStatus resolve(const string &path, uint64_t *inode, uint64_t snapshot = 0);
+	/* Directory and name of an absolute path */
+	ddfsStatus resolveParent(const string &path, uint64_t *directory, string *name);
+	/* The file behind handle was deleted or replaced since it was opened,
+	 * with the stripe of the file held */
+	bool isStale(ddfsOpenFile *handle);
+	/* Give the inode the time handle last read it at, the way relatime
+	 * does, with the stripe of the file held exclusive */
+	void noteAccess(ddfsOpenFile *handle);
+	/* Link the reserved number in as name, with the stripes of both held
+	 * exclusive, and add what it takes to transaction but the times of
+	 * parent */
+	ddfsStatus createInode(uint64_t parent, const string &name, uint32_t mode, uint64_t number,
+					const ddfsRedundancy &redundancy, uint64_t now, ddfsMetadataTransaction *transaction);
+	/* Take name out of directory and commit it, as removeTree(). With
+	 * expected set, only if name is still that inode */
+	ddfsStatus removeEntry(uint64_t directory, const string &name, uint64_t expected,
+					uint64_t *sequence, uint64_t *removed, bool *detached);
+	/* Apply transaction and queue it to the journal, wait on the sequence
+	 * returned once the locks are let go. The inodes it frees stay in
+	 * use until then, see pendingFrees. */
+	uint64_t commit(const ddfsMetadataTransaction &transaction);
+	/* With namespaceLock exclusive */
+	ddfsStatus checkpoint();
 }; 
 
 #endif /* Ending DDFS_SIMPLEFILESYSTEM */
-
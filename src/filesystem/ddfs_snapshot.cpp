@@ -0,0 +1,198 @@
+/*!
+ *    \file  ddfs_snapshot.cpp
+ *   \brief  Point in time snapshots of the namespace, copy-on-write.
+ *
+ *  \author  Harman Patial, harman.patial@gmail.com
+ *
+ *  \internal
+ *      Compiler:  g++
+ *     Copyright:
+ *
+ *  This source code is released for free distribution under the terms of the
+ *  GNU General Public License as published by the Free Software Foundation.
+ */
+
+#include "ddfs_snapshot.hpp"
+
+using namespace std;
+
+ddfsSnapshotTable::ddfsSnapshotTable() : nextId(1) {
+}
+
+ddfsStatus ddfsSnapshotTable::create(const string &name, uint64_t createTime, uint64_t *id) {
+	uint64_t existing;
+
+	if(name.empty())
+		return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+	if(find(name, &existing).compareStatus(ddfsStatus(DDFS_OK)))
+		return (ddfsStatus(DDFS_FILESYSTEM_FILE_EXISTS));
+
+	/* Nothing is copied until the tables change */
+	snapshot &added = snapshots[nextId];
+	added.name = name;
+	added.createTime = createTime;
+
+	*id = nextId++;
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsSnapshotTable::remove(uint64_t id) {
+	map<uint64_t, snapshot>::iterator removed = snapshots.find(id);
+	if(removed == snapshots.end())
+		return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+
+	/* The older one read through this one, what it found here it keeps */
+	if(removed != snapshots.begin()) {
+		map<uint64_t, snapshot>::iterator older = removed;
+		older--;
+		older->second.inodeBlocks.insert(removed->second.inodeBlocks.begin(), removed->second.inodeBlocks.end());
+		older->second.directories.insert(removed->second.directories.begin(), removed->second.directories.end());
+	}
+	snapshots.erase(removed);
+
+	if(snapshots.empty()) {
+		inodeBlockSaved.clear();
+		directorySaved.clear();
+	}
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsSnapshotTable::find(const string &name, uint64_t *id) {
+	for(map<uint64_t, snapshot>::iterator iter = snapshots.begin(); iter != snapshots.end(); iter++) {
+		if(iter->second.name == name) {
+			*id = iter->first;
+			return (ddfsStatus(DDFS_OK));
+		}
+	}
+	return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+}
+
+void ddfsSnapshotTable::list(vector<ddfsSnapshotInfo> *info) {
+	info->clear();
+
+	for(map<uint64_t, snapshot>::iterator iter = snapshots.begin(); iter != snapshots.end(); iter++) {
+		ddfsSnapshotInfo one;
+		one.id = iter->first;
+		one.name = iter->second.name;
+		one.createTime = iter->second.createTime;
+		one.preservedBytes = iter->second.inodeBlocks.size() * DDFS_INODE_BLOCK_RECORDS * DDFS_INODE_SIZE;
+
+		unordered_map<uint64_t, std::shared_ptr<const directoryEntries> >::iterator dir;
+		for(dir = iter->second.directories.begin(); dir != iter->second.directories.end(); dir++) {
+			if(dir->second == NULL)
+				continue;
+			for(directoryEntries::const_iterator entry = dir->second->begin(); entry != dir->second->end(); entry++)
+				one.preservedBytes += entry->first.size() + sizeof(entry->second);
+		}
+		info->push_back(one);
+	}
+}
+
+void ddfsSnapshotTable::clear() {
+	snapshots.clear();
+	inodeBlockSaved.clear();
+	directorySaved.clear();
+}
+
+void ddfsSnapshotTable::beforeInodeWrite(uint64_t block, const ddfsInode *records) {
+	if(snapshots.empty())
+		return;
+
+	uint64_t newest = snapshots.rbegin()->first;
+	if(block >= inodeBlockSaved.size())
+		inodeBlockSaved.resize(block + 1, 0);
+	if(inodeBlockSaved[block] >= newest)
+		return;
+
+	/* First change since the newest snapshot */
+	snapshots.rbegin()->second.inodeBlocks[block] =
+				std::make_shared<const inodeBlock>(records, records + DDFS_INODE_BLOCK_RECORDS);
+	inodeBlockSaved[block] = newest;
+}
+
+void ddfsSnapshotTable::beforeDirectoryWrite(uint64_t directory, const map<string, uint64_t> *entries) {
+	if(snapshots.empty())
+		return;
+
+	uint64_t newest = snapshots.rbegin()->first;
+	uint64_t &saved = directorySaved[directory];
+	if(saved >= newest)
+		return;
+
+	std::shared_ptr<const directoryEntries> copy;
+	if(entries != NULL)
+		copy = std::make_shared<const directoryEntries>(*entries);
+	snapshots.rbegin()->second.directories[directory] = copy;
+	saved = newest;
+}
+
+ddfsStatus ddfsSnapshotTable::getInode(uint64_t id, ddfsInodeTable &inodes, uint64_t number, ddfsInode *inode) {
+	map<uint64_t, snapshot>::iterator iter = snapshots.find(id);
+	if(iter == snapshots.end())
+		return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+
+	uint64_t block = number / DDFS_INODE_BLOCK_RECORDS;
+	for(; iter != snapshots.end(); iter++) {
+		unordered_map<uint64_t, std::shared_ptr<const inodeBlock> >::iterator saved = iter->second.inodeBlocks.find(block);
+		if(saved == iter->second.inodeBlocks.end())
+			continue;
+
+		const ddfsInode &record = (*saved->second)[number % DDFS_INODE_BLOCK_RECORDS];
+		if(number == 0 || record.inode != number)
+			return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+		*inode = record;
+		return (ddfsStatus(DDFS_OK));
+	}
+
+	/* Not changed since the snapshot */
+	ddfsInode *live = inodes.get(number);
+	if(live == NULL)
+		return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+	*inode = *live;
+	return (ddfsStatus(DDFS_OK));
+}
+
+bool ddfsSnapshotTable::findDirectory(uint64_t id, uint64_t directory, const directoryEntries **entries) {
+	for(map<uint64_t, snapshot>::iterator iter = snapshots.find(id); iter != snapshots.end(); iter++) {
+		unordered_map<uint64_t, std::shared_ptr<const directoryEntries> >::iterator saved =
+					iter->second.directories.find(directory);
+		if(saved != iter->second.directories.end()) {
+			*entries = saved->second.get();
+			return true;
+		}
+	}
+	return false;
+}
+
+ddfsStatus ddfsSnapshotTable::lookup(uint64_t id, ddfsDirectoryTable &directories, uint64_t directory,
+				const string &name, uint64_t *inode) {
+	const directoryEntries *entries;
+
+	if(snapshots.count(id) == 0)
+		return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+	if(findDirectory(id, directory, &entries) == false)
+		return directories.lookup(directory, name, inode);
+	if(entries == NULL)
+		return (ddfsStatus(DDFS_FILESYSTEM_NOT_A_DIRECTORY));
+
+	directoryEntries::const_iterator entry = entries->find(name);
+	if(entry == entries->end())
+		return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+	*inode = entry->second;
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsSnapshotTable::list(uint64_t id, ddfsDirectoryTable &directories, uint64_t directory,
+				vector<pair<string, uint64_t> > *result) {
+	const directoryEntries *entries;
+
+	if(snapshots.count(id) == 0)
+		return (ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+	if(findDirectory(id, directory, &entries) == false)
+		return directories.list(directory, result);
+	if(entries == NULL)
+		return (ddfsStatus(DDFS_FILESYSTEM_NOT_A_DIRECTORY));
+
+	result->assign(entries->begin(), entries->end());
+	return (ddfsStatus(DDFS_OK));
+}
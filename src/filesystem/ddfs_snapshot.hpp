@@ -0,0 +1,140 @@
+/*!
+ *    \file  ddfs_snapshot.hpp
+ *   \brief  Point in time snapshots of the namespace, copy-on-write.
+ *
+ *  Taking a snapshot copies nothing, it only starts a new one. The live
+ *  tables go on changing in place; the first change after the snapshot
+ *  to a block of inode records (DDFS_INODE_BLOCK_RECORDS of them) or to
+ *  a directory hands the block as it was to the newest snapshot first.
+ *  A snapshot holds the blocks that changed since it was taken and
+ *  nothing else.
+ *
+ *  A block a snapshot does not hold is the same in it as in the next
+ *  newer snapshot, or in the live tables past the newest. Reading walks
+ *  that way until it finds the block. Blocks are shared and reference
+ *  counted: when a snapshot is deleted the older snapshot next to it
+ *  takes over the blocks it does not hold yet, without copying them.
+ *
+ *  Writers are never held up for longer than one copy of 4KB, or of one
+ *  directory, whatever the size of the namespace.
+ *
+ *  Snapshots are in memory, they do not outlive the filesystem. No
+ *  locking of its own, the filesystem serialises calls as it does for
+ *  the tables.
+ *
+ *  \author  Harman Patial, harman.patial@gmail.com
+ *
+ *  \internal
+ *      Compiler:  g++
+ *     Copyright:
+ *
+ *  This source code is released for free distribution under the terms of the
+ *  GNU General Public License as published by the Free Software Foundation.
+ */
+
+#ifndef DDFS_SNAPSHOT_HPP
+#define DDFS_SNAPSHOT_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <stdint.h>
+
+#include "ddfs_inodeTable.hpp"
+#include "ddfs_directoryTable.hpp"
+#include "../global/ddfs_status.hpp"
+
+using namespace std;
+
+/*!
+ *  \class  ddfsSnapshotInfo
+ *  \brief  What is known of a snapshot from outside.
+ */
+struct ddfsSnapshotInfo {
+	uint64_t id;
+	string name;
+	/* Nanoseconds since the epoch */
+	uint64_t createTime;
+	/* Bytes of blocks it holds, shared ones counted in every holder */
+	uint64_t preservedBytes;
+};
+
+/*!
+ *  \class  ddfsSnapshotTable
+ *  \brief  The snapshots of one filesystem and the blocks they preserve.
+ */
+class ddfsSnapshotTable {
+public:
+	ddfsSnapshotTable();
+
+	/*
+	 * @brief Start a snapshot of the tables as they are now. O(1).
+	 *
+	 * @return DDFS_OK                      *id is the new snapshot
+	 * @return DDFS_FILESYSTEM_FILE_EXISTS  name is taken
+	 * @return DDFS_GENERAL_PARAM_INVALID   name is empty
+	 */
+	ddfsStatus create(const string &name, uint64_t createTime, uint64_t *id);
+	/*
+	 * @return DDFS_OK                              Deleted, its blocks are
+	 *                                              handed on or freed
+	 * @return DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST  No such snapshot
+	 */
+	ddfsStatus remove(uint64_t id);
+	ddfsStatus find(const string &name, uint64_t *id);
+	/* Oldest first */
+	void list(vector<ddfsSnapshotInfo> *snapshots);
+	/* Drop every snapshot */
+	void clear();
+
+	/* Write hooks of the tables */
+	void beforeInodeWrite(uint64_t block, const ddfsInode *records);
+	void beforeDirectoryWrite(uint64_t directory, const map<string, uint64_t> *entries);
+
+	/*
+	 * Reads of snapshot id, falling through to the live tables.
+	 *
+	 * @return DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST  Not in the snapshot, or
+	 *                                              no such snapshot
+	 * @return DDFS_FILESYSTEM_NOT_A_DIRECTORY      directory was not one
+	 */
+	ddfsStatus getInode(uint64_t id, ddfsInodeTable &inodes, uint64_t number, ddfsInode *inode);
+	ddfsStatus lookup(uint64_t id, ddfsDirectoryTable &directories, uint64_t directory,
+					const string &name, uint64_t *inode);
+	ddfsStatus list(uint64_t id, ddfsDirectoryTable &directories, uint64_t directory,
+					vector<pair<string, uint64_t> > *entries);
+
+	bool empty() {
+		return snapshots.empty();
+	}
+
+private:
+	typedef vector<ddfsInode> inodeBlock;
+	typedef map<string, uint64_t> directoryEntries;
+
+	struct snapshot {
+		string name;
+		uint64_t createTime;
+		unordered_map<uint64_t, std::shared_ptr<const inodeBlock> > inodeBlocks;
+		/* NULL for a directory that did not exist yet */
+		unordered_map<uint64_t, std::shared_ptr<const directoryEntries> > directories;
+	};
+
+	/* By id, oldest first */
+	map<uint64_t, snapshot> snapshots;
+	uint64_t nextId;
+	/* Newest snapshot a block was last handed to */
+	vector<uint64_t> inodeBlockSaved;
+	unordered_map<uint64_t, uint64_t> directorySaved;
+
+	/* false if the live table has directory as it was in snapshot id,
+	 * otherwise *entries is the copy, NULL if it did not exist */
+	bool findDirectory(uint64_t id, uint64_t directory, const directoryEntries **entries);
+
+	ddfsSnapshotTable(ddfsSnapshotTable const&);     // Don't Implement
+	void operator=(ddfsSnapshotTable const&);        // Don't implement
+};
+
+#endif /* Ending DDFS_SNAPSHOT_HPP */
@@ -0,0 +1,275 @@
+/*!
+ *    \file  ddfs_writeBack.cpp
+ *   \brief  Write-back buffering of small writes to open files.
+ *
+ *  \author  Harman Patial, harman.patial@gmail.com
+ *
+ *  \internal
+ *      Compiler:  g++
+ *     Copyright:
+ *
+ *  This source code is released for free distribution under the terms of the
+ *  GNU General Public License as published by the Free Software Foundation.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "ddfs_writeBack.hpp"
+#include "../logger/ddfs_fileLogger.hpp"
+
+using namespace std;
+
+ddfsLogger &global_logger_wb = ddfsLogger::getInstance();
+
+ddfsWriteBack::ddfsWriteBack(ddfsPageWriter w, size_t chunk, uint64_t maxDirty, int flushMs) :
+					writer(w), chunkBytes(chunk), maxDirtyBytes(maxDirty), flushAfterMs(flushMs),
+					dirtyBytes(0), storageWrites(0), throttledWrites(0), pressure(false),
+					stopFlusher(false) {
+	if(chunkBytes == 0)
+		chunkBytes = DDFS_WRITEBACK_CHUNK_SIZE;
+	flusher = std::thread(&ddfsWriteBack::flusherRoutine, this);
+}
+
+ddfsWriteBack::~ddfsWriteBack() {
+	{
+		std::lock_guard<std::mutex> guard(writeBackLock);
+		stopFlusher = true;
+	}
+	flushNeeded.notify_all();
+	roomMade.notify_all();
+	flusher.join();
+
+	/* Files left open, their data should still reach storage */
+	set<std::shared_ptr<ddfsWriteBuffer> > left = buffers;
+	for(set<std::shared_ptr<ddfsWriteBuffer> >::iterator iter = left.begin(); iter != left.end(); iter++) {
+		std::lock_guard<std::mutex> guard((*iter)->bufferLock);
+		flushLocked(iter->get(), false);
+	}
+}
+
+std::shared_ptr<ddfsWriteBuffer> ddfsWriteBack::open(uint64_t fileID) {
+	std::shared_ptr<ddfsWriteBuffer> buffer(new ddfsWriteBuffer(fileID));
+
+	std::lock_guard<std::mutex> guard(writeBackLock);
+	buffers.insert(buffer);
+	return buffer;
+}
+
+ddfsStatus ddfsWriteBack::close(std::shared_ptr<ddfsWriteBuffer> buffer) {
+	std::lock_guard<std::mutex> guard(buffer->bufferLock);
+
+	ddfsStatus error = takeError(buffer.get());
+	ddfsStatus status = flushLocked(buffer.get(), false);
+
+	/* Nothing is going to retry what could not be written */
+	unreserve(buffer->data.size());
+	buffer->data.clear();
+
+	{
+		std::lock_guard<std::mutex> registry(writeBackLock);
+		buffers.erase(buffer);
+	}
+
+	if(error.compareStatus(ddfsStatus(DDFS_OK)) == false)
+		return error;
+	return status;
+}
+
+ddfsStatus ddfsWriteBack::write(std::shared_ptr<ddfsWriteBuffer> buffer, uint64_t offset,
+				const void *data, size_t size) {
+	if(size == 0)
+		return (ddfsStatus(DDFS_OK));
+
+	reserve(size);
+
+	std::lock_guard<std::mutex> guard(buffer->bufferLock);
+	ddfsWriteBuffer *b = buffer.get();
+
+	ddfsStatus status = takeError(b);
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+		unreserve(size);
+		return status;
+	}
+
+	/* Only a write that continues or overlaps the buffer joins it */
+	if(b->data.empty() == false && (offset < b->start || offset > b->start + b->data.size())) {
+		status = flushLocked(b, false);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+			unreserve(size);
+			return status;
+		}
+	}
+
+	if(b->data.empty()) {
+		b->start = offset;
+		b->dirtySince = chrono::steady_clock::now();
+	}
+
+	size_t before = b->data.size();
+	size_t at = (size_t) (offset - b->start);
+	if(at + size > b->data.size())
+		b->data.resize(at + size);
+	memcpy(b->data.data() + at, data, size);
+
+	/* Overwritten bytes were counted when they came in */
+	size_t grown = b->data.size() - before;
+	if(grown < size)
+		unreserve(size - grown);
+
+	if(b->data.size() >= chunkBytes)
+		return flushLocked(b, true);
+
+	return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsWriteBack::flush(std::shared_ptr<ddfsWriteBuffer> buffer) {
+	std::lock_guard<std::mutex> guard(buffer->bufferLock);
+
+	ddfsStatus error = takeError(buffer.get());
+	ddfsStatus status = flushLocked(buffer.get(), false);
+
+	if(error.compareStatus(ddfsStatus(DDFS_OK)) == false)
+		return error;
+	return status;
+}
+
+ddfsStatus ddfsWriteBack::takeError(ddfsWriteBuffer *buffer) {
+	ddfsStatus error = buffer->error;
+	buffer->error = ddfsStatus(DDFS_OK);
+	return error;
+}
+
+ddfsStatus ddfsWriteBack::flushLocked(ddfsWriteBuffer *buffer, bool wholeChunksOnly) {
+	ddfsStatus status(DDFS_OK);
+	uint64_t end = buffer->start + buffer->data.size();
+
+	if(wholeChunksOnly)
+		end = end / chunkBytes * chunkBytes;
+	if(end <= buffer->start)
+		return status;
+
+	/* One storage write per chunk, on chunk boundaries */
+	size_t done = 0;
+	uint64_t writes = 0;
+	while(buffer->start + done < end) {
+		uint64_t pieceStart = buffer->start + done;
+		uint64_t pieceEnd = min(end, (pieceStart / chunkBytes + 1) * chunkBytes);
+
+		status = writer(buffer->fileID, pieceStart, buffer->data.data() + done,
+						(size_t) (pieceEnd - pieceStart));
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+			break;
+
+		done += (size_t) (pieceEnd - pieceStart);
+		writes++;
+	}
+
+	buffer->data.erase(buffer->data.begin(), buffer->data.begin() + done);
+	buffer->start += done;
+
+	{
+		std::lock_guard<std::mutex> guard(writeBackLock);
+		storageWrites += writes;
+	}
+	unreserve(done);
+
+	return status;
+}
+
+void ddfsWriteBack::reserve(size_t size) {
+	std::unique_lock<std::mutex> guard(writeBackLock);
+
+	if(dirtyBytes > 0 && dirtyBytes + size > maxDirtyBytes) {
+		throttledWrites++;
+		pressure = true;
+		flushNeeded.notify_all();
+		roomMade.wait(guard, [this, size] {
+			return dirtyBytes == 0 || dirtyBytes + size <= maxDirtyBytes || stopFlusher;
+		});
+	}
+
+	dirtyBytes += size;
+}
+
+void ddfsWriteBack::unreserve(size_t size) {
+	if(size == 0)
+		return;
+
+	{
+		std::lock_guard<std::mutex> guard(writeBackLock);
+		dirtyBytes -= min((uint64_t) size, dirtyBytes);
+	}
+	roomMade.notify_all();
+}
+
+void ddfsWriteBack::flusherRoutine() {
+	std::unique_lock<std::mutex> guard(writeBackLock);
+	chrono::milliseconds interval(max(flushAfterMs / 4, 1));
+
+	while(stopFlusher == false) {
+		flushNeeded.wait_for(guard, interval);
+		if(stopFlusher)
+			break;
+
+		vector<std::shared_ptr<ddfsWriteBuffer> > candidates(buffers.begin(), buffers.end());
+		guard.unlock();
+
+		vector<pair<chrono::steady_clock::time_point, std::shared_ptr<ddfsWriteBuffer> > > dirty;
+		for(size_t i = 0; i < candidates.size(); i++) {
+			std::lock_guard<std::mutex> bufferGuard(candidates[i]->bufferLock);
+			if(candidates[i]->data.empty() == false)
+				dirty.push_back(make_pair(candidates[i]->dirtySince, candidates[i]));
+		}
+
+		/* Oldest first */
+		sort(dirty.begin(), dirty.end(),
+			[] (const pair<chrono::steady_clock::time_point, std::shared_ptr<ddfsWriteBuffer> > &a,
+				const pair<chrono::steady_clock::time_point, std::shared_ptr<ddfsWriteBuffer> > &b) {
+				return a.first < b.first;
+			});
+
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		for(size_t i = 0; i < dirty.size(); i++) {
+			bool squeezed;
+			{
+				std::lock_guard<std::mutex> registry(writeBackLock);
+				/* Under pressure, flush down to half the limit */
+				squeezed = pressure && dirtyBytes > maxDirtyBytes / 2;
+			}
+
+			ddfsWriteBuffer *b = dirty[i].second.get();
+			std::lock_guard<std::mutex> bufferGuard(b->bufferLock);
+			if(b->data.empty())
+				continue;
+			if(squeezed == false && now - b->dirtySince < chrono::milliseconds(flushAfterMs))
+				continue;
+
+			ddfsStatus status = flushLocked(b, false);
+			if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+				global_logger_wb << ddfsLogger::LOG_WARNING << "WRITEBACK:: Flushing file " << b->fileID
+							<< " at " << b->start << " failed. " << status.statusToString() << "\n";
+				b->error = status;
+			}
+		}
+
+		guard.lock();
+		if(dirtyBytes <= maxDirtyBytes / 2)
+			pressure = false;
+	}
+}
+
+uint64_t ddfsWriteBack::getDirtyBytes() {
+	std::lock_guard<std::mutex> guard(writeBackLock);
+	return dirtyBytes;
+}
+
+uint64_t ddfsWriteBack::getStorageWrites() {
+	std::lock_guard<std::mutex> guard(writeBackLock);
+	return storageWrites;
+}
+
+uint64_t ddfsWriteBack::getThrottledWrites() {
+	std::lock_guard<std::mutex> guard(writeBackLock);
+	return throttledWrites;
+}
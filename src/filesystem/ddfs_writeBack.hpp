@@ -0,0 +1,157 @@
+/*!
+ *    \file  ddfs_writeBack.hpp
+ *   \brief  Write-back buffering of small writes to open files.
+ *
+ *  Every open file has a ddfsWriteBuffer. Writes land in it as long as
+ *  they continue or overlap what it holds, and leave it in whole
+ *  DDFS_WRITEBACK_CHUNK_SIZE pieces on chunk boundaries. A log written a
+ *  few hundred bytes at a time reaches storage one chunk per write.
+ *
+ *  What is left in a buffer goes to storage when
+ *
+ *   - a write elsewhere in the file comes along,
+ *   - it was dirty for flushAfterMs, the background flusher writes it,
+ *   - the file is synced or closed, or read through the same handle.
+ *
+ *  Dirty bytes in all buffers are bounded by maxDirtyBytes. A writer that
+ *  would go over it wakes the flusher, which writes out the oldest
+ *  buffers, and waits for room. Writers slow down to the speed of the
+ *  storage instead of filling memory.
+ *
+ *  A failed background write keeps the data in the buffer. The error is
+ *  returned by the next write, sync or close of that file.
+ *
+ *  \author  Harman Patial, harman.patial@gmail.com
+ *
+ *  \internal
+ *      Compiler:  g++
+ *     Copyright:
+ *
+ *  This source code is released for free distribution under the terms of the
+ *  GNU General Public License as published by the Free Software Foundation.
+ */
+
+#ifndef DDFS_WRITEBACK_HPP
+#define DDFS_WRITEBACK_HPP
+
+#include <vector>
+#include <set>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <stdint.h>
+
+#include "../global/ddfs_status.hpp"
+
+using namespace std;
+
+#define DDFS_WRITEBACK_CHUNK_SIZE       (1024 * 1024)
+#define DDFS_WRITEBACK_MAX_DIRTY        (64ULL * 1024 * 1024)
+#define DDFS_WRITEBACK_FLUSH_MS         100
+
+/* Writes size bytes of a file at offset to storage */
+typedef std::function<ddfsStatus(uint64_t fileID, uint64_t offset, const uint8_t *buffer,
+					size_t size)> ddfsPageWriter;
+
+/*!
+ *  \class  ddfsWriteBuffer
+ *  \brief  Dirty bytes of one open file, not yet in storage.
+ */
+class ddfsWriteBuffer {
+public:
+	ddfsWriteBuffer(uint64_t id) : fileID(id), start(0), error(DDFS_OK) {}
+
+	bool isDirty() {
+		std::lock_guard<std::mutex> guard(bufferLock);
+		return data.empty() == false;
+	}
+
+private:
+	friend class ddfsWriteBack;
+
+	std::mutex bufferLock;
+	uint64_t fileID;
+	/* Offset in the file of data[0] */
+	uint64_t start;
+	vector<uint8_t> data;
+	chrono::steady_clock::time_point dirtySince;
+	/* Failure of a background flush, not reported yet */
+	ddfsStatus error;
+
+	ddfsWriteBuffer(ddfsWriteBuffer const&);     // Don't Implement
+	void operator=(ddfsWriteBuffer const&);      // Don't implement
+};
+
+/*!
+ *  \class  ddfsWriteBack
+ *  \brief  The write buffers of all open files and their flusher.
+ */
+class ddfsWriteBack {
+public:
+	ddfsWriteBack(ddfsPageWriter writer, size_t chunkBytes = DDFS_WRITEBACK_CHUNK_SIZE,
+					uint64_t maxDirtyBytes = DDFS_WRITEBACK_MAX_DIRTY,
+					int flushAfterMs = DDFS_WRITEBACK_FLUSH_MS);
+	~ddfsWriteBack();
+
+	/* Buffer for a file being opened */
+	std::shared_ptr<ddfsWriteBuffer> open(uint64_t fileID);
+	/* Flush and forget the buffer of a file being closed */
+	ddfsStatus close(std::shared_ptr<ddfsWriteBuffer> buffer);
+
+	/*
+	 * @brief Write size bytes at offset into the buffer.
+	 *
+	 * Waits for room while the dirty bytes are over the limit.
+	 *
+	 * @return DDFS_OK      The bytes are buffered or written
+	 * @return Anything else storage failed with, now or in the background
+	 */
+	ddfsStatus write(std::shared_ptr<ddfsWriteBuffer> buffer, uint64_t offset,
+					const void *data, size_t size);
+
+	/* Write out everything buffered, fsync */
+	ddfsStatus flush(std::shared_ptr<ddfsWriteBuffer> buffer);
+
+	uint64_t getDirtyBytes();
+	/* Writes that reached storage */
+	uint64_t getStorageWrites();
+	/* Writes that had to wait for room */
+	uint64_t getThrottledWrites();
+
+private:
+	ddfsPageWriter writer;
+	size_t chunkBytes;
+	uint64_t maxDirtyBytes;
+	int flushAfterMs;
+
+	std::mutex writeBackLock;
+	std::condition_variable flushNeeded;
+	std::condition_variable roomMade;
+	set<std::shared_ptr<ddfsWriteBuffer> > buffers;
+	uint64_t dirtyBytes;
+	uint64_t storageWrites;
+	uint64_t throttledWrites;
+	bool pressure;
+	bool stopFlusher;
+	std::thread flusher;
+
+	void flusherRoutine();
+	/* Wait until size more dirty bytes fit and count them */
+	void reserve(size_t size);
+	void unreserve(size_t size);
+	/*
+	 * Write out the buffer, or only its whole chunks. Called with the
+	 * buffer lock held.
+	 */
+	ddfsStatus flushLocked(ddfsWriteBuffer *buffer, bool wholeChunksOnly);
+	/* Hand over the error of a background flush. Called with the buffer lock held */
+	ddfsStatus takeError(ddfsWriteBuffer *buffer);
+
+	ddfsWriteBack(ddfsWriteBack const&);     // Don't Implement
+	void operator=(ddfsWriteBack const&);    // Don't implement
+};
+
+#endif /* Ending DDFS_WRITEBACK_HPP */
@@ -0,0 +1,150 @@
+/*
+ * @file ddfs_compress.cpp
+ *
+ * @brief Fast LZ77 compression of byte blocks, for shipping metadata.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#include <cstring>
+
+#include "ddfs_compress.hpp"
+
+#define DDFS_COMPRESS_MIN_MATCH     4
+#define DDFS_COMPRESS_HASH_BITS     14
+#define DDFS_COMPRESS_MAX_OFFSET    65535
+/* The end of the input is never matched into, as in LZ4 */
+#define DDFS_COMPRESS_LAST_LITERALS 5
+#define DDFS_COMPRESS_MATCH_MARGIN  12
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t hash32(uint32_t value) {
+    return (value * 2654435761U) >> (32 - DDFS_COMPRESS_HASH_BITS);
+}
+
+/* 15 in the nibble, then bytes of 255 and the rest */
+static void putLength(std::vector<uint8_t> *out, size_t length) {
+    for(length -= 15; length >= 255; length -= 255)
+        out->push_back(255);
+    out->push_back((uint8_t) length);
+}
+
+static void putSequence(std::vector<uint8_t> *out, const uint8_t *literals, size_t literalLength,
+                size_t offset, size_t matchLength) {
+    size_t match = matchLength == 0 ? 0 : matchLength - DDFS_COMPRESS_MIN_MATCH;
+    uint8_t token = (uint8_t) (((literalLength < 15 ? literalLength : 15) << 4) | (match < 15 ? match : 15));
+
+    out->push_back(token);
+    if(literalLength >= 15)
+        putLength(out, literalLength);
+    out->insert(out->end(), literals, literals + literalLength);
+
+    if(matchLength == 0)
+        return;
+    out->push_back((uint8_t) (offset & 0xff));
+    out->push_back((uint8_t) (offset >> 8));
+    if(match >= 15)
+        putLength(out, match);
+}
+
+void ddfsCompress(const uint8_t *data, size_t length, std::vector<uint8_t> *out) {
+    out->clear();
+    out->reserve(length + length / 255 + 16);
+
+    size_t anchor = 0, position = 0;
+
+    if(length > DDFS_COMPRESS_MATCH_MARGIN) {
+        /* Position plus one of the last 4 bytes seen with each hash */
+        std::vector<uint32_t> table((size_t) 1 << DDFS_COMPRESS_HASH_BITS, 0);
+        size_t matchEnd = length - DDFS_COMPRESS_LAST_LITERALS;
+        size_t lastStart = length - DDFS_COMPRESS_MATCH_MARGIN;
+
+        while(position < lastStart) {
+            uint32_t sequence = read32(data + position);
+            uint32_t &slot = table[hash32(sequence)];
+            size_t candidate = slot;
+            slot = (uint32_t) (position + 1);
+
+            if(candidate == 0 || position + 1 - candidate > DDFS_COMPRESS_MAX_OFFSET ||
+               read32(data + candidate - 1) != sequence) {
+                /* Skip faster through data that does not compress */
+                position += 1 + ((position - anchor) >> 6);
+                continue;
+            }
+            candidate--;
+
+            size_t matchLength = DDFS_COMPRESS_MIN_MATCH;
+            while(position + matchLength < matchEnd && data[candidate + matchLength] == data[position + matchLength])
+                matchLength++;
+
+            putSequence(out, data + anchor, position - anchor, position - candidate, matchLength);
+            position += matchLength;
+            anchor = position;
+        }
+    }
+
+    putSequence(out, data + anchor, length - anchor, 0, 0);
+}
+
+/* Rest of a length after a nibble of 15 */
+static bool takeLength(const uint8_t *&cursor, const uint8_t *end, size_t *length) {
+    uint8_t byte;
+    do {
+        if(cursor == end)
+            return false;
+        byte = *cursor++;
+        *length += byte;
+    } while(byte == 255);
+    return true;
+}
+
+bool ddfsDecompress(const uint8_t *data, size_t length, std::vector<uint8_t> *out, size_t expected) {
+    const uint8_t *cursor = data, *end = data + length;
+    size_t written = 0;
+
+    out->resize(expected);
+    uint8_t *target = out->empty() ? NULL : &(*out)[0];
+
+    while(cursor < end) {
+        uint8_t token = *cursor++;
+
+        size_t literalLength = token >> 4;
+        if(literalLength == 15 && takeLength(cursor, end, &literalLength) == false)
+            return false;
+        if(literalLength > (size_t) (end - cursor) || literalLength > expected - written)
+            return false;
+        memcpy(target + written, cursor, literalLength);
+        cursor += literalLength;
+        written += literalLength;
+
+        /* The last sequence */
+        if(cursor == end)
+            break;
+
+        if(end - cursor < 2)
+            return false;
+        size_t offset = cursor[0] | ((size_t) cursor[1] << 8);
+        cursor += 2;
+
+        size_t matchLength = token & 0x0f;
+        if(matchLength == 15 && takeLength(cursor, end, &matchLength) == false)
+            return false;
+        matchLength += DDFS_COMPRESS_MIN_MATCH;
+
+        if(offset == 0 || offset > written || matchLength > expected - written)
+            return false;
+
+        /* Byte at a time, the match may overlap what it writes */
+        const uint8_t *from = target + written - offset;
+        for(size_t i = 0; i < matchLength; i++)
+            target[written + i] = from[i];
+        written += matchLength;
+    }
+
+    return written == expected;
+}
@@ -0,0 +1,44 @@
+/*
+ * @file ddfs_compress.hpp
+ *
+ * @brief Fast LZ77 compression of byte blocks, for shipping metadata.
+ *
+ * The format is that of an LZ4 block: a run of sequences, each a token
+ * byte, literals and a back reference. The high nibble of the token is
+ * the number of literals, the low nibble the match length less 4, 15 in
+ * either means more length follows in bytes of up to 255. A back
+ * reference is a 2 byte little endian offset, at most 64KB back. The
+ * last sequence has literals only.
+ *
+ * Matches are found with one hash table probe per position, no search,
+ * so compressing runs at several hundred MB/s. Inode records are mostly
+ * zeroes and repeated fields and directory entries share prefixes, the
+ * blocks shipped to followers come out 3 to 10 times smaller.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#ifndef DDFS_COMPRESS_H
+#define DDFS_COMPRESS_H
+
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+
+/*
+ * @brief Compress length bytes at data into *out, replacing what it
+ *        held. Never fails, at worst out is length / 255 + 16 bytes
+ *        longer than the input.
+ */
+void ddfsCompress(const uint8_t *data, size_t length, std::vector<uint8_t> *out);
+
+/*
+ * @brief Decompress length bytes at data into *out, which must come out
+ *        exactly expected bytes long.
+ *
+ * @return false if data is not a whole block of expected bytes, out is
+ *         then undefined
+ */
+bool ddfsDecompress(const uint8_t *data, size_t length, std::vector<uint8_t> *out, size_t expected);
+
+#endif /* Ending DDFS_COMPRESS_H */
@@ -0,0 +1,130 @@
+/*
+ * @file ddfs_crc32c.cpp
+ *
+ * @brief CRC32C (Castagnoli) checksum.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#include <cstring>
+
+#include "ddfs_crc32c.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define DDFS_CRC32C_HAVE_SSE42
+#endif
+
+/* Reflected Castagnoli polynomial */
+#define DDFS_CRC32C_POLY    0x82F63B78
+
+typedef uint32_t (*crc32cFunction)(const uint8_t *, size_t, uint32_t);
+
+/*
+ * Slice by 8 tables, table[0] is the classic byte at a time table and
+ * table[k] advances a byte through k more zero bytes.
+ */
+class crc32cTables {
+public:
+    uint32_t table[8][256];
+
+    crc32cTables() {
+        for(uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for(int bit = 0; bit < 8; bit++)
+                crc = (crc & 1) ? (crc >> 1) ^ DDFS_CRC32C_POLY : (crc >> 1);
+            table[0][i] = crc;
+        }
+
+        for(uint32_t i = 0; i < 256; i++)
+            for(int k = 1; k < 8; k++)
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+    }
+};
+
+static const crc32cTables& getTables() {
+    static crc32cTables tables;
+    return tables;
+}
+
+static uint32_t crc32cSoftware(const uint8_t *data, size_t length, uint32_t crc) {
+    const crc32cTables &t = getTables();
+
+    while(length >= 8) {
+        /* Assemble little endian, independent of the host byte order */
+        uint32_t low = crc ^ ((uint32_t) data[0] | ((uint32_t) data[1] << 8) |
+                            ((uint32_t) data[2] << 16) | ((uint32_t) data[3] << 24));
+        uint32_t high = (uint32_t) data[4] | ((uint32_t) data[5] << 8) |
+                            ((uint32_t) data[6] << 16) | ((uint32_t) data[7] << 24);
+
+        crc = t.table[7][low & 0xFF] ^ t.table[6][(low >> 8) & 0xFF] ^
+              t.table[5][(low >> 16) & 0xFF] ^ t.table[4][low >> 24] ^
+              t.table[3][high & 0xFF] ^ t.table[2][(high >> 8) & 0xFF] ^
+              t.table[1][(high >> 16) & 0xFF] ^ t.table[0][high >> 24];
+
+        data += 8;
+        length -= 8;
+    }
+
+    while(length--)
+        crc = (crc >> 8) ^ t.table[0][(crc ^ *data++) & 0xFF];
+
+    return crc;
+}
+
+#ifdef DDFS_CRC32C_HAVE_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(const uint8_t *data, size_t length, uint32_t crc) {
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while(length >= 8) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        data += 8;
+        length -= 8;
+    }
+    crc = (uint32_t) crc64;
+#endif
+
+    while(length >= 4) {
+        uint32_t word;
+        memcpy(&word, data, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+        data += 4;
+        length -= 4;
+    }
+
+    while(length--)
+        crc = _mm_crc32_u8(crc, *data++);
+
+    return crc;
+}
+#endif
+
+/* Picked once, the CPU does not change under us */
+static crc32cFunction selectImplementation() {
+#ifdef DDFS_CRC32C_HAVE_SSE42
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse4.2"))
+        return crc32cHardware;
+#endif
+    return crc32cSoftware;
+}
+
+static crc32cFunction getImplementation() {
+    static crc32cFunction implementation = selectImplementation();
+    return implementation;
+}
+
+uint32_t ddfsCrc32c(const void *data, size_t length, uint32_t crc) {
+    return ~getImplementation()((const uint8_t *) data, length, ~crc);
+}
+
+bool ddfsCrc32cIsHardware() {
+#ifdef DDFS_CRC32C_HAVE_SSE42
+    return (getImplementation() == crc32cHardware);
+#else
+    return false;
+#endif
+}
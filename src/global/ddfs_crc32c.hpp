@@ -0,0 +1,30 @@
+/*
+ * @file ddfs_crc32c.hpp
+ *
+ * @brief CRC32C (Castagnoli) checksum.
+ *
+ * Used as the integrity trailer of the cluster wire format. The SSE4.2
+ * crc32 instruction is used when the CPU has it, a table driven
+ * implementation otherwise. Both give the same result.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#ifndef DDFS_CRC32C_H
+#define DDFS_CRC32C_H
+
+#include <cstddef>
+#include <stdint.h>
+
+/*
+ * @brief CRC32C of length bytes at data.
+ *
+ * crc is the value returned for the preceding bytes, so a buffer can be
+ * checksummed in pieces. Start with 0.
+ */
+uint32_t ddfsCrc32c(const void *data, size_t length, uint32_t crc = 0);
+
+/* true if ddfsCrc32c() runs on the crc32 instruction */
+bool ddfsCrc32cIsHardware();
+
+#endif /* Ending DDFS_CRC32C_H */
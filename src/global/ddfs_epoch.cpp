@@ -0,0 +1,152 @@
+/*
+ * @file ddfs_epoch.cpp
+ *
+ * @brief Epoch based reclamation, for readers that take no lock.
+ *
+ * The domain counts up one epoch per object retired. A reader announces
+ * the epoch it entered in, an object retired in epoch r may have been
+ * seen by a reader that entered in r or before, and is reclaimed once
+ * every reader inside entered after it.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "ddfs_epoch.hpp"
+
+namespace {
+
+struct participant {
+    participant() : epoch(0), taken(true), next(NULL), depth(0) {}
+
+    /* Of the reader inside, 0 outside */
+    std::atomic<uint64_t> epoch;
+    std::atomic<bool> taken;
+    participant *next;
+    /* Of enter() calls, touched by the thread that has it only */
+    unsigned int depth;
+};
+
+struct retiredObject {
+    uint64_t epoch;
+    std::function<void()> reclaim;
+};
+
+struct epochDomain {
+    epochDomain() : participants(NULL), epoch(1) {}
+
+    /* Slots are never freed, only handed on */
+    std::atomic<participant *> participants;
+    std::atomic<uint64_t> epoch;
+    std::mutex retiredLock;
+    std::vector<retiredObject> retired;
+};
+
+/* Gives the slot back when the thread ends */
+struct threadSlot {
+    threadSlot() : self(NULL) {}
+    ~threadSlot() {
+        if(self != NULL) {
+            self->depth = 0;
+            self->epoch.store(0, std::memory_order_release);
+            self->taken.store(false, std::memory_order_release);
+        }
+    }
+
+    participant *self;
+};
+
+}
+
+static thread_local threadSlot slot;
+
+static epochDomain &getDomain() {
+    static epochDomain domain;
+    return domain;
+}
+
+static participant *takeSlot() {
+    epochDomain &domain = getDomain();
+
+    for(participant *p = domain.participants.load(std::memory_order_acquire); p != NULL; p = p->next) {
+        bool taken = false;
+        if(p->taken.load(std::memory_order_relaxed) == false &&
+           p->taken.compare_exchange_strong(taken, true, std::memory_order_acquire))
+            return p;
+    }
+
+    participant *p = new participant();
+    participant *head = domain.participants.load(std::memory_order_relaxed);
+    do {
+        p->next = head;
+    } while(domain.participants.compare_exchange_weak(head, p, std::memory_order_release,
+                                                     std::memory_order_relaxed) == false);
+    return p;
+}
+
+void ddfsEpoch::enter() {
+    participant *self = slot.self;
+    if(self == NULL)
+        self = slot.self = takeSlot();
+
+    if(self->depth++ == 0) {
+        self->epoch.store(getDomain().epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+        /* Announced before anything shared is read, or collect() misses it */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+void ddfsEpoch::exit() {
+    participant *self = slot.self;
+    if(--self->depth == 0)
+        self->epoch.store(0, std::memory_order_release);
+}
+
+void ddfsEpoch::retire(std::function<void()> reclaim) {
+    epochDomain &domain = getDomain();
+    bool full;
+
+    /* A reader sees the unlink before this, or collect() sees the reader */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t epoch = domain.epoch.fetch_add(1, std::memory_order_acq_rel);
+    {
+        std::lock_guard<std::mutex> guard(domain.retiredLock);
+        retiredObject retired = { epoch, reclaim };
+        domain.retired.push_back(retired);
+        full = domain.retired.size() >= DDFS_EPOCH_RECLAIM_BATCH;
+    }
+    if(full)
+        collect();
+}
+
+void ddfsEpoch::collect() {
+    epochDomain &domain = getDomain();
+    std::vector<std::function<void()> > ready;
+    {
+        std::lock_guard<std::mutex> guard(domain.retiredLock);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        uint64_t oldest = ~((uint64_t) 0);
+        for(participant *p = domain.participants.load(std::memory_order_acquire); p != NULL; p = p->next) {
+            uint64_t epoch = p->epoch.load(std::memory_order_acquire);
+            if(epoch != 0 && epoch < oldest)
+                oldest = epoch;
+        }
+
+        size_t kept = 0;
+        for(size_t i = 0; i < domain.retired.size(); i++) {
+            if(domain.retired[i].epoch < oldest)
+                ready.push_back(domain.retired[i].reclaim);
+            else
+                domain.retired[kept++] = domain.retired[i];
+        }
+        domain.retired.resize(kept);
+    }
+
+    /* Outside the lock, reclaiming may retire more */
+    for(size_t i = 0; i < ready.size(); i++)
+        ready[i]();
+}
@@ -0,0 +1,69 @@
+/*
+ * @file ddfs_epoch.hpp
+ *
+ * @brief Epoch based reclamation, for readers that take no lock.
+ *
+ * A reader of a shared structure enters an epoch for as long as it
+ * holds pointers into it, and takes no lock. A writer that unlinks
+ * something a reader may still be looking at does not free it, it
+ * retires it: the reclaim function runs once every reader that was
+ * inside when it was unlinked has left. Readers pay a store and a fence
+ * to enter and a store to leave, and never wait; writers never wait
+ * for readers either, retired objects just wait for them.
+ *
+ * Every thread that enters gets a slot, kept for the life of the
+ * thread and given to a new one after. Entering again from within is
+ * fine. Objects are reclaimed in batches, by whichever writer retires
+ * the one that fills the batch.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#ifndef DDFS_EPOCH_H
+#define DDFS_EPOCH_H
+
+#include <functional>
+#include <stdint.h>
+
+/* Retired objects gathered before trying to reclaim them */
+#define DDFS_EPOCH_RECLAIM_BATCH        64
+
+/*
+ * @class ddfsEpoch
+ *
+ * @brief One epoch domain for the process.
+ */
+class ddfsEpoch {
+public:
+    static void enter();
+    static void exit();
+
+    /* Run reclaim once no reader can see what was unlinked before this */
+    static void retire(std::function<void()> reclaim);
+    /* Reclaim what can be now */
+    static void collect();
+
+private:
+    ddfsEpoch();                        // Don't Implement
+};
+
+/*
+ * @class ddfsEpochGuard
+ *
+ * @brief Inside an epoch until it goes out of scope.
+ */
+class ddfsEpochGuard {
+public:
+    ddfsEpochGuard() {
+        ddfsEpoch::enter();
+    }
+    ~ddfsEpochGuard() {
+        ddfsEpoch::exit();
+    }
+
+private:
+    ddfsEpochGuard(ddfsEpochGuard const&);        // Don't Implement
+    void operator=(ddfsEpochGuard const&);        // Don't implement
+};
+
+#endif /* Ending DDFS_EPOCH_H */
@@ -0,0 +1,308 @@
+/*
+ * @file ddfs_reedSolomon.cpp
+ *
+ * @brief Reed-Solomon erasure code over GF(2^8).
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#include <cstring>
+#include <utility>
+
+#include "ddfs_reedSolomon.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DDFS_RS_HAVE_SIMD
+#endif
+
+/* x^8 + x^4 + x^3 + x^2 + 1 */
+#define DDFS_GF_POLY    0x11D
+
+/* dst ^= coefficient * src over length bytes */
+typedef void (*gfMulAddFunction)(uint8_t *dst, const uint8_t *src, uint8_t coefficient, size_t length);
+
+/* Log and exponent tables of the field, generator 2 */
+class gfTables {
+public:
+    uint8_t exp[512];
+    uint8_t log[256];
+
+    gfTables() {
+        unsigned int x = 1;
+        for(int i = 0; i < 255; i++) {
+            exp[i] = (uint8_t) x;
+            log[x] = (uint8_t) i;
+            x <<= 1;
+            if(x & 0x100)
+                x ^= DDFS_GF_POLY;
+        }
+        /* Saves a modulo in mul() */
+        for(int i = 255; i < 512; i++)
+            exp[i] = exp[i - 255];
+        log[0] = 0;
+    }
+
+    uint8_t mul(uint8_t a, uint8_t b) const {
+        if(a == 0 || b == 0)
+            return 0;
+        return exp[log[a] + log[b]];
+    }
+
+    uint8_t inverse(uint8_t a) const {
+        return exp[255 - log[a]];
+    }
+};
+
+static const gfTables& getTables() {
+    static gfTables tables;
+    return tables;
+}
+
+/*
+ * c * b is c * (b & 0x0F) ^ c * (b & 0xF0), two 16 entry tables cover
+ * every byte. The SIMD versions look both up with a byte shuffle.
+ */
+static void splitTables(uint8_t coefficient, uint8_t *low, uint8_t *high) {
+    const gfTables &t = getTables();
+    for(int i = 0; i < 16; i++) {
+        low[i] = t.mul(coefficient, (uint8_t) i);
+        high[i] = t.mul(coefficient, (uint8_t) (i << 4));
+    }
+}
+
+static void gfMulAddScalar(uint8_t *dst, const uint8_t *src, uint8_t coefficient, size_t length) {
+    uint8_t low[16], high[16];
+    splitTables(coefficient, low, high);
+
+    for(size_t i = 0; i < length; i++)
+        dst[i] ^= low[src[i] & 0x0F] ^ high[src[i] >> 4];
+}
+
+#ifdef DDFS_RS_HAVE_SIMD
+__attribute__((target("ssse3")))
+static void gfMulAddSsse3(uint8_t *dst, const uint8_t *src, uint8_t coefficient, size_t length) {
+    uint8_t low[16], high[16];
+    splitTables(coefficient, low, high);
+
+    __m128i lowTable = _mm_loadu_si128((const __m128i *) low);
+    __m128i highTable = _mm_loadu_si128((const __m128i *) high);
+    __m128i mask = _mm_set1_epi8(0x0F);
+    size_t i = 0;
+
+    for(; i + 16 <= length; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i lowNibbles = _mm_and_si128(in, mask);
+        __m128i highNibbles = _mm_and_si128(_mm_srli_epi64(in, 4), mask);
+        __m128i product = _mm_xor_si128(_mm_shuffle_epi8(lowTable, lowNibbles),
+                                        _mm_shuffle_epi8(highTable, highNibbles));
+        __m128i out = _mm_loadu_si128((const __m128i *) (dst + i));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_xor_si128(out, product));
+    }
+
+    for(; i < length; i++)
+        dst[i] ^= low[src[i] & 0x0F] ^ high[src[i] >> 4];
+}
+
+__attribute__((target("avx2")))
+static void gfMulAddAvx2(uint8_t *dst, const uint8_t *src, uint8_t coefficient, size_t length) {
+    uint8_t low[16], high[16];
+    splitTables(coefficient, low, high);
+
+    /* The shuffle works per 128 bit lane, both lanes get the tables */
+    __m256i lowTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) low));
+    __m256i highTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) high));
+    __m256i mask = _mm256_set1_epi8(0x0F);
+    size_t i = 0;
+
+    for(; i + 32 <= length; i += 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i lowNibbles = _mm256_and_si256(in, mask);
+        __m256i highNibbles = _mm256_and_si256(_mm256_srli_epi64(in, 4), mask);
+        __m256i product = _mm256_xor_si256(_mm256_shuffle_epi8(lowTable, lowNibbles),
+                                           _mm256_shuffle_epi8(highTable, highNibbles));
+        __m256i out = _mm256_loadu_si256((const __m256i *) (dst + i));
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_xor_si256(out, product));
+    }
+
+    for(; i < length; i++)
+        dst[i] ^= low[src[i] & 0x0F] ^ high[src[i] >> 4];
+}
+#endif
+
+/* Picked once, the CPU does not change under us */
+static gfMulAddFunction selectImplementation() {
+#ifdef DDFS_RS_HAVE_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return gfMulAddAvx2;
+    if(__builtin_cpu_supports("ssse3"))
+        return gfMulAddSsse3;
+#endif
+    return gfMulAddScalar;
+}
+
+static gfMulAddFunction getImplementation() {
+    static gfMulAddFunction implementation = selectImplementation();
+    return implementation;
+}
+
+const char *ddfsReedSolomon::getImplementationName() {
+#ifdef DDFS_RS_HAVE_SIMD
+    if(getImplementation() == gfMulAddAvx2)
+        return "avx2";
+    if(getImplementation() == gfMulAddSsse3)
+        return "ssse3";
+#endif
+    return "scalar";
+}
+
+/* dst = sum of coefficients[i] * sources[i] */
+static void gfDotProduct(uint8_t *dst, const uint8_t *const *sources, const uint8_t *coefficients,
+                    int count, size_t length) {
+    gfMulAddFunction mulAdd = getImplementation();
+
+    memset(dst, 0, length);
+    for(int i = 0; i < count; i++) {
+        if(coefficients[i] == 0)
+            continue;
+        if(coefficients[i] == 1) {
+            for(size_t j = 0; j < length; j++)
+                dst[j] ^= sources[i][j];
+            continue;
+        }
+        mulAdd(dst, sources[i], coefficients[i], length);
+    }
+}
+
+/*
+ * Invert the n x n matrix in place, Gauss-Jordan.
+ *
+ * @return false if it is singular.
+ */
+static bool gfInvert(std::vector<uint8_t> &matrix, int n) {
+    const gfTables &t = getTables();
+    std::vector<uint8_t> inverse(n * n, 0);
+
+    for(int i = 0; i < n; i++)
+        inverse[i * n + i] = 1;
+
+    for(int column = 0; column < n; column++) {
+        int pivot = column;
+        while(pivot < n && matrix[pivot * n + column] == 0)
+            pivot++;
+        if(pivot == n)
+            return false;
+
+        if(pivot != column) {
+            for(int j = 0; j < n; j++) {
+                std::swap(matrix[pivot * n + j], matrix[column * n + j]);
+                std::swap(inverse[pivot * n + j], inverse[column * n + j]);
+            }
+        }
+
+        uint8_t scale = t.inverse(matrix[column * n + column]);
+        for(int j = 0; j < n; j++) {
+            matrix[column * n + j] = t.mul(matrix[column * n + j], scale);
+            inverse[column * n + j] = t.mul(inverse[column * n + j], scale);
+        }
+
+        for(int row = 0; row < n; row++) {
+            uint8_t factor = matrix[row * n + column];
+            if(row == column || factor == 0)
+                continue;
+            for(int j = 0; j < n; j++) {
+                matrix[row * n + j] ^= t.mul(factor, matrix[column * n + j]);
+                inverse[row * n + j] ^= t.mul(factor, inverse[column * n + j]);
+            }
+        }
+    }
+
+    matrix.swap(inverse);
+    return true;
+}
+
+ddfsReedSolomon::ddfsReedSolomon(int k, int m) : dataFragments(k), parityFragments(m) {
+    valid = (k >= 1 && m >= 1 && k + m <= DDFS_RS_MAX_FRAGMENTS);
+    if(valid == false)
+        return;
+
+    /* Cauchy matrix 1 / (x_i + y_j), x_i = k + i and y_j = j are all distinct */
+    const gfTables &t = getTables();
+    parityMatrix.resize(m * k);
+    for(int i = 0; i < m; i++) {
+        for(int j = 0; j < k; j++)
+            parityMatrix[i * k + j] = t.inverse((uint8_t) ((k + i) ^ j));
+    }
+}
+
+ddfsStatus ddfsReedSolomon::encode(const uint8_t *const *data, uint8_t **parity, size_t fragmentSize) {
+    if(valid == false)
+        return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+    for(int i = 0; i < parityFragments; i++)
+        gfDotProduct(parity[i], data, &parityMatrix[i * dataFragments], dataFragments, fragmentSize);
+
+    return (ddfsStatus(DDFS_OK));
+}
+
+ddfsStatus ddfsReedSolomon::reconstruct(uint8_t **fragments, const bool *present, size_t fragmentSize) {
+    if(valid == false)
+        return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+    int k = dataFragments;
+    int total = dataFragments + parityFragments;
+    bool dataMissing = false, parityMissing = false;
+
+    for(int i = 0; i < total; i++) {
+        if(present[i] == false) {
+            if(i < k)
+                dataMissing = true;
+            else
+                parityMissing = true;
+        }
+    }
+
+    if(dataMissing) {
+        /* The first k fragments present, and the rows that made them */
+        std::vector<int> rows;
+        for(int i = 0; i < total && (int) rows.size() < k; i++) {
+            if(present[i])
+                rows.push_back(i);
+        }
+        if((int) rows.size() < k)
+            return (ddfsStatus(DDFS_FAILURE));
+
+        std::vector<uint8_t> matrix(k * k, 0);
+        for(int r = 0; r < k; r++) {
+            if(rows[r] < k)
+                matrix[r * k + rows[r]] = 1;
+            else
+                memcpy(&matrix[r * k], &parityMatrix[(rows[r] - k) * k], k);
+        }
+
+        /* Singular can not happen for a Cauchy matrix, the check stays anyway */
+        if(gfInvert(matrix, k) == false)
+            return (ddfsStatus(DDFS_FAILURE));
+
+        std::vector<const uint8_t *> sources(k);
+        for(int r = 0; r < k; r++)
+            sources[r] = fragments[rows[r]];
+
+        /* Data fragment i is row i of the inverse times the fragments we have */
+        for(int i = 0; i < k; i++) {
+            if(present[i] == false)
+                gfDotProduct(fragments[i], &sources[0], &matrix[i * k], k, fragmentSize);
+        }
+    }
+
+    if(parityMissing) {
+        for(int i = 0; i < parityFragments; i++) {
+            if(present[k + i] == false)
+                gfDotProduct(fragments[k + i], (const uint8_t *const *) fragments,
+                             &parityMatrix[i * k], k, fragmentSize);
+        }
+    }
+
+    return (ddfsStatus(DDFS_OK));
+}
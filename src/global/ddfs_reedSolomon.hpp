@@ -0,0 +1,92 @@
+/*
+ * @file ddfs_reedSolomon.hpp
+ *
+ * @brief Reed-Solomon erasure code over GF(2^8).
+ *
+ * k data fragments are extended by m parity fragments, and any k of the
+ * k + m fragments give back the data. RS(6,3) stores a chunk in 1.5
+ * times its size and survives any three lost fragments, three replicas
+ * take 3 times the size for two.
+ *
+ * The code is systematic, the data fragments are the data itself. The
+ * parity rows are a Cauchy matrix, every square submatrix of it can be
+ * inverted, so any k fragments decode.
+ *
+ * The work is multiplying whole fragments by a constant and adding them
+ * up. That runs 32 or 16 bytes at a time with AVX2 or SSSE3 byte
+ * shuffles when the CPU has them, a table at a time otherwise. All give
+ * the same result.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#ifndef DDFS_REEDSOLOMON_H
+#define DDFS_REEDSOLOMON_H
+
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#include "ddfs_status.hpp"
+
+/* Data plus parity fragments, the field has room for 256 */
+#define DDFS_RS_MAX_FRAGMENTS   32
+
+/*
+ * @class ddfsReedSolomon
+ *
+ * @brief Encoder and decoder for one (k, m) scheme.
+ */
+class ddfsReedSolomon {
+public:
+    ddfsReedSolomon(int dataFragments, int parityFragments);
+
+    /* Both counts at least 1 and no more than DDFS_RS_MAX_FRAGMENTS together */
+    bool isValid() {
+        return valid;
+    }
+
+    int getDataFragments() {
+        return dataFragments;
+    }
+
+    int getParityFragments() {
+        return parityFragments;
+    }
+
+    /*
+     * @brief Compute the parity fragments of data.
+     *
+     * data holds dataFragments pointers, parity parityFragments, all of
+     * them fragmentSize bytes.
+     *
+     * @return DDFS_OK                      Parity is written
+     * @return DDFS_GENERAL_PARAM_INVALID   Invalid scheme
+     */
+    ddfsStatus encode(const uint8_t *const *data, uint8_t **parity, size_t fragmentSize);
+
+    /*
+     * @brief Rebuild the missing fragments.
+     *
+     * fragments holds all k + m fragments, data first. present tells
+     * which of them hold data, the others are written.
+     *
+     * @return DDFS_OK                      Every fragment is there
+     * @return DDFS_FAILURE                 Fewer than k fragments present
+     * @return DDFS_GENERAL_PARAM_INVALID   Invalid scheme
+     */
+    ddfsStatus reconstruct(uint8_t **fragments, const bool *present, size_t fragmentSize);
+
+    /* "avx2", "ssse3" or "scalar" */
+    static const char *getImplementationName();
+
+private:
+    int dataFragments;
+    int parityFragments;
+    bool valid;
+    /* parityFragments rows of dataFragments coefficients */
+    std::vector<uint8_t> parityMatrix;
+};
+
+#endif /* Ending DDFS_REEDSOLOMON_H */
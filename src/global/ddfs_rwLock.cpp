@@ -0,0 +1,78 @@
+/*
+ * @file ddfs_rwLock.cpp
+ *
+ * @brief Reader-writer lock, and stripes of them.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#include <algorithm>
+
+#include "ddfs_rwLock.hpp"
+
+ddfsRWLock::ddfsRWLock() : writes(0) {
+    pthread_rwlockattr_t attributes;
+    pthread_rwlockattr_init(&attributes);
+#ifdef __GLIBC__
+    /* Readers by default, a checkpoint would wait for a quiet moment */
+    pthread_rwlockattr_setkind_np(&attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&rwlock, &attributes);
+    pthread_rwlockattr_destroy(&attributes);
+}
+
+ddfsRWLock::~ddfsRWLock() {
+    pthread_rwlock_destroy(&rwlock);
+}
+
+ddfsLockStripes::ddfsLockStripes(uint32_t count) : shift(64) {
+    /* At least two, a shift of 64 is undefined */
+    uint32_t rounded = 2;
+    while(rounded < count) {
+        rounded <<= 1;
+    }
+    for(uint32_t bits = rounded; bits > 1; bits >>= 1) {
+        shift--;
+    }
+    stripes.reset(new stripe[rounded]);
+}
+
+ddfsStripeGuard::ddfsStripeGuard(ddfsLockStripes &s, std::initializer_list<uint64_t> keys, bool e) :
+                stripes(s), exclusive(e), held(few), heldCount(0) {
+    take(keys.begin(), keys.size() < DDFS_STRIPE_GUARD_MAX_KEYS ? keys.size() : DDFS_STRIPE_GUARD_MAX_KEYS);
+}
+
+ddfsStripeGuard::ddfsStripeGuard(ddfsLockStripes &s, const std::vector<uint64_t> &keys, bool e) :
+                stripes(s), exclusive(e), held(few), heldCount(0) {
+    if(keys.size() > DDFS_STRIPE_GUARD_MAX_KEYS) {
+        many.resize(keys.size());
+        held = &many[0];
+    }
+    take(keys.empty() ? NULL : &keys[0], keys.size());
+}
+
+void ddfsStripeGuard::take(const uint64_t *keys, size_t count) {
+    for(size_t k = 0; k < count; k++) {
+        if(keys[k] != 0)
+            held[heldCount++] = stripes.getIndex(keys[k]);
+    }
+
+    std::sort(held, held + heldCount);
+    heldCount = (unsigned int) (std::unique(held, held + heldCount) - held);
+
+    for(unsigned int i = 0; i < heldCount; i++) {
+        if(exclusive)
+            stripes.getLock(held[i]).lock();
+        else
+            stripes.getLock(held[i]).lockShared();
+    }
+}
+
+ddfsStripeGuard::~ddfsStripeGuard() {
+    for(unsigned int i = heldCount; i > 0; i--) {
+        if(exclusive)
+            stripes.getLock(held[i - 1]).unlock();
+        else
+            stripes.getLock(held[i - 1]).unlockShared();
+    }
+}
@@ -0,0 +1,170 @@
+/*
+ * @file ddfs_rwLock.hpp
+ *
+ * @brief Reader-writer lock, and stripes of them.
+ *
+ * ddfsRWLock is a pthread rwlock that prefers writers: once a writer
+ * waits, new readers queue behind it, so a steady stream of readers
+ * can not keep it out. Readers must not take it twice, a writer
+ * waiting in between would deadlock them. lock() and unlock() are the
+ * exclusive side, it works with std::lock_guard.
+ *
+ * It is a sequence lock as well: every exclusive hold bumps a count
+ * when taken and when released, odd while held. A reader that takes no
+ * lock at all reads the count with readBegin(), copies what it wants,
+ * and keeps the copy only if readValidate() says no writer came in
+ * between. Whatever it copies must stay mapped, it may be mid-change.
+ *
+ * ddfsLockStripes is a fixed power of two of them, a key is hashed to
+ * one. Whatever hashes to the same stripe is locked together, more
+ * stripes mean fewer false conflicts. ddfsStripeGuard locks the stripes
+ * of a few keys at once, each stripe once and in index order, which is
+ * the order every holder of more than one takes them in. Bulk
+ * operations hand it a vector of as many keys as they change together.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#ifndef DDFS_RWLOCK_H
+#define DDFS_RWLOCK_H
+
+#include <atomic>
+#include <initializer_list>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+
+#define DDFS_STRIPE_GUARD_MAX_KEYS      4
+
+/*
+ * @class ddfsRWLock
+ *
+ * @brief Reader-writer lock, writers first.
+ */
+class ddfsRWLock {
+public:
+    ddfsRWLock();
+    ~ddfsRWLock();
+
+    void lock() {
+        pthread_rwlock_wrlock(&rwlock);
+        writes.store(writes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        /* Odd before anything the holder changes */
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+    void unlock() {
+        writes.store(writes.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        pthread_rwlock_unlock(&rwlock);
+    }
+    void lockShared() {
+        pthread_rwlock_rdlock(&rwlock);
+    }
+    void unlockShared() {
+        pthread_rwlock_unlock(&rwlock);
+    }
+
+    /* Sequence of the exclusive side, odd while it is held */
+    uint32_t readBegin() {
+        return writes.load(std::memory_order_acquire);
+    }
+    /* No writer held it since readBegin() returned begin */
+    bool readValidate(uint32_t begin) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return (begin & 1) == 0 && writes.load(std::memory_order_relaxed) == begin;
+    }
+
+private:
+    pthread_rwlock_t rwlock;
+    std::atomic<uint32_t> writes;
+
+    ddfsRWLock(ddfsRWLock const&);        // Don't Implement
+    void operator=(ddfsRWLock const&);    // Don't implement
+};
+
+/*
+ * @class ddfsSharedGuard
+ *
+ * @brief std::lock_guard for the shared side.
+ */
+class ddfsSharedGuard {
+public:
+    explicit ddfsSharedGuard(ddfsRWLock &l) : rwlock(l) {
+        rwlock.lockShared();
+    }
+    ~ddfsSharedGuard() {
+        rwlock.unlockShared();
+    }
+
+private:
+    ddfsRWLock &rwlock;
+
+    ddfsSharedGuard(ddfsSharedGuard const&);      // Don't Implement
+    void operator=(ddfsSharedGuard const&);       // Don't implement
+};
+
+/*
+ * @class ddfsLockStripes
+ *
+ * @brief Reader-writer locks, one per hash of a key.
+ */
+class ddfsLockStripes {
+public:
+    /* count is rounded up to a power of two, at least 2 */
+    explicit ddfsLockStripes(uint32_t count);
+
+    uint32_t getIndex(uint64_t key) {
+        return (uint32_t) ((key * 0x9E3779B97F4A7C15ULL) >> shift);
+    }
+    ddfsRWLock &getLock(uint32_t index) {
+        return stripes[index].rwlock;
+    }
+    ddfsRWLock &forKey(uint64_t key) {
+        return getLock(getIndex(key));
+    }
+
+private:
+    /* A cache line to itself, threads on neighbouring stripes do not
+     * bounce each other's */
+    struct stripe {
+        ddfsRWLock rwlock;
+        uint8_t padding[64];
+    };
+
+    unsigned int shift;
+    std::unique_ptr<stripe[]> stripes;
+
+    ddfsLockStripes(ddfsLockStripes const&);      // Don't Implement
+    void operator=(ddfsLockStripes const&);       // Don't implement
+};
+
+/*
+ * @class ddfsStripeGuard
+ *
+ * @brief The stripes of up to DDFS_STRIPE_GUARD_MAX_KEYS keys, or of
+ *        a vector of any number, locked until it goes out of scope.
+ *        Keys of 0 are skipped.
+ */
+class ddfsStripeGuard {
+public:
+    ddfsStripeGuard(ddfsLockStripes &stripes, std::initializer_list<uint64_t> keys, bool exclusive);
+    ddfsStripeGuard(ddfsLockStripes &stripes, const std::vector<uint64_t> &keys, bool exclusive);
+    ~ddfsStripeGuard();
+
+private:
+    ddfsLockStripes &stripes;
+    bool exclusive;
+    /* Points at few, or at many for more keys than it holds */
+    uint32_t *held;
+    uint32_t few[DDFS_STRIPE_GUARD_MAX_KEYS];
+    std::vector<uint32_t> many;
+    unsigned int heldCount;
+
+    void take(const uint64_t *keys, size_t count);
+
+    ddfsStripeGuard(ddfsStripeGuard const&);      // Don't Implement
+    void operator=(ddfsStripeGuard const&);       // Don't implement
+};
+
+#endif /* Ending DDFS_RWLOCK_H */
@@ -43,6 +43,9 @@ std::string ddfsStatus::statusToString() {
 	case DDFS_NETWORK_OVERRUN:
 		return (std::string("Network : More data than expected"));
 		break;
+	case DDFS_NETWORK_CORRUPTED:
+		return (std::string("Network : Message failed the integrity check"));
+		break;
 	case DDFS_GENERAL_PARAM_INVALID:
 		return (std::string("General: The paramter passed was invalid"));
 		break;
@@ -52,6 +55,21 @@ std::string ddfsStatus::statusToString() {
     case DDFS_CLUSTER_ALREADY_MEMBER:
 		return (std::string("General: This member is already part of the cluster"));
 		break;
+	case DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST:
+		return (std::string("Filesystem: No such file or directory"));
+		break;
+	case DDFS_FILESYSTEM_FILE_PERMISSIONS_DENIED:
+		return (std::string("Filesystem: Permission denied"));
+		break;
+	case DDFS_FILESYSTEM_CORRUPTED:
+		return (std::string("Filesystem: Metadata is corrupted"));
+		break;
+	case DDFS_FILESYSTEM_FILE_EXISTS:
+		return (std::string("Filesystem: File exists"));
+		break;
+	case DDFS_FILESYSTEM_NOT_A_DIRECTORY:
+		return (std::string("Filesystem: Not a directory"));
+		break;
 	case DDFS_FAILURE:
 		return (std::string("Failure"));
 		break;
@@ -15,12 +15,15 @@ enum DDFS_STATUS {
     DDFS_NETWORK_RETRY,
     DDFS_NETWORK_UNDERRUN,
     DDFS_NETWORK_OVERRUN,
+    DDFS_NETWORK_CORRUPTED,
     DDFS_GENERAL_PARAM_INVALID,
     DDFS_CLUSTER_INSUFFICIENT_NODES,
     DDFS_CLUSTER_ALREADY_MEMBER,
     DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST,
     DDFS_FILESYSTEM_FILE_PERMISSIONS_DENIED,
     DDFS_FILESYSTEM_CORRUPTED,
+    DDFS_FILESYSTEM_FILE_EXISTS,
+    DDFS_FILESYSTEM_NOT_A_DIRECTORY,
     DDFS_FAILURE
 };
 
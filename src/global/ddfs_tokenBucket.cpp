@@ -0,0 +1,61 @@
+/*
+ * @file ddfs_tokenBucket.cpp
+ *
+ * @brief Token bucket, limits background work to a byte rate.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#include <thread>
+
+#include "ddfs_tokenBucket.hpp"
+
+ddfsTokenBucket::ddfsTokenBucket(uint64_t bytesPerSecond, uint64_t burstBytes) :
+                rate(bytesPerSecond), burst(burstBytes == 0 ? 1 : burstBytes), tokens((double) burst),
+                lastRefill(std::chrono::steady_clock::now()) {
+}
+
+void ddfsTokenBucket::setRate(uint64_t bytesPerSecond) {
+    std::lock_guard<std::mutex> guard(bucketLock);
+    refill();
+    rate = bytesPerSecond;
+}
+
+uint64_t ddfsTokenBucket::getRate() {
+    std::lock_guard<std::mutex> guard(bucketLock);
+    return rate;
+}
+
+void ddfsTokenBucket::refill() {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - lastRefill).count();
+
+    lastRefill = now;
+    tokens += seconds * rate;
+    if(tokens > (double) burst)
+        tokens = (double) burst;
+}
+
+void ddfsTokenBucket::acquire(uint64_t bytes) {
+    std::unique_lock<std::mutex> guard(bucketLock);
+
+    while(true) {
+        if(rate == 0)
+            return;
+
+        refill();
+
+        /* A request over the burst goes once the bucket is full */
+        double needed = (bytes > burst) ? (double) burst : (double) bytes;
+        if(tokens >= needed) {
+            tokens -= (double) bytes;
+            return;
+        }
+
+        /* Sleep for the missing tokens, without holding up setRate() */
+        double waitSeconds = (needed - tokens) / rate;
+        guard.unlock();
+        std::this_thread::sleep_for(std::chrono::microseconds((uint64_t) (waitSeconds * 1000000) + 1));
+        guard.lock();
+    }
+}
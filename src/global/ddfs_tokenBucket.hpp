@@ -0,0 +1,53 @@
+/*
+ * @file ddfs_tokenBucket.hpp
+ *
+ * @brief Token bucket, limits background work to a byte rate.
+ *
+ * Tokens are bytes. They fill up at the configured rate, to at most
+ * burst bytes, and a caller takes as many as it is about to move. When
+ * there are not enough the caller sleeps until there are. A request
+ * bigger than the burst is let through once the bucket is full, the
+ * bucket then owes the difference and the next caller waits for it.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#ifndef DDFS_TOKENBUCKET_H
+#define DDFS_TOKENBUCKET_H
+
+#include <mutex>
+#include <chrono>
+#include <stdint.h>
+
+/*
+ * @class ddfsTokenBucket
+ *
+ * @brief Byte rate limiter shared by any number of threads.
+ */
+class ddfsTokenBucket {
+public:
+    /* bytesPerSecond of 0 means no limit */
+    ddfsTokenBucket(uint64_t bytesPerSecond, uint64_t burstBytes);
+
+    void setRate(uint64_t bytesPerSecond);
+    uint64_t getRate();
+
+    /* Wait until bytes may be moved, and take them */
+    void acquire(uint64_t bytes);
+
+private:
+    /* Add the tokens earned since the last refill */
+    void refill();
+
+    uint64_t rate;
+    uint64_t burst;
+    /* Negative while a big request is being paid off */
+    double tokens;
+    std::chrono::steady_clock::time_point lastRefill;
+    std::mutex bucketLock;
+
+    ddfsTokenBucket(ddfsTokenBucket const&);     // Don't Implement
+    void operator=(ddfsTokenBucket const&);      // Don't implement
+};
+
+#endif /* Ending DDFS_TOKENBUCKET_H */
@@ -0,0 +1,142 @@
+/*
+ * @file ddfs_bufferPool.hpp
+ *
+ * @brief Recycled buffers for sending and receiving messages.
+ *
+ * Every message used to be built in a stack buffer and copied, or
+ * received into a fresh malloc. Messages are now encoded straight into
+ * a pooled buffer and received into one, and the buffer goes back to
+ * the pool once the message is sent or handed to the subscribers.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#ifndef DDFS_BUFFERPOOL_H
+#define DDFS_BUFFERPOOL_H
+
+#include <vector>
+#include <mutex>
+#include <cstddef>
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace std;
+
+/*
+ * @class ddfsBufferPool
+ *
+ * @brief Free list of equally sized buffers.
+ *
+ * A request larger than the buffer size gets a buffer of its own, which
+ * is freed instead of cached on release.
+ */
+class ddfsBufferPool {
+public:
+    /* Pool shared by the network connections */
+    static ddfsBufferPool& getInstance() {
+        static ddfsBufferPool instance(s_defaultBufferSize, s_defaultMaxCached);
+        return instance;
+    }
+
+    ddfsBufferPool(size_t size, size_t maxCached) : bufferSize(size), maxCachedBuffers(maxCached) {}
+
+    ~ddfsBufferPool() {
+        for(unsigned int i = 0; i < freeBuffers.size(); i++)
+            free(freeBuffers[i]);
+    }
+
+    /*
+     * @brief Buffer of at least size bytes.
+     *
+     * @return The buffer and its capacity, NULL if out of memory.
+     */
+    uint8_t *acquire(size_t size, size_t *capacity) {
+        if(size > bufferSize) {
+            *capacity = size;
+            return (uint8_t *) malloc(size);
+        }
+
+        *capacity = bufferSize;
+
+        {
+            std::lock_guard<std::mutex> guard(poolLock);
+            if(freeBuffers.empty() == false) {
+                uint8_t *buffer = freeBuffers.back();
+                freeBuffers.pop_back();
+                return buffer;
+            }
+        }
+
+        return (uint8_t *) malloc(bufferSize);
+    }
+
+    /* capacity is the one acquire() returned */
+    void release(uint8_t *buffer, size_t capacity) {
+        if(buffer == NULL)
+            return;
+
+        if(capacity == bufferSize) {
+            std::lock_guard<std::mutex> guard(poolLock);
+            if(freeBuffers.size() < maxCachedBuffers) {
+                freeBuffers.push_back(buffer);
+                return;
+            }
+        }
+
+        free(buffer);
+    }
+
+    size_t getBufferSize() {
+        return bufferSize;
+    }
+
+private:
+    /* Fits every consensus message with room to spare */
+    static const size_t s_defaultBufferSize = 4096;
+    static const size_t s_defaultMaxCached = 256;
+
+    size_t bufferSize;
+    size_t maxCachedBuffers;
+    std::mutex poolLock;
+    vector<uint8_t *> freeBuffers;
+
+    ddfsBufferPool(ddfsBufferPool const&);     // Don't Implement
+    void operator=(ddfsBufferPool const&);     // Don't implement
+};
+
+/*
+ * @class ddfsPooledBuffer
+ *
+ * @brief A buffer from a pool, given back when it goes out of scope.
+ */
+class ddfsPooledBuffer {
+public:
+    explicit ddfsPooledBuffer(size_t size, ddfsBufferPool &p = ddfsBufferPool::getInstance()) : pool(p) {
+        buffer = pool.acquire(size, &bufferCapacity);
+        if(buffer == NULL)
+            bufferCapacity = 0;
+    }
+
+    ~ddfsPooledBuffer() {
+        pool.release(buffer, bufferCapacity);
+    }
+
+    /* NULL if the allocation failed */
+    uint8_t *getData() {
+        return buffer;
+    }
+
+    size_t getCapacity() {
+        return bufferCapacity;
+    }
+
+private:
+    ddfsBufferPool &pool;
+    uint8_t *buffer;
+    size_t bufferCapacity;
+
+    ddfsPooledBuffer(ddfsPooledBuffer const&);     // Don't Implement
+    void operator=(ddfsPooledBuffer const&);       // Don't implement
+};
+
+#endif /* Ending DDFS_BUFFERPOOL_H */
@@ -0,0 +1,392 @@
+/*
+ * @file ddfs_loopbackConnection.hpp
+ *
+ * @brief In-process transport used to run a whole cluster in one process.
+ *
+ * Every node of the test cluster lives in the same address space and
+ * all the loopback connections share one fabric. The fabric delivers the
+ * messages from a single dispatcher thread, after an injected latency,
+ * and can drop a configurable fraction of them.
+ *
+ * ________________________________________________
+ *  node A (ddfsClusterPaxos)    node B (ddfsClusterPaxos)
+ * ------------------------------------------------
+ *  member(B) -- A->B -->  fabric  --> B->A -- member(A)
+ *
+ * A connection is identified by <local host, remote host>. Data send on
+ * <A, B> is handed to the subscribers of <B, A>.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#ifndef DDFS_LOOPBACKCONNECTION_H
+#define DDFS_LOOPBACKCONNECTION_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <queue>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <stdint.h>
+
+using namespace std;
+
+#include "ddfs_network.hpp"
+#include "../logger/ddfs_fileLogger.hpp"
+#include "../global/ddfs_status.hpp"
+
+/* Counters collected by the fabric, used by the benchmark harness */
+struct ddfsLoopbackStats {
+    uint64_t sent;
+    uint64_t delivered;
+    uint64_t dropped;
+    uint64_t bytes;
+    /* One sample per delivered message, in micro seconds */
+    std::vector<uint64_t> latencyUs;
+};
+
+/*
+ * @class ddfsLoopbackEndpoint
+ *
+ * @brief Receiving side of a loopback connection.
+ */
+class ddfsLoopbackEndpoint {
+public:
+    virtual void deliver(void *data, int size) = 0;
+    virtual ~ddfsLoopbackEndpoint() {}
+};
+
+/*
+ * @class ddfsLoopbackFabric
+ *
+ * @brief The wire shared by all the loopback connections.
+ *
+ * @note A singleton class. It is never freed, the dispatcher thread
+ *       runs until the process exits.
+ */
+class ddfsLoopbackFabric {
+public:
+    static ddfsLoopbackFabric& getInstance() {
+        static ddfsLoopbackFabric *singleton_fabric = new ddfsLoopbackFabric();
+        return *singleton_fabric;
+    }
+
+    /*
+     * @brief Set the link properties applied to every message send from now on.
+     *
+     * @param latencyUs   One way latency in micro seconds.
+     * @param jitterUs    Random extra latency [0, jitterUs] in micro seconds.
+     * @param lossRate    Fraction [0.0, 1.0] of messages dropped.
+     */
+    void setLinkProfile(uint32_t latencyUs, uint32_t jitterUs, double lossRate) {
+        std::lock_guard<std::mutex> guard(fabricLock);
+        linkLatencyUs = latencyUs;
+        linkJitterUs = jitterUs;
+        linkLossRate = lossRate;
+    }
+
+    ddfsStatus registerEndpoint(string local, string remote, ddfsLoopbackEndpoint *endpoint) {
+        std::lock_guard<std::mutex> guard(fabricLock);
+
+        if(endpoints.find(make_pair(local, remote)) != endpoints.end())
+            return (ddfsStatus(DDFS_FAILURE));
+
+        endpoints[make_pair(local, remote)] = endpoint;
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    void unregisterEndpoint(string local, string remote) {
+        /* Wait for an in flight delivery to this endpoint to finish */
+        std::lock_guard<std::mutex> deliveryGuard(deliveryLock);
+        std::lock_guard<std::mutex> guard(fabricLock);
+
+        endpoints.erase(make_pair(local, remote));
+    }
+
+    bool isEndpointRegistered(string local, string remote) {
+        std::lock_guard<std::mutex> guard(fabricLock);
+        return (endpoints.find(make_pair(local, remote)) != endpoints.end());
+    }
+
+    /* Queue data send on <local, remote>. Data is copied. */
+    ddfsStatus transmit(string local, string remote, void *data, int size) {
+        std::lock_guard<std::mutex> guard(fabricLock);
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+        stats.sent++;
+
+        if((linkLossRate > 0.0) && (lossDistribution(randomEngine) < linkLossRate)) {
+            stats.dropped++;
+            return (ddfsStatus(DDFS_OK));
+        }
+
+        uint64_t delayUs = linkLatencyUs;
+        if(linkJitterUs)
+            delayUs += randomEngine() % (linkJitterUs + 1);
+
+        /* Keep the link FIFO, like a TCP stream would be */
+        std::pair<string, string> link = make_pair(local, remote);
+        std::chrono::steady_clock::time_point deliverAt = now + std::chrono::microseconds(delayUs);
+        std::map<std::pair<string, string>, std::chrono::steady_clock::time_point>::iterator last = lastDelivery.find(link);
+        if((last != lastDelivery.end()) && (last->second > deliverAt))
+            deliverAt = last->second;
+        lastDelivery[link] = deliverAt;
+
+        loopbackMessage message;
+        message.destination = make_pair(remote, local);
+        message.payload.assign((uint8_t *) data, (uint8_t *) data + size);
+        message.sentAt = now;
+        message.deliverAt = deliverAt;
+        message.sequence = nextSequence++;
+
+        inFlight.push(message);
+        pending.notify_one();
+
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    void getStats(ddfsLoopbackStats *result) {
+        std::lock_guard<std::mutex> guard(fabricLock);
+        *result = stats;
+    }
+
+    void resetStats() {
+        std::lock_guard<std::mutex> guard(fabricLock);
+        stats.sent = stats.delivered = stats.dropped = stats.bytes = 0;
+        stats.latencyUs.clear();
+    }
+
+private:
+    struct loopbackMessage {
+        std::pair<string, string> destination;
+        std::vector<uint8_t> payload;
+        std::chrono::steady_clock::time_point sentAt;
+        std::chrono::steady_clock::time_point deliverAt;
+        uint64_t sequence;
+    };
+
+    /* Earliest deliverAt first, send order among equals */
+    struct laterDelivery {
+        bool operator()(const loopbackMessage &a, const loopbackMessage &b) const {
+            if(a.deliverAt != b.deliverAt)
+                return a.deliverAt > b.deliverAt;
+            return a.sequence > b.sequence;
+        }
+    };
+
+    static const size_t s_maxLatencySamples = 1 << 20;
+
+    std::mutex fabricLock;
+    /* Held while a message is being handed to an endpoint */
+    std::mutex deliveryLock;
+    std::condition_variable pending;
+    std::priority_queue<loopbackMessage, std::vector<loopbackMessage>, laterDelivery> inFlight;
+    std::map<std::pair<string, string>, ddfsLoopbackEndpoint *> endpoints;
+    std::map<std::pair<string, string>, std::chrono::steady_clock::time_point> lastDelivery;
+    uint64_t nextSequence;
+
+    uint32_t linkLatencyUs;
+    uint32_t linkJitterUs;
+    double linkLossRate;
+    std::mt19937 randomEngine;
+    std::uniform_real_distribution<double> lossDistribution;
+
+    ddfsLoopbackStats stats;
+    std::thread dispatcher;
+
+    ddfsLoopbackFabric() : nextSequence(0), linkLatencyUs(0), linkJitterUs(0),
+                linkLossRate(0.0), randomEngine(5327), lossDistribution(0.0, 1.0) {
+        stats.sent = stats.delivered = stats.dropped = stats.bytes = 0;
+        dispatcher = std::thread(&ddfsLoopbackFabric::dispatch, this);
+        dispatcher.detach();
+    }
+    ddfsLoopbackFabric(ddfsLoopbackFabric const&);  // Don't Implement
+    void operator=(ddfsLoopbackFabric const&);      // Don't implement
+
+    void dispatch() {
+        while(1) {
+            std::unique_lock<std::mutex> guard(fabricLock);
+
+            while(inFlight.empty())
+                pending.wait(guard);
+
+            std::chrono::steady_clock::time_point due = inFlight.top().deliverAt;
+            if(std::chrono::steady_clock::now() < due) {
+                /* A message with an earlier deadline may show up meanwhile */
+                pending.wait_until(guard, due);
+                continue;
+            }
+
+            loopbackMessage message = inFlight.top();
+            inFlight.pop();
+            guard.unlock();
+
+            std::lock_guard<std::mutex> deliveryGuard(deliveryLock);
+            ddfsLoopbackEndpoint *endpoint = NULL;
+
+            guard.lock();
+            std::map<std::pair<string, string>, ddfsLoopbackEndpoint *>::iterator iter = endpoints.find(message.destination);
+            if(iter == endpoints.end()) {
+                /* Nobody at the other end, same as a connection refused */
+                stats.dropped++;
+                continue;
+            }
+            endpoint = iter->second;
+
+            stats.delivered++;
+            stats.bytes += message.payload.size();
+            if(stats.latencyUs.size() < s_maxLatencySamples) {
+                stats.latencyUs.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                                std::chrono::steady_clock::now() - message.sentAt).count());
+            }
+            guard.unlock();
+
+            /* Subscribers are free to send data from the callback */
+            endpoint->deliver(message.payload.data(), message.payload.size());
+        }
+    }
+};
+
+/*
+ * @class ddfsLoopbackConnection
+ *
+ * @brief Network implementation on top of ddfsLoopbackFabric.
+ *
+ * Implements the same Network interface as ddfsTcpConnection, so it can
+ * be used by the cluster members in place of it.
+ */
+template <typename T_sub>
+class ddfsLoopbackConnection : public Network<string, T_sub, DDFS_NETWORK_TYPE>, public ddfsLoopbackEndpoint {
+public:
+    /* localHostName : Name of the node this connection belongs to. */
+    explicit ddfsLoopbackConnection(string localHostName) :
+            localNodeHostName(localHostName), isNodeLocal(false), registered(false) {}
+
+    ~ddfsLoopbackConnection() {
+        closeConnection();
+    }
+
+    ddfsStatus init() {
+        this->setNetworkType(DDFS_NETWORK_LOOPBACK);
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    ddfsStatus openConnection(string nodeUniqueID, bool doNotConnect) {
+        std::string localhost("localhost");
+
+        remoteNodeHostName = nodeUniqueID;
+
+        /* Nothing to listen on for the local node */
+        if(!localhost.compare(remoteNodeHostName)) {
+            isNodeLocal = true;
+            return (ddfsStatus(DDFS_OK));
+        }
+
+        /* There is no connect, so doNotConnect does not matter. */
+        ddfsStatus status = ddfsLoopbackFabric::getInstance().registerEndpoint(localNodeHostName,
+                                        remoteNodeHostName, this);
+        if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+            global_logger_lb << ddfsLogger::LOG_WARNING << "LOOPBACK(" << localNodeHostName << "): Connection to "
+                        << remoteNodeHostName << " is already open.\n";
+            return status;
+        }
+
+        registered = true;
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    ddfsStatus setupPortal(void **privatePtr) {
+        /* Only one portal per connection, the connection itself */
+        *privatePtr = this;
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    /* Sending is a copy into the fabric and never waits on the peer,
+     * so there is nothing to put in order and trafficClass is unused. */
+    ddfsStatus sendData(void *data, int size, void *privatePtr, ddfsTrafficClass trafficClass) {
+        if(isNodeLocal == true || registered == false)
+            return (ddfsStatus(DDFS_FAILURE));
+
+        if(isConnectionOpen() == false)
+            return (ddfsStatus(DDFS_HOST_DOWN));
+
+        return ddfsLoopbackFabric::getInstance().transmit(localNodeHostName, remoteNodeHostName, data, size);
+    }
+
+    ddfsStatus receiveData(void *des, int requestedSize, int *actualSize) {
+        /* Data is pushed to the subscribers */
+        return (ddfsStatus(DDFS_FAILURE));
+    }
+
+    /* The connection is open once the remote node opened its end */
+    bool isConnectionOpen() {
+        if(isNodeLocal == true)
+            return false;
+
+        return ddfsLoopbackFabric::getInstance().isEndpointRegistered(remoteNodeHostName, localNodeHostName);
+    }
+
+    ddfsStatus checkConnection() {
+        if(isConnectionOpen() == false)
+            return (ddfsStatus(DDFS_FAILURE));
+
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    ddfsStatus subscribe(T_sub *owner, void *privatePtr) {
+        if(privatePtr == NULL) {
+            global_logger_lb << ddfsLogger::LOG_INFO << "LOOPBACK::Subscribe: Null privatePtr passed.\n";
+            return (ddfsStatus(DDFS_FAILURE));
+        }
+
+        subscriptionLock.lock();
+        subscriptions.addSubscription(owner);
+        subscriptionLock.unlock();
+
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    ddfsStatus closeConnection() {
+        if(registered == true) {
+            ddfsLoopbackFabric::getInstance().unregisterEndpoint(localNodeHostName, remoteNodeHostName);
+            registered = false;
+        }
+
+        subscriptionLock.lock();
+        subscriptions.removeAllSubscription();
+        subscriptionLock.unlock();
+
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    ddfsStatus copyData(void *des, int requestedSize, int *actualSize) {
+        return (ddfsStatus(DDFS_FAILURE));
+    }
+
+    /* Called by the fabric dispatcher thread */
+    void deliver(void *data, int size) {
+        subscriptionLock.lock();
+        subscriptions.callSubscription(data, size);
+        subscriptionLock.unlock();
+    }
+
+private:
+    string localNodeHostName;
+    string remoteNodeHostName;
+    bool isNodeLocal;
+    bool registered;
+
+    std::mutex subscriptionLock;
+    ddfsSubscriptionClass <T_sub> subscriptions;
+
+    /* Logger instance */
+    ddfsLogger &global_logger_lb = ddfsLogger::getInstance();
+};
+
+#endif /* Ending DDFS_LOOPBACKCONNECTION_H */
@@ -39,12 +39,87 @@
 
 #ifndef DDFS_NETWORK_H
 #define DDFS_NETWORK_H
+#include <vector>
+
 #include "../global/ddfs_status.hpp"
 
+enum DDFS_NETWORK_TYPE {
+    DDFS_NETWORK_TCP,
+    DDFS_NETWORK_UDP,
+    DDFS_NETWORK_FC,
+    DDFS_NETWORK_ISCSI,
+    DDFS_NETWORK_LOOPBACK,  /* In-process transport, used for test clusters */
+    DDFS_NETWORK_SHM        /* Shared memory, for nodes on the same host */
+};
+
+/*
+ * What a packet carries. Decides its place in the send order of a
+ * connection, see ddfs_trafficScheduler.hpp.
+ */
+enum ddfsTrafficClass {
+    DDFS_TRAFFIC_CONSENSUS,     /* Paxos and heartbeats, always first */
+    DDFS_TRAFFIC_REPLICATION,   /* Copies between replicas */
+    DDFS_TRAFFIC_CLIENT,        /* Data for and from clients */
+    DDFS_TRAFFIC_CLASSES
+};
+
+/*
+ * Components receiving data from a network instance subscribe to it.
+ * Every implementation of the Network interface hands the received
+ * data to T::callback(void *data, int size).
+ *
+ * Implementations that track the connection also report it going up
+ * and down through T::connectionStateChanged(bool connected).
+ */
+template<typename T>
+class ddfsSubscriptionClass {
+private:
+    std::vector<T*> subscribedInstances;
+public:
+    void addSubscription(T* owner) {
+        subscribedInstances.push_back(owner);
+    }
+
+    void removeAllSubscription() {
+        subscribedInstances.clear();
+    }
+
+    int removeSubscription(T *owner) {
+       for(unsigned int i=0; i < subscribedInstances.size(); i++){
+           if(subscribedInstances[i] == owner) {
+                subscribedInstances.erase(subscribedInstances.begin()+i);
+                return 0;
+            }
+        }
+        return -1;
+    }
+
+    void callSubscription(void *data, int size) {
+        for(unsigned int i=0; i < subscribedInstances.size(); i++){
+            subscribedInstances[i]->callback(data, size);
+        }
+    }
+
+    void callConnectionState(bool connected) {
+        for(unsigned int i=0; i < subscribedInstances.size(); i++){
+            subscribedInstances[i]->connectionStateChanged(connected);
+        }
+    }
+};
 
 template <typename T_ddfsRemoteNodeUniqueID, typename T_ddfsSubscribedClass, typename T_ddfsNetworkType>
 class Network {
 public:
+	/*	init				*/
+	/**
+	 * @brief   Initialize the network instance.
+	 *
+	 * Called once, before openConnection.
+	 *
+	 * @return DDFS_OK	Success
+	 * @return DDFS_FAILURE	Failure
+	 */
+	virtual ddfsStatus init() = 0;
 	/* @sa openConnection				*/
 	/**
 	 * @sa openConnection
@@ -60,6 +135,17 @@ public:
 	 * @return DDFS_FAILURE	Failure
 	 */
 	virtual ddfsStatus openConnection(T_ddfsRemoteNodeUniqueID nodeUniqueID, bool ) = 0;
+	/*	setupPortal			*/
+	/**
+	 * @brief   Allocate a request/response queue pair.
+	 *
+	 * @param[out]  privatePtr	Filled with the request queue that has to
+	 * 				be passed back in sendData and subscribe.
+	 *
+	 * @return DDFS_OK	Success
+	 * @return DDFS_FAILURE	Failure
+	 */
+	virtual ddfsStatus setupPortal(void **privatePtr) = 0;
 	/*	sendData			*/
 	/**
 	 * @brief   Send data across.
@@ -69,6 +155,8 @@ public:
 	 *
 	 * @param   data		Pointer to the data that needs to be send
 	 * @param   size		Size of the data to be send
+	 * @param   trafficClass	Lane the data is sent in. Consensus
+	 * 				traffic is never queued behind the others.
 	 * @param   fn			The callback function. If this is NULL, this is
 	 * 				synchronous call.
 	 * 				If this fn is not NULL, this is asynchronous calls.
@@ -78,7 +166,8 @@ public:
 	 * @return  DDFS_HOST_DOWN	Host is down
 	 * @return  DDFS_FAILURE	Failure
 	 */
-	virtual ddfsStatus sendData(void *data, int size, void *privatePtr) = 0;
+	virtual ddfsStatus sendData(void *data, int size, void *privatePtr,
+					ddfsTrafficClass trafficClass) = 0;
 	/*	receiveData			*/
 	/**
 	 *
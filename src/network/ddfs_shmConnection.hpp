@@ -0,0 +1,513 @@
+/*
+ * @file ddfs_shmConnection.hpp
+ *
+ * @brief Shared memory transport between nodes running on the same host.
+ *
+ * Two nodes share one POSIX shared memory segment, named after both
+ * host names. The segment holds one ring per direction.
+ *
+ * ________________________________________________
+ *  header | ring control[0] | ring control[1] | ring data[0] | ring data[1]
+ * ------------------------------------------------
+ *
+ * Ring 0 carries data from the node with the smaller host name to the
+ * other one, ring 1 the opposite direction.
+ *
+ * Every ring is a single producer, single consumer byte ring. Producer
+ * only moves the tail, consumer only moves the head, so neither side
+ * takes a lock shared with the other. A side with nothing to do sleeps
+ * on a futex word that the other side bumps.
+ *
+ * Record in the ring : [ length : 4 bytes ][ payload ][ padding to 8 ]
+ * A length of s_wrapMarker means the record continues at the ring start.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#ifndef DDFS_SHMCONNECTION_H
+#define DDFS_SHMCONNECTION_H
+
+#include <string>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+using namespace std;
+
+#include "ddfs_network.hpp"
+#include "ddfs_trafficScheduler.hpp"
+#include "../logger/ddfs_fileLogger.hpp"
+#include "../global/ddfs_status.hpp"
+
+/* Shared between processes, the atomics must not need a lock */
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "Shared memory transport needs lock free 32 bit atomics");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Shared memory transport needs lock free 64 bit atomics");
+
+/*
+ * @class ddfsShmSegment
+ *
+ * @brief One mapped shared memory segment and the two rings in it.
+ */
+class ddfsShmSegment {
+public:
+    /* Size of each ring, has to be a power of 2 */
+    static const uint64_t s_ringSize = 1 << 20;
+    /* Largest payload that can be pushed in one record */
+    static const uint32_t s_maxRecordSize = s_ringSize / 4;
+
+    ddfsShmSegment() : mapping(NULL), mappingSize(0), side(0) {}
+    ~ddfsShmSegment() { detach(); }
+
+    /*
+     * @brief Create or open the segment shared by local and remote.
+     *
+     * @return DDFS_OK       Success
+     * @return DDFS_FAILURE  Unable to open or map the segment.
+     */
+    ddfsStatus attach(string local, string remote) {
+        int fd;
+
+        segmentName = getSegmentName(local, remote);
+        side = (local < remote) ? 0 : 1;
+        mappingSize = getDataOffset() + 2 * s_ringSize;
+
+        fd = shm_open(segmentName.c_str(), O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+        if(fd == -1) {
+            global_logger_shm << ddfsLogger::LOG_WARNING << "SHM: Unable to open " << segmentName
+                        << ". " << strerror(errno) << "\n";
+            return (ddfsStatus(DDFS_FAILURE));
+        }
+
+        /* Both sides truncate to the same size. Fresh pages are zero. */
+        if(ftruncate(fd, mappingSize) == -1) {
+            global_logger_shm << ddfsLogger::LOG_WARNING << "SHM: Unable to size " << segmentName
+                        << ". " << strerror(errno) << "\n";
+            close(fd);
+            return (ddfsStatus(DDFS_FAILURE));
+        }
+
+        mapping = (uint8_t *) mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if(mapping == MAP_FAILED) {
+            global_logger_shm << ddfsLogger::LOG_WARNING << "SHM: Unable to map " << segmentName
+                        << ". " << strerror(errno) << "\n";
+            mapping = NULL;
+            return (ddfsStatus(DDFS_FAILURE));
+        }
+
+        segmentHeader *header = getHeader();
+        uint32_t expected = s_segmentNew;
+
+        if(header->state.compare_exchange_strong(expected, s_segmentInitializing)) {
+            header->ringSize = s_ringSize;
+            header->state.store(s_segmentReady);
+        } else {
+            while(header->state.load() != s_segmentReady)
+                std::this_thread::yield();
+        }
+
+        /* Whatever is left over from a previous run of this node is stale */
+        ringControl *in = getRing(1 - side);
+        in->head.store(in->tail.load());
+
+        header->attached[side].store(1);
+        global_logger_shm << ddfsLogger::LOG_INFO << "SHM: Attached to " << segmentName << "\n";
+
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    void detach() {
+        if(mapping == NULL)
+            return;
+
+        segmentHeader *header = getHeader();
+        header->attached[side].store(0);
+
+        /* Wake up anybody sleeping on our rings, so they notice */
+        getRing(0)->dataSeq.fetch_add(1);
+        getRing(1)->dataSeq.fetch_add(1);
+        futexWake(&getRing(0)->dataSeq);
+        futexWake(&getRing(1)->dataSeq);
+
+        bool lastOne = (header->attached[1 - side].load() == 0);
+
+        munmap(mapping, mappingSize);
+        mapping = NULL;
+
+        if(lastOne)
+            shm_unlink(segmentName.c_str());
+    }
+
+    bool isPeerAttached() {
+        if(mapping == NULL)
+            return false;
+        return (getHeader()->attached[1 - side].load() == 1);
+    }
+
+    /*
+     * @brief Copy one record in the outgoing ring.
+     *
+     * @note Only one thread at a time may push, caller serializes.
+     *
+     * @return DDFS_OK               Success
+     * @return DDFS_NETWORK_OVERRUN  Record is larger than s_maxRecordSize
+     * @return DDFS_NETWORK_RETRY    Ring stayed full for timeoutMs
+     */
+    ddfsStatus push(void *data, uint32_t size, int timeoutMs) {
+        ringControl *out = getRing(side);
+        uint8_t *ringData = getRingData(side);
+        uint64_t recordSize = alignRecord(size);
+        int waitedMs = 0;
+
+        if(size > s_maxRecordSize)
+            return (ddfsStatus(DDFS_NETWORK_OVERRUN));
+
+        while(1) {
+            uint64_t tail = out->tail.load(std::memory_order_relaxed);
+            uint64_t head = out->head.load(std::memory_order_acquire);
+            uint64_t offset = tail & (s_ringSize - 1);
+            uint64_t contiguous = s_ringSize - offset;
+            uint64_t needed = recordSize + ((contiguous < recordSize) ? contiguous : 0);
+
+            if((s_ringSize - (tail - head)) < needed) {
+                /* Ring is full, wait for the consumer to make some space */
+                uint32_t seq = out->spaceSeq.load(std::memory_order_acquire);
+                if(out->head.load(std::memory_order_acquire) != head)
+                    continue;
+                if(waitedMs >= timeoutMs)
+                    return (ddfsStatus(DDFS_NETWORK_RETRY));
+
+                out->producerWaiting.store(1);
+                futexWait(&out->spaceSeq, seq, s_waitSliceMs);
+                out->producerWaiting.store(0);
+                waitedMs += s_waitSliceMs;
+                continue;
+            }
+
+            if(contiguous < recordSize) {
+                *(uint32_t *)(ringData + offset) = s_wrapMarker;
+                tail += contiguous;
+                offset = 0;
+            }
+
+            *(uint32_t *)(ringData + offset) = size;
+            memcpy(ringData + offset + sizeof(uint32_t), data, size);
+
+            out->tail.store(tail + recordSize, std::memory_order_release);
+            out->dataSeq.fetch_add(1);
+            if(out->consumerWaiting.load())
+                futexWake(&out->dataSeq);
+
+            return (ddfsStatus(DDFS_OK));
+        }
+    }
+
+    /*
+     * @brief Wait for the next incoming record.
+     *
+     * Data is not copied, the pointer is into the ring and stays valid
+     * until pop() is called.
+     *
+     * @return true   A record is available.
+     * @return false  Nothing arrived in timeoutMs.
+     */
+    bool peek(void **data, uint32_t *size, int timeoutMs) {
+        ringControl *in = getRing(1 - side);
+        uint8_t *ringData = getRingData(1 - side);
+
+        while(1) {
+            uint64_t head = in->head.load(std::memory_order_relaxed);
+
+            if(head == in->tail.load(std::memory_order_acquire)) {
+                uint32_t seq = in->dataSeq.load(std::memory_order_acquire);
+                if(head != in->tail.load(std::memory_order_acquire))
+                    continue;
+
+                in->consumerWaiting.store(1);
+                int ret = futexWait(&in->dataSeq, seq, timeoutMs);
+                in->consumerWaiting.store(0);
+
+                if((ret == -1) && (errno == ETIMEDOUT))
+                    return false;
+                if(head == in->tail.load(std::memory_order_acquire))
+                    return false;
+                continue;
+            }
+
+            uint64_t offset = head & (s_ringSize - 1);
+            uint32_t length = *(uint32_t *)(ringData + offset);
+
+            if(length == s_wrapMarker) {
+                in->head.store(head + (s_ringSize - offset), std::memory_order_release);
+                continue;
+            }
+
+            *data = ringData + offset + sizeof(uint32_t);
+            *size = length;
+            return true;
+        }
+    }
+
+    /* Name of the segment shared by the two nodes, same on both sides */
+    static string getSegmentName(string local, string remote) {
+        string name("/ddfs-");
+
+        name.append((local < remote) ? local : remote);
+        name.append("-");
+        name.append((local < remote) ? remote : local);
+
+        for(unsigned int i = 1; i < name.size(); i++) {
+            if(name[i] == '/')
+                name[i] = '_';
+        }
+        return name;
+    }
+
+    /* Release the record returned by the last peek() */
+    void pop() {
+        ringControl *in = getRing(1 - side);
+        uint8_t *ringData = getRingData(1 - side);
+        uint64_t head = in->head.load(std::memory_order_relaxed);
+        uint32_t length = *(uint32_t *)(ringData + (head & (s_ringSize - 1)));
+
+        in->head.store(head + alignRecord(length), std::memory_order_release);
+        in->spaceSeq.fetch_add(1);
+        if(in->producerWaiting.load())
+            futexWake(&in->spaceSeq);
+    }
+
+private:
+    static const uint32_t s_wrapMarker = 0xFFFFFFFF;
+    static const uint32_t s_segmentNew = 0;
+    static const uint32_t s_segmentInitializing = 1;
+    static const uint32_t s_segmentReady = 2;
+    static const int s_waitSliceMs = 10;
+
+    /* Producer and consumer fields live on their own cache lines */
+    struct ringControl {
+        std::atomic<uint64_t> head;             /* Moved by the consumer */
+        uint8_t pad0[56];
+        std::atomic<uint64_t> tail;             /* Moved by the producer */
+        uint8_t pad1[56];
+        std::atomic<uint32_t> dataSeq;          /* Futex word, bumped after a push */
+        std::atomic<uint32_t> consumerWaiting;
+        std::atomic<uint32_t> spaceSeq;         /* Futex word, bumped after a pop */
+        std::atomic<uint32_t> producerWaiting;
+        uint8_t pad2[48];
+    };
+
+    struct segmentHeader {
+        std::atomic<uint32_t> state;
+        std::atomic<uint32_t> attached[2];
+        uint32_t reserved;
+        uint64_t ringSize;
+        uint8_t pad[40];
+        ringControl ring[2];
+    };
+
+    uint8_t *mapping;
+    uint64_t mappingSize;
+    int side;
+    string segmentName;
+
+    /* Logger instance */
+    ddfsLogger &global_logger_shm = ddfsLogger::getInstance();
+
+    static uint64_t alignRecord(uint32_t size) {
+        return (sizeof(uint32_t) + size + 7) & ~((uint64_t) 7);
+    }
+
+    static uint64_t getDataOffset() {
+        return (sizeof(segmentHeader) + 4095) & ~((uint64_t) 4095);
+    }
+
+    segmentHeader *getHeader() { return (segmentHeader *) mapping; }
+    ringControl *getRing(int index) { return &getHeader()->ring[index]; }
+    uint8_t *getRingData(int index) { return mapping + getDataOffset() + (index * s_ringSize); }
+
+    /* The segment is shared between processes, no FUTEX_PRIVATE_FLAG */
+    static int futexWait(std::atomic<uint32_t> *word, uint32_t expected, int timeoutMs) {
+        struct timespec timeout;
+
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+        return syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, expected, &timeout, NULL, 0);
+    }
+
+    static void futexWake(std::atomic<uint32_t> *word) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+
+    ddfsShmSegment(ddfsShmSegment const&);     // Don't Implement
+    void operator=(ddfsShmSegment const&);     // Don't implement
+};
+
+/*
+ * @class ddfsShmConnection
+ *
+ * @brief Network implementation on top of ddfsShmSegment.
+ *
+ * Data send is copied once in the ring. Received data is handed to the
+ * subscribers straight from the ring.
+ */
+template <typename T_sub>
+class ddfsShmConnection : public Network<string, T_sub, DDFS_NETWORK_TYPE> {
+public:
+    /* localHostName : Name of the node this connection belongs to. */
+    explicit ddfsShmConnection(string localHostName) :
+            localNodeHostName(localHostName), isNodeLocal(false), terminateThread(false) {}
+
+    ~ddfsShmConnection() {
+        closeConnection();
+    }
+
+    ddfsStatus init() {
+        this->setNetworkType(DDFS_NETWORK_SHM);
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    ddfsStatus openConnection(string nodeUniqueID, bool doNotConnect) {
+        std::string localhost("localhost");
+
+        remoteNodeHostName = nodeUniqueID;
+
+        /* Nothing to listen on for the local node */
+        if(!localhost.compare(remoteNodeHostName)) {
+            isNodeLocal = true;
+            return (ddfsStatus(DDFS_OK));
+        }
+
+        /* Both sides attach, so doNotConnect does not matter. */
+        ddfsStatus status = segment.attach(localNodeHostName, remoteNodeHostName);
+        if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+            return status;
+
+        terminateThread.store(false);
+        bkThread = std::thread(&ddfsShmConnection::bk_routine, this);
+
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    ddfsStatus setupPortal(void **privatePtr) {
+        /* Only one portal per connection, the connection itself */
+        *privatePtr = this;
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    ddfsStatus sendData(void *data, int size, void *privatePtr, ddfsTrafficClass trafficClass) {
+        if(isNodeLocal == true || size < 0)
+            return (ddfsStatus(DDFS_FAILURE));
+
+        if(isConnectionOpen() == false)
+            return (ddfsStatus(DDFS_HOST_DOWN));
+
+        ddfsTrafficTurn turn(sendScheduler, trafficClass, size);
+        return segment.push(data, size, s_sendTimeoutMs);
+    }
+
+    ddfsStatus receiveData(void *des, int requestedSize, int *actualSize) {
+        /* Data is pushed to the subscribers */
+        return (ddfsStatus(DDFS_FAILURE));
+    }
+
+    bool isConnectionOpen() {
+        if(isNodeLocal == true)
+            return false;
+
+        return segment.isPeerAttached();
+    }
+
+    ddfsStatus checkConnection() {
+        if(isConnectionOpen() == false)
+            return (ddfsStatus(DDFS_FAILURE));
+
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    ddfsStatus subscribe(T_sub *owner, void *privatePtr) {
+        if(privatePtr == NULL) {
+            global_logger_shmc << ddfsLogger::LOG_INFO << "SHM::Subscribe: Null privatePtr passed.\n";
+            return (ddfsStatus(DDFS_FAILURE));
+        }
+
+        subscriptionLock.lock();
+        subscriptions.addSubscription(owner);
+        subscriptionLock.unlock();
+
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    ddfsStatus closeConnection() {
+        if(bkThread.joinable()) {
+            terminateThread.store(true);
+            bkThread.join();
+        }
+
+        segment.detach();
+
+        subscriptionLock.lock();
+        subscriptions.removeAllSubscription();
+        subscriptionLock.unlock();
+
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    ddfsStatus copyData(void *des, int requestedSize, int *actualSize) {
+        return (ddfsStatus(DDFS_FAILURE));
+    }
+
+    /* Hand every incoming record to the subscribers, in place. */
+    void bk_routine() {
+        void *data;
+        uint32_t size;
+
+        global_logger_shmc << ddfsLogger::LOG_INFO << "SHM(" << remoteNodeHostName << "):: Started the background thread.\n";
+
+        while(terminateThread.load() == false) {
+            if(segment.peek(&data, &size, s_pollTimeoutMs) == false)
+                continue;
+
+            subscriptionLock.lock();
+            subscriptions.callSubscription(data, size);
+            subscriptionLock.unlock();
+
+            segment.pop();
+        }
+
+        global_logger_shmc << ddfsLogger::LOG_INFO << "SHM(" << remoteNodeHostName << "):: Exiting the receiver thread.\n";
+    }
+
+private:
+    static const int s_sendTimeoutMs = 1000;
+    static const int s_pollTimeoutMs = 100;
+
+    string localNodeHostName;
+    string remoteNodeHostName;
+    bool isNodeLocal;
+
+    ddfsShmSegment segment;
+    /* One message at a time into the ring, consensus first */
+    ddfsTrafficScheduler sendScheduler;
+
+    std::thread bkThread;
+    std::atomic<bool> terminateThread;
+
+    std::mutex subscriptionLock;
+    ddfsSubscriptionClass <T_sub> subscriptions;
+
+    /* Logger instance */
+    ddfsLogger &global_logger_shmc = ddfsLogger::getInstance();
+};
+
+#endif /* Ending DDFS_SHMCONNECTION_H */
@@ -0,0 +1,241 @@
+/*
+ * @file ddfs_tcpAcceptor.hpp
+ *
+ * @brief Accepts the incoming cluster connections of the local node.
+ *
+ * Every acceptor thread owns its own listening socket. All of them are
+ * bound to the same address and port with SO_REUSEPORT, and the kernel
+ * spreads the incoming connections across them. This keeps a burst of
+ * connections (every node reconnecting after a cluster restart) from
+ * queueing up behind a single accept loop.
+ *
+ * Accepted sockets are non blocking and inherit the socket options of
+ * the listening socket.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#ifndef DDFS_TCPACCEPTOR_H
+#define DDFS_TCPACCEPTOR_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <stdint.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+using namespace std;
+
+#include "../logger/ddfs_fileLogger.hpp"
+#include "../global/ddfs_status.hpp"
+#include "ddfs_tcpSocketOptions.hpp"
+
+#define DDFS_SERVER_PORT    53327
+
+/*
+ * @brief Split a node identification "a.b.c.d[:port]".
+ *
+ * Port is DDFS_SERVER_PORT, if the node identification does not have one.
+ *
+ * @return true   Success
+ * @return false  Port is not a valid port number.
+ */
+inline bool ddfsParseNodeAddress(string nodeUniqueID, string *address, uint16_t *port)
+{
+    size_t separator = nodeUniqueID.rfind(':');
+
+    if(separator == string::npos) {
+        *address = nodeUniqueID;
+        *port = DDFS_SERVER_PORT;
+        return true;
+    }
+
+    long value = strtol(nodeUniqueID.c_str() + separator + 1, NULL, 10);
+    if(value <= 0 || value > 65535)
+        return false;
+
+    *address = nodeUniqueID.substr(0, separator);
+    *port = (uint16_t) value;
+    return true;
+}
+
+/*
+ * Listening configuration of a node.
+ */
+struct ddfsTcpListenConfig {
+    string bindAddress;         /* Address to listen on, "0.0.0.0" for all */
+    uint16_t port;              /* Port to listen on */
+    int backlog;                /* Pending connections per acceptor */
+    int numberOfAcceptors;      /* Acceptor threads sharing the port */
+
+    ddfsTcpListenConfig() : bindAddress("0.0.0.0"), port(DDFS_SERVER_PORT),
+                        backlog(SOMAXCONN), numberOfAcceptors(2) {}
+};
+
+/*
+ * @class ddfsTcpAcceptor
+ *
+ * @brief Listening sockets and acceptor threads of the local node.
+ */
+class ddfsTcpAcceptor {
+public:
+    /* Called from an acceptor thread for every accepted socket.
+     * The handler owns the socket. */
+    typedef std::function<void (int socketFD, struct sockaddr_in clientAddr)> acceptHandler;
+
+    ddfsTcpAcceptor() : terminateThreads(false) {}
+    ~ddfsTcpAcceptor() { stop(); }
+
+    /*
+     * @brief Open the listening sockets and start the acceptor threads.
+     *
+     * @return DDFS_OK                     Success
+     * @return DDFS_GENERAL_PARAM_INVALID  Bind address is not valid
+     * @return DDFS_FAILURE                Unable to open/bind/listen
+     */
+    ddfsStatus start(const ddfsTcpListenConfig &config, const ddfsTcpSocketOptions &options,
+                    acceptHandler handler) {
+        struct sockaddr_in serverAddr;
+
+        if(listenSockets.size() != 0)
+            return (ddfsStatus(DDFS_FAILURE));
+
+        memset(&serverAddr, 0, sizeof(serverAddr));
+        serverAddr.sin_family = AF_INET;
+        serverAddr.sin_port = htons(config.port);
+        if(inet_pton(AF_INET, config.bindAddress.c_str(), &serverAddr.sin_addr) != 1) {
+            global_logger_acc << ddfsLogger::LOG_WARNING << "TCP::Acceptor : Invalid bind address "
+                            << config.bindAddress << "\n";
+            return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+        }
+
+        onAccept = handler;
+        terminateThreads.store(false);
+
+        for(int i = 0; i < ((config.numberOfAcceptors > 0) ? config.numberOfAcceptors : 1); i++) {
+            int listenFD = openListenSocket(serverAddr, config.backlog, options);
+            if(listenFD == -1) {
+                stop();
+                return (ddfsStatus(DDFS_FAILURE));
+            }
+            listenSockets.push_back(listenFD);
+        }
+
+        for(unsigned int i = 0; i < listenSockets.size(); i++)
+            acceptorThreads.push_back(std::thread(&ddfsTcpAcceptor::acceptLoop, this, listenSockets[i]));
+
+        global_logger_acc << ddfsLogger::LOG_INFO << "TCP::Acceptor : Listening on " << config.bindAddress
+                        << ":" << config.port << " with " << (int) listenSockets.size() << " acceptors.\n";
+
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    /* Stop the acceptor threads and close the listening sockets */
+    void stop() {
+        terminateThreads.store(true);
+
+        for(unsigned int i = 0; i < acceptorThreads.size(); i++)
+            acceptorThreads[i].join();
+        acceptorThreads.clear();
+
+        for(unsigned int i = 0; i < listenSockets.size(); i++)
+            close(listenSockets[i]);
+        listenSockets.clear();
+    }
+
+private:
+    /* How often the acceptor threads check for termination */
+    static const int s_pollTimeoutMs = 500;
+
+    std::vector<int> listenSockets;
+    std::vector<std::thread> acceptorThreads;
+    std::atomic<bool> terminateThreads;
+    acceptHandler onAccept;
+
+    /* Logger instance */
+    ddfsLogger &global_logger_acc = ddfsLogger::getInstance();
+
+    int openListenSocket(struct sockaddr_in &serverAddr, int backlog, const ddfsTcpSocketOptions &options) {
+        int listenFD, enable = 1;
+
+        if((listenFD = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+            global_logger_acc << ddfsLogger::LOG_WARNING << "TCP::Acceptor : Unable to open socket. "
+                            << strerror(errno) << "\n";
+            return -1;
+        }
+
+        if((setsockopt(listenFD, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) == -1) ||
+           (setsockopt(listenFD, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == -1)) {
+            global_logger_acc << ddfsLogger::LOG_WARNING << "TCP::Acceptor : Unable to set SO_REUSEPORT. "
+                            << strerror(errno) << "\n";
+            close(listenFD);
+            return -1;
+        }
+
+        /* Buffer sizes have to be set before listen for the window scaling to use them */
+        options.apply(listenFD);
+
+        if(::bind(listenFD, (struct sockaddr *) &serverAddr, sizeof(serverAddr)) == -1) {
+            global_logger_acc << ddfsLogger::LOG_WARNING << "TCP::Acceptor : Unable to bind socket. "
+                            << strerror(errno) << "\n";
+            close(listenFD);
+            return -1;
+        }
+
+        if(listen(listenFD, backlog) == -1) {
+            global_logger_acc << ddfsLogger::LOG_WARNING << "TCP::Acceptor : Unable to listen. "
+                            << strerror(errno) << "\n";
+            close(listenFD);
+            return -1;
+        }
+
+        return listenFD;
+    }
+
+    void acceptLoop(int listenFD) {
+        struct pollfd pfd;
+
+        pfd.fd = listenFD;
+        pfd.events = POLLIN;
+
+        while(terminateThreads.load() == false) {
+            int ret = poll(&pfd, 1, s_pollTimeoutMs);
+            if(ret <= 0)
+                continue;
+
+            /* Drain everything that is pending on this socket */
+            while(1) {
+                struct sockaddr_in clientAddr;
+                socklen_t clilen = sizeof(clientAddr);
+
+                int newsockfd = accept4(listenFD, (struct sockaddr *) &clientAddr, &clilen,
+                                        SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if(newsockfd == -1) {
+                    if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                        global_logger_acc << ddfsLogger::LOG_INFO << "TCP::Acceptor : ERROR on accept. "
+                                        << strerror(errno) << "\n";
+                    }
+                    break;
+                }
+
+                onAccept(newsockfd, clientAddr);
+            }
+        }
+    }
+
+    ddfsTcpAcceptor(ddfsTcpAcceptor const&);     // Don't Implement
+    void operator=(ddfsTcpAcceptor const&);      // Don't implement
+};
+
+#endif /* Ending DDFS_TCPACCEPTOR_H */
@@ -26,50 +26,26 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <cstring>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <poll.h>
 
 using namespace std;
 
 #include "ddfs_network.hpp"
-//#include "../cluster/ddfs_clusterMessagesPaxos.h"
+#include "ddfs_tcpAcceptor.hpp"
+#include "ddfs_tcpConnectionRegistry.hpp"
+#include "ddfs_tcpReconnectScheduler.hpp"
+#include "ddfs_bufferPool.hpp"
+#include "ddfs_trafficScheduler.hpp"
+#include "../cluster/ddfs_clusterWire.hpp"
 #include "../logger/ddfs_fileLogger.hpp"
 #include "../global/ddfs_status.hpp"
 
-#define DDFS_SERVER_PORT    53327
 #define MAX_CLUSTER_NODES    4
 #define MAX_TCP_CONNECTIONS    MAX_CLUSTER_NODES
 
-template<typename T>
-class ddfsSubscriptionClass {
-private:
-    std::vector<T*> subscribedInstances;
-public:
-    void addSubscription(T* owner) {
-        subscribedInstances.push_back(owner);
-    }
-
-    void removeAllSubscription() {
-       for(int i=0; i < subscribedInstances.size(); i++){
-                subscribedInstances.erase(subscribedInstances.begin()+i);
-        }
-    }
-
-    int removeSubscription(T *owner) {
-       for(int i=0; i < subscribedInstances.size(); i++){
-           if(subscribedInstances[i] == owner) {
-                subscribedInstances.erase(subscribedInstances.begin()+i);
-                return 0;
-            }
-        }
-        return -1;
-    }
-
-    void callSubscription(void *data, int size) {
-        for(int i=0; i < subscribedInstances.size(); i++){
-            subscribedInstances[i]->callback(data, size);
-        }
-    }
-};
-
 template <typename T_sub>
 class responseQueue {
 public:
@@ -79,6 +55,8 @@ public:
     int correspondingRequestQIndex;
     bool in_use;
 
+    responseQueue() : responseQIndex(-1), correspondingRequestQIndex(-1), in_use(false) {}
+
     /* Subscription is bound to response queues.
      * Each component should create it's req-rsp queue
      * when they want to transfer data with this particular
@@ -99,24 +77,25 @@ public:
     bool in_use;
     int requestQIndex;
     int correspondingResponseQIndex;
-};
 
-enum DDFS_NETWORK_TYPE {
-    DDFS_NETWORK_TCP,
-    DDFS_NETWORK_UDP,
-    DDFS_NETWORK_FC,
-    DDFS_NETWORK_ISCSI
+    requestQueue() : in_use(false), requestQIndex(-1), correspondingResponseQIndex(-1) {}
 };
 
 template <typename T_sub>
-class ddfsTcpConnection : public Network<string, T_sub, DDFS_NETWORK_TYPE>{
-private:
-    static std::mutex openConnectionLock;
-    static vector<pair<int, struct sockaddr_in> > openConnections;
-
+class ddfsTcpConnection : public Network<string, T_sub, DDFS_NETWORK_TYPE>, public ddfsTcpSocketOwner {
 public:
-    ddfsTcpConnection() {}
-    ~ddfsTcpConnection() {}
+    /* localHostName : Node identification of the local node, sent in the hello */
+    ddfsTcpConnection(string localHostName) : localNodeHostName(localHostName),
+                        serverSocketFD(-1), pendingSocketFD(-1), isRegistered(false),
+                        isDialing(false), responseQueueIndex(-1), stopReceiving(false) {}
+
+    ~ddfsTcpConnection() {
+        stopReceiver();
+        if(isRegistered == true)
+            ddfsTcpConnectionRegistry::getInstance().unregisterConnection(localNodeHostName, remoteNodeHostName);
+        if(isDialing == true)
+            ddfsTcpReconnectScheduler::getInstance().cancel(this);
+    }
 
     void printBuffer(void *data, int size, string printMessage) {
         global_logger_tem << ddfsLogger::LOG_INFO << printMessage << ": \n";
@@ -124,6 +103,10 @@ public:
         int i=0;
         uint8_t *printData = (uint8_t *) data;
 
+        /* Headers are all that matter, stream chunks would flood the log */
+        if(size > s_printBufferLimit)
+            size = s_printBufferLimit;
+
         while(i < size) {
             if((size-i) > 16) {
                 for(int j=0; j < 16; j++, i++) {
@@ -143,8 +126,20 @@ public:
         }
     }
 
+    /* Listening address of the local node. Set before openConnection("localhost") */
+    void setListenConfig(const ddfsTcpListenConfig &config) {
+        listenConfig = config;
+    }
+
+    /* Options for the sockets of this connection. Set before openConnection() */
+    void setSocketOptions(const ddfsTcpSocketOptions &options) {
+        socketOptions = options;
+    }
+
     ddfsStatus init() {
-        serverSocketFD = -1;
+        serverSocketFD.store(-1);
+        pendingSocketFD.store(-1);
+        responseQueueIndex.store(-1);
         //clientSocketFD = -1;
 
         isNodeLocal = false;
@@ -156,41 +151,34 @@ public:
     }
 
     bool isConnectionOpen() {
-        vector<pair<int, struct sockaddr_in> >::iterator iter;
-        bool found = false;
-
         if(isNodeLocal == true) {
             global_logger_tem << ddfsLogger::LOG_INFO << "TCP: isConnectionOpen: This should not be called for the local Node.\n";
             return false;
         }
 
-        if(serverSocketFD != -1)
-            return true;
-
-        openConnectionLock.lock();
-        if(serverSocketFD == -1) {
-            for (iter = openConnections.begin(); iter != openConnections.end(); ) {
-                string connHostName(inet_ntoa(iter->second.sin_addr));
-                if(!connHostName.compare(remoteNodeHostName)) {
-                    serverSocketFD = iter->first;
-                    openConnections.erase(iter);
-                    found = true;
-                    global_logger_tem << ddfsLogger::LOG_INFO <<
-                            "Found the connection with " << remoteNodeHostName << ". socket : " << serverSocketFD << "\n";
-                    break;
-                } else
-                    iter++;
-           }
-        }
+        return (serverSocketFD.load() != -1 || pendingSocketFD.load() != -1);
+    }
+
+    /* Called by the registry when the remote node connects to us, or by the
+     * reconnect scheduler when we connected to the remote node. */
+    void adoptSocket(int socketFD) {
+        global_logger_tem << ddfsLogger::LOG_INFO <<
+                "Found the connection with " << remoteNodeHostName << ". socket : " << socketFD << "\n";
+
+        socketOptions.apply(socketFD);
+
+        /* bk_routine owns the sockets, it switches over to this one */
+        int displaced = pendingSocketFD.exchange(socketFD);
+        if(displaced != -1)
+            close(displaced);
 
-        openConnectionLock.unlock();
- 
-       return found;
+        std::lock_guard<std::mutex> guard(socketLock);
+        socketArrived.notify_all();
     }
 
     ddfsStatus openConnection(string nodeUniqueID, bool doNotConnect)
     {
-        struct sockaddr_in serverAddr;
+        ddfsStatus status(DDFS_OK);
 
         /* Copy the node IP to this instance */
         remoteNodeHostName = nodeUniqueID;
@@ -201,75 +189,72 @@ public:
         if(localhost.compare(remoteNodeHostName)) {
             global_logger_tem << ddfsLogger::LOG_INFO << "This tcpConnection Instance is for a remote node.\n";
 
+            uint16_t remotePort;
+            if(ddfsParseNodeAddress(remoteNodeHostName, &remoteNodeAddress, &remotePort) == false) {
+                global_logger_tem << ddfsLogger::LOG_WARNING << "TCP:: Invalid node " << remoteNodeHostName << "\n";
+                return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+            }
+
             if(doNotConnect == false) {
                 global_logger_tem << ddfsLogger::LOG_INFO << "Open a remote connection. \n";
 
                 /* Setting the destination socket addr */
+                memset(&destinationAddr, 0, sizeof(destinationAddr));
                 destinationAddr.sin_family = AF_INET;
 
-                destinationAddr.sin_addr.s_addr = inet_addr(remoteNodeHostName.c_str());
-                destinationAddr.sin_port = htons(DDFS_SERVER_PORT);
+                destinationAddr.sin_addr.s_addr = inet_addr(remoteNodeAddress.c_str());
+                destinationAddr.sin_port = htons(remotePort);
                 destinationAddrSize = sizeof(destinationAddr);
 
-                /*  Open the server socket and wait for the client connections.
-                 * Server connection at each node opens at well defined port DDFS_SERVER_PORT.
-                 */
-                if ((serverSocketFD = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-                    global_logger_tem << ddfsLogger::LOG_WARNING << "Server :: Unable to open socket.\n";
-                    //close(clientSocketFD);
-                    return (ddfsStatus(DDFS_FAILURE));
+                /* Connect in the background, bk_routine picks up the socket */
+                status = ddfsTcpReconnectScheduler::getInstance().schedule(this, localNodeHostName,
+                                                remoteNodeHostName, destinationAddr, socketOptions);
+                if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+                    global_logger_tem << ddfsLogger::LOG_WARNING << "TCP:: Already connecting to "
+                                    << remoteNodeHostName << "\n";
+                    return status;
                 }
-
-                if(connect(serverSocketFD, (struct sockaddr *) &destinationAddr, sizeof(destinationAddr)) == -1) {
-                    global_logger_tem << ddfsLogger::LOG_WARNING << "Server :: Unable to connect to socket."
-                                    << strerror(errno) << "\n";
-                    //close(clientSocketFD);
-                    return (ddfsStatus(DDFS_FAILURE));
+                isDialing = true;
+            } else {
+                /* Wait for the remote node to connect to us */
+                status = ddfsTcpConnectionRegistry::getInstance().registerConnection(localNodeHostName,
+                                                                    remoteNodeHostName, this);
+                if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+                    global_logger_tem << ddfsLogger::LOG_WARNING << "TCP:: Connection to " << remoteNodeHostName
+                                    << " already exists.\n";
+                    return status;
                 }
-
-                global_logger_tem << ddfsLogger::LOG_INFO << "Connected to node :" << remoteNodeHostName << "\n";
+                isRegistered = true;
             }
         } else { /* This tcpConnection Instance is for local port */
             global_logger_tem << ddfsLogger::LOG_INFO << "This tcpConnection Instance is for a local node. "
                         << "Open a server port. \n";
-            global_logger_tem << ddfsLogger::LOG_INFO << "localhost : Setting the local port.\n";
 
             isNodeLocal = true;
 
-            //lengthServerAddr = sizeof(serverAddr);
-            if ((serverSocketFD = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-                global_logger_tem << ddfsLogger::LOG_WARNING << "Server :: Unable to open socket.\n";
-                //close(clientSocketFD);
-                return (ddfsStatus(DDFS_FAILURE));
-            }
-
-            memset(&serverAddr, 0, sizeof(serverAddr));
-            serverAddr.sin_family = AF_INET;
-            serverAddr.sin_addr.s_addr = INADDR_ANY;
-            serverAddr.sin_port = htons(DDFS_SERVER_PORT);
-            bzero(&(serverAddr.sin_zero),8);
+            /* The acceptor threads hand every incoming connection over to
+             * the registry, which passes it on to the remote node instance.
+             */
+            status = acceptor.start(listenConfig, socketOptions, [](int newsockfd, struct sockaddr_in clientAddr) {
+                ddfsTcpConnectionRegistry::getInstance().dispatchSocket(newsockfd, clientAddr);
+            });
 
-            /* Bind socket with the server */
-            if (::bind(serverSocketFD,(struct sockaddr *)&serverAddr, sizeof(struct sockaddr)) == -1)
-            {
-                global_logger_tem << ddfsLogger::LOG_WARNING << "TCP::Server :: Unable to bind socket. "
-                                << strerror(errno) <<"\n";
-                close(serverSocketFD);
-                return (ddfsStatus(DDFS_FAILURE));
+            if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+                global_logger_tem << ddfsLogger::LOG_WARNING << "TCP::Server :: Unable to start the acceptors.\n";
+                return status;
             }
 
-            global_logger_tem << ddfsLogger::LOG_INFO << "Successfully created the server socket " <<
-                            "to handle incoming messages\n";
+            global_logger_tem << ddfsLogger::LOG_INFO << "TCP:: Server port opened.\n";
 
+            return (ddfsStatus(DDFS_OK));
         }
 
         /* Start the thread to handle the incoming traffic from
          * the remote node(remoteNodeHostName) in the cluster.
          */
         global_logger_tem << ddfsLogger::LOG_INFO << "About to create a thread.\n";
+        stopReceiving.store(false);
         bkThreads = std::thread(&ddfsTcpConnection::bk_routine, this);
-        //std::thread t1(ddfsTcpConnection::bk_routine, (void *) this);
-        global_logger_tem << ddfsLogger::LOG_INFO << "TCP:: Server port opened.\n";
 
         return (ddfsStatus(DDFS_OK));
     }
@@ -296,6 +281,7 @@ public:
         if(i == g_max_req_queues) {
             global_logger_tem << ddfsLogger::LOG_WARNING << "TCP(" << remoteNodeHostName << "): Max. number of req/rsp queues reached : " << 
                             g_max_req_queues << ".\n";
+            queuesLock.unlock();
             return ddfsStatus(DDFS_FAILURE);
         }
 
@@ -307,7 +293,13 @@ public:
         requestQueues[i].correspondingResponseQIndex = i;
         queuesLock.unlock();
 
-        responseQueueIndex = i;
+        responseQueueIndex.store(i);
+
+        /* bk_routine waits for the response queue before receiving */
+        {
+            std::lock_guard<std::mutex> guard(socketLock);
+            socketArrived.notify_all();
+        }
 
         global_logger_tem << ddfsLogger::LOG_WARNING << "TCP(" << remoteNodeHostName << "): Response Queue Index is " << responseQueueIndex << "\n";
 
@@ -322,11 +314,11 @@ public:
         return ddfsStatus(DDFS_OK);
     }
 
-    /* Only put data on queue, don't actually send it  */
-    /* privatePtr : This is the pointer to the request queue where
-     *              data needs to be placed.
+    /* Send the data to the remote node, returns once it is on the socket */
+    /* privatePtr : This is the pointer to the request queue set up
+     *              by setupPortal.
      */
-    ddfsStatus sendData(void *data, int size, void *privatePtr)
+    ddfsStatus sendData(void *data, int size, void *privatePtr, ddfsTrafficClass trafficClass)
     {
         int returnValue = 0;
         requestQueue *rQueueInstance = (requestQueue *) privatePtr;
@@ -334,42 +326,36 @@ public:
         global_logger_tem << ddfsLogger::LOG_INFO
                 << "network :: sendData.\n";
 
-        if(rQueueInstance->in_use == false)
+        /* No portal, setupPortal failed or was never called */
+        if(rQueueInstance == NULL || rQueueInstance->in_use == false)
             return ddfsStatus(DDFS_FAILURE);
 
-        if(isConnectionOpen() == false)
+        int socketFD = serverSocketFD.load();
+        if(socketFD == -1)
             return (ddfsStatus(DDFS_FAILURE));
 
-        struct request * entry = new request;
-        //ddfsClusterHeader *clusterH = (ddfsClusterHeader *) data;
-
-        entry->data = data;
-        entry->size = size;
-
-        rQueueInstance->pipe.push(entry);
-
-        while(rQueueInstance->pipe.empty() == false) {
-            rQueueInstance->rLock.lock();
-            entry = rQueueInstance->pipe.front();
-            rQueueInstance->pipe.pop();
-            rQueueInstance->rLock.unlock();
-            
-            printBuffer(entry->data, entry->size, "TCP::Send: Network Packet: ");
-
-            /* Send the data to the other node */
-            returnValue = sendto(serverSocketFD, entry->data,
-                                entry->size, 0,
-                                (struct sockaddr *) &destinationAddr, destinationAddrSize);
-            if(returnValue == -1) {
-                global_logger_tem << ddfsLogger::LOG_INFO << "TCP::Send : Unable to send data."
-                    << strerror(errno) << "\n";
+        printBuffer(data, size, "TCP::Send: Network Packet: ");
+
+        /* Send the data to the other node. Stream chunks and consensus
+         * messages come from different threads, each one is sent whole
+         * in its turn. */
+        {
+            ddfsTrafficTurn turn(sendScheduler, trafficClass, size);
+
+            /* bk_routine may have switched sockets in the meantime, it
+             * closes the old one only once the send is done with it */
+            std::lock_guard<std::mutex> guard(sendLock);
+            socketFD = serverSocketFD.load();
+            if(socketFD == -1)
                 return (ddfsStatus(DDFS_FAILURE));
-            } else {
-                break;
-            }
+            returnValue = sendFull(socketFD, data, size);
         }
 
-        free(entry);
+        if(returnValue == -1) {
+            global_logger_tem << ddfsLogger::LOG_INFO << "TCP::Send : Unable to send data."
+                << strerror(errno) << "\n";
+            return (ddfsStatus(DDFS_FAILURE));
+        }
 
         return (ddfsStatus(DDFS_OK));
     }
@@ -418,19 +404,22 @@ public:
         int i = 0;
 
         if(isNodeLocal == true) {
-            bkThreads.join();
+            acceptor.stop();
             return (ddfsStatus(DDFS_OK));
         } else {
+            /* Stop dialing and accepting for this node */
+            if(isDialing == true)
+                ddfsTcpReconnectScheduler::getInstance().cancel(this);
+            if(isRegistered == true)
+                ddfsTcpConnectionRegistry::getInstance().unregisterConnection(localNodeHostName, remoteNodeHostName);
+            isDialing = false;
+            isRegistered = false;
 
-            /* Notify all the components that have subscription */
-            i=0;
-            while((i<g_max_req_queues)) {
-                if(responseQueues[i].in_use == false)
-                    continue;
+            /* No subscriber is called from bk_routine after this */
+            stopReceiver();
 
-                /* Call all the subscription fn for this resposen queue. */
-                //responseQueues[i]->subscriptions.callSubscription(-1);
-            }
+            /* Notify all the components that have subscription */
+            notifyConnectionState(false);
 
             /* Wait for 10 seconds for the subscribed components to
             * perform internal cleanup.
@@ -442,9 +431,9 @@ public:
              * upper componenets.
              */
             i=0;
-            while((i<ddfsTcpConnection::g_max_rsp_queues)) {
+            for(i = 0; i < ddfsTcpConnection::g_max_rsp_queues; i++) {
                 if(responseQueues[i].in_use == false)
-                continue;
+                    continue;
 
                 /* Remove all the subscription fn for this resposen queue. */
                 responseQueues[i].subscriptions.removeAllSubscription();
@@ -452,8 +441,8 @@ public:
         }
 
         /* Close the connections */
-        close(serverSocketFD);
-        serverSocketFD = -1;
+        closeSocket(serverSocketFD.exchange(-1));
+        closeSocket(pendingSocketFD.exchange(-1));
 
         //close(clientSocketFD);
         //clientSocketFD = -1;
@@ -498,174 +487,254 @@ public:
      */
     void bk_routine()
     {
-        //ddfsTcpConnection *tcpInstance = (ddfsTcpConnection *) arg;
-        struct sockaddr_in clientAddr;
-        int serverAddrLen = sizeof(struct sockaddr_in);
-        std::string localhost("localhost");
         int ret = 0;
 
         global_logger_tem << ddfsLogger::LOG_WARNING << "TCP:: Started the background thread.\n";
 
-        if(!localhost.compare(remoteNodeHostName)) {  /* Thread for local Port */
-            global_logger_tem << ddfsLogger::LOG_INFO << "TCP(" << remoteNodeHostName << "):: Background thread for localNode.\n";
-            while(1) {
-                socklen_t clilen = sizeof(clientAddr);
+        /* Thread for remoteNode. The local node is served by the acceptor. */
+        while(stopReceiving.load() == false) {
+            /* Switch over to the socket handed over last */
+            if(pendingSocketFD.load() != -1 && responseQueueIndex.load() != -1) {
+                closeSocket(serverSocketFD.exchange(pendingSocketFD.exchange(-1)));
 
-                global_logger_tem << ddfsLogger::LOG_INFO << "TCP(" << remoteNodeHostName << "):: BT : Listening for a connection.\n";
-                ret = listen(serverSocketFD,5);
-                if (ret == -1) {
-                    global_logger_tem << ddfsLogger::LOG_INFO << "ERROR on listen. error " << strerror(errno) << "\n";
-                    continue;
-                }
+                global_logger_tem << ddfsLogger::LOG_INFO << "TCP(" << remoteNodeHostName << "):: BT : Connection established with " << remoteNodeHostName << "\n";
+                notifyConnectionState(true);
+            }
+
+            /* Nothing to receive on, sleep till the registry or the
+             * reconnect scheduler hands over a socket. */
+            if(serverSocketFD.load() == -1) {
+                global_logger_tem << ddfsLogger::LOG_WARNING << " TCP(" << remoteNodeHostName << "):: BT : Waiting for a connection with "
+                                << remoteNodeHostName << ".\n";
+                std::unique_lock<std::mutex> guard(socketLock);
+                socketArrived.wait(guard, [this] {
+                            return (pendingSocketFD.load() != -1 && responseQueueIndex.load() != -1) ||
+                                        stopReceiving.load(); });
+                continue;
+            }
+
+            /* Accepted sockets are non blocking, wait for the next message */
+            if(waitForSocket(serverSocketFD, POLLIN, s_receivePollTimeoutMs) == false)
+                continue;
+
+            /* The first bytes tell the wire version and with it the header size */
+            ret = receiveFull(serverSocketFD, tempBuffer, DDFS_WIRE_PREFIX_SIZE);
+            if(ret <= 0 && stopReceiving.load())
+                break;
+            if(ret <= 0) {
+                global_logger_tem << ddfsLogger::LOG_WARNING << "TCP(" << remoteNodeHostName << "):: BT : Connection closed by pair. "
+                            << strerror(errno) <<"\n";
+                connectionLost();
+                continue;
+            }
+
+            int headerSize = ddfsClusterWire::headerSize(tempBuffer[0]);
+            if(headerSize == 0) {
+                global_logger_tem << ddfsLogger::LOG_WARNING << "TCP(" << remoteNodeHostName << "):: BT : Unknown wire version "
+                            << (int) tempBuffer[0] << ". Dropping the connection.\n";
+                connectionLost();
+                continue;
+            }
 
-                int newsockfd = accept(serverSocketFD, (struct sockaddr *) &clientAddr, &clilen);
-                if (newsockfd < 0) { 
-                    global_logger_tem << ddfsLogger::LOG_INFO << "ERROR on accept. error " << strerror(errno) << "\n";
+            if(headerSize > DDFS_WIRE_PREFIX_SIZE) {
+                ret = receiveFull(serverSocketFD, tempBuffer + DDFS_WIRE_PREFIX_SIZE,
+                                headerSize - DDFS_WIRE_PREFIX_SIZE);
+                if(ret <= 0) {
+                    global_logger_tem << ddfsLogger::LOG_WARNING << "TCP(" << remoteNodeHostName << "):: BT : Connection lost in the middle of a header. "
+                                << strerror(errno) <<"\n";
+                    connectionLost();
                     continue;
                 }
+            }
 
-                global_logger_tem << ddfsLogger::LOG_INFO << "Accepted a new connection from "
-                               << inet_ntoa(clientAddr.sin_addr) << " and port " << clientAddr.sin_port << " socket : " << newsockfd << "\n";
+            printBuffer(tempBuffer, headerSize, "TCP:: BT: Recieved Network Packet: ");
 
-                /* This newsockfd should be passed to the appropriate ddfsTcpConnection object.
-                 * Parse the clientAddr and then decide on which ddfsTcpConnection to pass this socket to.
-                 */
+            /* totalLengthOfTheMessage -- Total Length of the message including the header  */
+            uint64_t frameLength = ddfsClusterWire::frameLength(tempBuffer);
 
-                openConnectionLock.lock();
-                openConnections.push_back(make_pair(newsockfd, clientAddr));
-                openConnectionLock.unlock();
+            global_logger_tem << ddfsLogger::LOG_INFO << "TCP(" << remoteNodeHostName << "):: BT: v: " << (int) tempBuffer[0]
+                            << ". tl:" << frameLength << "\n";
 
+            if(frameLength < (uint64_t) headerSize || frameLength > s_maxMessageSize) {
+                global_logger_tem << ddfsLogger::LOG_WARNING << "TCP(" << remoteNodeHostName << "):: BT : Invalid message length "
+                            << frameLength << ". Dropping the connection.\n";
+                connectionLost();
                 continue;
             }
-        } else { /* Thread for remoteNode. */
-            bool connectionEstablishedRightNow = false;
-            while(1) {
-                if(isConnectionOpen() == false) {
-                    global_logger_tem << ddfsLogger::LOG_WARNING << " TCP(" << remoteNodeHostName << "):: BT : Not connected to " << remoteNodeHostName
-                                    << ". Sleeping for 2 second.\n";
-                    sleep(2);
-                    connectionEstablishedRightNow = false;
+            int totalLengthOfTheMessage = (int) frameLength;
+
+            /* Subscribers read the message in place, the buffer goes back to the
+             * pool once they are done with it */
+            ddfsPooledBuffer messageBuffer(totalLengthOfTheMessage);
+            uint8_t *totalMessage = messageBuffer.getData();
+            memcpy(totalMessage, tempBuffer, headerSize);
+
+            /* Read the rest of the message behind the header */
+            if(totalLengthOfTheMessage > headerSize) {
+                ret = receiveFull(serverSocketFD, totalMessage + headerSize,
+                                totalLengthOfTheMessage - headerSize);
+
+                if(ret <= 0) {
+                    global_logger_tem << ddfsLogger::LOG_WARNING << "TCP(" << remoteNodeHostName << "):: BT : Connection lost in the middle of a message. "
+                            << strerror(errno) <<"\n";
+                    connectionLost();
                     continue;
                 }
+            }
 
-                if(connectionEstablishedRightNow == false) {
-                    global_logger_tem << ddfsLogger::LOG_INFO << "TCP(" << remoteNodeHostName << "):: BT : Connection established with " << remoteNodeHostName << "\n";
-                    connectionEstablishedRightNow = true;
-                }
-                global_logger_tem << ddfsLogger::LOG_INFO << "TCP(" << remoteNodeHostName << "):: BT: Temp Buffer before recieve data.\n";
-                
-                for (int i = 0; i < 6; i++) {
-                        global_logger_tem << ddfsLogger::LOG_INFO << "    " << tempBuffer[i] << "\n";
-                }
+            printBuffer(totalMessage, totalLengthOfTheMessage, "TCP:: Complete DDFS Message: ");
 
-                /* Just PEEK, peeking with keep the data as unread and the subsequent recvfrom will read the same data */
-                ret = recvfrom(serverSocketFD, (void *) tempBuffer,
-                                sizeof(ddfsClusterHeader), MSG_PEEK,
-                                (struct sockaddr *) &clientAddr, (socklen_t *)&serverAddrLen);
+            socketOptions.rearmQuickAck(serverSocketFD);
 
-                if(ret == -1) {
-                    global_logger_tem << ddfsLogger::LOG_WARNING << "TCP(" << remoteNodeHostName << "):: BT : Fail to get IP address from Host Name. "
-                                << strerror(errno) <<"\n";
-                    continue;
-                } else if(ret == 0) {
-                    global_logger_tem << ddfsLogger::LOG_WARNING << "TCP(" << remoteNodeHostName << "):: BT : Connection closed by pair. "
-                                << strerror(errno) <<"\n";
-                    sleep(2);
-                    serverSocketFD = -1;
-                    continue;
-                }
-                global_logger_tem << ddfsLogger::LOG_INFO << "TCP:: BT : " << remoteNodeHostName << ": Recieved data of size " << ret << "\n";
-#if 0 
-                global_logger_tem << ddfsLogger::LOG_INFO << "TCP:: BT : " << remoteNodeHostName << ": Temp Buffer : ";
-                for (int i = 0; i < ret; i++) {
-                        global_logger_tem << ddfsLogger::LOG_INFO << "i = " << i << "       ** ";
-                        global_logger_tem << ddfsLogger::LOG_INFO << "    " << tempBuffer[i] << "\n";
-                }
-#endif
-                printBuffer(tempBuffer, ret, "TCP:: BT: Recieved Network Packet: ");
+            global_logger_tem << ddfsLogger::LOG_INFO << "TCP(" << remoteNodeHostName << "):: BT : Calling subscribers of Response Queue no. " << responseQueueIndex << "\n";
 
-                if(ret < sizeof(ddfsClusterHeader)) {
-                    global_logger_tem << ddfsLogger::LOG_WARNING << "TCP(" << remoteNodeHostName << "):: BT : Data recieved is less that clusterheader from Host Name.\n";
-                    continue;
-                }
+            responseQueues[responseQueueIndex].rLock.lock();
+            responseQueues[responseQueueIndex].subscriptions.callSubscription(totalMessage, totalLengthOfTheMessage);
+            responseQueues[responseQueueIndex].rLock.unlock();
 
-                //requestQEntry *newRequest = (requestQEntry *) tempBuffer;
-                //ddfsClusterHeader *clusterH = (ddfsClusterHeader *) newRequest->data;
-                ddfsClusterHeader *clusterH = (ddfsClusterHeader *) tempBuffer;
-
-                global_logger_tem << ddfsLogger::LOG_INFO << "TCP(" << remoteNodeHostName << "):: BT: v: " << clusterH->version << ". tOS: " << clusterH->typeOfService << "\n";
-                global_logger_tem << ddfsLogger::LOG_INFO << "TCP(" << remoteNodeHostName << "):: BT: tl:" << clusterH->totalLength << ".ID: " << clusterH->uniqueID << "\n";
-                global_logger_tem << ddfsLogger::LOG_INFO << "TCP(" << remoteNodeHostName << "):: BT: sizeof(ddfsClusterHeader) : " << sizeof(ddfsClusterHeader) << "\n";
-
-                /* We alloc it here and it would be deallocated by whoever is the consumer of
-                 * this response entry */
-                /* totalLengthOfTheMessage -- Total Length of the message including the header  */
-                int totalLengthOfTheMessage = clusterH->totalLength;
-                void *totalMessage = malloc(totalLengthOfTheMessage);
-                memcpy(totalMessage, tempBuffer, sizeof(ddfsClusterHeader));
-
-                /* Parse the ddfsHeader and know how much data is expected with
-                 * this ddfs Message. Alloc memory and 
-                 *
-                 * Place the ddfsHeader as well as the data on the response queue.
-                 */
-                if((totalLengthOfTheMessage - sizeof(ddfsClusterHeader)) > 0) {
-                    ret = recvfrom(serverSocketFD, totalMessage,
-                                    totalLengthOfTheMessage, 0,
-                                    (struct sockaddr *) &clientAddr, (socklen_t *)&serverAddrLen);
-
-                    if(ret == -1) {
-                        global_logger_tem << ddfsLogger::LOG_WARNING << "TCP(" << remoteNodeHostName << "):: BT : Fail to get IP address from Host Name. "
-                                << strerror(errno) <<"\n";
-                        continue;
-                    }
-                }
-#if 0
-            /* Find for which instance of tcp connection this data is for */
-            typename vector <ddfsTcpConnection <T_sub> *>::iterator iter;
-            ddfsTcpConnection<T_sub> *rightTCPConnection = NULL;
+        } /* while loop end */
 
-            for (iter = allNetworkConnections.begin(); iter != allNetworkConnections.end(); iter++) {
+        global_logger_tem << ddfsLogger::LOG_WARNING << "TCP(" << remoteNodeHostName << "):: BT : Exiting the receiver thread.\n";
+    }  /* End of bk_routine() */
+
+    //vector<ddfsTcpConnection<T_sub> *> allNetworkConnections;
+
+private:
+    /* How long bk_routine waits for a message before checking the connection again */
+    static const int s_receivePollTimeoutMs = 1000;
+    /* Messages longer than this are treated as a broken stream */
+    static const int s_maxMessageSize = 1 << 20;
+    /* Bytes of a message printBuffer() logs */
+    static const int s_printBufferLimit = 64;
+
+    /* Wait till the socket is ready for events. false on timeout or error. */
+    bool waitForSocket(int socketFD, short events, int timeoutMs) {
+        struct pollfd pfd;
+
+        pfd.fd = socketFD;
+        pfd.events = events;
+        pfd.revents = 0;
+
+        return (poll(&pfd, 1, timeoutMs) > 0);
+    }
 
-                if(!strncpy(inet_ntoa(serverAddr.sin_addr), (*iter)->remoteNodeHostName.c_str(), sizeof(serverAddr.sin_addr.s_addr)))
-                    rightTCPConnection = (*iter);
+    /*
+     * Read exactly size bytes, socket may be non blocking.
+     *
+     * @return size  Success
+     * @return 0     Connection closed by the pair
+     * @return -1    Error
+     */
+    int receiveFull(int socketFD, void *data, int size) {
+        int received = 0;
+
+        while(received < size) {
+            ssize_t ret = recv(socketFD, (uint8_t *) data + received, size - received, 0);
+            if(ret > 0) {
+                received += ret;
+            } else if(ret == 0) {
+                return 0;
+            } else if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                /* A pair stalled in the middle of a message must not keep
+                 * closeConnection waiting */
+                if(stopReceiving.load())
+                    return -1;
+                waitForSocket(socketFD, POLLIN, s_receivePollTimeoutMs);
+            } else if(errno != EINTR) {
+                return -1;
             }
-#endif
+        }
 
-                printBuffer(totalMessage, clusterH->totalLength, "TCP:: Complete DDFS Message: ");
+        return received;
+    }
 
-                responseQEntry newEntry;
+    /* Write exactly size bytes, socket may be non blocking. -1 on error. */
+    int sendFull(int socketFD, void *data, int size) {
+        int sent = 0;
+
+        while(sent < size) {
+            ssize_t ret = send(socketFD, (uint8_t *) data + sent, size - sent, MSG_NOSIGNAL);
+            if(ret >= 0) {
+                sent += ret;
+            } else if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                waitForSocket(socketFD, POLLOUT, s_receivePollTimeoutMs);
+            } else if(errno != EINTR) {
+                return -1;
+            }
+        }
 
-                newEntry.typeOfService = clusterH->typeOfService;
-                newEntry.totalLength = clusterH->totalLength;
-                newEntry.data = totalMessage;
+        return sent;
+    }
 
-                global_logger_tem << ddfsLogger::LOG_INFO << "TCP(" << remoteNodeHostName << "):: BT : Placing data on Response Queue no. " << responseQueueIndex << "\n";
-                global_logger_tem << ddfsLogger::LOG_INFO << "TCP(" << remoteNodeHostName << "):: BT : in use = " << responseQueues[responseQueueIndex].in_use << "\n";
+    /* The socket went away. Subscribers are told and, if this node is
+     * the one dialing, the reconnect scheduler tries again. */
+    void connectionLost() {
+        closeSocket(serverSocketFD.exchange(-1));
 
-                responseQueues[responseQueueIndex].rLock.lock();
-                responseQueues[responseQueueIndex].dataBuffer.push(newEntry);
-                global_logger_tem << ddfsLogger::LOG_INFO << "TCP(" << remoteNodeHostName << "):: BT : Placed the data. Calling subscribers.\n";
-                responseQueues[responseQueueIndex].subscriptions.callSubscription(newEntry.data, newEntry.totalLength);
-                responseQueues[responseQueueIndex].rLock.unlock();
+        notifyConnectionState(false);
 
-            } /* while loop end */
-        } /* else loop end */
+        if(isDialing == true)
+            ddfsTcpReconnectScheduler::getInstance().reconnect(this);
+    }
 
-        global_logger_tem << ddfsLogger::LOG_WARNING << "TCP(" << remoteNodeHostName << "):: BT : Exiting the receiver thread.\n";
+    /* Close a socket that is no longer serverSocketFD. A send still on it
+     * fails right away and closing waits for it, so its number is not
+     * reused under the sender. */
+    void closeSocket(int socketFD) {
+        if(socketFD == -1)
+            return;
 
-        pthread_exit(NULL);
-    }  /* End of bk_routine() */
+        shutdown(socketFD, SHUT_RDWR);
+        std::lock_guard<std::mutex> guard(sendLock);
+        close(socketFD);
+    }
 
-    //vector<ddfsTcpConnection<T_sub> *> allNetworkConnections;
+    /* Stop bk_routine and wait for it. It notices within s_receivePollTimeoutMs. */
+    void stopReceiver() {
+        {
+            std::lock_guard<std::mutex> guard(socketLock);
+            stopReceiving.store(true);
+            socketArrived.notify_all();
+        }
 
-private:
-    int serverSocketFD;
-    //int clientSocketFD;
+        if(bkThreads.joinable())
+            bkThreads.join();
+    }
+
+    void notifyConnectionState(bool connected) {
+        int index = responseQueueIndex.load();
+        if(index == -1)
+            return;
+
+        responseQueues[index].rLock.lock();
+        responseQueues[index].subscriptions.callConnectionState(connected);
+        responseQueues[index].rLock.unlock();
+    }
+
+    /* Node identification of the local node */
+    string localNodeHostName;
+    /* Socket to the remote node, only replaced by bk_routine */
+    std::atomic<int> serverSocketFD;
+    /* One message at a time on the socket, consensus first */
+    ddfsTrafficScheduler sendScheduler;
+    /* Held while sending, a socket is closed only under it */
+    std::mutex sendLock;
+    /* Socket handed over by the registry, waiting for bk_routine to pick it up */
+    std::atomic<int> pendingSocketFD;
+    std::mutex socketLock;
+    std::condition_variable socketArrived;
+    /* Registered with ddfsTcpConnectionRegistry */
+    bool isRegistered;
+    /* Connected through ddfsTcpReconnectScheduler */
+    bool isDialing;
     string remoteNodeHostName;
+    /* Address part of remoteNodeHostName */
+    string remoteNodeAddress;
     sockaddr_in destinationAddr;
     uint32_t destinationAddrSize;
-    int responseQueueIndex;
+    std::atomic<int> responseQueueIndex;
+    /* Set by closeConnection, bk_routine returns */
+    std::atomic<bool> stopReceiving;
 
     /* Request/Response Queues */
     std::mutex queuesLock;
@@ -686,7 +755,10 @@ private:
     /* Vector thread list */
     std::thread bkThreads;
 
-    std::vector<bool> terminateThreads;
+    /* Listening sockets of the local node */
+    ddfsTcpListenConfig listenConfig;
+    ddfsTcpSocketOptions socketOptions;
+    ddfsTcpAcceptor acceptor;
 
     /* Logger instance */
     ddfsLogger &global_logger_tem = ddfsLogger::getInstance();
@@ -700,10 +772,4 @@ private:
     uint8_t tempBuffer[g_temp_buffer_size];
 };
 
-template <typename T_sub>
-std::mutex ddfsTcpConnection<T_sub>::openConnectionLock; 
-
-template <typename T_sub>
-vector<pair<int, struct sockaddr_in> > ddfsTcpConnection<T_sub>::openConnections;
-
 #endif /* Ending DDFS_TCPCONNECTION_H */
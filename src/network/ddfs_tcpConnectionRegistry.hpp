@@ -0,0 +1,380 @@
+/*
+ * @file ddfs_tcpConnectionRegistry.hpp
+ *
+ * @brief Hands accepted sockets over to the connection they belong to.
+ *
+ * The node that connects sends a hello first, naming itself and the node
+ * it wants to reach. The acceptor threads only accept, one poller thread
+ * reads the hellos of all accepted sockets without blocking and looks up
+ * the ddfsTcpConnection registered for that pair of nodes. If the
+ * connection is not registered yet, the socket is parked until it is,
+ * for s_parkTimeoutMs at most and s_maxParkedSockets sockets at most:
+ * the names in a hello are not checked against anything.
+ *
+ * Peers are identified by their node identification, not by the source
+ * address of the socket, so several nodes can run behind one address.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#ifndef DDFS_TCPCONNECTIONREGISTRY_H
+#define DDFS_TCPCONNECTIONREGISTRY_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <unordered_map>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+using namespace std;
+
+#include "../logger/ddfs_fileLogger.hpp"
+#include "../global/ddfs_status.hpp"
+
+#define DDFS_TCP_HELLO_MAGIC    0x53464444      /* "DDFS" */
+#define DDFS_TCP_HELLO_VERSION  1
+#define DDFS_MAX_NODE_NAME      63
+
+/*
+ * First bytes on every cluster connection, sent by the connecting node.
+ */
+struct ddfsTcpHello {
+    uint32_t magic;
+    uint32_t version;
+    char sender[DDFS_MAX_NODE_NAME + 1];      /* Node that connects */
+    char receiver[DDFS_MAX_NODE_NAME + 1];    /* Node that accepts */
+} __attribute__((packed));
+
+/*
+ * Implemented by the connection that owns the sockets between a pair of nodes.
+ */
+class ddfsTcpSocketOwner {
+public:
+    virtual ~ddfsTcpSocketOwner() {}
+
+    /* A socket from the remote node arrived. Called with the registry lock held. */
+    virtual void adoptSocket(int socketFD) = 0;
+};
+
+/*
+ * @class ddfsTcpConnectionRegistry
+ *
+ * @brief Connections of all the local nodes in this process.
+ *
+ * A singleton class. Only the hello poller and the connection setup
+ * take the registry lock, sending and receiving never do.
+ */
+class ddfsTcpConnectionRegistry {
+public:
+    static ddfsTcpConnectionRegistry& getInstance() {
+        static ddfsTcpConnectionRegistry instance;
+        return instance;
+    }
+
+    /*
+     * @brief Register the connection of localNode with remoteNode.
+     *
+     * A socket that is already parked for the pair is handed over right away.
+     */
+    ddfsStatus registerConnection(string localNode, string remoteNode, ddfsTcpSocketOwner *owner) {
+        string key = makeKey(localNode, remoteNode);
+        std::lock_guard<std::mutex> guard(registryLock);
+
+        if(owners.find(key) != owners.end())
+            return (ddfsStatus(DDFS_FAILURE));
+
+        owners[key] = owner;
+
+        unordered_map<string, parkedSocket>::iterator parked = parkedSockets.find(key);
+        if(parked != parkedSockets.end()) {
+            global_logger_reg << ddfsLogger::LOG_INFO << "TCP::Registry : Handing the parked socket "
+                            << parked->second.socketFD << " to " << localNode << " -> " << remoteNode << "\n";
+            owner->adoptSocket(parked->second.socketFD);
+            parkedSockets.erase(parked);
+        }
+
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    void unregisterConnection(string localNode, string remoteNode) {
+        std::lock_guard<std::mutex> guard(registryLock);
+        owners.erase(makeKey(localNode, remoteNode));
+    }
+
+    /*
+     * @brief Pass an accepted socket to the hello poller.
+     *
+     * Returns right away, so the acceptor threads only accept. The
+     * registry owns the socket from here on. It is closed if no valid
+     * hello arrives within s_helloTimeoutMs of the accept.
+     */
+    ddfsStatus dispatchSocket(int socketFD, struct sockaddr_in clientAddr) {
+        std::lock_guard<std::mutex> guard(helloLock);
+        helloEntry &entry = hellos[socketFD];
+
+        entry.clientAddr = clientAddr;
+        entry.received = 0;
+        entry.deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds((int) s_helloTimeoutMs);
+        startThread();
+        wakeUp();
+
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    /* Send the hello on a freshly connected socket */
+    static ddfsStatus sendHello(int socketFD, string localNode, string remoteNode) {
+        ddfsTcpHello hello;
+
+        if(localNode.size() > DDFS_MAX_NODE_NAME || remoteNode.size() > DDFS_MAX_NODE_NAME)
+            return (ddfsStatus(DDFS_GENERAL_PARAM_INVALID));
+
+        memset(&hello, 0, sizeof(hello));
+        hello.magic = DDFS_TCP_HELLO_MAGIC;
+        hello.version = DDFS_TCP_HELLO_VERSION;
+        strncpy(hello.sender, localNode.c_str(), DDFS_MAX_NODE_NAME);
+        strncpy(hello.receiver, remoteNode.c_str(), DDFS_MAX_NODE_NAME);
+
+        if(send(socketFD, &hello, sizeof(hello), MSG_NOSIGNAL) != (ssize_t) sizeof(hello))
+            return (ddfsStatus(DDFS_FAILURE));
+
+        return (ddfsStatus(DDFS_OK));
+    }
+
+private:
+    /* How long a connecting node has, from the accept, to send its hello */
+    static const int s_helloTimeoutMs = 2000;
+    /* How long a socket waits for its connection to be registered */
+    static const int s_parkTimeoutMs = 10000;
+    static const unsigned int s_maxParkedSockets = 256;
+
+    /* Accepted socket whose hello is still coming in */
+    struct helloEntry {
+        struct sockaddr_in clientAddr;
+        ddfsTcpHello hello;
+        unsigned int received;      /* Bytes of hello so far */
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    /* Socket with a valid hello, for a connection not registered yet */
+    struct parkedSocket {
+        int socketFD;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    std::mutex registryLock;
+    unordered_map<string, ddfsTcpSocketOwner *> owners;
+    unordered_map<string, parkedSocket> parkedSockets;
+
+    /* Taken by the acceptor threads only long enough to add a socket */
+    std::mutex helloLock;
+    unordered_map<int, helloEntry> hellos;
+    bool pollerStarted;
+    int wakeUpFD;
+
+    /* Logger instance */
+    ddfsLogger &global_logger_reg = ddfsLogger::getInstance();
+
+    ddfsTcpConnectionRegistry() : pollerStarted(false), wakeUpFD(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+    static string makeKey(string localNode, string remoteNode) {
+        return localNode + "|" + remoteNode;
+    }
+
+    /* With helloLock held. The thread lives as long as the process, like
+     * the other singletons */
+    void startThread() {
+        if(pollerStarted == false) {
+            std::thread(&ddfsTcpConnectionRegistry::run, this).detach();
+            pollerStarted = true;
+        }
+    }
+
+    void wakeUp() {
+        uint64_t one = 1;
+
+        if(write(wakeUpFD, &one, sizeof(one)) == -1) {
+            /* Counter is already non zero, the thread wakes up anyway */
+        }
+    }
+
+    void rejectHello(int socketFD, const helloEntry &entry, const char *reason) {
+        char clientHostName[INET_ADDRSTRLEN];
+
+        inet_ntop(AF_INET, &entry.clientAddr.sin_addr, clientHostName, sizeof(clientHostName));
+        global_logger_reg << ddfsLogger::LOG_WARNING << "TCP::Registry : " << reason << " "
+                        << clientHostName << ":" << ntohs(entry.clientAddr.sin_port) << ". Closing socket.\n";
+        close(socketFD);
+    }
+
+    /*
+     * Read what there is of the hello on socketFD. Returns true once the
+     * socket is done with, handed over or closed.
+     */
+    bool receiveHello(int socketFD, helloEntry &entry) {
+        uint8_t *data = (uint8_t *) &entry.hello;
+
+        while(entry.received < sizeof(ddfsTcpHello)) {
+            ssize_t ret = recv(socketFD, data + entry.received, sizeof(ddfsTcpHello) - entry.received, 0);
+            if(ret == 0) {
+                rejectHello(socketFD, entry, "Connection closed before the hello from");
+                return true;
+            }
+            if(ret == -1) {
+                if(errno == EINTR)
+                    continue;
+                if(errno == EAGAIN || errno == EWOULDBLOCK)
+                    return false;
+                rejectHello(socketFD, entry, "Unable to read the hello from");
+                return true;
+            }
+            entry.received += ret;
+        }
+
+        if(entry.hello.magic != DDFS_TCP_HELLO_MAGIC || entry.hello.version != DDFS_TCP_HELLO_VERSION) {
+            rejectHello(socketFD, entry, "No valid hello from");
+            return true;
+        }
+
+        entry.hello.sender[DDFS_MAX_NODE_NAME] = '\0';
+        entry.hello.receiver[DDFS_MAX_NODE_NAME] = '\0';
+
+        handOver(socketFD, entry.hello);
+        return true;
+    }
+
+    /* Give the socket to its connection, or park it until there is one */
+    void handOver(int socketFD, const ddfsTcpHello &hello) {
+        string key = makeKey(hello.receiver, hello.sender);
+        std::lock_guard<std::mutex> guard(registryLock);
+
+        unordered_map<string, ddfsTcpSocketOwner *>::iterator owner = owners.find(key);
+        if(owner != owners.end()) {
+            global_logger_reg << ddfsLogger::LOG_INFO << "TCP::Registry : Connection from " << hello.sender
+                            << " to " << hello.receiver << ". socket : " << socketFD << "\n";
+            owner->second->adoptSocket(socketFD);
+            return;
+        }
+
+        /* Only the latest socket from a peer is kept */
+        unordered_map<string, parkedSocket>::iterator parked = parkedSockets.find(key);
+        if(parked != parkedSockets.end()) {
+            close(parked->second.socketFD);
+        } else if(parkedSockets.size() >= s_maxParkedSockets) {
+            global_logger_reg << ddfsLogger::LOG_WARNING << "TCP::Registry : " << s_maxParkedSockets
+                            << " sockets parked already, closing the one from " << hello.sender
+                            << " to " << hello.receiver << "\n";
+            close(socketFD);
+            return;
+        }
+
+        parkedSocket &park = parkedSockets[key];
+        park.socketFD = socketFD;
+        park.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds((int) s_parkTimeoutMs);
+        global_logger_reg << ddfsLogger::LOG_INFO << "TCP::Registry : Parked the connection from " << hello.sender
+                        << " to " << hello.receiver << ". socket : " << socketFD << "\n";
+    }
+
+    /* Hello poller, one for all the acceptors of the process */
+    void run() {
+        vector<struct pollfd> pollFDs;
+
+        while(1) {
+            int timeoutMs = -1;
+
+            pollFDs.clear();
+            pollfd wakeUpPoll;
+            wakeUpPoll.fd = wakeUpFD;
+            wakeUpPoll.events = POLLIN;
+            pollFDs.push_back(wakeUpPoll);
+
+            helloLock.lock();
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            for(unordered_map<int, helloEntry>::iterator iter = hellos.begin(); iter != hellos.end();) {
+                if(iter->second.deadline <= now) {
+                    rejectHello(iter->first, iter->second, "No hello in time from");
+                    iter = hellos.erase(iter);
+                    continue;
+                }
+
+                pollfd helloPoll;
+                helloPoll.fd = iter->first;
+                helloPoll.events = POLLIN;
+                pollFDs.push_back(helloPoll);
+
+                int wait = std::chrono::duration_cast<std::chrono::milliseconds>(iter->second.deadline - now).count() + 1;
+                if(timeoutMs == -1 || wait < timeoutMs)
+                    timeoutMs = wait;
+                iter++;
+            }
+            helloLock.unlock();
+
+            /* Parked sockets whose connection never came */
+            registryLock.lock();
+            for(unordered_map<string, parkedSocket>::iterator iter = parkedSockets.begin();
+                            iter != parkedSockets.end();) {
+                if(iter->second.deadline <= now) {
+                    global_logger_reg << ddfsLogger::LOG_WARNING << "TCP::Registry : No connection "
+                                    << iter->first << " registered in time. Closing socket "
+                                    << iter->second.socketFD << "\n";
+                    close(iter->second.socketFD);
+                    iter = parkedSockets.erase(iter);
+                    continue;
+                }
+
+                int wait = std::chrono::duration_cast<std::chrono::milliseconds>(iter->second.deadline - now).count() + 1;
+                if(timeoutMs == -1 || wait < timeoutMs)
+                    timeoutMs = wait;
+                iter++;
+            }
+            registryLock.unlock();
+
+            if(poll(&pollFDs[0], pollFDs.size(), timeoutMs) <= 0)
+                continue;
+
+            if(pollFDs[0].revents) {
+                uint64_t count;
+                if(read(wakeUpFD, &count, sizeof(count)) == -1) {
+                    /* Nothing to drain */
+                }
+            }
+
+            for(unsigned int i = 1; i < pollFDs.size(); i++) {
+                if(pollFDs[i].revents == 0)
+                    continue;
+
+                /* Handing over takes the registry lock, not with helloLock held */
+                helloEntry entry;
+                {
+                    std::lock_guard<std::mutex> guard(helloLock);
+                    unordered_map<int, helloEntry>::iterator hello = hellos.find(pollFDs[i].fd);
+                    if(hello == hellos.end())
+                        continue;
+                    entry = hello->second;
+                    hellos.erase(hello);
+                }
+
+                if(receiveHello(pollFDs[i].fd, entry) == false) {
+                    std::lock_guard<std::mutex> guard(helloLock);
+                    hellos[pollFDs[i].fd] = entry;
+                }
+            }
+        }
+    }
+
+    ddfsTcpConnectionRegistry(ddfsTcpConnectionRegistry const&);     // Don't Implement
+    void operator=(ddfsTcpConnectionRegistry const&);                // Don't implement
+};
+
+#endif /* Ending DDFS_TCPCONNECTIONREGISTRY_H */
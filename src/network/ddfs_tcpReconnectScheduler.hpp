@@ -0,0 +1,310 @@
+/*
+ * @file ddfs_tcpReconnectScheduler.hpp
+ *
+ * @brief Connects to the remote nodes in the background.
+ *
+ * One thread drives a non blocking connect for every remote node this
+ * process has to dial. A node that can not be reached is retried with
+ * exponential backoff and jitter, so an unreachable node costs neither
+ * the caller of openConnection nor the other nodes anything.
+ *
+ * Once connected, the hello is sent and the socket is handed to the
+ * owning connection through ddfsTcpSocketOwner::adoptSocket(), the same
+ * way the registry hands over accepted sockets. When the connection is
+ * lost later, the owner asks for a reconnect.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#ifndef DDFS_TCPRECONNECTSCHEDULER_H
+#define DDFS_TCPRECONNECTSCHEDULER_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <unordered_map>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+using namespace std;
+
+#include "../logger/ddfs_fileLogger.hpp"
+#include "../global/ddfs_status.hpp"
+#include "ddfs_tcpSocketOptions.hpp"
+#include "ddfs_tcpConnectionRegistry.hpp"
+
+/*
+ * @class ddfsTcpReconnectScheduler
+ *
+ * @brief Background connects with per node backoff.
+ *
+ * A singleton class. The owner callbacks are made with the scheduler
+ * lock held, so an owner is never called after cancel() returns.
+ */
+class ddfsTcpReconnectScheduler {
+public:
+    static ddfsTcpReconnectScheduler& getInstance() {
+        static ddfsTcpReconnectScheduler instance;
+        return instance;
+    }
+
+    /*
+     * @brief Start connecting owner to remoteNode at remoteAddr.
+     *
+     * The first attempt is made right away.
+     */
+    ddfsStatus schedule(ddfsTcpSocketOwner *owner, string localNode, string remoteNode,
+                        const struct sockaddr_in &remoteAddr, const ddfsTcpSocketOptions &options) {
+        std::lock_guard<std::mutex> guard(schedulerLock);
+
+        if(peers.find(owner) != peers.end())
+            return (ddfsStatus(DDFS_FAILURE));
+
+        peerEntry &peer = peers[owner];
+        peer.localNode = localNode;
+        peer.remoteNode = remoteNode;
+        peer.remoteAddr = remoteAddr;
+        peer.options = options;
+        peer.attempt = 0;
+        peer.socketFD = -1;
+        peer.connected = false;
+        peer.nextAttempt = std::chrono::steady_clock::now();
+
+        startThread();
+        wakeUp();
+
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    /* The connection of owner was lost, dial again after the backoff */
+    void reconnect(ddfsTcpSocketOwner *owner) {
+        std::lock_guard<std::mutex> guard(schedulerLock);
+
+        unordered_map<ddfsTcpSocketOwner *, peerEntry>::iterator peer = peers.find(owner);
+        if(peer == peers.end() || peer->second.connected == false)
+            return;
+
+        peer->second.connected = false;
+        peer->second.nextAttempt = std::chrono::steady_clock::now() + backoff(peer->second);
+        wakeUp();
+    }
+
+    /* Stop dialing for owner */
+    void cancel(ddfsTcpSocketOwner *owner) {
+        std::lock_guard<std::mutex> guard(schedulerLock);
+
+        unordered_map<ddfsTcpSocketOwner *, peerEntry>::iterator peer = peers.find(owner);
+        if(peer == peers.end())
+            return;
+
+        if(peer->second.socketFD != -1)
+            close(peer->second.socketFD);
+        peers.erase(peer);
+        wakeUp();
+    }
+
+private:
+    /* Backoff starts at s_minBackoffMs and doubles up to s_maxBackoffMs */
+    static const int s_minBackoffMs = 100;
+    static const int s_maxBackoffMs = 30000;
+    /* A connect that takes longer than this is abandoned */
+    static const int s_connectTimeoutMs = 3000;
+
+    struct peerEntry {
+        string localNode;
+        string remoteNode;
+        struct sockaddr_in remoteAddr;
+        ddfsTcpSocketOptions options;
+        int attempt;                /* Failed attempts since the last connect */
+        int socketFD;               /* Connect in progress, -1 otherwise */
+        bool connected;             /* Handed over to the owner */
+        std::chrono::steady_clock::time_point nextAttempt;
+        std::chrono::steady_clock::time_point connectDeadline;
+    };
+
+    std::mutex schedulerLock;
+    unordered_map<ddfsTcpSocketOwner *, peerEntry> peers;
+    bool schedulerStarted;
+    int wakeUpFD;
+    std::mt19937 jitter;
+
+    /* Logger instance */
+    ddfsLogger &global_logger_rs = ddfsLogger::getInstance();
+
+    ddfsTcpReconnectScheduler() : schedulerStarted(false), wakeUpFD(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+                            jitter(std::random_device()()) {}
+
+    /* With schedulerLock held. The thread lives as long as the process,
+     * like the other singletons */
+    void startThread() {
+        if(schedulerStarted == false) {
+            std::thread(&ddfsTcpReconnectScheduler::run, this).detach();
+            schedulerStarted = true;
+        }
+    }
+
+    void wakeUp() {
+        uint64_t one = 1;
+        if(write(wakeUpFD, &one, sizeof(one)) == -1) {
+            /* Counter is already non zero, the thread wakes up anyway */
+        }
+    }
+
+    /* Delay before the next attempt, somewhere in [delay/2, delay] */
+    std::chrono::milliseconds backoff(peerEntry &peer) {
+        int delay = s_maxBackoffMs;
+        if(peer.attempt < 16 && (s_minBackoffMs << peer.attempt) < s_maxBackoffMs)
+            delay = s_minBackoffMs << peer.attempt;
+        peer.attempt++;
+
+        std::uniform_int_distribution<int> spread(delay / 2, delay);
+        return std::chrono::milliseconds(spread(jitter));
+    }
+
+    void failed(peerEntry &peer, const char *reason, int error) {
+        if(peer.socketFD != -1)
+            close(peer.socketFD);
+        peer.socketFD = -1;
+
+        std::chrono::milliseconds delay = backoff(peer);
+        peer.nextAttempt = std::chrono::steady_clock::now() + delay;
+
+        global_logger_rs << ddfsLogger::LOG_INFO << "TCP::Reconnect : " << reason << " " << peer.remoteNode
+                        << ". " << strerror(error) << ". Retrying in " << (int) delay.count() << "ms.\n";
+    }
+
+    /* Connected, send the hello and hand the socket over */
+    void established(ddfsTcpSocketOwner *owner, peerEntry &peer) {
+        ddfsStatus status = ddfsTcpConnectionRegistry::sendHello(peer.socketFD, peer.localNode, peer.remoteNode);
+        if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+            failed(peer, "Unable to send hello to", errno);
+            return;
+        }
+
+        global_logger_rs << ddfsLogger::LOG_INFO << "TCP::Reconnect : Connected to " << peer.remoteNode
+                        << ". socket : " << peer.socketFD << "\n";
+
+        owner->adoptSocket(peer.socketFD);
+        peer.socketFD = -1;
+        peer.attempt = 0;
+        peer.connected = true;
+    }
+
+    void startConnect(ddfsTcpSocketOwner *owner, peerEntry &peer) {
+        peer.socketFD = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(peer.socketFD == -1) {
+            failed(peer, "Unable to open socket for", errno);
+            return;
+        }
+
+        peer.options.apply(peer.socketFD);
+
+        if(connect(peer.socketFD, (struct sockaddr *) &peer.remoteAddr, sizeof(peer.remoteAddr)) == 0) {
+            established(owner, peer);
+        } else if(errno == EINPROGRESS) {
+            peer.connectDeadline = std::chrono::steady_clock::now() +
+                                std::chrono::milliseconds((int) s_connectTimeoutMs);
+        } else {
+            failed(peer, "Unable to connect to", errno);
+        }
+    }
+
+    void run() {
+        vector<struct pollfd> pollFDs;
+        vector<ddfsTcpSocketOwner *> pollOwners;
+
+        while(1) {
+            int timeoutMs = -1;
+
+            pollFDs.clear();
+            pollOwners.clear();
+
+            pollfd wakeUpPoll;
+            wakeUpPoll.fd = wakeUpFD;
+            wakeUpPoll.events = POLLIN;
+            pollFDs.push_back(wakeUpPoll);
+            pollOwners.push_back(NULL);
+
+            schedulerLock.lock();
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+            for(unordered_map<ddfsTcpSocketOwner *, peerEntry>::iterator iter = peers.begin();
+                                                iter != peers.end(); iter++) {
+                peerEntry &peer = iter->second;
+
+                if(peer.connected)
+                    continue;
+
+                if(peer.socketFD == -1 && peer.nextAttempt <= now)
+                    startConnect(iter->first, peer);
+
+                if(peer.socketFD != -1 && peer.connectDeadline <= now)
+                    failed(peer, "Timed out connecting to", ETIMEDOUT);
+
+                if(peer.connected)
+                    continue;
+
+                std::chrono::steady_clock::time_point wakeAt = peer.nextAttempt;
+                if(peer.socketFD != -1) {
+                    pollfd connectPoll;
+                    connectPoll.fd = peer.socketFD;
+                    connectPoll.events = POLLOUT;
+                    pollFDs.push_back(connectPoll);
+                    pollOwners.push_back(iter->first);
+                    wakeAt = peer.connectDeadline;
+                }
+
+                int wait = std::chrono::duration_cast<std::chrono::milliseconds>(wakeAt - now).count() + 1;
+                if(timeoutMs == -1 || wait < timeoutMs)
+                    timeoutMs = std::max(wait, 0);
+            }
+            schedulerLock.unlock();
+
+            if(poll(&pollFDs[0], pollFDs.size(), timeoutMs) <= 0)
+                continue;
+
+            if(pollFDs[0].revents) {
+                uint64_t count;
+                if(read(wakeUpFD, &count, sizeof(count)) == -1) {
+                    /* Nothing to drain */
+                }
+            }
+
+            std::lock_guard<std::mutex> guard(schedulerLock);
+            for(unsigned int i = 1; i < pollFDs.size(); i++) {
+                if(pollFDs[i].revents == 0)
+                    continue;
+
+                /* The peer may have been cancelled while polling */
+                unordered_map<ddfsTcpSocketOwner *, peerEntry>::iterator peer = peers.find(pollOwners[i]);
+                if(peer == peers.end() || peer->second.socketFD != pollFDs[i].fd)
+                    continue;
+
+                int error = 0;
+                socklen_t errorLength = sizeof(error);
+                if(getsockopt(pollFDs[i].fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) == -1)
+                    error = errno;
+
+                if(error == 0)
+                    established(peer->first, peer->second);
+                else
+                    failed(peer->second, "Unable to connect to", error);
+            }
+        }
+    }
+
+    ddfsTcpReconnectScheduler(ddfsTcpReconnectScheduler const&);     // Don't Implement
+    void operator=(ddfsTcpReconnectScheduler const&);                // Don't implement
+};
+
+#endif /* Ending DDFS_TCPRECONNECTSCHEDULER_H */
@@ -0,0 +1,98 @@
+/*
+ * @file ddfs_tcpSocketOptions.hpp
+ *
+ * @brief Socket options applied to every cluster connection.
+ *
+ * Paxos messages are small and latency bound, so Nagle is off by default
+ * and keepalive is on to notice dead peers within seconds. Busy polling
+ * and quick acks trade CPU for latency and are off by default.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#ifndef DDFS_TCPSOCKETOPTIONS_H
+#define DDFS_TCPSOCKETOPTIONS_H
+
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "../logger/ddfs_fileLogger.hpp"
+#include "../global/ddfs_status.hpp"
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL    46
+#endif
+
+struct ddfsTcpSocketOptions {
+    bool noDelay;               /* TCP_NODELAY */
+    int sendBufferSize;         /* SO_SNDBUF in bytes, 0 keeps the kernel default */
+    int receiveBufferSize;      /* SO_RCVBUF in bytes, 0 keeps the kernel default */
+    bool keepAlive;             /* SO_KEEPALIVE */
+    int keepAliveIdleSec;       /* TCP_KEEPIDLE */
+    int keepAliveIntervalSec;   /* TCP_KEEPINTVL */
+    int keepAliveCount;         /* TCP_KEEPCNT */
+    int busyPollUs;             /* SO_BUSY_POLL, 0 is off */
+    bool quickAck;              /* TCP_QUICKACK, rearmed after every received message */
+
+    ddfsTcpSocketOptions() : noDelay(true), sendBufferSize(0), receiveBufferSize(0),
+                        keepAlive(true), keepAliveIdleSec(10), keepAliveIntervalSec(5),
+                        keepAliveCount(3), busyPollUs(0), quickAck(false) {}
+
+    /*
+     * @brief Apply the options to socketFD.
+     *
+     * Options are best effort, an option that can not be set is logged
+     * and the rest are still applied.
+     *
+     * @return DDFS_OK       All the options are set
+     * @return DDFS_FAILURE  At least one option could not be set
+     */
+    ddfsStatus apply(int socketFD) const {
+        bool failed = false;
+
+        failed |= !setOption(socketFD, IPPROTO_TCP, TCP_NODELAY, noDelay ? 1 : 0, "TCP_NODELAY");
+
+        if(sendBufferSize > 0)
+            failed |= !setOption(socketFD, SOL_SOCKET, SO_SNDBUF, sendBufferSize, "SO_SNDBUF");
+        if(receiveBufferSize > 0)
+            failed |= !setOption(socketFD, SOL_SOCKET, SO_RCVBUF, receiveBufferSize, "SO_RCVBUF");
+
+        failed |= !setOption(socketFD, SOL_SOCKET, SO_KEEPALIVE, keepAlive ? 1 : 0, "SO_KEEPALIVE");
+        if(keepAlive) {
+            failed |= !setOption(socketFD, IPPROTO_TCP, TCP_KEEPIDLE, keepAliveIdleSec, "TCP_KEEPIDLE");
+            failed |= !setOption(socketFD, IPPROTO_TCP, TCP_KEEPINTVL, keepAliveIntervalSec, "TCP_KEEPINTVL");
+            failed |= !setOption(socketFD, IPPROTO_TCP, TCP_KEEPCNT, keepAliveCount, "TCP_KEEPCNT");
+        }
+
+        if(busyPollUs > 0)
+            failed |= !setOption(socketFD, SOL_SOCKET, SO_BUSY_POLL, busyPollUs, "SO_BUSY_POLL");
+
+        rearmQuickAck(socketFD);
+
+        return (failed ? ddfsStatus(DDFS_FAILURE) : ddfsStatus(DDFS_OK));
+    }
+
+    /* The kernel drops out of quick ack mode on its own, set it again */
+    void rearmQuickAck(int socketFD) const {
+        if(quickAck) {
+            int enable = 1;
+            setsockopt(socketFD, IPPROTO_TCP, TCP_QUICKACK, &enable, sizeof(enable));
+        }
+    }
+
+private:
+    static bool setOption(int socketFD, int level, int option, int value, const char *name) {
+        if(setsockopt(socketFD, level, option, &value, sizeof(value)) == -1) {
+            ddfsLogger::getInstance() << ddfsLogger::LOG_WARNING << "TCP:: Unable to set " << name
+                                << " to " << value << ". " << strerror(errno) << "\n";
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif /* Ending DDFS_TCPSOCKETOPTIONS_H */
@@ -0,0 +1,190 @@
+/*
+ * @file ddfs_trafficScheduler.hpp
+ *
+ * @brief Decides whose packet goes on a connection next.
+ *
+ * Consensus messages, replication and client data share one connection
+ * to a member. Without an order between them a leader election or a
+ * heartbeat waits behind whatever bulk data got to the socket first,
+ * and times out behind a large re-replication.
+ *
+ * Consensus traffic has strict priority, it is sent as soon as the
+ * packet on the wire is done. The other classes share what is left by
+ * deficit round robin over bytes, in proportion to their weights.
+ * Packets within a class keep the order they were handed in.
+ *
+ * Bulk data is sent in chunks (see ddfs_clusterStream.hpp), so a
+ * consensus message never waits for more than one chunk.
+ *
+ * Author Harman Patial <harman.patial@gmail.com>
+ */
+
+#ifndef DDFS_TRAFFICSCHEDULER_H
+#define DDFS_TRAFFICSCHEDULER_H
+
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+#include "ddfs_network.hpp"
+
+/*
+ * @class ddfsTrafficScheduler
+ *
+ * @brief Hands out turns to send on one connection.
+ *
+ * A sender takes a turn with ddfsTrafficTurn, writes its packet and
+ * lets go. Only one turn is out at a time.
+ */
+class ddfsTrafficScheduler {
+public:
+    ddfsTrafficScheduler() : busy(false), chosen(-1), active(DDFS_TRAFFIC_REPLICATION) {
+        for(int i = 0; i < DDFS_TRAFFIC_CLASSES; i++) {
+            waiting[i] = 0;
+            nextTicket[i] = 0;
+            servingTicket[i] = 0;
+            deficit[i] = 0;
+            sentBytes[i] = 0;
+        }
+        weight[DDFS_TRAFFIC_CONSENSUS] = 0;
+        weight[DDFS_TRAFFIC_REPLICATION] = s_defaultReplicationWeight;
+        weight[DDFS_TRAFFIC_CLIENT] = s_defaultClientWeight;
+    }
+
+    /*
+     * @brief Share of a weighted class, relative to the other one.
+     *
+     * Consensus traffic has no weight, it always goes first.
+     *
+     * @return DDFS_OK          Weight is set
+     * @return DDFS_FAILURE     Consensus class or a weight below 1
+     */
+    ddfsStatus setWeight(ddfsTrafficClass trafficClass, int classWeight) {
+        if(trafficClass <= DDFS_TRAFFIC_CONSENSUS || trafficClass >= DDFS_TRAFFIC_CLASSES ||
+           classWeight < 1)
+            return (ddfsStatus(DDFS_FAILURE));
+
+        std::lock_guard<std::mutex> guard(schedulerLock);
+        weight[trafficClass] = classWeight;
+        return (ddfsStatus(DDFS_OK));
+    }
+
+    /* Bytes sent so far in a class */
+    uint64_t getSentBytes(ddfsTrafficClass trafficClass) {
+        std::lock_guard<std::mutex> guard(schedulerLock);
+        return sentBytes[trafficClass];
+    }
+
+    /* Blocks till it is the turn of this packet */
+    void acquire(ddfsTrafficClass trafficClass, int size) {
+        std::unique_lock<std::mutex> guard(schedulerLock);
+        uint64_t ticket = nextTicket[trafficClass]++;
+
+        waiting[trafficClass]++;
+        if(busy == false)
+            schedule();
+
+        turnChanged.wait(guard, [this, trafficClass, ticket] {
+            return (busy == false && chosen == trafficClass &&
+                    servingTicket[trafficClass] == ticket);
+        });
+
+        busy = true;
+        waiting[trafficClass]--;
+        servingTicket[trafficClass]++;
+        deficit[trafficClass] -= size;
+        sentBytes[trafficClass] += size;
+    }
+
+    void release() {
+        std::lock_guard<std::mutex> guard(schedulerLock);
+        busy = false;
+        schedule();
+        turnChanged.notify_all();
+    }
+
+private:
+    /* Bytes a class of weight 1 may send per round */
+    static const int s_quantum = 16 * 1024;
+    static const int s_defaultReplicationWeight = 3;
+    static const int s_defaultClientWeight = 1;
+
+    std::mutex schedulerLock;
+    std::condition_variable turnChanged;
+
+    bool busy;
+    /* Class whose turn is next, -1 if nobody waits */
+    int chosen;
+    /* Weighted class the round robin is at */
+    int active;
+
+    int waiting[DDFS_TRAFFIC_CLASSES];
+    /* Keeps the order within a class */
+    uint64_t nextTicket[DDFS_TRAFFIC_CLASSES];
+    uint64_t servingTicket[DDFS_TRAFFIC_CLASSES];
+    int64_t deficit[DDFS_TRAFFIC_CLASSES];
+    int weight[DDFS_TRAFFIC_CLASSES];
+    uint64_t sentBytes[DDFS_TRAFFIC_CLASSES];
+
+    /* Called with schedulerLock held, while no turn is out */
+    void schedule() {
+        if(waiting[DDFS_TRAFFIC_CONSENSUS] > 0) {
+            chosen = DDFS_TRAFFIC_CONSENSUS;
+            return;
+        }
+
+        bool anyWaiting = false;
+        for(int i = DDFS_TRAFFIC_REPLICATION; i < DDFS_TRAFFIC_CLASSES; i++)
+            anyWaiting = anyWaiting || (waiting[i] > 0);
+
+        if(anyWaiting == false) {
+            chosen = -1;
+            return;
+        }
+
+        /* A packet may overdraw the deficit, the class then sits out
+         * rounds till the quantum made up for it.
+         */
+        while(waiting[active] == 0 || deficit[active] <= 0) {
+            /* An idle class does not save up for later */
+            if(waiting[active] == 0)
+                deficit[active] = 0;
+
+            active++;
+            if(active == DDFS_TRAFFIC_CLASSES)
+                active = DDFS_TRAFFIC_REPLICATION;
+
+            if(waiting[active] > 0)
+                deficit[active] += (int64_t) weight[active] * s_quantum;
+        }
+
+        chosen = active;
+    }
+
+    ddfsTrafficScheduler(ddfsTrafficScheduler const&);     // Don't Implement
+    void operator=(ddfsTrafficScheduler const&);           // Don't implement
+};
+
+/*
+ * @class ddfsTrafficTurn
+ *
+ * @brief A turn to send, given back when it goes out of scope.
+ */
+class ddfsTrafficTurn {
+public:
+    ddfsTrafficTurn(ddfsTrafficScheduler &s, ddfsTrafficClass trafficClass, int size) : scheduler(s) {
+        scheduler.acquire(trafficClass, size);
+    }
+
+    ~ddfsTrafficTurn() {
+        scheduler.release();
+    }
+
+private:
+    ddfsTrafficScheduler &scheduler;
+
+    ddfsTrafficTurn(ddfsTrafficTurn const&);       // Don't Implement
+    void operator=(ddfsTrafficTurn const&);        // Don't implement
+};
+
+#endif /* Ending DDFS_TRAFFICSCHEDULER_H */
@@ -0,0 +1,1525 @@
+/*
+ * loopbackBench.cpp
+ *
+ * Runs N ddfsClusterPaxos nodes in this process over the loopback
+ * transport and reports election time, message latency and throughput.
+ *
+ * Usage : loopbackBench [-n nodes] [-t trials] [-l latencyUs] [-j jitterUs] [-p lossPercent]
+ *                       [-x loopback|shm|tcp] [-s streamBytes] [-c] [-r chunkBytes]
+ *                       [-e chunkBytes] [-m placementChunks] [-b rebalanceChunks]
+ *                       [-w rebalanceMBps] [-k metadataPaths] [-f fileMB] [-a appendBytes]
+ *                       [-i files] [-v renames] [-o files] [-q files] [-y files]
+ *                       [-g files]
+ *
+ * Every trial creates a fresh cluster on 127.0.<trial>.<node> and runs one
+ * leader election from the first node.
+ *
+ * With -x shm the nodes talk through shared memory instead. With -x tcp
+ * they all listen on 127.0.0.1, each on its own port. Latency, loss and
+ * the message counters only apply to the loopback transport.
+ *
+ * With -s the first node also streams that many bytes to the second one
+ * after the election, and the stream throughput is reported. With -c the
+ * stream runs during the election instead, which shows whether consensus
+ * traffic gets through a bulk transfer.
+ *
+ * With -r the first node writes a chunk of that many bytes down the chain
+ * of the other nodes (at most three), and the replication throughput is
+ * reported. Every replica is checked against what was written.
+ *
+ * With -e a file of that many bytes is written through ddfsSimpleFilesystem
+ * as RS(6,3), every write-back chunk of it as fragments spread over the
+ * nodes by the first node, then read back with the second node down,
+ * which makes the read rebuild its fragments from parity.
+ *
+ * With -f a file of that many MB is read through the page cache of
+ * ddfsSimpleFilesystem, from storage that takes 200us per read: cold
+ * without readahead, cold with it, and warm.
+ *
+ * With -a a 32MB log is appended that many bytes at a time, to storage
+ * that takes 20us per write, once straight to storage and once through
+ * the write-back buffers of ddfsSimpleFilesystem.
+ *
+ * With -i that many files are created in 100 directories of a
+ * ddfsSimpleFilesystem, stat'ed by path and by handle, and found again
+ * after the metadata is saved and loaded into another one.
+ *
+ * With -v 8 threads publish that many results by creating a temporary
+ * file, writing it and renaming it over one of 100 results. The journal
+ * is replayed into another filesystem, which must see every result whole
+ * and none of the temporaries.
+ *
+ * With -o a node that is not the leader bookmarks a namespace of that
+ * many files on the leader while a writer keeps renaming them. The
+ * bookmark must show every file once: under its new name if it was
+ * renamed before the bookmark was asked for, under its old name if it
+ * was renamed after the bookmark came back.
+ *
+ * With -q a node that is not the leader follows the metadata of a
+ * namespace of that many files on the leader: it catches up in full,
+ * follows a hundredth of the files being renamed as they are, then goes
+ * away while another hundredth is renamed over a checkpoint and catches
+ * up again. The second catch-up should be a small part of the first,
+ * and the follower must end with the namespace of the leader.
+ *
+ * With -y 1, 2, 4 and 8 threads create that many files between them in
+ * a ddfsSimpleFilesystem, each in a directory of its own and then all
+ * in one directory, and stat them back by path. Every file must be
+ * there at the end.
+ *
+ * With -g that many files are created in a ddfsSimpleFilesystem one
+ * commit each and then in batches of 1000, listed with readDirectory
+ * against a statFile of each entry, and a tree of them in 100
+ * directories is removed with removeTree, once waited for and once
+ * left half done and finished by the next init().
+ *
+ * The exit status is 1 if any check of any trial failed.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <map>
+#include <set>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "../src/global/ddfs_status.hpp"
+#include "../src/global/ddfs_global.hpp"
+#include "../src/cluster/ddfs_clusterPaxos.hpp"
+#include "../src/cluster/ddfs_clusterMemberPaxos.hpp"
+#include "../src/cluster/ddfs_clusterReplication.hpp"
+#include "../src/cluster/ddfs_clusterErasure.hpp"
+#include "../src/cluster/ddfs_clusterPlacement.hpp"
+#include "../src/cluster/ddfs_clusterRebalancer.hpp"
+#include "../src/cluster/ddfs_clusterMetadataCache.hpp"
+#include "../src/cluster/ddfs_clusterBookmark.hpp"
+#include "../src/cluster/ddfs_clusterMetadataReplica.hpp"
+#include "../src/filesystem/ddfs_simplefilesystem.hpp"
+#include "../src/network/ddfs_loopbackConnection.hpp"
+#include "../src/network/ddfs_shmConnection.hpp"
+
+using namespace std;
+
+static uint64_t percentile(vector<uint64_t> &samples, double p)
+{
+	if(samples.empty())
+		return 0;
+
+	size_t index = (size_t) (p * (samples.size() - 1));
+	return samples[index];
+}
+
+static void printPercentiles(string name, vector<uint64_t> &samples, string unit)
+{
+	sort(samples.begin(), samples.end());
+
+	cout << name << " (" << samples.size() << " samples) : "
+		<< "p50 " << percentile(samples, 0.50) << unit
+		<< "  p90 " << percentile(samples, 0.90) << unit
+		<< "  p99 " << percentile(samples, 0.99) << unit
+		<< "  max " << (samples.empty() ? 0 : samples.back()) << unit << "\n";
+}
+
+static DDFS_NETWORK_TYPE transport = DDFS_NETWORK_LOOPBACK;
+
+static string nodeAddress(int trial, int node)
+{
+	ostringstream address;
+	if(transport == DDFS_NETWORK_TCP)
+		address << "127.0.0.1:" << (DDFS_SERVER_PORT + trial * 256 + node);
+	else
+		address << "127.0." << trial << "." << node;
+	return address.str();
+}
+
+static string transportName()
+{
+	switch(transport) {
+	case DDFS_NETWORK_SHM: return "shm";
+	case DDFS_NETWORK_TCP: return "tcp";
+	default: return "loopback";
+	}
+}
+
+static ddfsClusterMemberPaxos *findMember(ddfsClusterPaxos *node, string hostName)
+{
+	for(unsigned int i = 0; i < node->clusterMembers.size(); i++) {
+		if(node->clusterMembers[i]->getHostName() == hostName)
+			return node->clusterMembers[i];
+	}
+	return NULL;
+}
+
+/* Stream streamBytes from the first to the second node, returns MB/s or -1 */
+static double streamTrial(vector<ddfsClusterPaxos *> &nodes, int trial, size_t streamBytes)
+{
+	ddfsClusterMemberPaxos *sender = findMember(nodes[0], nodeAddress(trial, 2));
+	ddfsClusterMemberPaxos *receiver = findMember(nodes[1], nodeAddress(trial, 1));
+	if(sender == NULL || receiver == NULL)
+		return -1.0;
+
+	vector<uint8_t> payload(streamBytes);
+	for(size_t i = 0; i < streamBytes; i++)
+		payload[i] = (uint8_t) (i * 131 + trial);
+
+	std::mutex doneLock;
+	std::condition_variable doneSignal;
+	bool done = false, intact = false;
+
+	receiver->setStreamHandler([&](uint64_t streamID, vector<uint8_t> &received) {
+		std::lock_guard<std::mutex> guard(doneLock);
+		intact = (received == payload);
+		done = true;
+		doneSignal.notify_all();
+	});
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	ddfsStatus status = sender->sendStream(&payload[0], streamBytes, NULL);
+
+	std::unique_lock<std::mutex> guard(doneLock);
+	doneSignal.wait_for(guard, chrono::seconds(30), [&] { return done; });
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	receiver->setStreamHandler(ddfsClusterStreamHandler());
+
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false || intact == false) {
+		cout << "Stream : " << status.statusToString() << (intact ? "" : ", payload not intact") << "\n";
+		return -1.0;
+	}
+
+	return (streamBytes / (1024.0 * 1024.0)) / seconds;
+}
+
+/* Write chunkBytes from the first node down the chain of the others, returns MB/s or -1 */
+static double replicationTrial(vector<ddfsClusterPaxos *> &nodes, int trial, size_t chunkBytes)
+{
+	vector<vector<uint8_t> > replicas(nodes.size());
+	vector<ddfsClusterReplication *> replication;
+	vector<string> chain;
+
+	for(unsigned int i = 0; i < nodes.size(); i++) {
+		vector<uint8_t> *replica = &replicas[i];
+		replication.push_back(new ddfsClusterReplication(nodes[i],
+			[replica](uint64_t chunkID, uint64_t offset, const uint8_t *data, size_t size) {
+				if(replica->size() < offset + size)
+					replica->resize(offset + size);
+				std::copy(data, data + size, replica->begin() + offset);
+				return ddfsStatus(DDFS_OK);
+			}));
+		if(i > 0 && chain.size() < DDFS_REPLICATION_MAX_CHAIN)
+			chain.push_back(nodeAddress(trial, i + 1));
+	}
+
+	vector<uint8_t> chunk(chunkBytes);
+	for(size_t i = 0; i < chunkBytes; i++)
+		chunk[i] = (uint8_t) (i * 151 + trial);
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	ddfsStatus status = replication[0]->replicate(chain, trial, &chunk[0], chunkBytes);
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	for(unsigned int i = 0; i < replication.size(); i++)
+		delete replication[i];
+
+	bool intact = true;
+	for(unsigned int i = 1; i <= chain.size(); i++)
+		intact = intact && (replicas[i] == chunk);
+
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false || intact == false) {
+		cout << "Replication : " << status.statusToString() << (intact ? "" : ", replicas not intact") << "\n";
+		return -1.0;
+	}
+
+	return (chunkBytes / (1024.0 * 1024.0)) / seconds;
+}
+
+/* Fragments stored on one node, written from the network threads */
+struct fragmentStore {
+	std::mutex lock;
+	map<uint64_t, vector<uint8_t> > fragments;
+};
+
+/* Chunks of an erasure coded file as the fragments of one trial, by chunk ID */
+struct erasureFile {
+	std::mutex lock;
+	map<uint64_t, size_t> lengths;
+	/* The last chunk decoded, pages of it are read one by one */
+	uint64_t decodedChunk;
+	vector<uint8_t> decoded;
+};
+
+/* Write a file of fileBytes with RS(6,3) through ddfsSimpleFilesystem and read it
+ * back degraded, returns false on failure */
+static bool erasureTrial(vector<ddfsClusterPaxos *> &nodes, int trial, size_t fileBytes,
+			double *writeMBps, double *readMBps)
+{
+	const int dataFragments = 6, parityFragments = 3;
+	/* Every write-back chunk of the file is one erasure coded chunk */
+	const uint64_t chunkBytes = DDFS_WRITEBACK_CHUNK_SIZE;
+	const size_t readBytes = 128 * 1024;
+	vector<fragmentStore> stores(nodes.size());
+	vector<ddfsClusterReplication *> replication;
+	map<string, int> nodeIndex;
+	vector<string> members;
+
+	for(unsigned int i = 0; i < nodes.size(); i++) {
+		fragmentStore *store = &stores[i];
+		replication.push_back(new ddfsClusterReplication(nodes[i],
+			[store](uint64_t chunkID, uint64_t offset, const uint8_t *data, size_t size) {
+				std::lock_guard<std::mutex> guard(store->lock);
+				vector<uint8_t> &fragment = store->fragments[chunkID];
+				if(fragment.size() < offset + size)
+					fragment.resize(offset + size);
+				std::copy(data, data + size, fragment.begin() + offset);
+				return ddfsStatus(DDFS_OK);
+			}));
+		nodeIndex[nodeAddress(trial, i + 1)] = i;
+	}
+
+	/* Round robin, a node may hold more than one fragment */
+	for(int i = 0; i < dataFragments + parityFragments; i++)
+		members.push_back(nodeAddress(trial, (i % nodes.size()) + 1));
+
+	vector<uint8_t> data(fileBytes), readBack(fileBytes);
+	for(size_t i = 0; i < fileBytes; i++)
+		data[i] = (uint8_t) (i * 167 + trial);
+
+	ddfsClusterErasure erasure(replication[0], dataFragments, parityFragments);
+	erasureFile file;
+	file.decodedChunk = UINT64_MAX;
+	string downNode;
+
+	ddfsFragmentReader reader = [&](const string &member, uint64_t fragmentID, uint8_t *buffer, size_t size) {
+		if(member == downNode)
+			return ddfsStatus(DDFS_HOST_DOWN);
+
+		fragmentStore &store = stores[nodeIndex[member]];
+		std::lock_guard<std::mutex> guard(store.lock);
+		map<uint64_t, vector<uint8_t> >::iterator fragment = store.fragments.find(fragmentID);
+		if(fragment == store.fragments.end() || fragment->second.size() != size)
+			return ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST);
+		std::copy(fragment->second.begin(), fragment->second.end(), buffer);
+		return ddfsStatus(DDFS_OK);
+	};
+
+	/* The file is the only one, its chunks are numbered from 0 */
+	ddfsSimpleFilesystem fs;
+	fs.setDataWriter([&] (uint64_t fileID, const ddfsRedundancy &redundancy, uint64_t offset,
+					const uint8_t *buffer, size_t size) {
+		if(redundancy.scheme != DDFS_REDUNDANCY_ERASURE_CODED || redundancy.dataFragments != dataFragments ||
+						redundancy.parityFragments != parityFragments || offset % chunkBytes != 0)
+			return ddfsStatus(DDFS_GENERAL_PARAM_INVALID);
+
+		ddfsStatus status = erasure.writeChunk(members, offset / chunkBytes, buffer, size);
+		std::lock_guard<std::mutex> guard(file.lock);
+		file.lengths[offset / chunkBytes] = size;
+		return status;
+	});
+	fs.setDataReader([&] (uint64_t fileID, const ddfsRedundancy &redundancy, uint64_t offset,
+					uint8_t *buffer, size_t size, size_t *bytesRead) {
+		*bytesRead = 0;
+		if(redundancy.scheme != DDFS_REDUNDANCY_ERASURE_CODED)
+			return ddfsStatus(DDFS_GENERAL_PARAM_INVALID);
+
+		std::lock_guard<std::mutex> guard(file.lock);
+		while(*bytesRead < size) {
+			uint64_t at = offset + *bytesRead, chunkID = at / chunkBytes;
+			map<uint64_t, size_t>::iterator length = file.lengths.find(chunkID);
+			if(length == file.lengths.end() || at - chunkID * chunkBytes >= length->second)
+				break;
+
+			if(file.decodedChunk != chunkID) {
+				file.decoded.resize(length->second);
+				ddfsStatus status = erasure.readChunk(members, chunkID, &file.decoded[0], length->second, reader);
+				if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+					file.decodedChunk = UINT64_MAX;
+					return status;
+				}
+				file.decodedChunk = chunkID;
+			}
+
+			size_t from = at - chunkID * chunkBytes;
+			size_t copied = min(size - *bytesRead, length->second - from);
+			memcpy(buffer + *bytesRead, &file.decoded[from], copied);
+			*bytesRead += copied;
+		}
+		return ddfsStatus(DDFS_OK);
+	});
+
+	ddfsRedundancy coded = {DDFS_REDUNDANCY_ERASURE_CODED, dataFragments, parityFragments};
+	ddfsFileHandle handle;
+	ddfsStatus status = fs.createFile("/", "cold", 0644, coded);
+	if(status.compareStatus(ddfsStatus(DDFS_OK)))
+		status = fs.openFile("/cold", 0, &handle);
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+		cout << "Erasure create : " << status.statusToString() << "\n";
+		return false;
+	}
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	status = fs.writeFile(handle, (int) fileBytes, &data[0], 0);
+	if(status.compareStatus(ddfsStatus(DDFS_OK)))
+		status = fs.syncFile(handle);
+	*writeMBps = (fileBytes / (1024.0 * 1024.0)) / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	fs.closeFile(handle);
+
+	for(unsigned int i = 0; i < replication.size(); i++)
+		delete replication[i];
+
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+		cout << "Erasure write : " << status.statusToString() << "\n";
+		return false;
+	}
+
+	/* The second node is down */
+	downNode = nodeAddress(trial, 2);
+	fs.openFile("/cold", 0, &handle);
+	ddfsOpenFile *open = fs.getOpenFiles().lookup(handle);
+
+	start = chrono::steady_clock::now();
+	size_t offset = 0;
+	while(offset < fileBytes && status.compareStatus(ddfsStatus(DDFS_OK))) {
+		status = fs.readFile(handle, (int) min(readBytes, fileBytes - offset), &readBack[offset]);
+		if(open->transferred == 0)
+			break;
+		offset += open->transferred;
+	}
+	*readMBps = (fileBytes / (1024.0 * 1024.0)) / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	fs.closeFile(handle);
+
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false || readBack != data) {
+		cout << "Erasure degraded read : " << status.statusToString()
+			<< (readBack == data ? "" : ", file not intact") << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+/* Place chunks of rebalanceChunkBytes on the nodes, take the last node down and
+ * let the first one restore the replicas at rateMBps. Returns MB/s or -1 */
+static double rebalanceTrial(vector<ddfsClusterPaxos *> &nodes, int trial, int chunks, uint64_t rateMBps)
+{
+	const uint64_t chunkBytes = 1024 * 1024;
+	ddfsClusterPlacement &placement = nodes[0]->getPlacement();
+	std::mutex holdersLock;
+	map<uint64_t, set<string> > holders;
+	uint64_t copies = 0;
+
+	ddfsClusterRebalancer rebalancer(nodes[0],
+		[&](uint64_t chunkID, uint64_t size, const string &source, const string &target) {
+			std::lock_guard<std::mutex> guard(holdersLock);
+			if(holders[chunkID].count(source) == 0)
+				return ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST);
+			holders[chunkID].insert(target);
+			copies++;
+			return ddfsStatus(DDFS_OK);
+		},
+		ddfsChunkDropper(), DDFS_REPLICATION_MAX_CHAIN, rateMBps * 1024 * 1024);
+
+	for(int c = 0; c < chunks; c++) {
+		vector<string> replicas;
+		placement.getReplicas(c, DDFS_REPLICATION_MAX_CHAIN, &replicas);
+		holders[c].insert(replicas.begin(), replicas.end());
+		rebalancer.recordChunk(c, chunkBytes, replicas);
+	}
+	rebalancer.waitIdle(5000);
+
+	string downNode = nodeAddress(trial, nodes.size());
+	findMember(nodes[0], downNode)->setCurrentState(s_clusterMemberDead);
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	bool idle = rebalancer.waitIdle(300000);
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	/* Every chunk back to full strength without the down node */
+	int shortChunks = 0;
+	for(int c = 0; c < chunks; c++) {
+		int live = (int) holders[c].size() - (int) holders[c].count(downNode);
+		if(live < DDFS_REPLICATION_MAX_CHAIN)
+			shortChunks++;
+	}
+
+	if(idle == false || shortChunks > 0 || rebalancer.getLostChunks() > 0) {
+		cout << "Rebalance : " << shortChunks << " chunks under-replicated, " << rebalancer.getLostChunks() << " lost.\n";
+		return -1.0;
+	}
+
+	cout << "Rebalance : " << downNode << " down, " << copies << " of " << chunks << " chunks re-replicated in "
+		<< (uint64_t) (seconds * 1000) << "ms.\n";
+	return (copies * chunkBytes / (1024.0 * 1024.0)) / seconds;
+}
+
+/* Look paths up from a node that is not the leader, first from the leader, then
+ * from the cache, and change one of them. Latencies go to missUs, hitUs and
+ * invalidateUs, returns false on failure */
+static bool metadataTrial(vector<ddfsClusterPaxos *> &nodes, int trial, int paths,
+			vector<uint64_t> &missUs, vector<uint64_t> &hitUs, vector<uint64_t> &invalidateUs)
+{
+	ddfsClusterMemberPaxos *leader = nodes[0]->getLeader();
+	if(leader == NULL)
+		return false;
+
+	int leaderIndex = -1, clientIndex = -1;
+	for(unsigned int i = 0; i < nodes.size(); i++) {
+		if(nodeAddress(trial, i + 1) == leader->getHostName())
+			leaderIndex = i;
+		else if(clientIndex == -1 && nodes[i]->getLeader() != NULL)
+			clientIndex = i;
+	}
+	if(leaderIndex == -1 || clientIndex == -1)
+		return false;
+
+	std::mutex filesLock;
+	map<string, ddfsFileInformation> files;
+	for(int p = 0; p < paths; p++) {
+		ddfsFileInformation &info = files["/bench/file" + to_string(p)];
+		info.inode = p + 1;
+		info.size = 64 * 1024 * 1024;
+		info.version = 1;
+		for(uint64_t c = 0; c < 4; c++) {
+			vector<string> replicas;
+			nodes[leaderIndex]->getPlacement().getReplicas(info.inode * 4 + c, DDFS_REPLICATION_MAX_CHAIN, &replicas);
+			info.chunkLocations.push_back(replicas);
+		}
+	}
+
+	ddfsMetadataLeaseServer server(nodes[leaderIndex], [&](const string &path, ddfsFileInformation *info) {
+		std::lock_guard<std::mutex> guard(filesLock);
+		map<string, ddfsFileInformation>::iterator file = files.find(path);
+		if(file == files.end())
+			return ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST);
+		*info = file->second;
+		return ddfsStatus(DDFS_OK);
+	});
+	ddfsMetadataCache cache(nodes[clientIndex]);
+
+	/* The first round asks the leader, the others should not */
+	for(int round = 0; round < 4; round++) {
+		for(int p = 0; p < paths; p++) {
+			ddfsFileInformation info;
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			ddfsStatus status = cache.lookup("/bench/file" + to_string(p), &info);
+			uint64_t elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+
+			if(status.compareStatus(ddfsStatus(DDFS_OK)) == false || info.inode != (uint64_t) p + 1) {
+				cout << "Metadata lookup : " << status.statusToString() << "\n";
+				return false;
+			}
+			(round == 0 ? missUs : hitUs).push_back(elapsed);
+		}
+	}
+
+	if(cache.getMisses() != (uint64_t) paths) {
+		cout << "Metadata cache : " << cache.getMisses() << " misses for " << paths << " paths\n";
+		return false;
+	}
+
+	/* Change a file, the client must see the new version at once */
+	{
+		std::lock_guard<std::mutex> guard(filesLock);
+		files["/bench/file0"].version++;
+	}
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	ddfsStatus status = server.invalidate("/bench/file0");
+	invalidateUs.push_back(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count());
+
+	ddfsFileInformation info;
+	cache.lookup("/bench/file0", &info);
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false || info.version != 2) {
+		cout << "Metadata invalidate : " << status.statusToString() << ", version " << info.version << "\n";
+		return false;
+	}
+
+	return true;
+}
+
+/* Bookmark the namespace of the leader from another node while it changes,
+ * the latency goes to bookmarkUs, returns false on failure */
+static bool bookmarkTrial(vector<ddfsClusterPaxos *> &nodes, int trial, int files, vector<uint64_t> &bookmarkUs)
+{
+	const int directories = 100;
+	ddfsClusterMemberPaxos *leader = nodes[0]->getLeader();
+	if(leader == NULL)
+		return false;
+
+	int leaderIndex = -1, clientIndex = -1;
+	for(unsigned int i = 0; i < nodes.size(); i++) {
+		if(nodeAddress(trial, i + 1) == leader->getHostName())
+			leaderIndex = i;
+		else if(clientIndex == -1 && nodes[i]->getLeader() != NULL)
+			clientIndex = i;
+	}
+	if(leaderIndex == -1 || clientIndex == -1)
+		return false;
+
+	ddfsSimpleFilesystem fs;
+	for(int d = 0; d < directories; d++)
+		fs.makedirectory("/", "dir" + to_string(d));
+	for(int f = 0; f < files; f++)
+		fs.createFile("/dir" + to_string(f % directories), "file" + to_string(f), 0644);
+
+	ddfsBookmarkServer server(nodes[leaderIndex], [&fs](const string &name, uint64_t *id) {
+		return fs.createSnapshot(name, id);
+	});
+	ddfsBookmarkClient client(nodes[clientIndex]);
+
+	/* Every file is renamed once, some before the bookmark, most after */
+	std::atomic<int> renamed(0);
+	thread writer([&fs, &renamed, files] () {
+		for(int f = 0; f < files; f++) {
+			string path = "/dir" + to_string(f % directories) + "/file" + to_string(f);
+			fs.renameFile(path, path + ".done");
+			renamed++;
+		}
+	});
+	while(renamed < files / 10)
+		this_thread::yield();
+
+	/* Files below renamedBefore were renamed before the bookmark, files
+	 * past renamedAfter after it, the one at renamedAfter may be either */
+	uint64_t bookmark = 0;
+	int renamedBefore = renamed;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	ddfsStatus status = client.createBookmark("trial" + to_string(trial), &bookmark);
+	bookmarkUs.push_back(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count());
+	int renamedAfter = renamed;
+	writer.join();
+
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+		cout << "Bookmark : " << status.statusToString() << "\n";
+		return false;
+	}
+
+	/* Names in the bookmark: each file once, in its directory, under the
+	 * name it had when the bookmark was taken */
+	vector<int> listed(files, 0);
+	int seen = 0, oldNames = 0, wrongNames = 0;
+	for(int d = 0; d < directories; d++) {
+		vector<pair<string, uint64_t> > entries;
+		fs.listSnapshot(bookmark, "/dir" + to_string(d), &entries);
+		for(size_t e = 0; e < entries.size(); e++) {
+			const string &name = entries[e].first;
+			bool done = name.size() > 5 && name.compare(name.size() - 5, 5, ".done") == 0;
+			int f = name.compare(0, 4, "file") == 0 ? atoi(name.c_str() + 4) : -1;
+			ddfsInode info;
+			if(f < 0 || f >= files || f % directories != d || name != "file" + to_string(f) + (done ? ".done" : "") ||
+							fs.statSnapshot(bookmark, "/dir" + to_string(d) + "/" + name, &info)
+								.compareStatus(ddfsStatus(DDFS_OK)) == false || info.inode != entries[e].second) {
+				wrongNames++;
+				continue;
+			}
+
+			listed[f]++;
+			seen++;
+			if(done == false)
+				oldNames++;
+			if((f < renamedBefore && done == false) || (f > renamedAfter && done))
+				wrongNames++;
+		}
+	}
+	for(int f = 0; f < files; f++) {
+		if(listed[f] != 1)
+			wrongNames++;
+	}
+
+	vector<ddfsSnapshotInfo> snapshots;
+	fs.listSnapshots(&snapshots);
+	cout << "Bookmark : " << files << " files, " << seen << " in the bookmark, " << oldNames
+		<< " under their old name (" << files - renamedAfter - 1 << " to " << files - renamedBefore
+		<< " expected), " << wrongNames << " wrong, "
+		<< (snapshots.empty() ? 0 : snapshots[0].preservedBytes / 1024) << "KB preserved.\n";
+	return seen == files && wrongNames == 0;
+}
+
+/* Every directory of the replica trial, listed in a snapshot of fs */
+static vector<vector<pair<string, uint64_t> > > listReplica(ddfsSimpleFilesystem &fs, int directories)
+{
+	vector<vector<pair<string, uint64_t> > > listing(directories);
+	uint64_t id;
+	if(fs.createSnapshot("compare", &id).compareStatus(ddfsStatus(DDFS_OK)) == false)
+		return listing;
+	for(int d = 0; d < directories; d++)
+		fs.listSnapshot(id, "/dir" + to_string(d), &listing[d]);
+	fs.deleteSnapshot(id);
+	return listing;
+}
+
+static bool replicaTrial(vector<ddfsClusterPaxos *> &nodes, int trial, int files,
+			vector<uint64_t> &fullKB, vector<uint64_t> &incrementalKB, vector<uint64_t> &catchUpMs)
+{
+	const int directories = 100;
+	ddfsClusterMemberPaxos *leader = nodes[0]->getLeader();
+	if(leader == NULL)
+		return false;
+
+	int leaderIndex = -1, followerIndex = -1;
+	for(unsigned int i = 0; i < nodes.size(); i++) {
+		if(nodeAddress(trial, i + 1) == leader->getHostName())
+			leaderIndex = i;
+		else if(followerIndex == -1 && nodes[i]->getLeader() != NULL)
+			followerIndex = i;
+	}
+	if(leaderIndex == -1 || followerIndex == -1)
+		return false;
+
+	ddfsSimpleFilesystem primary, replica;
+	for(int d = 0; d < directories; d++)
+		primary.makedirectory("/", "dir" + to_string(d));
+	for(int f = 0; f < files; f++)
+		primary.createFile("/dir" + to_string(f % directories), "file" + to_string(f), 0644);
+
+	ddfsMetadataShipper shipper(nodes[leaderIndex], [&primary](uint64_t since, vector<uint8_t> *updates) {
+		return primary.catchUp(since, updates);
+	});
+	primary.setUpdateHandler([&shipper](const vector<uint8_t> &update) {
+		shipper.ship(update);
+	});
+
+	ddfsReplicaApply apply = [&replica](const uint8_t *updates, size_t length) {
+		return replica.applyUpdates(updates, length);
+	};
+	ddfsReplicaCheckpoint at = [&replica]() {
+		return replica.getCheckpoint();
+	};
+
+	/* Renames count more files, with a checkpoint half way */
+	int next = 0;
+	auto churn = [&primary, &next, files] (int count) {
+		for(int i = 0; i < count; i++, next++) {
+			string path = "/dir" + to_string(next % directories) + "/file" + to_string(next % files);
+			primary.renameFile(path, path + "." + to_string(next));
+			if(i == count / 2)
+				primary.sync();
+		}
+	};
+
+	uint64_t full = 0, incremental = 0, elapsedMs = 0;
+	bool live = false;
+	{
+		ddfsMetadataFollower follower(nodes[followerIndex], apply, at);
+		ddfsStatus status = follower.catchUp();
+		full = follower.getCatchUpBytes();
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+			cout << "Replica : full catch-up " << status.statusToString() << "\n";
+			return false;
+		}
+
+		/* Followed as it happens */
+		churn(files / 100);
+		for(int wait = 0; wait < 500 && live == false; wait++) {
+			live = listReplica(primary, directories) == listReplica(replica, directories);
+			if(live == false)
+				usleep(10000);
+		}
+	}
+
+	/* Missed while the follower was away */
+	churn(files / 100);
+
+	ddfsMetadataFollower follower(nodes[followerIndex], apply, at);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	ddfsStatus status = follower.catchUp();
+	elapsedMs = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+	incremental = follower.getCatchUpBytes();
+
+	bool same = listReplica(primary, directories) == listReplica(replica, directories);
+	primary.setUpdateHandler(ddfsMetadataUpdateHandler());
+
+	cout << "Replica : " << files << " files, full catch-up " << full / 1024 << "KB, after "
+		<< files / 100 << " renames " << incremental / 1024 << "KB in " << elapsedMs << "ms. "
+		<< "Followed live : " << (live ? "yes" : "no") << ". Caught up : " << status.statusToString()
+		<< (same ? ", same namespace" : ", namespace differs") << ". Shipped : "
+		<< shipper.getShippedBytes() / 1024 << "KB\n";
+
+	if(status.compareStatus(ddfsStatus(DDFS_OK)) == false || same == false || live == false)
+		return false;
+	fullKB.push_back(full / 1024);
+	incrementalKB.push_back(incremental / 1024);
+	catchUpMs.push_back(elapsedMs);
+	return true;
+}
+
+static void placementTrial(int numberOfNodes, int chunks)
+{
+	const uint64_t terabyte = 1024ULL * 1024 * 1024 * 1024;
+	const int replicas = DDFS_REPLICATION_MAX_CHAIN;
+	ddfsClusterPlacement placement;
+	map<string, uint64_t> capacity;
+	uint64_t totalCapacity = 0;
+
+	for(int i = 1; i <= numberOfNodes; i++) {
+		capacity[nodeAddress(0, i)] = (i % 2) ? 2 * terabyte : terabyte;
+		placement.addMember(nodeAddress(0, i), capacity[nodeAddress(0, i)]);
+		totalCapacity += capacity[nodeAddress(0, i)];
+	}
+
+	vector<vector<string> > before(chunks);
+	map<string, int> load;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(int c = 0; c < chunks; c++) {
+		placement.getReplicas(c, replicas, &before[c]);
+		for(size_t r = 0; r < before[c].size(); r++)
+			load[before[c][r]]++;
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	/* Load over its fair share of the replicas, 1.0 is exact */
+	double worst = 0.0;
+	for(map<string, int>::iterator iter = load.begin(); iter != load.end(); iter++) {
+		double share = (double) capacity[iter->first] / totalCapacity;
+		double ratio = iter->second / (share * chunks * replicas);
+		if(ratio > worst)
+			worst = ratio;
+	}
+
+	string newNode = nodeAddress(0, numberOfNodes + 1);
+	placement.addMember(newNode, terabyte);
+
+	uint64_t moved = 0, placed = 0;
+	for(int c = 0; c < chunks; c++) {
+		vector<string> after;
+		placement.getReplicas(c, replicas, &after);
+		for(size_t r = 0; r < after.size(); r++) {
+			if(find(before[c].begin(), before[c].end(), after[r]) == before[c].end())
+				moved++;
+		}
+		placed += after.size();
+	}
+
+	cout << "Placement : " << chunks << " chunks x " << replicas << " on " << numberOfNodes
+		<< " nodes, " << (uint64_t) (chunks / seconds) << " lookups/s. Most loaded node at "
+		<< worst << " of its share.\n";
+	cout << "Placement : adding a node moved " << (100.0 * moved / placed) << "% of the replicas, its share is "
+		<< (100.0 * terabyte / (totalCapacity + terabyte)) << "%.\n";
+}
+
+/* Byte of the synthetic file at offset */
+static uint8_t fileByte(uint64_t fileID, uint64_t offset)
+{
+	return (uint8_t) (fileID * 131 + offset * 7 + (offset >> 16));
+}
+
+/* Read a file of fileMB sequentially through the page cache, 128KB at a
+ * time, and return MB/s. Every byte is checked. */
+static double pageCacheRead(ddfsSimpleFilesystem &fs, string path, uint64_t fileBytes, bool readahead)
+{
+	const size_t readBytes = 128 * 1024;
+	vector<uint8_t> buffer(readBytes);
+	ddfsFileHandle handle;
+
+	fs.createFile("/", path.substr(1), 0644);
+	fs.openFile(path, 0, &handle);
+	fs.truncateFile(handle, fileBytes);
+	ddfsOpenFile *file = fs.getOpenFiles().lookup(handle);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	uint64_t offset = 0;
+	while(offset < fileBytes) {
+		ddfsStatus status(DDFS_OK);
+		if(readahead)
+			status = fs.readFile(handle, (int) readBytes, buffer.data());
+		else
+			status = fs.getPageCache().read(file->fileID, offset, readBytes, buffer.data(), &file->transferred);
+
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false || file->transferred == 0) {
+			cout << "Page cache : read at " << offset << " failed. " << status.statusToString() << "\n";
+			return -1.0;
+		}
+		for(size_t i = 0; i < file->transferred; i++) {
+			if(buffer[i] != fileByte(file->fileID, offset + i)) {
+				cout << "Page cache : byte " << offset + i << " is wrong.\n";
+				return -1.0;
+			}
+		}
+		offset += file->transferred;
+	}
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	fs.closeFile(handle);
+
+	return fileBytes / seconds / (1024 * 1024);
+}
+
+/* Returns false if a read failed or a byte was wrong */
+static bool pageCacheTrial(uint64_t fileMB)
+{
+	const uint64_t fileBytes = fileMB * 1024 * 1024;
+	ddfsSimpleFilesystem fs(2 * fileBytes);
+	std::atomic<uint64_t> storageReads(0);
+
+	fs.setDataReader([&] (uint64_t fileID, const ddfsRedundancy &, uint64_t offset, uint8_t *buffer,
+					size_t size, size_t *bytesRead) {
+		storageReads++;
+		this_thread::sleep_for(chrono::microseconds(200));
+		*bytesRead = offset >= fileBytes ? 0 : (size_t) min((uint64_t) size, fileBytes - offset);
+		for(size_t i = 0; i < *bytesRead; i++)
+			buffer[i] = fileByte(fileID, offset + i);
+		return ddfsStatus(DDFS_OK);
+	});
+
+	double plain = pageCacheRead(fs, "/plain", fileBytes, false);
+	double ahead = pageCacheRead(fs, "/ahead", fileBytes, true);
+	uint64_t coldReads = storageReads.load();
+	double warm = pageCacheRead(fs, "/ahead", fileBytes, true);
+
+	ddfsPageCache &cache = fs.getPageCache();
+	cout << "Page cache : " << fileMB << "MB file, " << DDFS_PAGE_SIZE / 1024 << "KB pages. Cold "
+		<< (uint64_t) plain << "MB/s, cold with readahead " << (uint64_t) ahead << "MB/s, warm "
+		<< (uint64_t) warm << "MB/s.\n";
+	cout << "Page cache : " << cache.getHits() << " hits, " << cache.getMisses() << " misses, "
+		<< cache.getReadaheadPages() << " pages read ahead, " << storageReads.load() - coldReads
+		<< " storage reads when warm.\n";
+	return plain >= 0.0 && ahead >= 0.0 && warm >= 0.0;
+}
+
+/* Returns false if a write failed or the log is not what was written */
+static bool appendTrial(size_t appendBytes)
+{
+	const uint64_t logBytes = 32 * 1024 * 1024;
+	vector<uint8_t> storage(logBytes);
+	uint64_t storageWrites = 0;
+	std::mutex storageLock;
+
+	ddfsDataWriter writer = [&] (uint64_t fileID, const ddfsRedundancy &, uint64_t offset, const uint8_t *buffer,
+					size_t size) {
+		this_thread::sleep_for(chrono::microseconds(20));
+		std::lock_guard<std::mutex> guard(storageLock);
+		if(offset + size > storage.size())
+			return ddfsStatus(DDFS_GENERAL_PARAM_INVALID);
+		memcpy(storage.data() + offset, buffer, size);
+		storageWrites++;
+		return ddfsStatus(DDFS_OK);
+	};
+
+	vector<uint8_t> record(appendBytes);
+	uint64_t records = logBytes / appendBytes;
+	ddfsRedundancy replicated = {DDFS_REDUNDANCY_REPLICATED, 0, 0};
+
+	/* Unbuffered, only the first second of it */
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	uint64_t direct = 0;
+	while(direct < records && chrono::steady_clock::now() - start < chrono::seconds(1)) {
+		writer(1, replicated, direct * appendBytes, record.data(), appendBytes);
+		direct++;
+	}
+	double directRate = direct * appendBytes / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	ddfsSimpleFilesystem fs;
+	fs.setDataWriter(writer);
+	ddfsFileHandle handle;
+	fs.createFile("/", "log", 0644);
+	fs.openFile("/log", 0, &handle);
+	storageWrites = 0;
+
+	start = chrono::steady_clock::now();
+	for(uint64_t r = 0; r < records; r++) {
+		for(size_t i = 0; i < appendBytes; i++)
+			record[i] = (uint8_t) (r * appendBytes + i);
+		ddfsStatus status = fs.writeFile(handle, (int) appendBytes, record.data());
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+			cout << "Append : write " << r << " failed. " << status.statusToString() << "\n";
+			return false;
+		}
+	}
+	ddfsStatus status = fs.closeFile(handle);
+	double bufferedRate = records * appendBytes / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	for(uint64_t i = 0; i < records * appendBytes; i++) {
+		if(storage[i] != (uint8_t) i) {
+			cout << "Append : byte " << i << " is wrong.\n";
+			return false;
+		}
+	}
+
+	cout << "Append : " << appendBytes << " byte records. Straight to storage "
+		<< (uint64_t) (directRate / (1024 * 1024)) << "MB/s, write-back "
+		<< (uint64_t) (bufferedRate / (1024 * 1024)) << "MB/s in " << storageWrites
+		<< " storage writes. Close : " << status.statusToString() << "\n";
+	return status.compareStatus(ddfsStatus(DDFS_OK));
+}
+
+/* Returns false unless every file is found again after the reload */
+static bool inodeTrial(int files)
+{
+	const int directories = 100;
+	string metaFile = "/tmp/ddfsBenchMeta";
+	unlink((metaFile + ".inodes").c_str());
+	unlink((metaFile + ".dirs").c_str());
+	unlink((metaFile + ".journal").c_str());
+
+	vector<string> paths;
+	{
+		ddfsSimpleFilesystem fs;
+		ddfsStatus status = fs.init(metaFile);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+			cout << "Inodes : init failed. " << status.statusToString() << "\n";
+			return false;
+		}
+
+		for(int d = 0; d < directories; d++)
+			fs.makedirectory("/", "dir" + to_string(d));
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for(int f = 0; f < files; f++) {
+			string directory = "/dir" + to_string(f % directories);
+			string name = "file" + to_string(f);
+			status = fs.createFile(directory, name, 0644);
+			if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+				cout << "Inodes : creating " << name << " failed. " << status.statusToString() << "\n";
+				return false;
+			}
+			paths.push_back(directory + "/" + name);
+		}
+		double createSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		ddfsInode info;
+		start = chrono::steady_clock::now();
+		for(int f = 0; f < files; f++)
+			fs.statFile(paths[f], &info);
+		double statSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		ddfsFileHandle handle;
+		fs.openFile(paths[0], 0, &handle);
+		const int handleStats = 1000000;
+		start = chrono::steady_clock::now();
+		for(int i = 0; i < handleStats; i++)
+			fs.statFile(handle, &info);
+		double handleSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		fs.closeFile(handle);
+
+		status = fs.sync();
+		cout << "Inodes : " << files << " files, " << (uint64_t) (files / createSeconds) << " creates/s, "
+			<< (uint64_t) (files / statSeconds) << " path stats/s, " << (uint64_t) (handleStats / handleSeconds)
+			<< " handle stats/s. Sync : " << status.statusToString() << "\n";
+	}
+
+	ddfsSimpleFilesystem reloaded;
+	ddfsStatus status = reloaded.init(metaFile);
+	int found = 0;
+	for(int f = 0; f < files; f++) {
+		ddfsInode info;
+		if(reloaded.statFile(paths[f], &info).compareStatus(ddfsStatus(DDFS_OK)) && info.isDirectory() == false)
+			found++;
+	}
+	cout << "Inodes : reloaded " << status.statusToString() << ", " << found << "/" << files << " files found.\n";
+
+	unlink((metaFile + ".inodes").c_str());
+	unlink((metaFile + ".dirs").c_str());
+	unlink((metaFile + ".journal").c_str());
+	return status.compareStatus(ddfsStatus(DDFS_OK)) && found == files;
+}
+
+/* Returns false unless the replayed journal has every result whole and
+ * no temporary */
+static bool renameTrial(int renames)
+{
+	const int threads = 8, results = 100;
+	const size_t recordBytes = 64;
+	string metaFile = "/tmp/ddfsBenchRename";
+	unlink((metaFile + ".inodes").c_str());
+	unlink((metaFile + ".dirs").c_str());
+	unlink((metaFile + ".journal").c_str());
+
+	int failed = 0;
+	{
+		ddfsSimpleFilesystem fs;
+		ddfsStatus status = fs.init(metaFile);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+			cout << "Rename : init failed. " << status.statusToString() << "\n";
+			return false;
+		}
+		fs.setDataWriter([] (uint64_t, const ddfsRedundancy &, uint64_t, const uint8_t *, size_t) {
+					return ddfsStatus(DDFS_OK);
+				});
+		fs.makedirectory("/", "out");
+
+		/* Every thread publishes its results by write-to-temp-then-rename */
+		std::atomic<int> failures(0);
+		vector<thread> workers;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for(int t = 0; t < threads; t++) {
+			workers.push_back(thread([&fs, &failures, t, renames] () {
+				uint8_t record[recordBytes];
+				memset(record, t, sizeof(record));
+				for(int i = t; i < renames; i += threads) {
+					string temporary = "tmp" + to_string(i);
+					ddfsFileHandle handle;
+					bool done = fs.createFile("/out", temporary, 0644).compareStatus(ddfsStatus(DDFS_OK)) &&
+								fs.openFile("/out/" + temporary, 0, &handle).compareStatus(ddfsStatus(DDFS_OK));
+					if(done) {
+						fs.writeFile(handle, sizeof(record), record);
+						done = fs.closeFile(handle).compareStatus(ddfsStatus(DDFS_OK)) &&
+									fs.renameFile("/out/" + temporary, "/out/result" + to_string(i % results))
+										.compareStatus(ddfsStatus(DDFS_OK));
+					}
+					if(done == false)
+						failures++;
+				}
+			}));
+		}
+		for(size_t t = 0; t < workers.size(); t++)
+			workers[t].join();
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		cout << "Rename : " << renames << " publishes from " << threads << " threads, "
+			<< (uint64_t) (renames / seconds) << " renames/s, " << fs.getJournal().getCommits()
+			<< " commits in " << fs.getJournal().getSyncs() << " syncs. Failures : " << failures << "\n";
+		failed = failures;
+	}
+
+	/* No checkpoint was taken: everything comes back from the journal */
+	ddfsSimpleFilesystem reloaded;
+	ddfsStatus status = reloaded.init(metaFile);
+	int found = 0, left = 0;
+	for(int r = 0; r < results && r < renames; r++) {
+		ddfsInode info;
+		if(reloaded.statFile("/out/result" + to_string(r), &info).compareStatus(ddfsStatus(DDFS_OK)) &&
+						info.size == recordBytes)
+			found++;
+	}
+	for(int i = 0; i < renames; i++) {
+		ddfsInode info;
+		if(reloaded.statFile("/out/tmp" + to_string(i), &info).compareStatus(ddfsStatus(DDFS_OK)))
+			left++;
+	}
+	cout << "Rename : replayed " << status.statusToString() << ", " << found << "/" << min(results, renames)
+		<< " results whole, " << left << " temporaries left, " << reloaded.getJournal().getSize()
+		<< " journal bytes after checkpoint.\n";
+
+	unlink((metaFile + ".inodes").c_str());
+	unlink((metaFile + ".dirs").c_str());
+	unlink((metaFile + ".journal").c_str());
+	return failed == 0 && status.compareStatus(ddfsStatus(DDFS_OK)) && found == min(results, renames) && left == 0;
+}
+
+/* Seconds for threads to create files between them, in a directory each
+ * or all in /shared, then to stat them */
+static bool parallelRound(int threads, int files, bool shared, double *createSeconds, double *statSeconds)
+{
+	ddfsSimpleFilesystem fs;
+	std::atomic<int> failures(0);
+
+	fs.makedirectory("/", "shared");
+	for(int t = 0; t < threads; t++)
+		fs.makedirectory("/", "dir" + to_string(t));
+
+	for(int phase = 0; phase < 2; phase++) {
+		vector<thread> workers;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for(int t = 0; t < threads; t++) {
+			workers.push_back(thread([&fs, &failures, t, threads, files, shared, phase] () {
+				string directory = shared ? string("/shared") : "/dir" + to_string(t);
+				ddfsInode info;
+				for(int f = t; f < files; f += threads) {
+					string name = "file" + to_string(f);
+					ddfsStatus status = phase == 0 ? fs.createFile(directory, name, 0644) :
+									fs.statFile(directory + "/" + name, &info);
+					if(status.compareStatus(ddfsStatus(DDFS_OK)) == false)
+						failures++;
+				}
+			}));
+		}
+		for(size_t t = 0; t < workers.size(); t++)
+			workers[t].join();
+		*(phase == 0 ? createSeconds : statSeconds) =
+						chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+	return failures == 0;
+}
+
+/* Returns false if a round missed a file */
+static bool parallelTrial(int files)
+{
+	bool all = true;
+	for(int shared = 0; shared < 2; shared++) {
+		for(int threads = 1; threads <= 8; threads *= 2) {
+			double createSeconds = 0, statSeconds = 0;
+			bool whole = parallelRound(threads, files, shared != 0, &createSeconds, &statSeconds);
+			cout << "Parallel : " << threads << " threads, " << (shared ? "one directory" : "a directory each")
+				<< ", " << (uint64_t) (files / createSeconds) << " creates/s, " << (uint64_t) (files / statSeconds)
+				<< " stats/s. " << (whole ? "All there." : "Some missing!") << "\n";
+			all = all && whole;
+		}
+	}
+	return all;
+}
+
+/* A directory of files below /tree, made in batches */
+static bool bulkTree(ddfsSimpleFilesystem &fs, const string &top, int files)
+{
+	const int directories = 100;
+	bool whole = fs.makedirectory("/", top).compareStatus(ddfsStatus(DDFS_OK));
+
+	for(int d = 0; d < directories; d++)
+		whole = whole && fs.makedirectory("/" + top, "dir" + to_string(d)).compareStatus(ddfsStatus(DDFS_OK));
+	for(int f = 0; f < files && whole; f += 1000) {
+		vector<string> names;
+		for(int n = f; n < min(f + 1000, files); n++)
+			names.push_back("file" + to_string(n));
+		whole = fs.createFiles("/" + top + "/dir" + to_string((f / 1000) % directories), names, 0644)
+						.compareStatus(ddfsStatus(DDFS_OK));
+	}
+	return whole;
+}
+
+/* Returns false if a create failed, or a removed tree is not gone before
+ * or after the reload */
+static bool bulkTrial(int files)
+{
+	string metaFile = "/tmp/ddfsBenchBulk";
+	bool good = true;
+	unlink((metaFile + ".inodes").c_str());
+	unlink((metaFile + ".dirs").c_str());
+	unlink((metaFile + ".journal").c_str());
+
+	{
+		ddfsSimpleFilesystem fs;
+		ddfsStatus status = fs.init(metaFile);
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == false) {
+			cout << "Bulk : init failed. " << status.statusToString() << "\n";
+			return false;
+		}
+		fs.makedirectory("/", "single");
+		fs.makedirectory("/", "batch");
+
+		int failures = 0;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for(int f = 0; f < files; f++) {
+			if(fs.createFile("/single", "file" + to_string(f), 0644).compareStatus(ddfsStatus(DDFS_OK)) == false)
+				failures++;
+		}
+		double singleSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		start = chrono::steady_clock::now();
+		for(int f = 0; f < files; f += 1000) {
+			vector<string> names;
+			for(int n = f; n < min(f + 1000, files); n++)
+				names.push_back("file" + to_string(n));
+			if(fs.createFiles("/batch", names, 0644).compareStatus(ddfsStatus(DDFS_OK)) == false)
+				failures++;
+		}
+		double batchSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		cout << "Bulk : " << (uint64_t) (files / singleSeconds) << " creates/s one by one, "
+			<< (uint64_t) (files / batchSeconds) << " creates/s in batches of 1000. "
+			<< (failures == 0 ? "Good" : "Failed") << "\n";
+
+		/* readdir-plus against readdir and a stat of every entry */
+		vector<pair<string, ddfsFileAttributes> > plus;
+		start = chrono::steady_clock::now();
+		fs.readDirectory("/batch", &plus);
+		double plusSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		/* What a listing alone would need on top, a stat of each */
+		ddfsInode info;
+		size_t stated = 0;
+		start = chrono::steady_clock::now();
+		for(size_t n = 0; n < plus.size(); n++) {
+			if(fs.statFile("/batch/" + plus[n].first, &info).compareStatus(ddfsStatus(DDFS_OK)))
+				stated++;
+		}
+		double statSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		cout << "Bulk : readDirectory " << plus.size() << " entries in " << (uint64_t) (plusSeconds * 1000)
+			<< "ms, a statFile of each of " << stated << " in " << (uint64_t) (statSeconds * 1000) << "ms.\n";
+		good = failures == 0 && plus.size() == (size_t) files && stated == plus.size();
+
+		/* The caller gets control back once the tree is detached */
+		bool whole = bulkTree(fs, "tree", files);
+		start = chrono::steady_clock::now();
+		status = fs.removeTree("/tree");
+		double detachSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		fs.waitRemovals();
+		double removeSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		bool gone = fs.statFile("/tree", &info).compareStatus(ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST));
+		cout << "Bulk : removeTree of " << files << " files " << status.statusToString() << " in "
+			<< (uint64_t) (detachSeconds * 1000000) << "us, removed in " << (uint64_t) (removeSeconds * 1000)
+			<< "ms. " << (whole && gone ? "Gone" : "Still there!") << "\n";
+		good = good && whole && gone;
+
+		/* Left for the next init() to finish */
+		bulkTree(fs, "left", files);
+		fs.removeTree("/left");
+	}
+
+	ddfsSimpleFilesystem reloaded;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	ddfsStatus status = reloaded.init(metaFile);
+	reloaded.waitRemovals();
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	/* Only the files of /single and /batch are left */
+	vector<pair<string, ddfsFileAttributes> > root;
+	reloaded.readDirectory("/", &root);
+	cout << "Bulk : reloaded " << status.statusToString() << ", half removed tree finished in "
+		<< (uint64_t) (seconds * 1000) << "ms, " << root.size() << " entries in /, "
+		<< reloaded.getJournal().getSize() << " journal bytes.\n";
+
+	unlink((metaFile + ".inodes").c_str());
+	unlink((metaFile + ".dirs").c_str());
+	unlink((metaFile + ".journal").c_str());
+	return good && status.compareStatus(ddfsStatus(DDFS_OK)) && root.size() == 2;
+}
+
+int main(int argc, char *argv[])
+{
+	int numberOfNodes = 3;
+	int numberOfTrials = 3;
+	uint32_t latencyUs = 100;
+	uint32_t jitterUs = 50;
+	double lossPercent = 0.0;
+	size_t streamBytes = 0;
+	bool streamDuringElection = false;
+	size_t chunkBytes = 0;
+	size_t erasureBytes = 0;
+	int placementChunks = 0;
+	int rebalanceChunks = 0;
+	int metadataPaths = 0;
+	uint64_t rebalanceMBps = 256;
+	uint64_t pageCacheMB = 0;
+	size_t appendBytes = 0;
+	int inodeFiles = 0;
+	int renames = 0;
+	int bookmarkFiles = 0;
+	int replicaFiles = 0;
+	int parallelFiles = 0;
+	int bulkFiles = 0;
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:t:l:j:p:x:s:cr:e:m:b:w:k:f:a:i:v:o:q:y:g:")) != -1) {
+		switch(opt) {
+		case 'n': numberOfNodes = atoi(optarg); break;
+		case 't': numberOfTrials = atoi(optarg); break;
+		case 'l': latencyUs = atoi(optarg); break;
+		case 'j': jitterUs = atoi(optarg); break;
+		case 'p': lossPercent = atof(optarg); break;
+		case 's': streamBytes = strtoul(optarg, NULL, 10); break;
+		case 'c': streamDuringElection = true; break;
+		case 'r': chunkBytes = strtoul(optarg, NULL, 10); break;
+		case 'e': erasureBytes = strtoul(optarg, NULL, 10); break;
+		case 'm': placementChunks = atoi(optarg); break;
+		case 'b': rebalanceChunks = atoi(optarg); break;
+		case 'w': rebalanceMBps = strtoul(optarg, NULL, 10); break;
+		case 'k': metadataPaths = atoi(optarg); break;
+		case 'f': pageCacheMB = strtoull(optarg, NULL, 10); break;
+		case 'a': appendBytes = strtoul(optarg, NULL, 10); break;
+		case 'i': inodeFiles = atoi(optarg); break;
+		case 'v': renames = atoi(optarg); break;
+		case 'o': bookmarkFiles = atoi(optarg); break;
+		case 'q': replicaFiles = atoi(optarg); break;
+		case 'y': parallelFiles = atoi(optarg); break;
+		case 'g': bulkFiles = atoi(optarg); break;
+		case 'x':
+			if(string(optarg) == "shm")
+				transport = DDFS_NETWORK_SHM;
+			else if(string(optarg) == "tcp")
+				transport = DDFS_NETWORK_TCP;
+			else
+				transport = DDFS_NETWORK_LOOPBACK;
+			break;
+		default:
+			cout << "Usage : " << argv[0] << " [-n nodes] [-t trials] [-l latencyUs] [-j jitterUs] [-p lossPercent] [-x loopback|shm|tcp] [-s streamBytes] [-c] [-r chunkBytes] [-e chunkBytes] [-m placementChunks] [-b rebalanceChunks] [-w rebalanceMBps] [-k metadataPaths] [-f fileMB] [-a appendBytes] [-i files] [-v renames] [-o files] [-q files] [-y files] [-g files]\n";
+			return 1;
+		}
+	}
+
+	if(numberOfNodes < 1 || numberOfNodes > 254 || numberOfTrials < 1 || numberOfTrials > 254) {
+		cout << "Nodes and trials should be between 1 and 254.\n";
+		return 1;
+	}
+
+	ddfsGlobal::initialize();
+
+	ddfsLoopbackFabric &fabric = ddfsLoopbackFabric::getInstance();
+	fabric.setLinkProfile(latencyUs, jitterUs, lossPercent / 100.0);
+
+	cout << "Transport : " << transportName()
+		<< ". Nodes : " << numberOfNodes << ". Trials : " << numberOfTrials
+		<< ". Latency : " << latencyUs << "us (+" << jitterUs << "us). Loss : " << lossPercent << "%\n";
+
+	vector<uint64_t> electionTimesMs;
+	vector<uint64_t> messageLatencyUs;
+	vector<uint64_t> streamMBps;
+	vector<uint64_t> replicationMBps;
+	vector<uint64_t> erasureWriteMBps, erasureReadMBps;
+	vector<uint64_t> rebalanceRate;
+	vector<uint64_t> metadataMissUs, metadataHitUs, metadataInvalidateUs;
+	vector<uint64_t> bookmarkUs;
+	vector<uint64_t> replicaFullKB, replicaIncrementalKB, replicaCatchUpMs;
+	uint64_t messages = 0, bytes = 0, dropped = 0;
+	double busySeconds = 0.0;
+	int elected = 0;
+	/* Trials whose checks failed, the exit status */
+	int failed = 0;
+
+	for(int trial = 1; trial <= numberOfTrials; trial++) {
+		vector<ddfsClusterPaxos *> nodes;
+
+		/* The nodes are leaked on purpose, their members stay registered
+		 * on the fabric until the process exits. */
+		for(int i = 1; i <= numberOfNodes; i++)
+			nodes.push_back(new ddfsClusterPaxos(nodeAddress(trial, i), transport));
+
+		for(int i = 1; i <= numberOfNodes; i++) {
+			for(int j = 1; j <= numberOfNodes; j++) {
+				if(i != j)
+					nodes[i-1]->addMember(nodeAddress(trial, j));
+			}
+		}
+
+		fabric.resetStats();
+
+		bool streaming = (streamBytes > 0 && numberOfNodes > 1);
+		double rate = -1.0;
+		std::thread streamer;
+		if(streaming && streamDuringElection)
+			streamer = std::thread([&] { rate = streamTrial(nodes, trial, streamBytes); });
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		ddfsStatus status = nodes[0]->leaderElection();
+		chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+		if(streamer.joinable())
+			streamer.join();
+
+		uint64_t elapsedMs = chrono::duration_cast<chrono::milliseconds>(end - start).count();
+
+		if(status.compareStatus(ddfsStatus(DDFS_OK)) == true) {
+			elected++;
+			electionTimesMs.push_back(elapsedMs);
+		}
+
+		/* Let the commit messages drain before reading the counters */
+		usleep(2 * (latencyUs + jitterUs) + 10000);
+
+		if(streaming) {
+			if(streamDuringElection == false)
+				rate = streamTrial(nodes, trial, streamBytes);
+			if(rate >= 0.0)
+				streamMBps.push_back((uint64_t) rate);
+			else
+				failed++;
+		}
+
+		if(chunkBytes > 0 && numberOfNodes > 1) {
+			double replicationRate = replicationTrial(nodes, trial, chunkBytes);
+			if(replicationRate >= 0.0)
+				replicationMBps.push_back((uint64_t) replicationRate);
+			else
+				failed++;
+		}
+
+		if(erasureBytes > 0 && numberOfNodes > 1) {
+			double writeRate, readRate;
+			if(erasureTrial(nodes, trial, erasureBytes, &writeRate, &readRate)) {
+				erasureWriteMBps.push_back((uint64_t) writeRate);
+				erasureReadMBps.push_back((uint64_t) readRate);
+			} else {
+				failed++;
+			}
+		}
+
+		if(metadataPaths > 0 && numberOfNodes > 1 &&
+						metadataTrial(nodes, trial, metadataPaths, metadataMissUs, metadataHitUs,
+									metadataInvalidateUs) == false)
+			failed++;
+
+		if(bookmarkFiles > 0 && numberOfNodes > 1 && bookmarkTrial(nodes, trial, bookmarkFiles, bookmarkUs) == false)
+			failed++;
+
+		if(replicaFiles > 0 && numberOfNodes > 1 &&
+						replicaTrial(nodes, trial, replicaFiles, replicaFullKB, replicaIncrementalKB,
+									replicaCatchUpMs) == false)
+			failed++;
+
+		/* Last, the node stays dead to the first one */
+		if(rebalanceChunks > 0 && numberOfNodes > DDFS_REPLICATION_MAX_CHAIN) {
+			double recoveryRate = rebalanceTrial(nodes, trial, rebalanceChunks, rebalanceMBps);
+			if(recoveryRate >= 0.0)
+				rebalanceRate.push_back((uint64_t) recoveryRate);
+			else
+				failed++;
+		}
+
+		ddfsLoopbackStats stats;
+		fabric.getStats(&stats);
+
+		messages += stats.delivered;
+		bytes += stats.bytes;
+		dropped += stats.dropped;
+		busySeconds += chrono::duration<double>(end - start).count();
+		messageLatencyUs.insert(messageLatencyUs.end(), stats.latencyUs.begin(), stats.latencyUs.end());
+
+		cout << "Trial " << trial << " : " << status.statusToString() << " in " << elapsedMs
+			<< "ms. Leader : " << (nodes[0]->getLeader() ? nodes[0]->getLeader()->getHostName() : string("none"))
+			<< ". Messages : " << stats.delivered << " delivered, " << stats.dropped << " dropped.\n";
+	}
+
+	/* The nodes never detach, remove their segments */
+	if(transport == DDFS_NETWORK_SHM) {
+		for(int trial = 1; trial <= numberOfTrials; trial++) {
+			for(int i = 1; i <= numberOfNodes; i++) {
+				for(int j = i + 1; j <= numberOfNodes; j++)
+					shm_unlink(ddfsShmSegment::getSegmentName(nodeAddress(trial, i), nodeAddress(trial, j)).c_str());
+			}
+		}
+	}
+
+	cout << "\nElections : " << elected << "/" << numberOfTrials << " succeeded.\n";
+	printPercentiles("Election time", electionTimesMs, "ms");
+	printPercentiles("Message latency", messageLatencyUs, "us");
+	if(streamBytes > 0)
+		printPercentiles("Stream throughput", streamMBps, "MB/s");
+	if(chunkBytes > 0)
+		printPercentiles("Replication throughput", replicationMBps, "MB/s");
+	if(erasureBytes > 0) {
+		cout << "Erasure coding : RS(6,3), " << ddfsReedSolomon::getImplementationName() << "\n";
+		printPercentiles("Erasure write", erasureWriteMBps, "MB/s");
+		printPercentiles("Erasure degraded read", erasureReadMBps, "MB/s");
+	}
+	if(metadataPaths > 0) {
+		printPercentiles("Metadata lookup, leader", metadataMissUs, "us");
+		printPercentiles("Metadata lookup, cached", metadataHitUs, "us");
+		printPercentiles("Metadata invalidate", metadataInvalidateUs, "us");
+	}
+	if(bookmarkFiles > 0)
+		printPercentiles("Bookmark", bookmarkUs, "us");
+	if(replicaFiles > 0) {
+		printPercentiles("Replica full catch-up", replicaFullKB, "KB");
+		printPercentiles("Replica catch-up after churn", replicaIncrementalKB, "KB");
+		printPercentiles("Replica catch-up time", replicaCatchUpMs, "ms");
+	}
+	if(rebalanceChunks > 0) {
+		cout << "Rebalance limit : " << rebalanceMBps << "MB/s\n";
+		printPercentiles("Rebalance throughput", rebalanceRate, "MB/s");
+	}
+	if(placementChunks > 0)
+		placementTrial(numberOfNodes, placementChunks);
+	if(pageCacheMB > 0 && pageCacheTrial(pageCacheMB) == false)
+		failed++;
+	if(appendBytes > 0 && appendTrial(appendBytes) == false)
+		failed++;
+	if(inodeFiles > 0 && inodeTrial(inodeFiles) == false)
+		failed++;
+	if(renames > 0 && renameTrial(renames) == false)
+		failed++;
+	if(parallelFiles > 0 && parallelTrial(parallelFiles) == false)
+		failed++;
+	if(bulkFiles > 0 && bulkTrial(bulkFiles) == false)
+		failed++;
+	if(busySeconds > 0.0) {
+		cout << "Throughput : " << (uint64_t) (messages / busySeconds) << " msg/s, "
+			<< (uint64_t) (bytes / busySeconds) << " bytes/s. Dropped : " << dropped << "\n";
+	}
+
+	if(failed > 0) {
+		cout << "Checks : " << failed << " failed.\n";
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,298 @@
+/*
+ * metadataTest.cpp
+ *
+ * Checks the metadata of ddfsSimpleFilesystem across reloads: the journal
+ * replayed, the inode table loaded back after a checkpoint, snapshots,
+ * removeTree() waited for and finished by the next init(), and inode
+ * records that reached their file ahead of the journal.
+ *
+ * Usage : metadataTest
+ *
+ * Every check prints Good or Failed, the exit status is 1 if any failed.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <unistd.h>
+
+#include "../src/global/ddfs_status.hpp"
+#include "../src/global/ddfs_global.hpp"
+#include "../src/filesystem/ddfs_simplefilesystem.hpp"
+
+using namespace std;
+
+static const string metaFile = "/tmp/ddfsMetadataTest";
+static int failures = 0;
+
+static void check(const string &what, bool good)
+{
+	cout << what << " : " << (good ? "Good" : "Failed") << "\n";
+	if(good == false)
+		failures++;
+}
+
+static void removeMeta()
+{
+	unlink((metaFile + ".inodes").c_str());
+	unlink((metaFile + ".dirs").c_str());
+	unlink((metaFile + ".journal").c_str());
+}
+
+static bool copyFile(const string &from, const string &to)
+{
+	ifstream in(from.c_str(), ios::binary);
+	string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	ofstream out(to.c_str(), ios::binary | ios::trunc);
+	out.write(data.data(), data.size());
+	return in.is_open() && out.good();
+}
+
+static bool exists(ddfsSimpleFilesystem &fs, const string &path, ddfsInode *info = NULL)
+{
+	ddfsInode copy;
+	return fs.statFile(path, info != NULL ? info : &copy).compareStatus(ddfsStatus(DDFS_OK));
+}
+
+/* Creates, a write, a rename and a delete, none checkpointed */
+static void replayTest()
+{
+	removeMeta();
+	{
+		ddfsSimpleFilesystem fs;
+		check("Replay : init", fs.init(metaFile).compareStatus(ddfsStatus(DDFS_OK)));
+		fs.setDataWriter([] (uint64_t, const ddfsRedundancy &, uint64_t, const uint8_t *, size_t) {
+					return ddfsStatus(DDFS_OK);
+				});
+
+		fs.makedirectory("/", "a");
+		for(int f = 0; f < 10; f++)
+			fs.createFile("/a", "f" + to_string(f), 0644);
+		vector<string> names;
+		for(int f = 0; f < 100; f++)
+			names.push_back("b" + to_string(f));
+		fs.createFiles("/a", names, 0644);
+
+		ddfsRedundancy coded = {DDFS_REDUNDANCY_ERASURE_CODED, 6, 3}, invalid = {DDFS_REDUNDANCY_ERASURE_CODED, 0, 3};
+		fs.createFile("/a", "cold", 0644, coded);
+		check("Replay : invalid scheme",
+			fs.createFile("/a", "bad", 0644, invalid).compareStatus(ddfsStatus(DDFS_GENERAL_PARAM_INVALID)));
+
+		ddfsFileHandle handle;
+		uint8_t record[100];
+		memset(record, 1, sizeof(record));
+		fs.openFile("/a/f0", 0, &handle);
+		fs.writeFile(handle, sizeof(record), record);
+		fs.syncFile(handle);
+		fs.closeFile(handle);
+
+		fs.renameFile("/a/f1", "/a/g1");
+		fs.openFile("/a/f2", 0, &handle);
+		check("Replay : delete", fs.deleteFile(handle).compareStatus(ddfsStatus(DDFS_OK)));
+		check("Replay : deleted twice",
+			fs.deleteFile(handle).compareStatus(ddfsStatus(DDFS_FILESYSTEM_FILE_DOES_NOT_EXIST)));
+		fs.closeFile(handle);
+	}
+
+	ddfsSimpleFilesystem reloaded;
+	check("Replay : reload", reloaded.init(metaFile).compareStatus(ddfsStatus(DDFS_OK)));
+
+	ddfsInode info;
+	check("Replay : size of the synced file", exists(reloaded, "/a/f0", &info) && info.size == 100);
+	check("Replay : rename", exists(reloaded, "/a/f1") == false && exists(reloaded, "/a/g1"));
+	check("Replay : delete gone", exists(reloaded, "/a/f2") == false);
+	check("Replay : erasure coded", exists(reloaded, "/a/cold", &info) &&
+					info.redundancy.scheme == DDFS_REDUNDANCY_ERASURE_CODED &&
+					info.redundancy.dataFragments == 6 && info.redundancy.parityFragments == 3);
+	check("Replay : replicated", exists(reloaded, "/a/b0", &info) &&
+					info.redundancy.scheme == DDFS_REDUNDANCY_REPLICATED);
+
+	vector<pair<string, ddfsFileAttributes> > entries;
+	reloaded.readDirectory("/a", &entries);
+	check("Replay : every entry", entries.size() == 9 + 100 + 1);
+	check("Replay : journal empty after the checkpoint", reloaded.getJournal().getSize() == 0);
+	removeMeta();
+}
+
+/* Numbers and records as they were, from the files alone */
+static void reloadTest()
+{
+	const int directories = 10, files = 1000;
+	vector<uint64_t> numbers;
+
+	removeMeta();
+	{
+		ddfsSimpleFilesystem fs;
+		fs.init(metaFile);
+		for(int d = 0; d < directories; d++)
+			fs.makedirectory("/", "dir" + to_string(d));
+		for(int f = 0; f < files; f++) {
+			ddfsInode info;
+			fs.createFile("/dir" + to_string(f % directories), "file" + to_string(f), 0644);
+			exists(fs, "/dir" + to_string(f % directories) + "/file" + to_string(f), &info);
+			numbers.push_back(info.inode);
+		}
+		check("Inodes : sync", fs.sync().compareStatus(ddfsStatus(DDFS_OK)));
+		check("Inodes : journal empty after sync", fs.getJournal().getSize() == 0);
+	}
+
+	ddfsSimpleFilesystem reloaded;
+	check("Inodes : reload", reloaded.init(metaFile).compareStatus(ddfsStatus(DDFS_OK)));
+
+	int same = 0;
+	for(int f = 0; f < files; f++) {
+		ddfsInode info;
+		if(exists(reloaded, "/dir" + to_string(f % directories) + "/file" + to_string(f), &info) &&
+						info.inode == numbers[f] && info.isDirectory() == false)
+			same++;
+	}
+	check("Inodes : every file under its number", same == files);
+	removeMeta();
+}
+
+/* The snapshot keeps the namespace it was taken of */
+static void snapshotTest()
+{
+	ddfsSimpleFilesystem fs;
+	fs.makedirectory("/", "s");
+	for(int f = 0; f < 10; f++)
+		fs.createFile("/s", "f" + to_string(f), 0644);
+	ddfsInode before;
+	exists(fs, "/s/f1", &before);
+
+	uint64_t id;
+	check("Snapshot : create", fs.createSnapshot("test", &id).compareStatus(ddfsStatus(DDFS_OK)));
+
+	fs.renameFile("/s/f0", "/s/h0");
+	ddfsFileHandle handle;
+	fs.openFile("/s/f1", 0, &handle);
+	fs.deleteFile(handle);
+	fs.closeFile(handle);
+	fs.createFile("/s", "new", 0644);
+
+	vector<pair<string, uint64_t> > entries;
+	fs.listSnapshot(id, "/s", &entries);
+	bool old = entries.size() == 10;
+	for(size_t e = 0; e < entries.size(); e++)
+		old = old && entries[e].first[0] == 'f';
+	check("Snapshot : old names", old);
+
+	ddfsInode info;
+	check("Snapshot : deleted file", fs.statSnapshot(id, "/s/f1", &info).compareStatus(ddfsStatus(DDFS_OK)) &&
+					info.inode == before.inode);
+	check("Snapshot : live namespace", exists(fs, "/s/f1") == false && exists(fs, "/s/h0") &&
+					exists(fs, "/s/new"));
+
+	vector<ddfsSnapshotInfo> snapshots;
+	fs.deleteSnapshot(id);
+	fs.listSnapshots(&snapshots);
+	check("Snapshot : delete", snapshots.empty());
+}
+
+/* A tree of directories and files below /top */
+static bool makeTree(ddfsSimpleFilesystem &fs, const string &top)
+{
+	bool whole = fs.makedirectory("/", top).compareStatus(ddfsStatus(DDFS_OK));
+	for(int d = 0; d < 10 && whole; d++) {
+		vector<string> names;
+		for(int f = 0; f < 100; f++)
+			names.push_back("file" + to_string(f));
+		whole = fs.makedirectory("/" + top, "dir" + to_string(d)).compareStatus(ddfsStatus(DDFS_OK)) &&
+					fs.createFiles("/" + top + "/dir" + to_string(d), names, 0644)
+						.compareStatus(ddfsStatus(DDFS_OK));
+	}
+	return whole;
+}
+
+/* Gone from the namespace at once, below it in the background, or by the
+ * next init() */
+static void removeTreeTest()
+{
+	removeMeta();
+	{
+		ddfsSimpleFilesystem fs;
+		fs.init(metaFile);
+		fs.makedirectory("/", "keep");
+		check("Remove : tree", makeTree(fs, "t"));
+		check("Remove : removeTree", fs.removeTree("/t").compareStatus(ddfsStatus(DDFS_OK)));
+		check("Remove : gone at once", exists(fs, "/t") == false && exists(fs, "/t/dir0/file0") == false);
+		fs.waitRemovals();
+
+		vector<pair<string, ddfsFileAttributes> > root;
+		fs.readDirectory("/", &root);
+		check("Remove : removed", root.size() == 1 && root[0].first == "keep");
+
+		/* Left to the next init() */
+		makeTree(fs, "u");
+		fs.removeTree("/u");
+	}
+
+	ddfsSimpleFilesystem reloaded;
+	check("Remove : reload", reloaded.init(metaFile).compareStatus(ddfsStatus(DDFS_OK)));
+	reloaded.waitRemovals();
+
+	vector<pair<string, ddfsFileAttributes> > root;
+	reloaded.readDirectory("/", &root);
+	check("Remove : finished after the reload", root.size() == 1 && exists(reloaded, "/u") == false);
+	check("Remove : tree again", makeTree(reloaded, "u"));
+	removeMeta();
+}
+
+/* The records reach their file whenever, the journal may not have what
+ * they say: a create and a move that never made it */
+static void aheadTest()
+{
+	const string saved = metaFile + ".saved";
+	ddfsInode directory, file;
+
+	removeMeta();
+	{
+		ddfsSimpleFilesystem fs;
+		fs.init(metaFile);
+		fs.makedirectory("/", "d1");
+		fs.makedirectory("/", "d2");
+		fs.createFile("/d1", "f", 0644);
+		exists(fs, "/d1", &directory);
+		exists(fs, "/d1/f", &file);
+
+		/* Nothing in the journal to replay the records from, what it
+		 * held at the crash */
+		fs.sync();
+		check("Ahead : journal saved", copyFile(metaFile + ".journal", saved));
+		fs.createFile("/d1", "new", 0644);
+		fs.renameFile("/d1/f", "/d2/f");
+	}
+	check("Ahead : journal restored", copyFile(saved, metaFile + ".journal"));
+	unlink(saved.c_str());
+
+	ddfsSimpleFilesystem reloaded;
+	check("Ahead : reload", reloaded.init(metaFile).compareStatus(ddfsStatus(DDFS_OK)));
+
+	ddfsInode info;
+	check("Ahead : create undone", exists(reloaded, "/d1/new") == false);
+	check("Ahead : move undone", exists(reloaded, "/d1/f", &info) && info.inode == file.inode &&
+					info.parent == directory.inode && exists(reloaded, "/d2/f") == false);
+	check("Ahead : create again", reloaded.createFile("/d1", "new", 0644).compareStatus(ddfsStatus(DDFS_OK)));
+	removeMeta();
+}
+
+int main(int argc, char *argv[])
+{
+	ddfsGlobal::initialize();
+
+	replayTest();
+	reloadTest();
+	snapshotTest();
+	removeTreeTest();
+	aheadTest();
+
+	if(failures > 0) {
+		cout << "Checks : " << failures << " failed.\n";
+		return 1;
+	}
+	cout << "Checks : all passed.\n";
+	return 0;
+}